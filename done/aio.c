@@ -0,0 +1,296 @@
+/**
+ * @file aio.c
+ * @brief imgStore server: asynchronous reads of images.
+ */
+
+#define _DEFAULT_SOURCE // for syscall and MAP_POPULATE
+
+#include "aio.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#else
+#define HAVE_IO_URING 0
+#endif
+
+/* a read in flight */
+struct aio_request {
+    int                 busy;
+    int                 fd;
+    struct iovec        iov;        // what is left to read
+    uint64_t            offset;     // of what is left
+    uint64_t            tag;
+    int                 result;     // for the blocking reads, until reaped
+};
+
+struct imgst_aio {
+    int                 ring_fd;    // -1: blocking reads
+    struct aio_request  requests[AIO_ENTRIES];
+    size_t              pending;
+
+#if HAVE_IO_URING
+    // submission queue
+    void*               sq_ptr;
+    size_t              sq_size;
+    unsigned*           sq_head;
+    unsigned*           sq_tail;
+    unsigned*           sq_mask;
+    unsigned*           sq_array;
+    struct io_uring_sqe* sqes;
+    size_t              sqes_size;
+
+    // completion queue
+    void*               cq_ptr;
+    size_t              cq_size;
+    unsigned*           cq_head;
+    unsigned*           cq_tail;
+    unsigned*           cq_mask;
+    struct io_uring_cqe* cqes;
+#endif
+};
+
+#if HAVE_IO_URING
+/**********************************************************************
+ * Set up of the ring (the sequence of liburing's io_uring_queue_init)
+ */
+static int
+ring_init (struct imgst_aio* aio)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    const int fd = (int) syscall(__NR_io_uring_setup, AIO_ENTRIES, &params);
+    if (fd < 0) return ERR_IO;
+
+    aio->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    aio->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        if (aio->cq_size > aio->sq_size) aio->sq_size = aio->cq_size;
+        aio->cq_size = aio->sq_size;
+    }
+
+    aio->sq_ptr = mmap(NULL, aio->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_SQ_RING);
+    aio->cq_ptr = aio->sq_ptr == MAP_FAILED || single ? aio->sq_ptr :
+                  mmap(NULL, aio->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_CQ_RING);
+    aio->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    aio->sqes = aio->cq_ptr == MAP_FAILED ? MAP_FAILED :
+                mmap(NULL, aio->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQES);
+
+    if (aio->sqes == MAP_FAILED) {
+        if (aio->cq_ptr != MAP_FAILED && !single) munmap(aio->cq_ptr, aio->cq_size);
+        if (aio->sq_ptr != MAP_FAILED) munmap(aio->sq_ptr, aio->sq_size);
+        close(fd);
+        return ERR_IO;
+    }
+
+    char* sq = aio->sq_ptr;
+    aio->sq_head = (unsigned*) (sq + params.sq_off.head);
+    aio->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    aio->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+    aio->sq_array = (unsigned*) (sq + params.sq_off.array);
+
+    char* cq = aio->cq_ptr;
+    aio->cq_head = (unsigned*) (cq + params.cq_off.head);
+    aio->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+    aio->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+    aio->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    aio->ring_fd = fd;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Submission of (the rest of) a request, as a readv of one iovec
+ */
+static int
+ring_submit (struct imgst_aio* aio, size_t index)
+{
+    const struct aio_request* request = &aio->requests[index];
+
+    const unsigned tail = *aio->sq_tail;
+    const unsigned slot = tail & *aio->sq_mask;
+    struct io_uring_sqe* sqe = &aio->sqes[slot];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = request->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &request->iov;
+    sqe->len = 1;
+    sqe->off = request->offset;
+    sqe->user_data = index;
+
+    aio->sq_array[slot] = slot;
+    __atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int ret;
+    do {
+        ret = (int) syscall(__NR_io_uring_enter, aio->ring_fd, 1, 0, 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret == 1 ? ERR_NONE : ERR_IO;
+}
+#endif
+
+/**********************************************************************
+ * Backend
+ */
+int
+aio_init (struct imgst_aio** aio)
+{
+    if (aio == NULL) return ERR_INVALID_ARGUMENT;
+
+    *aio = calloc(1, sizeof(struct imgst_aio));
+    if (*aio == NULL) return ERR_OUT_OF_MEMORY;
+    (*aio)->ring_fd = -1;
+
+#if HAVE_IO_URING
+    // unavailable: blocking reads
+    ring_init(*aio);
+#endif
+    return ERR_NONE;
+}
+
+void
+aio_close (struct imgst_aio* aio)
+{
+    if (aio == NULL) return;
+
+#if HAVE_IO_URING
+    if (aio->ring_fd >= 0) {
+        // the buffers of the reads in flight are not to be freed before
+        while (aio->pending > 0) {
+            struct aio_completion completions[AIO_ENTRIES];
+            if (aio_reap(aio, completions, AIO_ENTRIES) == 0) {
+                syscall(__NR_io_uring_enter, aio->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            }
+        }
+        munmap(aio->sqes, aio->sqes_size);
+        if (aio->cq_ptr != aio->sq_ptr) munmap(aio->cq_ptr, aio->cq_size);
+        munmap(aio->sq_ptr, aio->sq_size);
+        close(aio->ring_fd);
+    }
+#endif
+    free(aio);
+}
+
+size_t
+aio_pending (const struct imgst_aio* aio)
+{
+    return aio == NULL ? 0 : aio->pending;
+}
+
+/**********************************************************************
+ * Submission of a read
+ */
+int
+aio_read (struct imgst_aio* aio, int fd, uint64_t offset, void* buffer, uint32_t size, uint64_t tag)
+{
+    if (aio == NULL || buffer == NULL || fd < 0) return ERR_INVALID_ARGUMENT;
+
+    size_t index = 0;
+    while (index < AIO_ENTRIES && aio->requests[index].busy) ++index;
+    if (index == AIO_ENTRIES) return ERR_OUT_OF_MEMORY;
+
+    struct aio_request* request = &aio->requests[index];
+    request->fd = fd;
+    request->iov.iov_base = buffer;
+    request->iov.iov_len = size;
+    request->offset = offset;
+    request->tag = tag;
+    request->result = ERR_NONE;
+
+#if HAVE_IO_URING
+    if (aio->ring_fd >= 0) {
+        if (size > 0) {
+            const int ret = ring_submit(aio, index);
+            if (ret) return ret;
+        }
+        request->busy = 1;
+        ++aio->pending;
+        return ERR_NONE;
+    }
+#endif
+
+    // blocking: read now, completed at the next reap
+    size_t done = 0;
+    while (done < size && request->result == ERR_NONE) {
+        const ssize_t n = pread(fd, (char*) buffer + done, size - done, (off_t) (offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) request->result = ERR_IO;
+        else done += (size_t) n;
+    }
+    request->iov.iov_len = 0;
+    request->busy = 1;
+    ++aio->pending;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Completions
+ */
+size_t
+aio_reap (struct imgst_aio* aio, struct aio_completion* completions, size_t max)
+{
+    if (aio == NULL || completions == NULL) return 0;
+    size_t nb = 0;
+
+#if HAVE_IO_URING
+    if (aio->ring_fd >= 0) {
+        unsigned head = *aio->cq_head;
+        const unsigned tail = __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail && nb < max; ++head) {
+            const struct io_uring_cqe* cqe = &aio->cqes[head & *aio->cq_mask];
+            struct aio_request* request = &aio->requests[cqe->user_data];
+
+            if (cqe->res <= 0) {
+                request->result = ERR_IO;
+                request->iov.iov_len = 0;
+            } else {
+                request->iov.iov_base = (char*) request->iov.iov_base + cqe->res;
+                request->iov.iov_len -= (size_t) cqe->res;
+                request->offset += (uint64_t) cqe->res;
+                // short read: the rest
+                if (request->iov.iov_len > 0 && ring_submit(aio, (size_t) cqe->user_data) != ERR_NONE) {
+                    request->result = ERR_IO;
+                    request->iov.iov_len = 0;
+                }
+            }
+            if (request->iov.iov_len > 0) continue;
+
+            completions[nb].tag = request->tag;
+            completions[nb].result = request->result;
+            ++nb;
+            request->busy = 0;
+            --aio->pending;
+        }
+        __atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+    }
+#endif
+
+    // the empty and the blocking reads
+    for (size_t i = 0; i < AIO_ENTRIES && nb < max; ++i) {
+        struct aio_request* request = &aio->requests[i];
+        if (request->busy && request->iov.iov_len == 0) {
+            completions[nb].tag = request->tag;
+            completions[nb].result = request->result;
+            ++nb;
+            request->busy = 0;
+            --aio->pending;
+        }
+    }
+    return nb;
+}
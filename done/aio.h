@@ -0,0 +1,79 @@
+#pragma once
+
+/**
+ * @file aio.h
+ * @brief imgStore server: asynchronous reads of images.
+ *
+ * The reads are submitted to an io_uring (Linux 5.1 and later, without
+ * liburing), so that many of them are in flight at once while the event
+ * loop goes on; their completions are reaped once per round of the loop.
+ * Where io_uring is unavailable (older kernel, seccomp, other systems),
+ * each read is done at once with pread and completes at the next reap:
+ * the callers are the same.
+ *
+ * A read is identified by a tag chosen by the caller; a short read is
+ * resubmitted for its remainder, so that a completion is either the
+ * whole size or an error.
+ */
+
+#include "error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define AIO_ENTRIES 64
+
+/* a completed read */
+struct aio_completion {
+    uint64_t            tag;
+    int                 result;     // ERR_NONE or ERR_IO
+};
+
+struct imgst_aio; // see aio.c
+
+/**
+ * @brief Creates the I/O backend: an io_uring of AIO_ENTRIES entries if
+ *        available, blocking reads otherwise.
+ *
+ * @param aio Set to the backend
+ * @return Some error code. 0 if no error.
+ */
+int aio_init(struct imgst_aio** aio);
+
+/**
+ * @brief Frees the backend, once all its reads completed.
+ *
+ * @param aio The backend
+ */
+void aio_close(struct imgst_aio* aio);
+
+/**
+ * @brief Submits a read.
+ *
+ * @param aio The backend
+ * @param fd File to read
+ * @param offset Position in the file
+ * @param buffer Where to read, until completed
+ * @param size Number of bytes
+ * @param tag Identifies the read in its completion
+ * @return Some error code. 0 if no error. ERR_OUT_OF_MEMORY if
+ *         AIO_ENTRIES reads are already in flight.
+ */
+int aio_read(struct imgst_aio* aio, int fd, uint64_t offset, void* buffer, uint32_t size, uint64_t tag);
+
+/**
+ * @brief Collects the completed reads, without waiting.
+ *
+ * @param aio The backend
+ * @param completions Where to store them
+ * @param max Size of completions
+ * @return Their number.
+ */
+size_t aio_reap(struct imgst_aio* aio, struct aio_completion* completions, size_t max);
+
+/**
+ * @brief Number of reads submitted and not reaped yet.
+ *
+ * @param aio The backend
+ */
+size_t aio_pending(const struct imgst_aio* aio);
@@ -0,0 +1,178 @@
+/**
+ * @file archive.c
+ * @brief imgStore library: export and import of the images of an
+ *        imgStore as a stream.
+ */
+
+#include "archive.h"
+#include "scan.h"
+#include "shard.h"
+#include "lock.h"
+#include "image_content.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**********************************************************************
+ * Writes the resized image of an image, read from its imgStore
+ */
+static int
+export_resized (const struct scan_image* image, int res, FILE* out)
+{
+    const uint32_t size = image->metadata.size[res];
+    if (image->metadata.offset[res] == 0 || size == 0) return ERR_NONE;
+
+    char* buffer = malloc(size);
+    if (buffer == NULL) return ERR_OUT_OF_MEMORY;
+
+    int ret = read_at(image->file, image->metadata.offset[res], buffer, size);
+    if (ret == ERR_NONE && fwrite(buffer, size, 1, out) != 1) ret = ERR_IO;
+
+    free(buffer);
+    return ret;
+}
+
+/**********************************************************************
+ * Export of the valid images
+ */
+int
+do_export (struct imgst_file* imgst_file, FILE* out)
+{
+    if (imgst_file == NULL || out == NULL) return ERR_INVALID_ARGUMENT;
+
+    struct archive_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = ARCHIVE_VERSION;
+    header.features = imgst_file->header.features;
+    memcpy(header.res_resized, imgst_file->header.res_resized, sizeof(header.res_resized));
+    memcpy(header.encoding, imgst_file->ext.encoding, sizeof(header.encoding));
+
+    if (fwrite(&header, sizeof(header), 1, out) != 1) return ERR_IO;
+
+    // the originals in the order of the file (see scan.h)
+    struct imgst_scan* scan = NULL;
+    int ret = scan_open(imgst_file, RES_ORIG, &scan);
+
+    const struct scan_image* image = NULL;
+    while (ret == ERR_NONE && (ret = scan_next(scan, &image)) == ERR_NONE && image != NULL) {
+        struct archive_entry entry;
+        memset(&entry, 0, sizeof(entry));
+        strncpy(entry.img_id, image->metadata.img_id, MAX_IMG_ID);
+        entry.format = image->metadata.unused_16;
+        for (int res = 0; res < NB_RES; ++res) {
+            entry.size[res] = image->metadata.offset[res] != 0 ? image->metadata.size[res] : 0;
+        }
+
+        if (fwrite(&entry, sizeof(entry), 1, out) != 1
+            || fwrite(image->buffer, image->size, 1, out) != 1) {
+            ret = ERR_IO;
+        }
+        if (ret == ERR_NONE) ret = export_resized(image, RES_THUMB, out);
+        if (ret == ERR_NONE) ret = export_resized(image, RES_SMALL, out);
+    }
+    scan_close(scan);
+    if (ret) return ret;
+
+    // end of the archive
+    struct archive_entry end;
+    memset(&end, 0, sizeof(end));
+    if (fwrite(&end, sizeof(end), 1, out) != 1 || fflush(out) != 0) return ERR_IO;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Whether an imgStore resizes to a resolution as the exported one did
+ */
+static int
+same_resizing (const struct archive_header* header, const struct imgst_file* imgst_file, int res)
+{
+    const struct imgst_header* target = &imgst_file->header;
+
+    if (header->res_resized[2 * res] != target->res_resized[2 * res]
+        || header->res_resized[2 * res + 1] != target->res_resized[2 * res + 1]) {
+        return 0;
+    }
+    if ((header->features & IMGST_ENCODING) != (target->features & IMGST_ENCODING)) return 0;
+
+    return !(target->features & IMGST_ENCODING)
+           || !memcmp(&header->encoding[res], &imgst_file->ext.encoding[res], sizeof(struct imgst_encoding));
+}
+
+/**********************************************************************
+ * Reads the next size bytes of an archive
+ */
+static int
+read_blob (FILE* in, uint32_t size, char** buffer)
+{
+    *buffer = malloc(size > 0 ? size : 1);
+    if (*buffer == NULL) return ERR_OUT_OF_MEMORY;
+
+    if (size > 0 && fread(*buffer, size, 1, in) != 1) {
+        free(*buffer);
+        *buffer = NULL;
+        return ERR_IO;
+    }
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Imports an image: its original, then its resized images
+ */
+static int
+import_image (FILE* in, const struct archive_header* header, const struct archive_entry* entry,
+              struct imgst_file* imgst_file)
+{
+    char* buffer = NULL;
+    int ret = read_blob(in, entry->size[RES_ORIG], &buffer);
+    if (ret) return ret;
+
+    ret = do_insert(buffer, entry->size[RES_ORIG], entry->img_id, imgst_file);
+    free(buffer);
+    if (ret) return ret;
+
+    // its slot, in its shard
+    struct imgst_file* file = imgst_file->shards != NULL ? shard_of(imgst_file, entry->img_id) : imgst_file;
+    uint32_t index = 0;
+    ret = find_img(file, entry->img_id, &index);
+
+    for (int res = RES_THUMB; ret == ERR_NONE && res <= RES_SMALL; ++res) {
+        if (entry->size[res] == 0) continue;
+
+        ret = read_blob(in, entry->size[res], &buffer);
+        if (ret == ERR_NONE && same_resizing(header, file, res)) {
+            ret = attach_resized(res, file, index, buffer, entry->size[res]);
+        }
+        free(buffer);
+    }
+    return ret;
+}
+
+/**********************************************************************
+ * Import of an archive
+ */
+int
+do_import (FILE* in, struct imgst_file* imgst_file, uint32_t* nb_images)
+{
+    if (in == NULL || imgst_file == NULL) return ERR_INVALID_ARGUMENT;
+    if (nb_images != NULL) *nb_images = 0;
+
+    struct archive_header header;
+    if (fread(&header, sizeof(header), 1, in) != 1) return ERR_IO;
+    if (memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) || header.version != ARCHIVE_VERSION) {
+        return ERR_INVALID_FILENAME;
+    }
+
+    for (;;) {
+        struct archive_entry entry;
+        // a truncated archive is an error: it ends with an empty entry
+        if (fread(&entry, sizeof(entry), 1, in) != 1) return ERR_IO;
+
+        entry.img_id[MAX_IMG_ID] = '\0';
+        if (entry.img_id[0] == '\0') return ERR_NONE;
+
+        const int ret = import_image(in, &header, &entry, imgst_file);
+        if (ret) return ret;
+        if (nb_images != NULL) ++*nb_images;
+    }
+}
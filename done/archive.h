@@ -0,0 +1,67 @@
+#pragma once
+
+/**
+ * @file archive.h
+ * @brief imgStore library: export and import of the images of an
+ *        imgStore as a stream.
+ *
+ * An archive holds only the valid images: an archive_header, then for
+ * each image an archive_entry followed by its original and, if it has
+ * them, its thumbnail and small images; an entry with an empty id ends
+ * it. It is written and read sequentially (a pipe, through a compressor,
+ * to another host), in the native byte order of the imgStore files.
+ *
+ * The images are exported in the order of their positions (see scan.h),
+ * and imported with do_insert, which recomputes their hashes, their
+ * resolutions and their deduplication. The resized images are imported
+ * as they are if the imgStore resizes as the exported one did (same
+ * resolutions and encoding), dropped otherwise (and created again when
+ * read).
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define ARCHIVE_MAGIC "IMGSTARC"
+#define ARCHIVE_VERSION 1
+
+struct archive_header {
+
+    char 			magic[8]; // ARCHIVE_MAGIC (non terminé par '\0')
+    uint32_t 		version; // ARCHIVE_VERSION
+    uint32_t 		features; // fonctionnalités de l'imgStore exporté (IMGST_*)
+    uint16_t 		res_resized[(NB_RES - 1) * 2]; // résolutions maximales des images redimensionnées. ORDRE : « thumbnail », « small »
+    struct imgst_encoding encoding[NB_RES - 1]; // réglages d'encodage des images redimensionnées (IMGST_ENCODING)
+
+};
+
+struct archive_entry {
+
+    char 			img_id[MAX_IMG_ID + 1]; // (nom) de l'image ; vide pour la fin de l'archive
+    uint32_t 		size[NB_RES]; // tailles des images qui suivent, 0 si absente. ORDRE : « thumbnail », « small », « original »
+    uint16_t 		format; // format de l'image d'origine (IMG_FMT_*)
+    uint16_t 		unused_16;
+
+};
+
+/**
+ * @brief Writes the valid images of an imgStore to an archive.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param out Where to write the archive (e.g. stdout).
+ * @return Some error code. 0 if no error.
+ */
+int do_export(struct imgst_file* imgst_file, FILE* out);
+
+/**
+ * @brief Inserts the images of an archive into an imgStore.
+ *
+ * @param in Where to read the archive from (e.g. stdin).
+ * @param imgst_file The main in-memory data structure (opened "rb+")
+ * @param nb_images Set to the number of images imported (may be NULL).
+ * @return Some error code. 0 if no error.
+ */
+int do_import(FILE* in, struct imgst_file* imgst_file, uint32_t* nb_images);
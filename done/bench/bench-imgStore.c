@@ -0,0 +1,369 @@
+/**
+ * @file bench-imgStore.c
+ * @brief Benchmark of the core imgStore operations.
+ *
+ * For each store size (max_files) and fill level, creates an imgStore,
+ * fills it with distinct images, then measures do_open, do_list,
+ * do_read (per resolution: first read, with lazily_resize, then cached
+ * read), do_delete and do_gbcollect on it. The insertions of the filling
+ * are measured too.
+ *
+ * Prints one CSV line per (operation, max_files, fill) on stdout:
+ *   op,max_files,fill,nb_ops,ops_per_sec,mean_us,p50_us,p90_us,p99_us,p999_us,max_us
+ * Progress is reported on stderr.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
+
+#include "imgStore.h"
+#include "wal.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vips/vips.h>
+
+#define MAX_CONFIGS 16
+#define NB_REPEATS 20      // for do_open and do_list
+#define NB_SAMPLES 1000    // images read and deleted per configuration
+
+static const char* image_filename = "tests/data/papillon_thumb.jpg";
+static const char* directory = "/tmp";
+static enum wal_sync fsync_policy = WAL_SYNC_BATCH;
+static FILE* results; // the original stdout
+
+static char* image;        // content of image_filename...
+static size_t image_size;
+static char* unique_image; // ...and a copy made unique by a JPEG comment (COM segment)
+
+/********************************************************************//**
+ * Time in nanoseconds
+ */
+static double
+now (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+cmp_double (const void* a, const void* b)
+{
+    const double d1 = *(const double*) a;
+    const double d2 = *(const double*) b;
+    return (d1 > d2) - (d1 < d2);
+}
+
+/********************************************************************//**
+ * Prints the statistics of nb latencies (in ns)
+ */
+static void
+report (const char* op, uint32_t max_files, uint32_t fill, double* latencies, size_t nb)
+{
+    if (nb == 0) return;
+
+    double total = 0;
+    for (size_t i = 0; i < nb; ++i) total += latencies[i];
+    qsort(latencies, nb, sizeof(double), cmp_double);
+
+#define PERCENTILE(p) (latencies[(size_t) ((p) * (nb - 1))] / 1e3)
+    fprintf(results, "%s,%" PRIu32 ",%" PRIu32 ",%zu,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+           op, max_files, fill, nb, total > 0 ? nb * 1e9 / total : 0.0, total / nb / 1e3,
+           PERCENTILE(0.5), PERCENTILE(0.9), PERCENTILE(0.99), PERCENTILE(0.999),
+           latencies[nb - 1] / 1e3);
+#undef PERCENTILE
+    fflush(results);
+}
+
+/********************************************************************//**
+ * Image number i: the same picture, with i in a comment segment right
+ * after the SOI marker, so that deduplication does not apply.
+ */
+static const char*
+make_image (uint32_t i, size_t* size)
+{
+    // FF FE, length (2 + 8, big endian), 8 bytes of comment
+    memcpy(unique_image, image, 2);
+    const unsigned char com[4] = { 0xFF, 0xFE, 0x00, 0x0A };
+    memcpy(unique_image + 2, com, sizeof(com));
+    snprintf(unique_image + 6, 9, "%08" PRIx32, i);
+    memcpy(unique_image + 14, image + 2, image_size - 2);
+    *size = image_size + 12;
+    return unique_image;
+}
+
+/********************************************************************//**
+ * Random permutation of 0..n-1
+ */
+static uint32_t*
+shuffle (uint32_t n)
+{
+    uint32_t* perm = malloc(n * sizeof(uint32_t));
+    if (perm == NULL) return NULL;
+
+    for (uint32_t i = 0; i < n; ++i) perm[i] = i;
+    for (uint32_t i = n; i > 1; --i) {
+        const uint32_t j = (uint32_t) rand() % i;
+        const uint32_t tmp = perm[i - 1];
+        perm[i - 1] = perm[j];
+        perm[j] = tmp;
+    }
+    return perm;
+}
+
+static int
+open_store (const char* path, struct imgst_file* imgst_file)
+{
+    int ret = do_open(path, "rb+", imgst_file);
+    if (ret == ERR_NONE) ret = wal_set_policy(imgst_file, fsync_policy);
+    return ret;
+}
+
+/********************************************************************//**
+ * Benchmark of one configuration
+ */
+static int
+bench (uint32_t max_files, uint32_t fill_percent)
+{
+    const uint32_t nb_images = (uint32_t) ((uint64_t) max_files * fill_percent / 100);
+    const uint32_t nb_samples = nb_images < NB_SAMPLES ? nb_images : NB_SAMPLES;
+
+    char path[256];
+    char tmp_path[sizeof(path) + 4];
+    char img_id[MAX_IMG_ID + 1];
+    snprintf(path, sizeof(path), "%s/bench-%" PRIu32 "-%" PRIu32 ".imgst", directory, max_files, fill_percent);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    double* latencies = calloc(nb_images > NB_REPEATS ? nb_images : NB_REPEATS, sizeof(double));
+    if (latencies == NULL) return ERR_OUT_OF_MEMORY;
+
+    fprintf(stderr, "max_files %" PRIu32 ", %" PRIu32 "%% full: inserting %" PRIu32 " images\n",
+            max_files, fill_percent, nb_images);
+
+    // ---- do_insert (filling)
+    struct imgst_file myfile = { .header.max_files  = max_files,
+                                 .header.res_resized = {64, 64, 256, 256}};
+    int ret = do_create(path, &myfile);
+    do_close(&myfile);
+    if (ret == ERR_NONE) ret = open_store(path, &myfile);
+    if (ret) {
+        free(latencies);
+        return ret;
+    }
+
+    for (uint32_t i = 0; i < nb_images && ret == ERR_NONE; ++i) {
+        size_t size;
+        const char* content = make_image(i, &size);
+        snprintf(img_id, sizeof(img_id), "img%" PRIu32, i);
+
+        const double start = now();
+        ret = do_insert(content, size, img_id, &myfile);
+        latencies[i] = now() - start;
+    }
+    if (ret == ERR_NONE) ret = wal_sync(&myfile);
+    do_close(&myfile);
+    if (ret) {
+        free(latencies);
+        return ret;
+    }
+    report("insert", max_files, fill_percent, latencies, nb_images);
+
+    // ---- do_open
+    for (uint32_t i = 0; i < NB_REPEATS && ret == ERR_NONE; ++i) {
+        const double start = now();
+        ret = do_open(path, "rb", &myfile);
+        latencies[i] = now() - start;
+        do_close(&myfile);
+    }
+    if (ret == ERR_NONE) report("open", max_files, fill_percent, latencies, NB_REPEATS);
+
+    if (ret == ERR_NONE) ret = open_store(path, &myfile);
+    if (ret) {
+        free(latencies);
+        return ret;
+    }
+
+    // ---- do_list
+    for (uint32_t i = 0; i < NB_REPEATS && ret == ERR_NONE; ++i) {
+        const double start = now();
+        char* list = do_list(&myfile, JSON);
+        latencies[i] = now() - start;
+        if (list == NULL) ret = ERR_OUT_OF_MEMORY;
+        free(list);
+    }
+    if (ret == ERR_NONE) report("list", max_files, fill_percent, latencies, NB_REPEATS);
+
+    // ---- do_read, per resolution: first reads (with lazily_resize), then cached reads
+    uint32_t* sample = shuffle(nb_images);
+    if (sample == NULL && nb_images > 0) ret = ERR_OUT_OF_MEMORY;
+
+    static const struct {
+        const char* name;
+        int resolution;
+    } reads[] = {
+        { "read_orig", RES_ORIG },
+        { "read_thumb_first", RES_THUMB },
+        { "read_thumb", RES_THUMB },
+        { "read_small_first", RES_SMALL },
+        { "read_small", RES_SMALL }
+    };
+    for (size_t r = 0; r < sizeof(reads) / sizeof(reads[0]) && ret == ERR_NONE; ++r) {
+        for (uint32_t i = 0; i < nb_samples && ret == ERR_NONE; ++i) {
+            char* buffer = NULL;
+            uint32_t size = 0;
+            snprintf(img_id, sizeof(img_id), "img%" PRIu32, sample[i]);
+
+            const double start = now();
+            ret = do_read(img_id, reads[r].resolution, &buffer, &size, &myfile);
+            latencies[i] = now() - start;
+            free(buffer);
+        }
+        if (ret == ERR_NONE) ret = wal_sync(&myfile);
+        if (ret == ERR_NONE) report(reads[r].name, max_files, fill_percent, latencies, nb_samples);
+    }
+
+    // ---- do_delete
+    for (uint32_t i = 0; i < nb_samples && ret == ERR_NONE; ++i) {
+        snprintf(img_id, sizeof(img_id), "img%" PRIu32, sample[i]);
+
+        const double start = now();
+        ret = do_delete(img_id, &myfile);
+        latencies[i] = now() - start;
+    }
+    if (ret == ERR_NONE) ret = wal_sync(&myfile);
+    if (ret == ERR_NONE) report("delete", max_files, fill_percent, latencies, nb_samples);
+    do_close(&myfile);
+    free(sample);
+
+    // ---- do_gbcollect
+    if (ret == ERR_NONE) {
+        const double start = now();
+        ret = do_gbcollect(path, tmp_path);
+        latencies[0] = now() - start;
+        if (ret == ERR_NONE) report("gc", max_files, fill_percent, latencies, 1);
+    }
+
+    remove(path);
+    free(latencies);
+    return ret;
+}
+
+/********************************************************************//**
+ * Comma-separated list of values
+ */
+static size_t
+parse_list (char* str, uint32_t* values, size_t max)
+{
+    size_t nb = 0;
+    for (char* token = strtok(str, ","); token != NULL && nb < max; token = strtok(NULL, ",")) {
+        values[nb++] = atouint32(token);
+    }
+    return nb;
+}
+
+static void
+usage (void)
+{
+    fprintf(stderr, "bench-imgStore [options]\n");
+    fprintf(stderr, "   -sizes <N1,N2,...>: max_files of the imgStores (default 1000,10000,100000)\n");
+    fprintf(stderr, "   -fill <P1,P2,...>: fill levels, in percent (default 10,50,90)\n");
+    fprintf(stderr, "   -image <filename>: JPEG image inserted (default %s)\n", image_filename);
+    fprintf(stderr, "   -dir <directory>: where the imgStores are created (default %s)\n", directory);
+    fprintf(stderr, "   -fsync none|batch|always: fsync policy of the journal (default batch)\n");
+}
+
+// ======================================================================
+int
+main (int argc, char* argv[])
+{
+    uint32_t sizes[MAX_CONFIGS] = { 1000, 10000, 100000 };
+    uint32_t fills[MAX_CONFIGS] = { 10, 50, 90 };
+    size_t nb_sizes = 3;
+    size_t nb_fills = 3;
+
+    if (VIPS_INIT(argv[0])) {
+        vips_error_exit("unable to start VIPS");
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            usage();
+            return ERR_NOT_ENOUGH_ARGUMENTS;
+        }
+        if (!strcmp(argv[i], "-sizes")) {
+            nb_sizes = parse_list(argv[++i], sizes, MAX_CONFIGS);
+        } else if (!strcmp(argv[i], "-fill")) {
+            nb_fills = parse_list(argv[++i], fills, MAX_CONFIGS);
+        } else if (!strcmp(argv[i], "-image")) {
+            image_filename = argv[++i];
+        } else if (!strcmp(argv[i], "-dir")) {
+            directory = argv[++i];
+        } else if (!strcmp(argv[i], "-fsync")) {
+            ++i;
+            if (!strcmp(argv[i], "none")) fsync_policy = WAL_SYNC_NONE;
+            else if (!strcmp(argv[i], "batch")) fsync_policy = WAL_SYNC_BATCH;
+            else if (!strcmp(argv[i], "always")) fsync_policy = WAL_SYNC_ALWAYS;
+            else {
+                usage();
+                return ERR_INVALID_ARGUMENT;
+            }
+        } else {
+            usage();
+            return ERR_INVALID_COMMAND;
+        }
+    }
+
+    for (size_t i = 0; i < nb_sizes; ++i) {
+        if (sizes[i] == 0 || sizes[i] > MAX_MAX_FILES) return ERR_MAX_FILES;
+    }
+    for (size_t i = 0; i < nb_fills; ++i) {
+        if (fills[i] > 100) return ERR_INVALID_ARGUMENT;
+    }
+
+    FILE* file = fopen(image_filename, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "cannot read %s\n", image_filename);
+        return ERR_IO;
+    }
+    fseek(file, 0, SEEK_END);
+    image_size = (size_t) ftell(file);
+    rewind(file);
+    image = malloc(image_size);
+    unique_image = malloc(image_size + 12);
+    if (image == NULL || unique_image == NULL || image_size < 2
+        || fread(image, image_size, 1, file) != 1) {
+        fclose(file);
+        return ERR_IO;
+    }
+    fclose(file);
+
+    // the library also prints on stdout (e.g. do_create): stdout goes to
+    // stderr, the results keep the original one
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    if (results == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) return ERR_IO;
+
+    srand(42); // same samples from one run to the other
+
+    fprintf(results, "op,max_files,fill,nb_ops,ops_per_sec,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n");
+
+    int ret = ERR_NONE;
+    for (size_t i = 0; i < nb_sizes && ret == ERR_NONE; ++i) {
+        for (size_t j = 0; j < nb_fills && ret == ERR_NONE; ++j) {
+            ret = bench(sizes[i], fills[j]);
+        }
+    }
+
+    free(image);
+    free(unique_image);
+    fclose(results);
+    vips_shutdown();
+
+    if (ret) {
+        fprintf(stderr, "%s\n", ERR_MESSAGES[ret]);
+    }
+    return ret;
+}
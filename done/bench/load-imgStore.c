@@ -0,0 +1,670 @@
+/**
+ * @file load-imgStore.c
+ * @brief HTTP load generator for imgStore_server.
+ *
+ * Each client is a thread with its own keep-alive connection, replaying
+ * for a given duration a random mix of list, read (thumbnail and
+ * original), insert and delete requests against a running server. Reads
+ * are of the images listed at startup (optionally inserted first, see
+ * -seed); deletes are of the images inserted by the same client, so that
+ * clients never delete what another one reads. An insert is the two
+ * requests of the web interface: upload of the image, then insertion.
+ *
+ * Prints one CSV line per request type, and one for all of them, on stdout:
+ *   op,clients,nb_ops,errors,ops_per_sec,mean_us,p50_us,p90_us,p99_us,p999_us,max_us
+ * ops_per_sec being the throughput over the whole run. The number of
+ * connections opened is reported on stderr.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime, getaddrinfo and rand_r
+
+#include "error.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#define MAX_CLIENTS 1024
+#define MAX_HEADER 8192
+
+enum op {OP_LIST, OP_READ_THUMB, OP_READ_ORIG, OP_INSERT, OP_DELETE, NB_OPS};
+static const char* const op_names[NB_OPS] = {"list", "read_thumb", "read_orig", "insert", "delete"};
+
+static const char* host = "127.0.0.1";
+static const char* port = "8000";
+static uint32_t nb_clients = 8;
+static uint32_t duration = 10;   // seconds
+static uint32_t nb_seeds = 0;    // images inserted before the run
+static uint32_t weights[NB_OPS] = {5, 50, 25, 10, 10};
+static const char* image_filename = "tests/data/papillon_thumb.jpg";
+
+static struct addrinfo* address;
+static char* image;
+static size_t image_size;
+static char** ids;               // images listed at startup, to be read
+static size_t nb_ids;
+static double deadline;
+
+/* latencies (in ns) of one type of request */
+struct latencies {
+    double* values;
+    size_t  nb;
+    size_t  capacity;
+    size_t  errors;
+};
+
+struct client {
+    pthread_t       thread;
+    uint32_t        id;
+    unsigned int    seed;        // of rand_r
+    int             fd;          // -1 if not connected
+    size_t          connections;
+
+    char*           buffer;      // last response
+    size_t          size;
+    size_t          capacity;
+    size_t          body;        // position of its body in buffer
+
+    char**          inserted;    // own images, to be deleted
+    size_t          nb_inserted;
+    size_t          inserted_capacity;
+    uint32_t        nb_inserts;
+    char*           unique_image;
+
+    struct latencies latencies[NB_OPS];
+    int             ret;
+};
+
+/********************************************************************//**
+ * Time in nanoseconds
+ */
+static double
+now (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+cmp_double (const void* a, const void* b)
+{
+    const double d1 = *(const double*) a;
+    const double d2 = *(const double*) b;
+    return (d1 > d2) - (d1 < d2);
+}
+
+/********************************************************************//**
+ * Grows an array of elements of size elem so that it can hold n of them
+ */
+static int
+reserve (void* array, size_t* capacity, size_t n, size_t elem)
+{
+    if (n <= *capacity) return ERR_NONE;
+
+    size_t new_capacity = *capacity == 0 ? 1024 : 2 * *capacity;
+    while (new_capacity < n) new_capacity *= 2;
+
+    void* ptr = realloc(*(void**) array, new_capacity * elem);
+    if (ptr == NULL) return ERR_OUT_OF_MEMORY;
+    *(void**) array = ptr;
+    *capacity = new_capacity;
+    return ERR_NONE;
+}
+
+static int
+add_latency (struct latencies* latencies, double latency)
+{
+    int ret = reserve(&latencies->values, &latencies->capacity, latencies->nb + 1, sizeof(double));
+    if (ret) return ret;
+    latencies->values[latencies->nb++] = latency;
+    return ERR_NONE;
+}
+
+/********************************************************************//**
+ * Connection of a client to the server
+ */
+static int
+connect_client (struct client* c)
+{
+    c->fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (c->fd < 0) return ERR_IO;
+
+    if (connect(c->fd, address->ai_addr, address->ai_addrlen) != 0) {
+        close(c->fd);
+        c->fd = -1;
+        return ERR_IO;
+    }
+    c->connections += 1;
+    return ERR_NONE;
+}
+
+static void
+disconnect_client (struct client* c)
+{
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+}
+
+/********************************************************************//**
+ * Whether a kept-alive connection was closed by the server meanwhile
+ */
+static int
+is_closed (int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, 0) <= 0) return 0;
+
+    char byte;
+    return recv(fd, &byte, 1, MSG_PEEK) <= 0;
+}
+
+static int
+send_all (int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t n = send(fd, data, size, 0);
+        if (n <= 0) return ERR_IO;
+        data += n;
+        size -= (size_t) n;
+    }
+    return ERR_NONE;
+}
+
+/********************************************************************//**
+ * Receives more of the response (*closed set if the server closed the
+ * connection instead)
+ */
+static int
+receive (struct client* c, int* closed)
+{
+    int ret = reserve(&c->buffer, &c->capacity, c->size + 4096 + 1, 1);
+    if (ret) return ret;
+
+    const ssize_t n = recv(c->fd, c->buffer + c->size, c->capacity - c->size - 1, 0);
+    if (n < 0) return ERR_IO;
+
+    *closed = n == 0;
+    c->size += (size_t) n;
+    c->buffer[c->size] = '\0';
+    return ERR_NONE;
+}
+
+/********************************************************************//**
+ * Reads a response: status, header, then its body (of Content-Length
+ * bytes, or up to the closing of the connection)
+ */
+static int
+read_response (struct client* c, int* status)
+{
+    c->size = 0;
+    c->body = 0;
+
+    int closed = 0;
+    char* end = NULL;
+    while (end == NULL) {
+        if (closed || c->size > MAX_HEADER) return ERR_IO;
+        int ret = receive(c, &closed);
+        if (ret) return ret;
+        end = strstr(c->buffer, "\r\n\r\n");
+    }
+    c->body = (size_t) (end - c->buffer) + 4;
+
+    if (sscanf(c->buffer, "HTTP/1.%*d %d", status) != 1) return ERR_IO;
+
+    long long content_length = -1;
+    int keep_alive = 1;
+    for (char* line = strstr(c->buffer, "\r\n") + 2; line < end; line = strstr(line, "\r\n") + 2) {
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            content_length = strtoll(line + 15, NULL, 10);
+        } else if (!strncasecmp(line, "Connection:", 11)) {
+            keep_alive = strncasecmp(line + 11 + strspn(line + 11, " "), "close", 5) != 0;
+        }
+    }
+
+    int ret = ERR_NONE;
+    if (content_length >= 0) {
+        while (ret == ERR_NONE && c->size < c->body + (size_t) content_length) {
+            ret = closed ? ERR_IO : receive(c, &closed);
+        }
+    } else {
+        while (ret == ERR_NONE && !closed) ret = receive(c, &closed);
+        keep_alive = 0;
+    }
+
+    if (ret || closed || !keep_alive) disconnect_client(c);
+    return ret;
+}
+
+/********************************************************************//**
+ * One request, on the kept-alive connection of the client if any (sent
+ * again on a new one if the server closed it before answering)
+ */
+static int
+request (struct client* c, const char* method, const char* target,
+         const char* body, size_t body_size, int* status)
+{
+    char header[MAX_HEADER];
+    const int len = snprintf(header, sizeof(header),
+                             "%s %s HTTP/1.1\r\nHost: %s:%s\r\nContent-Length: %zu\r\n\r\n",
+                             method, target, host, port, body_size);
+    if (len < 0 || (size_t) len >= sizeof(header)) return ERR_INVALID_ARGUMENT;
+
+    int ret = ERR_IO;
+    for (int attempt = 0; attempt < 2 && ret; ++attempt) {
+        if (c->fd >= 0 && is_closed(c->fd)) disconnect_client(c);
+
+        const int reused = c->fd >= 0;
+        if (!reused && (ret = connect_client(c)) != ERR_NONE) return ret;
+
+        ret = send_all(c->fd, header, (size_t) len);
+        if (ret == ERR_NONE && body_size > 0) ret = send_all(c->fd, body, body_size);
+        if (ret == ERR_NONE) ret = read_response(c, status);
+        if (ret) {
+            disconnect_client(c);
+            if (!reused) break;
+        }
+    }
+    return ret;
+}
+
+/********************************************************************//**
+ * Percent-encoding of an image ID, for a query string
+ */
+static void
+url_encode (char* dst, size_t size, const char* src)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t i = 0;
+    for (; *src != '\0' && i + 4 <= size; ++src) {
+        const unsigned char ch = (unsigned char) *src;
+        if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9')
+            || ch == '-' || ch == '_' || ch == '.' || ch == '~') {
+            dst[i++] = (char) ch;
+        } else {
+            dst[i++] = '%';
+            dst[i++] = hex[ch >> 4];
+            dst[i++] = hex[ch & 0xF];
+        }
+    }
+    dst[i] = '\0';
+}
+
+/********************************************************************//**
+ * Image number n of client c: the same picture, with c and n in a
+ * comment segment right after the SOI marker, so that deduplication does
+ * not apply.
+ */
+static const char*
+make_image (struct client* c, uint32_t n, size_t* size)
+{
+    // FF FE, length (2 + 16, big endian), 16 bytes of comment
+    memcpy(c->unique_image, image, 2);
+    const unsigned char com[4] = { 0xFF, 0xFE, 0x00, 0x12 };
+    memcpy(c->unique_image + 2, com, sizeof(com));
+    char comment[17];
+    snprintf(comment, sizeof(comment), "%08" PRIx32 "%08" PRIx32, c->id, n);
+    memcpy(c->unique_image + 6, comment, 16);
+    memcpy(c->unique_image + 22, image + 2, image_size - 2);
+    *size = image_size + 20;
+    return c->unique_image;
+}
+
+/********************************************************************//**
+ * The requests
+ */
+static int
+list_images (struct client* c, int* status)
+{
+    return request(c, "GET", "/imgStore/list", NULL, 0, status);
+}
+
+static int
+read_image (struct client* c, const char* res, int* status)
+{
+    char id[3 * 128 + 1];
+    char target[sizeof(id) + 64];
+    url_encode(id, sizeof(id), ids[(size_t) rand_r(&c->seed) % nb_ids]);
+    snprintf(target, sizeof(target), "/imgStore/read?res=%s&img_id=%s", res, id);
+    return request(c, "GET", target, NULL, 0, status);
+}
+
+static int
+insert_image (struct client* c, int* status)
+{
+    char id[64];
+    char target[128];
+    const uint32_t n = c->nb_inserts++;
+    snprintf(id, sizeof(id), "load%" PRIu32 "-%" PRIu32 "-%" PRIu32, (uint32_t) getpid(), c->id, n);
+
+    size_t size;
+    const char* content = make_image(c, n, &size);
+
+    // upload, then insertion
+    snprintf(target, sizeof(target), "/imgStore/insert?offset=0&name=%s", id);
+    int ret = request(c, "POST", target, content, size, status);
+    if (ret || *status >= 400) return ret;
+
+    snprintf(target, sizeof(target), "/imgStore/insert?offset=%zu&name=%s", size, id);
+    ret = request(c, "POST", target, NULL, 0, status);
+
+    // the upload left by the server (local) in /tmp
+    char path[sizeof(id) + 5];
+    snprintf(path, sizeof(path), "/tmp/%s", id);
+    remove(path);
+
+    if (ret || *status >= 400) return ret;
+
+    ret = reserve(&c->inserted, &c->inserted_capacity, c->nb_inserted + 1, sizeof(char*));
+    if (ret == ERR_NONE) {
+        c->inserted[c->nb_inserted] = malloc(strlen(id) + 1);
+        if (c->inserted[c->nb_inserted] == NULL) return ERR_OUT_OF_MEMORY;
+        strcpy(c->inserted[c->nb_inserted++], id);
+    }
+    return ret;
+}
+
+static int
+delete_image (struct client* c, int* status)
+{
+    char target[128];
+    char* id = c->inserted[--c->nb_inserted];
+    snprintf(target, sizeof(target), "/imgStore/delete?img_id=%s", id);
+    free(id);
+    return request(c, "GET", target, NULL, 0, status);
+}
+
+/********************************************************************//**
+ * Random request type, according to the weights of the mix
+ */
+static enum op
+pick_op (struct client* c)
+{
+    uint32_t total = 0;
+    for (int op = 0; op < NB_OPS; ++op) total += weights[op];
+
+    uint32_t r = (uint32_t) rand_r(&c->seed) % total;
+    enum op op = OP_LIST;
+    while (r >= weights[op]) r -= weights[op++];
+
+    // nothing of its own to delete yet
+    if (op == OP_DELETE && c->nb_inserted == 0) op = OP_INSERT;
+    return op;
+}
+
+/********************************************************************//**
+ * A client: requests until the deadline
+ */
+static void*
+run_client (void* arg)
+{
+    struct client* c = arg;
+
+    while (c->ret == ERR_NONE && now() < deadline) {
+        const enum op op = pick_op(c);
+        int status = 0;
+        int ret = ERR_NONE;
+
+        const double start = now();
+        switch (op) {
+        case OP_LIST:       ret = list_images(c, &status); break;
+        case OP_READ_THUMB: ret = read_image(c, "thumb", &status); break;
+        case OP_READ_ORIG:  ret = read_image(c, "orig", &status); break;
+        case OP_INSERT:     ret = insert_image(c, &status); break;
+        case OP_DELETE:     ret = delete_image(c, &status); break;
+        default: break;
+        }
+        const double latency = now() - start;
+
+        if (ret == ERR_OUT_OF_MEMORY) c->ret = ret;
+        if (ret || status >= 400) c->latencies[op].errors += 1;
+        else c->ret = add_latency(&c->latencies[op], latency);
+    }
+    return NULL;
+}
+
+/********************************************************************//**
+ * Images to be read: those of the list of the server
+ */
+static int
+fetch_ids (struct client* c)
+{
+    int status = 0;
+    int ret = list_images(c, &status);
+    if (ret) return ret;
+    if (status != 200) return ERR_IO;
+
+    char* pos = strchr(c->buffer + c->body, '[');
+    size_t capacity = 0;
+    while (pos != NULL && (pos = strchr(pos, '"')) != NULL) {
+        char* end = strchr(++pos, '"');
+        if (end == NULL) break;
+
+        ret = reserve(&ids, &capacity, nb_ids + 1, sizeof(char*));
+        if (ret) return ret;
+        ids[nb_ids] = malloc((size_t) (end - pos) + 1);
+        if (ids[nb_ids] == NULL) return ERR_OUT_OF_MEMORY;
+        memcpy(ids[nb_ids], pos, (size_t) (end - pos));
+        ids[nb_ids++][end - pos] = '\0';
+        pos = end + 1;
+    }
+    return ERR_NONE;
+}
+
+/********************************************************************//**
+ * Prints the statistics of the requests of one type
+ */
+static void
+report (const char* op, struct latencies* latencies, double elapsed)
+{
+    const size_t nb = latencies->nb;
+    double* values = latencies->values;
+    if (nb == 0 && latencies->errors == 0) return;
+
+    double total = 0;
+    for (size_t i = 0; i < nb; ++i) total += values[i];
+    if (nb > 0) qsort(values, nb, sizeof(double), cmp_double);
+
+#define PERCENTILE(p) (nb > 0 ? values[(size_t) ((p) * (nb - 1))] / 1e3 : 0.0)
+    printf("%s,%" PRIu32 ",%zu,%zu,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+           op, nb_clients, nb, latencies->errors, nb * 1e9 / elapsed,
+           nb > 0 ? total / nb / 1e3 : 0.0,
+           PERCENTILE(0.5), PERCENTILE(0.9), PERCENTILE(0.99), PERCENTILE(0.999),
+           PERCENTILE(1.0));
+#undef PERCENTILE
+}
+
+/********************************************************************//**
+ * Comma-separated list of values
+ */
+static size_t
+parse_list (char* str, uint32_t* values, size_t max)
+{
+    size_t nb = 0;
+    for (char* token = strtok(str, ","); token != NULL && nb < max; token = strtok(NULL, ",")) {
+        values[nb++] = atouint32(token);
+    }
+    return nb;
+}
+
+static void
+usage (void)
+{
+    fprintf(stderr, "load-imgStore [options]\n");
+    fprintf(stderr, "   -host <address>: of the server (default %s)\n", host);
+    fprintf(stderr, "   -port <port>: of the server (default %s)\n", port);
+    fprintf(stderr, "   -clients <N>: concurrent clients (default %" PRIu32 ")\n", nb_clients);
+    fprintf(stderr, "   -duration <seconds>: of the run (default %" PRIu32 ")\n", duration);
+    fprintf(stderr, "   -mix <L,T,O,I,D>: weights of list, read thumb, read orig, insert and delete\n");
+    fprintf(stderr, "                     (default 5,50,25,10,10)\n");
+    fprintf(stderr, "   -seed <N>: images inserted before the run, to be read (default 0)\n");
+    fprintf(stderr, "   -image <filename>: JPEG image inserted (default %s)\n", image_filename);
+}
+
+// ======================================================================
+int
+main (int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            usage();
+            return ERR_NOT_ENOUGH_ARGUMENTS;
+        }
+        if (!strcmp(argv[i], "-host")) {
+            host = argv[++i];
+        } else if (!strcmp(argv[i], "-port")) {
+            port = argv[++i];
+        } else if (!strcmp(argv[i], "-clients")) {
+            nb_clients = atouint32(argv[++i]);
+        } else if (!strcmp(argv[i], "-duration")) {
+            duration = atouint32(argv[++i]);
+        } else if (!strcmp(argv[i], "-seed")) {
+            nb_seeds = atouint32(argv[++i]);
+        } else if (!strcmp(argv[i], "-image")) {
+            image_filename = argv[++i];
+        } else if (!strcmp(argv[i], "-mix")) {
+            if (parse_list(argv[++i], weights, NB_OPS) != NB_OPS) {
+                usage();
+                return ERR_INVALID_ARGUMENT;
+            }
+        } else {
+            usage();
+            return ERR_INVALID_COMMAND;
+        }
+    }
+
+    uint32_t total = 0;
+    for (int op = 0; op < NB_OPS; ++op) total += weights[op];
+    if (nb_clients == 0 || nb_clients > MAX_CLIENTS || duration == 0 || total == 0) {
+        usage();
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    FILE* file = fopen(image_filename, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "cannot read %s\n", image_filename);
+        return ERR_IO;
+    }
+    fseek(file, 0, SEEK_END);
+    image_size = (size_t) ftell(file);
+    rewind(file);
+    image = malloc(image_size);
+    if (image == NULL || image_size < 2 || fread(image, image_size, 1, file) != 1) {
+        fclose(file);
+        return ERR_IO;
+    }
+    fclose(file);
+
+    const struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    if (getaddrinfo(host, port, &hints, &address) != 0) {
+        fprintf(stderr, "cannot resolve %s:%s\n", host, port);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // a server closing a connection must not kill the client writing to it
+    signal(SIGPIPE, SIG_IGN);
+
+    struct client* clients = calloc(nb_clients, sizeof(struct client));
+    if (clients == NULL) return ERR_OUT_OF_MEMORY;
+    for (uint32_t i = 0; i < nb_clients; ++i) {
+        clients[i].id = i;
+        clients[i].seed = 42 + i; // same mix from one run to the other
+        clients[i].fd = -1;
+        clients[i].unique_image = malloc(image_size + 20);
+        if (clients[i].unique_image == NULL) return ERR_OUT_OF_MEMORY;
+    }
+
+    // ---- seeding (by the first client, kept afterwards for the deletes)
+    int ret = ERR_NONE;
+    for (uint32_t i = 0; i < nb_seeds && ret == ERR_NONE; ++i) {
+        int status = 0;
+        ret = insert_image(&clients[0], &status);
+        if (ret == ERR_NONE && status >= 400) ret = ERR_IO;
+    }
+    if (ret == ERR_NONE) ret = fetch_ids(&clients[0]);
+    if (ret == ERR_NONE && nb_ids == 0 && (weights[OP_READ_THUMB] > 0 || weights[OP_READ_ORIG] > 0)) {
+        fprintf(stderr, "no image to read: use -seed\n");
+        ret = ERR_FILE_NOT_FOUND;
+    }
+    if (ret) {
+        fprintf(stderr, "%s\n", ERR_MESSAGES[ret]);
+        return ret;
+    }
+    // the seeds are read by all clients: not to be deleted
+    for (size_t j = 0; j < clients[0].nb_inserted; ++j) free(clients[0].inserted[j]);
+    clients[0].nb_inserted = 0;
+    clients[0].connections = 0;
+    fprintf(stderr, "%" PRIu32 " clients, %" PRIu32 " s, %zu images to read\n",
+            nb_clients, duration, nb_ids);
+
+    // ---- run
+    const double start = now();
+    deadline = start + duration * 1e9;
+    uint32_t nb_started = 0;
+    for (; nb_started < nb_clients; ++nb_started) {
+        if (pthread_create(&clients[nb_started].thread, NULL, run_client, &clients[nb_started]) != 0) break;
+    }
+    for (uint32_t i = 0; i < nb_started; ++i) {
+        pthread_join(clients[i].thread, NULL);
+    }
+    const double elapsed = now() - start;
+
+    // ---- results
+    struct latencies all[NB_OPS + 1];
+    memset(all, 0, sizeof(all));
+    size_t connections = 0;
+    for (uint32_t i = 0; i < nb_started; ++i) {
+        struct client* c = &clients[i];
+        if (c->ret) ret = c->ret;
+        connections += c->connections;
+
+        for (int op = 0; op < NB_OPS; ++op) {
+            for (size_t j = 0; j < c->latencies[op].nb && ret == ERR_NONE; ++j) {
+                ret = add_latency(&all[op], c->latencies[op].values[j]);
+                if (ret == ERR_NONE) ret = add_latency(&all[NB_OPS], c->latencies[op].values[j]);
+            }
+            all[op].errors += c->latencies[op].errors;
+            all[NB_OPS].errors += c->latencies[op].errors;
+        }
+    }
+
+    if (ret == ERR_NONE) {
+        printf("op,clients,nb_ops,errors,ops_per_sec,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n");
+        for (int op = 0; op < NB_OPS; ++op) report(op_names[op], &all[op], elapsed);
+        report("all", &all[NB_OPS], elapsed);
+        fprintf(stderr, "%zu connections opened for %zu operations\n",
+                connections, all[NB_OPS].nb + all[NB_OPS].errors);
+    }
+
+    // ---- cleanup (the images inserted during the run are left in the imgStore)
+    for (uint32_t i = 0; i < nb_clients; ++i) {
+        struct client* c = &clients[i];
+        disconnect_client(c);
+        for (int op = 0; op < NB_OPS; ++op) free(c->latencies[op].values);
+        for (size_t j = 0; j < c->nb_inserted; ++j) free(c->inserted[j]);
+        free(c->inserted);
+        free(c->buffer);
+        free(c->unique_image);
+    }
+    for (int op = 0; op <= NB_OPS; ++op) free(all[op].values);
+    for (size_t i = 0; i < nb_ids; ++i) free(ids[i]);
+    free(ids);
+    free(clients);
+    free(image);
+    freeaddrinfo(address);
+
+    if (ret) {
+        fprintf(stderr, "%s\n", ERR_MESSAGES[ret]);
+    }
+    return ret;
+}
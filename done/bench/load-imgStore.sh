@@ -0,0 +1,39 @@
+#!/bin/bash
+
+## Load test of imgStore_server: launches it on a fresh imgStore, then
+## runs bench/load-imgStore against it (its arguments are passed on).
+## Results (CSV) on stdout, everything else on stderr.
+##
+## Environment: LOAD_DB (imgStore, default /tmp/load-<pid>.imgst),
+## LOAD_MAX_FILES (default 10000), LOAD_FSYNC (none|batch|always, default
+## batch), LOAD_SEED (images inserted before the run, default 100),
+## LOAD_WORKERS (pre-forked server workers, default 0: a single process).
+
+set -eu
+
+cd "$(dirname "$0")/.."
+
+db=${LOAD_DB:-/tmp/load-$$.imgst}
+max_files=${LOAD_MAX_FILES:-10000}
+fsync=${LOAD_FSYNC:-batch}
+seed=${LOAD_SEED:-100}
+workers=${LOAD_WORKERS:-0}
+
+export LD_LIBRARY_PATH="${PWD}/libmongoose"
+
+pidof imgStore_server > /dev/null && { echo "ERROR: an imgStore_server is already running." >&2; exit 1; }
+
+rm -f "$db"
+./imgStoreMgr create "$db" -max_files $max_files -growable >&2
+
+if [ "$workers" -gt 0 ]; then
+    ./imgStore_server "$db" -fsync $fsync -workers $workers >&2 &
+else
+    ./imgStore_server "$db" -fsync $fsync >&2 &
+fi
+server=$!
+trap 'kill -TERM $server 2> /dev/null; wait $server; rm -f "$db" "${db}.wal"' EXIT
+sleep 1 # wait a bit
+ps -p $server > /dev/null || { echo "ERROR: cannot launch imgStore_server." >&2; exit 1; }
+
+./bench/load-imgStore -seed $seed "$@"
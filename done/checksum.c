@@ -0,0 +1,158 @@
+/**
+ * @file checksum.c
+ * @brief imgStore library: checksums of the images stored.
+ */
+
+#include "checksum.h"
+#include "lock.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78 // reversed
+
+static atomic_int verify_reads;
+
+/**********************************************************************
+ * CRC-32C in software, bit by bit
+ */
+static uint32_t
+crc32c_soft (uint32_t crc, const unsigned char* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+        }
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+/**********************************************************************
+ * CRC-32C with the crc32 instruction of SSE 4.2, 8 bytes at a time
+ */
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_sse42 (uint32_t crc, const unsigned char* data, size_t size)
+{
+    uint64_t crc64 = crc;
+    for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+    for (; size > 0; ++data, --size) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+/**********************************************************************
+ * CRC-32C with the crc32c instructions of ARMv8, 8 bytes at a time
+ */
+static uint32_t
+crc32c_arm (uint32_t crc, const unsigned char* data, size_t size)
+{
+    for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    for (; size > 0; ++data, --size) {
+        crc = __crc32cb(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+/**********************************************************************
+ * CRC-32C
+ */
+uint32_t
+crc32c (const void* data, size_t size)
+{
+    return crc32c_extend(0, data, size);
+}
+
+/**********************************************************************
+ * CRC-32C of data following some other
+ */
+uint32_t
+crc32c_extend (uint32_t previous, const void* data, size_t size)
+{
+    if (data == NULL) size = 0;
+    const uint32_t crc = ~previous;
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) return ~crc32c_sse42(crc, data, size);
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    return ~crc32c_arm(crc, data, size);
+#endif
+    return ~crc32c_soft(crc, data, size);
+}
+
+/**********************************************************************
+ * Verification of the reads
+ */
+void
+checksum_verify_reads (int on)
+{
+    atomic_store(&verify_reads, on != 0);
+}
+
+int
+checksum_verifying (void)
+{
+    return atomic_load_explicit(&verify_reads, memory_order_relaxed);
+}
+
+/**********************************************************************
+ * Appending of a blob (and of its checksum)
+ */
+int
+write_blob (struct imgst_file* imgst_file, const void* buffer, size_t size, uint64_t* offset)
+{
+    if (imgst_file == NULL || imgst_file->file == NULL || offset == NULL) return ERR_INVALID_ARGUMENT;
+    if (buffer == NULL && size > 0) return ERR_INVALID_ARGUMENT;
+
+    uint64_t position = 0;
+    uint64_t end_of_data = 0;
+    const int ret = seek_append(imgst_file, BLOB_SPAN(imgst_file, (uint64_t) size), &position, &end_of_data);
+    if (ret) return ret;
+
+    if (size > 0 && fwrite(buffer, size, 1, imgst_file->file) != 1) return ERR_IO;
+
+    if (imgst_file->header.features & IMGST_CHECKSUM) {
+        const uint32_t crc = crc32c(buffer, size);
+        if (fwrite(&crc, CHECKSUM_SIZE, 1, imgst_file->file) != 1) return ERR_IO;
+    }
+
+    // the content ends after the blob, now that it is written
+    if (end_of_data != 0) imgst_file->ext.end_of_data = end_of_data;
+    *offset = position;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Verification of a blob read
+ */
+int
+verify_blob (struct imgst_file* imgst_file, uint64_t offset, const void* buffer, size_t size)
+{
+    if (imgst_file == NULL || !(imgst_file->header.features & IMGST_CHECKSUM)) return ERR_NONE;
+    if (!checksum_verifying()) return ERR_NONE;
+
+    uint32_t crc = 0;
+    const int ret = read_at(imgst_file, offset + size, &crc, CHECKSUM_SIZE);
+    if (ret) return ret;
+
+    return crc == crc32c(buffer, size) ? ERR_NONE : ERR_IO;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+/**
+ * @file checksum.h
+ * @brief imgStore library: checksums of the images stored.
+ *
+ * The SHA-256 of an original only serves the deduplication, and the
+ * resized images have none: nothing would notice a blob damaged on the
+ * disk. In an imgStore created with the IMGST_CHECKSUM feature, each
+ * blob (original or resized) is followed in the file by its CRC-32C
+ * (CHECKSUM_SIZE bytes, not part of its size in the metadata), which is
+ * cheap to compute: with the crc32 instructions of SSE 4.2 (x86-64) or
+ * ARMv8, checked at run time, in software otherwise.
+ *
+ * The checksums are verified by a scrub of the whole imgStore (see
+ * scrub.h) and, once checksum_verify_reads has been called, by each
+ * read (do_read, do_read_many, snapshot_read): a damaged image is then
+ * an I/O error instead of corrupted content.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief CRC-32C (Castagnoli) of some data, as in iSCSI.
+ *
+ * @param data The data.
+ * @param size Its size.
+ * @return Its CRC-32C.
+ */
+uint32_t crc32c(const void* data, size_t size);
+
+/**
+ * @brief CRC-32C of some data following some other, in pieces:
+ *        crc32c_extend(crc32c(a, n), b, m) is the CRC-32C of a then b.
+ *
+ * @param previous CRC-32C of the data before (0 if none).
+ * @param data The data.
+ * @param size Its size.
+ * @return The CRC-32C of the whole.
+ */
+uint32_t crc32c_extend(uint32_t previous, const void* data, size_t size);
+
+/**
+ * @brief Turns the verification of the images read on or off (for all
+ *        threads and imgStores; off by default).
+ *
+ * @param on Non zero to verify the checksums of the images read.
+ */
+void checksum_verify_reads(int on);
+
+/**
+ * @brief Whether the images read are verified (see checksum_verify_reads).
+ */
+int checksum_verifying(void);
+
+/**
+ * @brief Appends a blob to the imgStore file (see seek_append), followed by its
+ *        checksum if the imgStore has the IMGST_CHECKSUM feature (under
+ *        the writer lock).
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param buffer The blob.
+ * @param size Its size.
+ * @param offset Set to its position in the file.
+ * @return Some error code. 0 if no error.
+ */
+int write_blob(struct imgst_file* imgst_file, const void* buffer, size_t size, uint64_t* offset);
+
+/**
+ * @brief Verifies a blob just read against its checksum, if the imgStore
+ *        has the IMGST_CHECKSUM feature and the reads are verified.
+ *
+ * @param imgst_file The main in-memory data structure (its shard if sharded)
+ * @param offset Position of the blob in the file.
+ * @param buffer The blob read.
+ * @param size Its size.
+ * @return Some error code (ERR_IO if it does not match). 0 if no error.
+ */
+int verify_blob(struct imgst_file* imgst_file, uint64_t offset, const void* buffer, size_t size);
@@ -5,6 +5,7 @@
  */
 
 #include "dedup.h"
+#include "index.h"
 
 
 /**
@@ -35,34 +36,90 @@ do_name_and_content_dedup(struct imgst_file* imgst_file, uint32_t index)
         return ERR_INVALID_ARGUMENT;
     }
 
-    if(index < 0 || index >= imgst_file->header.max_files){
+    if(index < 0 || index >= NB_SLOTS(imgst_file)){
         return ERR_INVALID_ARGUMENT;
     }
 
+    struct metadata_table* const metadata = load_metadata(imgst_file, index);
+    if(metadata == NULL){
+        return ERR_IO;
+    }
+
+    const char* const img_id = SLOT_ID(metadata, index);
+    const uint32_t hash = metadata->id_hash[index];
+
     int content_dedup = 0;
-    uint32_t found_copy_index = 0;
-    for(uint32_t i = 0; i < imgst_file->header.max_files; ++i){
-        if(imgst_file->metadata[i].is_valid == NON_EMPTY){
+    uint32_t copy = 0;
+    if(INDEXED(imgst_file)){
+        // the same as the scan below, through the hash tables
+        uint32_t other = 0;
+        if(index_find(imgst_file, img_id, &other) == ERR_NONE && other != index){
+            return ERR_DUPLICATE_ID;
+        }
+        content_dedup = index_find_sha(imgst_file, SLOT_SHA(metadata, index), index, &copy) == ERR_NONE;
+    }
+    for(uint32_t i = 0; !INDEXED(imgst_file) && i < NB_SLOTS(imgst_file); ++i){
+        if(load_metadata(imgst_file, i) == NULL){
+            return ERR_IO;
+        }
+        if(metadata->is_valid[i] == NON_EMPTY){
             if(i != index){
-                if(!strcmp(imgst_file->metadata[i].img_id, imgst_file->metadata[index].img_id)){
+                if(metadata->id_hash[i] == hash && !strcmp(SLOT_ID(metadata, i), img_id)){
                     return ERR_DUPLICATE_ID;
                 }
-                if(!equals_SHA(imgst_file->metadata[i].SHA, imgst_file->metadata[index].SHA)){
+                if(!equals_SHA(SLOT_SHA(metadata, i), SLOT_SHA(metadata, index))){
                     content_dedup = 1;
-                    found_copy_index = i;
+                    copy = i;
                 }
             }
         }
     }
+    // the whole table read: the next inserts use the index (the new slot,
+    // still empty, is added by insert_image)
+    if(!INDEXED(imgst_file) && imgst_file->locks == NULL){
+        (void) index_build(imgst_file);
+    }
     
     if(content_dedup == 0){
-        imgst_file->metadata[index].offset[RES_ORIG] = 0;
+        SLOT_OFFSET(metadata, index, RES_ORIG) = 0;
     }else{
-        imgst_file->metadata[index].offset[RES_ORIG] = imgst_file->metadata[found_copy_index].offset[RES_ORIG];
-        imgst_file->metadata[index].offset[RES_SMALL] = imgst_file->metadata[found_copy_index].offset[RES_SMALL];
-        imgst_file->metadata[index].offset[RES_THUMB] = imgst_file->metadata[found_copy_index].offset[RES_THUMB];
-        imgst_file->metadata[index].size[RES_SMALL] = imgst_file->metadata[found_copy_index].size[RES_SMALL];
-        imgst_file->metadata[index].size[RES_THUMB] = imgst_file->metadata[found_copy_index].size[RES_THUMB];
+        SLOT_OFFSET(metadata, index, RES_ORIG) = SLOT_OFFSET(metadata, copy, RES_ORIG);
+        SLOT_OFFSET(metadata, index, RES_SMALL) = SLOT_OFFSET(metadata, copy, RES_SMALL);
+        SLOT_OFFSET(metadata, index, RES_THUMB) = SLOT_OFFSET(metadata, copy, RES_THUMB);
+        SLOT_SIZE(metadata, index, RES_SMALL) = SLOT_SIZE(metadata, copy, RES_SMALL);
+        SLOT_SIZE(metadata, index, RES_THUMB) = SLOT_SIZE(metadata, copy, RES_THUMB);
     }
     return ERR_NONE;
 }
+
+
+/**
+ * Check if a blob is still referenced by another valid image.
+ */
+int
+is_blob_referenced(struct imgst_file* imgst_file, uint64_t offset, uint32_t index)
+{
+    if(imgst_file == NULL || offset == 0){
+        return 0;
+    }
+
+    // blobs are only shared by duplicates, of the same SHA
+    if(INDEXED(imgst_file) && index < NB_SLOTS(imgst_file)){
+        return index_blob_referenced(imgst_file, offset, index);
+    }
+
+    for(uint32_t i = 0; i < NB_SLOTS(imgst_file); ++i){
+        const struct metadata_table* metadata = load_metadata(imgst_file, i);
+        if(metadata == NULL){
+            return 1; // unknown: keep the blob alive
+        }
+        if(i != index && metadata->is_valid[i] == NON_EMPTY){
+            for(int res = 0; res < NB_RES; ++res){
+                if(SLOT_OFFSET(metadata, i, res) == offset){
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -36,4 +36,16 @@ int equals_SHA(const unsigned char* SHA1, const unsigned char* SHA2);
  * @param index Image at index index
  * @return Some error code. 0 if no error.
  */
-int do_name_and_content_dedup(struct imgst_file* imgst_file, uint32_t index);
\ No newline at end of file
+int do_name_and_content_dedup(struct imgst_file* imgst_file, uint32_t index);
+
+
+/**
+ * @brief Check if a blob of the data region is still referenced by a valid
+ *  image other than the one at index "index" (deduplicated images share blobs).
+ *
+ * @param imgst_file In memory structure with header and metadata.
+ * @param offset Position of the blob in the imgStore file
+ * @param index Image at index index, which is not taken into account
+ * @return 1 if the blob is referenced. 0 if not.
+ */
+int is_blob_referenced(struct imgst_file* imgst_file, uint64_t offset, uint32_t index);
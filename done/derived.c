@@ -0,0 +1,423 @@
+/**
+ * @file derived.c
+ * @brief imgStore library: images resized on the fly to an arbitrary box,
+ *        and their on-disk cache.
+ *
+ * A derived image is generated by vips_thumbnail_buffer, which lets the
+ * JPEG decoder shrink the original image while loading it: much cheaper
+ * than loading it at full size then resizing it, as lazily_resize does.
+ *
+ * A cached image is valid as long as the slot still holds the same
+ * original image (same offset); do_gbcollect, which moves the images,
+ * removes the whole cache.
+ */
+
+#define _DEFAULT_SOURCE // for fileno and flock
+
+#include "derived.h"
+#include "image_content.h"
+#include "trace.h"
+#include "shard.h"
+#include "lock.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#define DATA_START ((long int) (sizeof(struct cache_header) + CACHE_ENTRIES * sizeof(struct cache_entry)))
+#define NB_SETS (CACHE_ENTRIES / CACHE_WAYS)
+
+/**********************************************************************
+ * Path of the cache of an imgStore
+ */
+static char*
+cache_path (const char* imgst_filename)
+{
+    char* path = malloc(strlen(imgst_filename) + sizeof(CACHE_SUFFIX));
+    if (path == NULL) return NULL;
+
+    strcpy(path, imgst_filename);
+    strcat(path, CACHE_SUFFIX);
+    return path;
+}
+
+/**********************************************************************
+ * Set up of the cache
+ */
+int
+derived_init (struct imgst_file* imgst_file, const char* imgst_filename)
+{
+    if (imgst_file == NULL || imgst_filename == NULL) return ERR_INVALID_ARGUMENT;
+
+    struct derived_cache* cache = calloc(1, sizeof(struct derived_cache));
+    if (cache == NULL) return ERR_OUT_OF_MEMORY;
+
+    cache->path = cache_path(imgst_filename);
+    if (cache->path == NULL) {
+        free(cache);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    imgst_file->cache = cache;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Writes the header of the cache
+ */
+static int
+write_cache_header (struct derived_cache* cache)
+{
+    if (fseek(cache->file, 0, SEEK_SET) != 0) return ERR_IO;
+    if (fwrite(&cache->header, sizeof(struct cache_header), 1, cache->file) != 1) return ERR_IO;
+    return fflush(cache->file) == 0 ? ERR_NONE : ERR_IO;
+}
+
+/**********************************************************************
+ * Opening of the cache file, locked while the imgStore is open; reset
+ * if not closed properly, then marked as in use
+ */
+static int
+open_cache (struct derived_cache* cache)
+{
+    int fd = open(cache->path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return ERR_IO;
+
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        return ERR_IO;
+    }
+
+    cache->file = fdopen(fd, "rb+");
+    if (cache->file == NULL) {
+        close(fd);
+        return ERR_IO;
+    }
+
+    cache->entries = calloc(CACHE_ENTRIES, sizeof(struct cache_entry));
+    if (cache->entries == NULL) return ERR_OUT_OF_MEMORY;
+
+    struct cache_header* header = &cache->header;
+    if (fread(header, sizeof(struct cache_header), 1, cache->file) != 1
+        || strncmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0
+        || header->nb_entries != CACHE_ENTRIES || header->data_size != CACHE_DATA_SIZE
+        || header->clean != 1
+        || fread(cache->entries, sizeof(struct cache_entry), CACHE_ENTRIES, cache->file) != CACHE_ENTRIES) {
+        memset(header, 0, sizeof(struct cache_header));
+        memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+        header->nb_entries = CACHE_ENTRIES;
+        header->data_size = CACHE_DATA_SIZE;
+        memset(cache->entries, 0, CACHE_ENTRIES * sizeof(struct cache_entry));
+    }
+
+    // the table on disk is out of date until derived_close
+    header->clean = 0;
+    return write_cache_header(cache);
+}
+
+/**********************************************************************
+ * Writes back the table of the cache and frees it
+ */
+void
+derived_close (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || imgst_file->cache == NULL) return;
+    struct derived_cache* cache = imgst_file->cache;
+
+    if (cache->file != NULL) {
+        if (!cache->disabled
+            && fseek(cache->file, (long int) sizeof(struct cache_header), SEEK_SET) == 0
+            && fwrite(cache->entries, sizeof(struct cache_entry), CACHE_ENTRIES, cache->file) == CACHE_ENTRIES
+            && fflush(cache->file) == 0) {
+            cache->header.clean = 1;
+            write_cache_header(cache);
+        }
+        fclose(cache->file);
+    }
+
+    free(cache->entries);
+    free(cache->path);
+    free(cache);
+    imgst_file->cache = NULL;
+}
+
+/**********************************************************************
+ * Removal of the cache
+ */
+int
+derived_remove (const char* imgst_filename)
+{
+    if (imgst_filename == NULL) return ERR_INVALID_ARGUMENT;
+
+    char* path = cache_path(imgst_filename);
+    if (path == NULL) return ERR_OUT_OF_MEMORY;
+
+    const int ret = unlink(path) == 0 || errno == ENOENT ? ERR_NONE : ERR_IO;
+    free(path);
+    return ret;
+}
+
+/**********************************************************************
+ * Parses "<width>x<height>"
+ */
+int
+parse_box (const char* str, uint32_t* width, uint32_t* height)
+{
+    if (str == NULL || width == NULL || height == NULL) return ERR_INVALID_ARGUMENT;
+
+    unsigned long w = 0;
+    unsigned long h = 0;
+    int end = 0;
+    if (sscanf(str, "%4lux%4lu%n", &w, &h, &end) != 2 || str[end] != '\0'
+        || w == 0 || h == 0 || w > MAX_BOX || h > MAX_BOX) {
+        return ERR_RESOLUTIONS;
+    }
+
+    *width = (uint32_t) w;
+    *height = (uint32_t) h;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * First entry of the set of (slot, width, height)
+ */
+static size_t
+cache_set (uint32_t slot, uint32_t width, uint32_t height)
+{
+    uint32_t hash = slot * 2654435761u;
+    hash ^= (width << 16 | height) * 2246822519u;
+    hash ^= hash >> 15;
+    return (size_t) (hash % NB_SETS) * CACHE_WAYS;
+}
+
+/**********************************************************************
+ * Cached image of (slot, width, height), still valid for the original
+ * image at orig_offset; NULL if none
+ */
+static struct cache_entry*
+cache_lookup (struct derived_cache* cache, uint32_t slot, uint32_t width, uint32_t height, uint64_t orig_offset)
+{
+    struct cache_entry* set = &cache->entries[cache_set(slot, width, height)];
+    for (size_t way = 0; way < CACHE_WAYS; ++way) {
+        const struct cache_entry* entry = &set[way];
+        if (entry->size != 0 && entry->slot == slot && entry->width == width
+            && entry->height == height && entry->orig_offset == orig_offset) {
+            return &set[way];
+        }
+    }
+    return NULL;
+}
+
+/**********************************************************************
+ * Stores an image in the cache: at the head of the data region, evicting
+ * the images it overwrites, in the entry of its set which was the same
+ * image, else an EMPTY one, else the oldest one
+ */
+static int
+cache_store (struct derived_cache* cache, uint32_t slot, uint32_t width, uint32_t height,
+             uint64_t orig_offset, const void* image, size_t size)
+{
+    struct cache_header* header = &cache->header;
+    if (size == 0 || size > header->data_size) return ERR_NONE;
+
+    if (header->head + size > header->data_size) header->head = 0;
+    const uint64_t start = header->head;
+
+    for (size_t i = 0; i < CACHE_ENTRIES; ++i) {
+        struct cache_entry* entry = &cache->entries[i];
+        if (entry->size != 0 && entry->offset < start + size && start < entry->offset + entry->size) {
+            entry->size = 0;
+        }
+    }
+
+    struct cache_entry* set = &cache->entries[cache_set(slot, width, height)];
+    struct cache_entry* victim = NULL;
+    for (size_t way = 0; way < CACHE_WAYS && victim == NULL; ++way) {
+        if (set[way].size != 0 && set[way].slot == slot
+            && set[way].width == width && set[way].height == height) {
+            victim = &set[way];
+        }
+    }
+    for (size_t way = 0; way < CACHE_WAYS && victim == NULL; ++way) {
+        if (set[way].size == 0) victim = &set[way];
+    }
+    if (victim == NULL) {
+        // the oldest is the next to be overwritten, the first after the head
+        victim = &set[0];
+        for (size_t way = 1; way < CACHE_WAYS; ++way) {
+            if ((set[way].offset + header->data_size - start) % header->data_size
+                < (victim->offset + header->data_size - start) % header->data_size) {
+                victim = &set[way];
+            }
+        }
+    }
+    victim->size = 0;
+
+    if (fseek(cache->file, DATA_START + (long int) start, SEEK_SET) != 0
+        || fwrite(image, size, 1, cache->file) != 1) {
+        return ERR_IO;
+    }
+    header->head = start + size;
+
+    victim->slot = slot;
+    victim->width = (uint16_t) width;
+    victim->height = (uint16_t) height;
+    victim->orig_offset = orig_offset;
+    victim->offset = start;
+    victim->size = (uint32_t) size;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Reads a cached image; the entry is evicted if it cannot be read
+ */
+static int
+cache_read (struct derived_cache* cache, struct cache_entry* entry, char** image_buffer, uint32_t* image_size)
+{
+    char* buffer = malloc(entry->size);
+    if (buffer == NULL) return ERR_OUT_OF_MEMORY;
+
+    if (fseek(cache->file, DATA_START + (long int) entry->offset, SEEK_SET) != 0
+        || fread(buffer, entry->size, 1, cache->file) != 1) {
+        free(buffer);
+        entry->size = 0;
+        return ERR_IO;
+    }
+
+    *image_buffer = buffer;
+    *image_size = entry->size;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Generates the image img_id fitted into the box
+ */
+static int
+generate (struct imgst_file* imgst_file, const char* img_id, uint32_t width, uint32_t height,
+          void** image, size_t* size)
+{
+    char* orig = NULL;
+    uint32_t orig_size = 0;
+    int ret = do_read(img_id, RES_ORIG, &orig, &orig_size, imgst_file);
+    if (ret) return ret;
+
+    VipsImage* resized = NULL;
+    TRACE_BEGIN(vips_thumbnail_buffer);
+    const int load = vips_thumbnail_buffer(orig, orig_size, &resized, (int) width,
+                                           "height", (int) height, NULL);
+    TRACE_END(vips_thumbnail_buffer);
+    if (load != 0) {
+        free(orig);
+        return ERR_IMGLIB;
+    }
+
+    // encoded as the small images
+    TRACE_BEGIN(encode_image);
+    const int save = encode_image(resized, imgst_file, RES_SMALL, image, size);
+    TRACE_END(encode_image);
+
+    g_object_unref(resized);
+    free(orig);
+    return save != 0 ? ERR_IMGLIB : ERR_NONE;
+}
+
+/**********************************************************************
+ * Reads an image fitted into a box (do_read_box, without its span)
+ */
+static int
+read_box (const char* img_id, uint32_t width, uint32_t height,
+          char** image_buffer, uint32_t* image_size, int* resolution,
+          struct imgst_file* imgst_file)
+{
+    if (img_id == NULL || image_buffer == NULL || image_size == NULL || imgst_file == NULL) {
+        return ERR_INVALID_ARGUMENT;
+    }
+    if (width == 0 || height == 0 || width > MAX_BOX || height > MAX_BOX) return ERR_RESOLUTIONS;
+    if (imgst_file->file == NULL) return ERR_FILE_NOT_FOUND;
+
+    uint32_t index = 0;
+    int ret = find_img(imgst_file, img_id, &index);
+    if (ret) return ret;
+
+    // the slot may change meanwhile in thread-safe mode: copied under its lock
+    const struct metadata_table* metadata = &imgst_file->metadata;
+    lock_slot(imgst_file, index, 0);
+    const int found = metadata->is_valid[index] == NON_EMPTY && !strcmp(SLOT_ID(metadata, index), img_id);
+    const uint32_t res_orig[2] = { SLOT_RES_ORIG(metadata, index)[0], SLOT_RES_ORIG(metadata, index)[1] };
+    const uint64_t orig_offset = SLOT_OFFSET(metadata, index, RES_ORIG);
+    unlock_slot(imgst_file, index);
+    if (!found) return ERR_FILE_NOT_FOUND;
+
+    // no enlargement: the original image if it fits
+    int res = RES_ORIG;
+    if (res_orig[0] > width || res_orig[1] > height) {
+        res = -1;
+        for (int r = RES_THUMB; r < NB_RES - 1; ++r) {
+            if (imgst_file->header.res_resized[2 * r] == width
+                && imgst_file->header.res_resized[2 * r + 1] == height) {
+                res = r;
+            }
+        }
+    }
+    if (resolution != NULL) *resolution = res < 0 ? RES_SMALL : res;
+    if (res >= 0) return do_read(img_id, res, image_buffer, image_size, imgst_file);
+
+    // the cache is used by one thread at a time, but not while generating
+    struct derived_cache* cache = imgst_file->cache;
+    lock_cache(imgst_file);
+    if (cache != NULL && cache->file == NULL && !cache->disabled && open_cache(cache) != ERR_NONE) {
+        cache->disabled = 1;
+    }
+    const int cached = cache != NULL && !cache->disabled;
+
+    if (cached) {
+        TRACE_BEGIN(cache_lookup);
+        struct cache_entry* entry = cache_lookup(cache, index, width, height, orig_offset);
+        ret = entry == NULL ? ERR_FILE_NOT_FOUND : cache_read(cache, entry, image_buffer, image_size);
+        TRACE_END(cache_lookup);
+    }
+    unlock_cache(imgst_file);
+    if (cached && (ret == ERR_NONE || ret == ERR_OUT_OF_MEMORY)) return ret;
+
+    void* image = NULL;
+    size_t size = 0;
+    ret = generate(imgst_file, img_id, width, height, &image, &size);
+    if (ret) return ret;
+
+    if (cached) {
+        TRACE_BEGIN(cache_store);
+        lock_cache(imgst_file);
+        // a cache which cannot be written is not used any more
+        if (!cache->disabled && cache_store(cache, index, width, height, orig_offset, image, size) != ERR_NONE) {
+            cache->disabled = 1;
+        }
+        unlock_cache(imgst_file);
+        TRACE_END(cache_store);
+    }
+
+    *image_buffer = image;
+    *image_size = (uint32_t) size;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Reads an image fitted into a box
+ */
+int
+do_read_box (const char* img_id, uint32_t width, uint32_t height,
+             char** image_buffer, uint32_t* image_size, int* resolution,
+             struct imgst_file* imgst_file)
+{
+    if (imgst_file != NULL && imgst_file->shards != NULL) {
+        return do_read_box(img_id, width, height, image_buffer, image_size, resolution,
+                           shard_of(imgst_file, img_id));
+    }
+
+    TRACE_BEGIN(do_read_box);
+    const int ret = read_box(img_id, width, height, image_buffer, image_size, resolution, imgst_file);
+    TRACE_END(do_read_box);
+    return ret;
+}
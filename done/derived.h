@@ -0,0 +1,120 @@
+#pragma once
+
+/**
+ * @file derived.h
+ * @brief imgStore library: images resized on the fly to an arbitrary box,
+ *        and their on-disk cache.
+ *
+ * Besides the thumbnail and small resolutions fixed at creation, an image
+ * can be read fitted into any box of width x height pixels (keeping its
+ * aspect ratio). Such derived images are generated from the original one
+ * and kept in a bounded cache next to the imgStore (<imgStore>.cache),
+ * keyed by (slot, width, height): a header, a set-associative table of
+ * CACHE_ENTRIES entries, then a data region of CACHE_DATA_SIZE bytes
+ * used as a ring. A new image overwrites the oldest ones (their entries
+ * are evicted); an entry is also evicted by a newer one of the same set.
+ *
+ * The cache is opened at the first read of a box, locked for the process
+ * (without it if another process holds it), and its table written back
+ * by do_close. It is reset if it was not closed properly: it only ever
+ * holds copies.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CACHE_SUFFIX ".cache"
+#define CACHE_MAGIC "IMGSTCCH"
+#define CACHE_ENTRIES 4096          // entries of the table...
+#define CACHE_WAYS 4                // ...by sets of CACHE_WAYS
+#define CACHE_DATA_SIZE (64 << 20)  // bytes of the data region
+#define MAX_BOX 4096                // max. width and height of a box
+
+/* header of the cache file */
+struct cache_header {
+    char        magic[8];       // CACHE_MAGIC (not null-terminated)
+    uint32_t    nb_entries;
+    uint32_t    clean;          // 1 if closed properly
+    uint64_t    data_size;      // size of the data region
+    uint64_t    head;           // where the next image is written in the data region
+};
+
+/* one cached image; EMPTY if size is 0 */
+struct cache_entry {
+    uint32_t    slot;           // index of the metadata of the image
+    uint16_t    width;          // box
+    uint16_t    height;
+    uint64_t    orig_offset;    // offset of its original image, for validity
+    uint64_t    offset;         // in the data region
+    uint32_t    size;
+    uint32_t    unused_32;
+};
+
+/* cache of an open imgStore */
+struct derived_cache {
+    char*               path;
+    FILE*               file;       // opened at the first read of a box
+    int                 disabled;   // used by another process, or I/O error
+    struct cache_header header;
+    struct cache_entry* entries;
+};
+
+/**
+ * @brief Sets up the cache of derived images of an imgStore (the cache
+ *        file is only opened when first needed).
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param imgst_filename Path to the imgStore file
+ * @return Some error code. 0 if no error.
+ */
+int derived_init(struct imgst_file* imgst_file, const char* imgst_filename);
+
+/**
+ * @brief Writes back the table of the cache, if open, and frees it.
+ *
+ * @param imgst_file The main in-memory data structure
+ */
+void derived_close(struct imgst_file* imgst_file);
+
+/**
+ * @brief Removes the cache of an imgStore (e.g. when it is rewritten).
+ *
+ * @param imgst_filename Path to the imgStore file
+ * @return Some error code. 0 if no error.
+ */
+int derived_remove(const char* imgst_filename);
+
+/**
+ * @brief Parses a box, "<width>x<height>".
+ *
+ * @param str The string to be parsed.
+ * @param width Location of the width.
+ * @param height Location of the height.
+ * @return Some error code. 0 if no error (ERR_RESOLUTIONS if str is not
+ *         a box of at most MAX_BOX x MAX_BOX).
+ */
+int parse_box(const char* str, uint32_t* width, uint32_t* height);
+
+/**
+ * @brief Reads an image fitted into a box of width x height pixels: the
+ *        original one if it fits, the thumbnail or small one if the box
+ *        is theirs, else a derived image, from the cache or generated
+ *        (and cached).
+ *
+ * @param img_id The ID of the image to be read.
+ * @param width Width of the box.
+ * @param height Height of the box.
+ * @param image_buffer Location of the location of the image content
+ * @param image_size Location of the image size variable
+ * @param resolution Set to the resolution whose encoding the image has
+ *        (derived images are encoded as the small ones), e.g. for
+ *        get_content_type. May be NULL.
+ * @param imgst_file The main in-memory data structure
+ * @return Some error code. 0 if no error.
+ */
+int do_read_box(const char* img_id, uint32_t width, uint32_t height,
+                char** image_buffer, uint32_t* image_size, int* resolution,
+                struct imgst_file* imgst_file);
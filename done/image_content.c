@@ -4,6 +4,12 @@
  */
 
 #include "image_content.h"
+#include "wal.h"
+#include "trace.h"
+#include "lock.h"
+#include "map.h"
+#include "replog.h"
+#include "checksum.h"
 
 /**
  * @brief Computes the shrinking factor (keeping aspect ratio)
@@ -23,161 +29,524 @@ shrink_value(const VipsImage *image,
 }
 
 /**
- * Create a resized image
+ * Encodes a resized image with the settings of the imgStore for its
+ * resolution (vips defaults if it has none)
+ */
+int
+encode_image(VipsImage* image, const struct imgst_file* imgst_file, int res_code, void** buffer, size_t* len)
+{
+    if(!(imgst_file->header.features & IMGST_ENCODING)){
+        return vips_jpegsave_buffer(image, buffer, len, NULL);
+    }
+
+    const struct imgst_encoding* encoding = &imgst_file->ext.encoding[res_code];
+    const int quality = encoding->quality == 0 ? DEFAULT_QUALITY : encoding->quality;
+
+    switch(encoding->format){
+    case IMG_FMT_JPEG:
+        return vips_jpegsave_buffer(image, buffer, len,
+                                    "Q", quality,
+                                    "strip", (encoding->flags & ENC_STRIP) != 0,
+                                    "optimize_coding", (encoding->flags & ENC_OPTIMIZE) != 0,
+                                    "interlace", (encoding->flags & ENC_PROGRESSIVE) != 0,
+                                    NULL);
+    case IMG_FMT_WEBP:
+        // ENC_OPTIMIZE and ENC_PROGRESSIVE are JPEG options
+        return vips_webpsave_buffer(image, buffer, len,
+                                    "Q", quality,
+                                    "strip", (encoding->flags & ENC_STRIP) != 0,
+                                    NULL);
+    default:
+        return -1;
+    }
+}
+
+/**
+ * Generates a resized image from the original one (no lock held)
+ */
+int
+generate_resized(int res_code, struct imgst_file* imgst_file, uint64_t original_offset,
+                 uint32_t original_size, int format, void** buffer, size_t* len)
+{
+    VipsImage* parent = vips_image_new();
+
+    VipsImage** t = (VipsImage**)vips_object_local_array(VIPS_OBJECT(parent), 2);
+
+    VipsImage* original = t[0];
+    VipsImage* resized = t[1];
+
+    void* buf = calloc(original_size, sizeof(char));
+
+    if(buf == NULL) {
+        g_object_unref(parent);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    TRACE_BEGIN(read_orig);
+    int ret = read_at(imgst_file, original_offset, buf, original_size);
+    if(ret == ERR_NONE){
+        ret = verify_blob(imgst_file, original_offset, buf, original_size);
+    }
+    TRACE_END(read_orig);
+
+    if(ret) {
+        free(buf);
+        buf = NULL;
+        g_object_unref(parent);
+        return ret;
+    }
+
+    TRACE_BEGIN(load_image);
+    int load = load_image(buf, original_size, format, &original);
+    TRACE_END(load_image);
+
+    if(load == -1) {
+        g_object_unref(parent);
+        free(buf);
+        buf = NULL;
+        return ERR_IMGLIB;
+    }
+
+    const double ratio = shrink_value(original,
+                                      imgst_file->header.res_resized[(res_code * 2)],
+                                      imgst_file->header.res_resized[(res_code * 2) + 1]);
+
+    TRACE_BEGIN(vips_resize);
+    vips_resize(original, &resized, ratio, NULL);
+    TRACE_END(vips_resize);
+
+    TRACE_BEGIN(encode_image);
+    int save = encode_image(resized, imgst_file, res_code, buffer, len);
+    TRACE_END(encode_image);
+
+    g_object_unref(parent);
+    free(buf);
+    buf = NULL;
+
+    if(save == -1) {
+        free(*buffer);
+        *buffer = NULL;
+        return ERR_IMGLIB;
+    }
+    return ERR_NONE;
+}
+
+/**
+ * Appends a resized image and publishes it in its slot (under the writer
+ * lock), unless the slot changed or got it meanwhile
+ */
+static int
+append_resized(int res_code, struct imgst_file* imgst_file, size_t index,
+               uint64_t original_offset, const void* buffer, size_t len)
+{
+    // only the writer changes the slot: read without its lock
+    struct metadata_table* metadata = &imgst_file->metadata;
+
+    if(metadata->is_valid[index] != NON_EMPTY
+       || SLOT_OFFSET(metadata, index, RES_ORIG) != original_offset){
+        return ERR_FILE_NOT_FOUND;
+    }
+    if(SLOT_OFFSET(metadata, index, res_code) != 0){
+        return ERR_NONE;
+    }
+
+    int ret = check_live_bytes(imgst_file);
+
+    if(ret) {
+        return ret;
+    }
+
+    TRACE_BEGIN(write_blob);
+    uint64_t offset = 0;
+    ret = write_blob(imgst_file, buffer, len, &offset);
+    TRACE_END(write_blob);
+
+    // the readers see the new image once it can be read
+    if(ret != ERR_NONE || publish_writes(imgst_file) != ERR_NONE) {
+        return ERR_IO;
+    }
+
+    lock_slot(imgst_file, (uint32_t) index, 1);
+    SLOT_SIZE(metadata, index, res_code) = len;
+    SLOT_OFFSET(metadata, index, res_code) = offset;
+    unlock_slot(imgst_file, (uint32_t) index);
+    HEADER_ADD(imgst_file, live_bytes, BLOB_SPAN(imgst_file, len));
+
+    TRACE_BEGIN(commit);
+    ret = write_metadata(imgst_file, index);
+
+    if(ret == ERR_NONE) {
+        // the header holds the live bytes count
+        ret = write_header(imgst_file);
+    }
+
+    ret = wal_commit(imgst_file, ret);
+    TRACE_END(commit);
+
+    if(ret != ERR_NONE){
+        // nothing written: the slot as in the file, the new blob dead
+        lock_slot(imgst_file, (uint32_t) index, 1);
+        SLOT_SIZE(metadata, index, res_code) = 0;
+        SLOT_OFFSET(metadata, index, res_code) = 0;
+        unlock_slot(imgst_file, (uint32_t) index);
+        HEADER_SUB(imgst_file, live_bytes, BLOB_SPAN(imgst_file, len));
+        return ret;
+    }
+
+    return replog_append(imgst_file, REPLOG_RESIZED, res_code, SLOT_ID(metadata, index), buffer, (uint32_t) len);
+}
+
+/**
+ * Stores an image already resized as the resized image of a slot
+ */
+int
+attach_resized(int res_code, struct imgst_file* imgst_file, size_t index, const void* buffer, size_t len)
+{
+    if(imgst_file == NULL || imgst_file->file == NULL || buffer == NULL) return ERR_INVALID_ARGUMENT;
+
+    if(index >= NB_SLOTS(imgst_file) || (res_code != RES_SMALL && res_code != RES_THUMB)){
+        return ERR_INVALID_ARGUMENT;
+    }
+    if(load_metadata(imgst_file, index) == NULL){
+        return ERR_IO;
+    }
+
+    lock_writer(imgst_file);
+    const int ret = append_resized(res_code, imgst_file, index,
+                                   SLOT_OFFSET(&imgst_file->metadata, index, RES_ORIG), buffer, len);
+    unlock_writer(imgst_file);
+    return ret;
+}
+
+/**
+ * Create a resized image (lazily_resize, without its span): generated
+ * without lock, only appended under the writer lock
  * 
 */
-int
-lazily_resize(int res_code, struct imgst_file* imgst_file, size_t index)
+static int
+resize_image(int res_code, struct imgst_file* imgst_file, size_t index)
 {
     if(imgst_file == NULL) return ERR_INVALID_ARGUMENT;
     if(imgst_file->file == NULL) return ERR_INVALID_ARGUMENT;
 
     if(res_code == RES_ORIG) return ERR_NONE;
 
-    if(index < 0 || index >= imgst_file->header.max_files || (res_code != RES_SMALL && res_code != RES_THUMB)){
+    if(index < 0 || index >= NB_SLOTS(imgst_file) || (res_code != RES_SMALL && res_code != RES_THUMB)){
         return ERR_INVALID_ARGUMENT;
     }
 
-    if(imgst_file->metadata[index].offset[res_code] == 0){
+    struct metadata_table* metadata = load_metadata(imgst_file, index);
 
-        VipsImage* parent = vips_image_new();
+    if(metadata == NULL){
+        return ERR_IO;
+    }
 
-        VipsImage** t = (VipsImage**)vips_object_local_array(VIPS_OBJECT(parent), 2);
+    lock_slot(imgst_file, (uint32_t) index, 0);
+    const int valid = metadata->is_valid[index] == NON_EMPTY;
+    const uint64_t resized_offset = SLOT_OFFSET(metadata, index, res_code);
+    const uint64_t original_offset = SLOT_OFFSET(metadata, index, RES_ORIG);
+    const uint32_t original_size = SLOT_SIZE(metadata, index, RES_ORIG);
+    const int format = SLOT_FORMAT(metadata, index);
+    unlock_slot(imgst_file, (uint32_t) index);
+
+    // in thread-safe mode, the slot may have been deleted since find_img
+    if(!valid){
+        return ERR_FILE_NOT_FOUND;
+    }
+    if(resized_offset != 0){
+        return ERR_NONE;
+    }
 
-        VipsImage* original = t[0];
-        VipsImage* resized = t[1];
+    // a mapped imgStore is read-only: created by the writer (see map.h)
+    if(imgst_file->map != NULL){
+        return ERR_INVALID_COMMAND;
+    }
 
-        uint32_t original_size = imgst_file->metadata[index].size[RES_ORIG];
+    void* buffer = NULL;
+    size_t len = 0;
 
-        void* buf = calloc(original_size, sizeof(char));
+    int ret = generate_resized(res_code, imgst_file, original_offset, original_size, format, &buffer, &len);
 
-        if(buf == NULL) {
-            g_object_unref(parent);
-            return ERR_OUT_OF_MEMORY;
-        }
+    if(ret){
+        return ret;
+    }
 
-        int seek = fseek(imgst_file->file, imgst_file->metadata[index].offset[RES_ORIG], SEEK_SET);
+    lock_writer(imgst_file);
+    ret = append_resized(res_code, imgst_file, index, original_offset, buffer, len);
+    unlock_writer(imgst_file);
 
-        if(seek != 0) {
-            free(buf);
-            buf = NULL;
-            g_object_unref(parent);
-            return ERR_IO;
-        }
+    free(buffer);
+    buffer = NULL;
+    return ret;
+}
 
-        size_t read = fread(buf, original_size, 1, imgst_file->file);
+/**
+ * Create a resized image: concurrent requests for the same one (in
+ * thread-safe mode) wait for a single generation and share its result
+ * 
+*/
+int
+lazily_resize(int res_code, struct imgst_file* imgst_file, size_t index)
+{
+    TRACE_BEGIN(lazily_resize);
+    int ret = ERR_NONE;
+    struct flight* flight = NULL;
+    if(flight_begin(imgst_file, (uint32_t) index, res_code, &ret, &flight)){
+        ret = resize_image(res_code, imgst_file, index);
+        flight_end(imgst_file, flight, ret);
+    }
+    TRACE_END(lazily_resize);
+    return ret;
+}
 
-        if(read != 1) {
-            free(buf);
-            buf = NULL;
-            g_object_unref(parent);
-            return ERR_IO;
-        }
 
-        int load = vips_jpegload_buffer(buf, original_size, &original, NULL);
+/**
+ * Big- and little-endian integers of the image headers
+ */
+static uint32_t
+be16(const unsigned char* p)
+{
+    return (uint32_t) p[0] << 8 | p[1];
+}
 
-        if(load == -1) {
-            g_object_unref(parent);
-            free(buf);
-            buf = NULL;
-            return ERR_IMGLIB;
-        }
+static uint32_t
+be32(const unsigned char* p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
 
-        const double ratio = shrink_value(original,
-                                          imgst_file->header.res_resized[(res_code * 2)],
-                                          imgst_file->header.res_resized[(res_code * 2) + 1]);
+static uint32_t
+le16(const unsigned char* p)
+{
+    return (uint32_t) p[1] << 8 | p[0];
+}
 
-        vips_resize(original, &resized, ratio, NULL);
+static uint32_t
+le24(const unsigned char* p)
+{
+    return (uint32_t) p[2] << 16 | (uint32_t) p[1] << 8 | p[0];
+}
 
-        size_t len = 0;
+/**
+ * Whether an ISO base media file (AVIF) has the brand brand, major or
+ * compatible, in its ftyp box
+ */
+static int
+has_brand(const unsigned char* p, size_t size, const char* brand)
+{
+    if (size < 16 || memcmp(p + 4, "ftyp", 4) != 0) return 0;
 
-        void* buffer;
+    const size_t box_size = be32(p);
+    if (box_size < 16 || box_size > size) return 0;
 
-        int save = vips_jpegsave_buffer(resized, &buffer, &len, NULL);
+    if (memcmp(p + 8, brand, 4) == 0) return 1;
+    for (size_t pos = 16; pos + 4 <= box_size; pos += 4) {
+        if (memcmp(p + pos, brand, 4) == 0) return 1;
+    }
+    return 0;
+}
 
-        if(save == -1) {
-            g_object_unref(parent);
-            free(buffer);
-            free(buf);
-            buffer = NULL;
-            buf = NULL;
-            return ERR_IMGLIB;
-        }
+/**
+ * Format of an image, from its first bytes
+ */
+int
+get_format(const char* image_buffer, size_t image_size)
+{
+    if (image_buffer == NULL) return -1;
+    const unsigned char* p = (const unsigned char*) image_buffer;
 
-        seek = fseek(imgst_file->file, 0, SEEK_END);
+    if (image_size >= 3 && p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF) {
+        return IMG_FMT_JPEG;
+    }
+    if (image_size >= 8 && memcmp(p, "\x89PNG\r\n\x1a\n", 8) == 0) {
+        return IMG_FMT_PNG;
+    }
+    if (image_size >= 12 && memcmp(p, "RIFF", 4) == 0 && memcmp(p + 8, "WEBP", 4) == 0) {
+        return IMG_FMT_WEBP;
+    }
+    if (has_brand(p, image_size, "avif") || has_brand(p, image_size, "avis")) {
+        return IMG_FMT_AVIF;
+    }
+    return -1;
+}
 
-        if(seek != 0){
-            g_object_unref(parent);
-            return ERR_IO;
+/**
+ * Dimensions of a JPEG image, from its SOF segment
+ */
+static int
+probe_jpeg(const unsigned char* p, size_t size, uint32_t* height, uint32_t* width)
+{
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (p[pos] != 0xFF) return -1;
+        const unsigned char marker = p[pos + 1];
+        if (marker == 0xFF) {           // fill byte
+            ++pos;
+            continue;
         }
-
-        imgst_file->metadata[index].size[res_code] = len;
-        imgst_file->metadata[index].offset[res_code] = ftell(imgst_file->file);
-
-        size_t write = fwrite(buffer, len, 1, imgst_file->file);
-
-        if(write != 1) {
-            g_object_unref(parent);
-            free(buffer);
-            free(buf);
-            buffer = NULL;
-            buf = NULL;
-            return ERR_IO;
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {  // no length
+            pos += 2;
+            continue;
         }
+        if (marker == 0xDA || marker == 0xD9) return -1;              // no SOF before the data
+
+        const size_t length = be16(p + pos + 2);
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (length < 7 || pos + 9 > size) return -1;
+            *height = be16(p + pos + 5);
+            *width = be16(p + pos + 7);
+            return 0;
+        }
+        pos += 2 + length;
+    }
+    return -1;
+}
 
-        g_object_unref(parent);
+/**
+ * Dimensions of a PNG image, from its IHDR chunk
+ */
+static int
+probe_png(const unsigned char* p, size_t size, uint32_t* height, uint32_t* width)
+{
+    if (size < 24 || memcmp(p + 12, "IHDR", 4) != 0) return -1;
+    *width = be32(p + 16);
+    *height = be32(p + 20);
+    return 0;
+}
 
-        long int offset = sizeof(struct img_metadata) * (index) + sizeof(struct imgst_header);
+/**
+ * Dimensions of a WebP image, from its first chunk (lossy, lossless or
+ * extended)
+ */
+static int
+probe_webp(const unsigned char* p, size_t size, uint32_t* height, uint32_t* width)
+{
+    if (size >= 30 && memcmp(p + 12, "VP8 ", 4) == 0 && memcmp(p + 23, "\x9d\x01\x2a", 3) == 0) {
+        *width = le16(p + 26) & 0x3FFF;
+        *height = le16(p + 28) & 0x3FFF;
+        return 0;
+    }
+    if (size >= 25 && memcmp(p + 12, "VP8L", 4) == 0 && p[20] == 0x2F) {
+        const uint32_t bits = (uint32_t) p[21] | (uint32_t) p[22] << 8
+                              | (uint32_t) p[23] << 16 | (uint32_t) p[24] << 24;
+        *width = (bits & 0x3FFF) + 1;
+        *height = ((bits >> 14) & 0x3FFF) + 1;
+        return 0;
+    }
+    if (size >= 30 && memcmp(p + 12, "VP8X", 4) == 0) {
+        *width = le24(p + 24) + 1;
+        *height = le24(p + 27) + 1;
+        return 0;
+    }
+    return -1;
+}
 
-        if(fseek(imgst_file->file, offset, SEEK_SET) != 0){
-            return ERR_IO;
+/**
+ * Dimensions of an AVIF image, from the first ispe property (image
+ * spatial extents), in meta/iprp/ipco
+ */
+static int
+probe_avif(const unsigned char* p, size_t size, uint32_t* height, uint32_t* width)
+{
+    size_t pos = 0;
+    size_t end = size;
+    while (pos + 8 <= end) {
+        uint64_t box_size = be32(p + pos);
+        size_t header = 8;
+        if (box_size == 1) {
+            if (pos + 16 > end) return -1;
+            box_size = (uint64_t) be32(p + pos + 8) << 32 | be32(p + pos + 12);
+            header = 16;
+        } else if (box_size == 0) {
+            box_size = end - pos;
         }
-
-        int w = fwrite(&imgst_file->metadata[index], sizeof(struct img_metadata), 1, imgst_file->file);
-
-        if(w != 1) {
-            return ERR_IO;
+        if (box_size < header || box_size > end - pos) return -1;
+
+        const unsigned char* type = p + pos + 4;
+        if (memcmp(type, "ispe", 4) == 0) {
+            // version and flags, then width and height
+            if (box_size < header + 12) return -1;
+            *width = be32(p + pos + header + 4);
+            *height = be32(p + pos + header + 8);
+            return 0;
+        }
+        if (memcmp(type, "meta", 4) == 0 || memcmp(type, "iprp", 4) == 0 || memcmp(type, "ipco", 4) == 0) {
+            // into the box (meta is a full box: version and flags first)
+            end = pos + (size_t) box_size;
+            pos += header + (memcmp(type, "meta", 4) == 0 ? 4 : 0);
+        } else {
+            pos += (size_t) box_size;
         }
-
-        free(buffer);
-        free(buf);
-        buffer = NULL;
-        buf = NULL;
     }
-    return ERR_NONE;
+    return -1;
 }
 
+/**
+ * Loads an image of a given format
+ */
+int
+load_image(const char* image_buffer, size_t image_size, int format, VipsImage** image)
+{
+    void* buffer = (void*) image_buffer;
+    switch (format) {
+    case IMG_FMT_JPEG:
+        return vips_jpegload_buffer(buffer, image_size, image, NULL);
+    case IMG_FMT_PNG:
+        return vips_pngload_buffer(buffer, image_size, image, NULL);
+    case IMG_FMT_WEBP:
+        return vips_webpload_buffer(buffer, image_size, image, NULL);
+    case IMG_FMT_AVIF:
+        return vips_heifload_buffer(buffer, image_size, image, NULL);
+    default:
+        return -1;
+    }
+}
 
 /**
- * Recover the resolution of a JPEG image
+ * Recover the resolution of an image: from its header, else by loading it
  */
 int 
 get_resolution(uint32_t* height, uint32_t* width, const char* image_buffer, size_t image_size)
 {
-    VipsObject* parent = VIPS_OBJECT(vips_image_new());
-
-    if(parent == NULL){
-        return ERR_IMGLIB;
+    if(height == NULL || width == NULL || image_buffer == NULL){
+        return ERR_INVALID_ARGUMENT;
     }
 
-    VipsImage** t = (VipsImage**)vips_object_local_array(parent, 1);
-
-    if(t == NULL){
+    const unsigned char* p = (const unsigned char*) image_buffer;
+    const int format = get_format(image_buffer, image_size);
+    int probe = -1;
+
+    switch(format){
+    case IMG_FMT_JPEG:
+        probe = probe_jpeg(p, image_size, height, width);
+        break;
+    case IMG_FMT_PNG:
+        probe = probe_png(p, image_size, height, width);
+        break;
+    case IMG_FMT_WEBP:
+        probe = probe_webp(p, image_size, height, width);
+        break;
+    case IMG_FMT_AVIF:
+        probe = probe_avif(p, image_size, height, width);
+        break;
+    default:
         return ERR_IMGLIB;
     }
 
-    VipsImage* image = t[0];
-
-    int load = vips_jpegload_buffer((void*) image_buffer, image_size, &image, NULL);
+    if(probe == 0 && *width != 0 && *height != 0){
+        return ERR_NONE;
+    }
 
-    if(load == -1){
+    // header not understood: vips decodes it
+    VipsImage* image = NULL;
+    if(load_image(image_buffer, image_size, format, &image) != 0){
         return ERR_IMGLIB;
     }
 
     *width =  (uint32_t)image->Xsize;
     *height = (uint32_t)image->Ysize;
     
-    g_object_unref(parent);
+    g_object_unref(image);
     
     return ERR_NONE;
 }
@@ -23,9 +23,66 @@
  */
 int lazily_resize(int res_code, struct imgst_file* imgst_file, size_t index);
 
+/**
+ * @brief Stores an image already resized (e.g. imported, see archive.h)
+ *        as the resized image of a slot, unless it already has one
+ * @param res_code internal code of the resized imaged : THUMB or SMALL
+ * @param imgst_file the structure which is given in parameter
+ * @param index position/ index of the image
+ * @param buffer the resized image, encoded
+ * @param len its size
+ */
+int attach_resized(int res_code, struct imgst_file* imgst_file, size_t index, const void* buffer, size_t len);
+
+/**
+ * @brief Generates a resized image from an original one, without storing
+ *        it (no lock held)
+ * @param res_code internal code of the resized imaged : THUMB or SMALL
+ * @param imgst_file the structure which is given in parameter
+ * @param original_offset offset of the original image in the file
+ * @param original_size its size
+ * @param format its format (IMG_FMT_*)
+ * @param buffer set to the encoded image (to be freed by the caller)
+ * @param len set to its size
+ */
+int generate_resized(int res_code, struct imgst_file* imgst_file, uint64_t original_offset,
+                     uint32_t original_size, int format, void** buffer, size_t* len);
+
+/**
+ * @brief Encodes a resized image with the settings of the imgStore for
+ *        its resolution (IMGST_ENCODING), as JPEG with the vips defaults
+ *        if it has none
+ * @param image the resized image
+ * @param imgst_file the structure which is given in parameter
+ * @param res_code internal code of the resolution : THUMB or SMALL
+ * @param buffer set to the encoded image (to be freed by the caller)
+ * @param len set to its size
+ * @return 0 if no error, -1 otherwise (as vips)
+ */
+int encode_image(VipsImage* image, const struct imgst_file* imgst_file, int res_code, void** buffer, size_t* len);
+
+/**
+ * @brief Format of an image, from its first bytes (magic numbers)
+ * @param image_buffer memory buffer area of the image
+ * @param image_size image size in memory
+ * @return IMG_FMT_JPEG, IMG_FMT_PNG, IMG_FMT_WEBP or IMG_FMT_AVIF; -1 if
+ *         none of them
+ */
+int get_format(const char* image_buffer, size_t image_size);
+
+/**
+ * @brief Loads (decodes) an image of a given format
+ * @param image_buffer memory buffer area of the image
+ * @param image_size image size in memory
+ * @param format its format (IMG_FMT_*)
+ * @param image set to the loaded image
+ * @return 0 if no error, -1 otherwise (as vips)
+ */
+int load_image(const char* image_buffer, size_t image_size, int format, VipsImage** image);
 
 /**
- * @brief Recover the resolution of a JPEG image
+ * @brief Recover the resolution of an image (JPEG, PNG, WebP or AVIF),
+ *        from its header only when possible
  * @param height pointer of the height of the image
  * @param width pointer of the width of the image
  * @param image_buffer memory buffer area to load. 
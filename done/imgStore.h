@@ -11,6 +11,16 @@
  * because it should be stored as raw bytes appended at the end of the
  * imgStore file and addressed by offsets in the metadata structure.
  *
+ * When imgst_header.features is not 0, the metadata structures are
+ * followed by one header extension (struct imgst_ext). A growable
+ * imgStore may then chain metadata extents (struct imgst_extent followed
+ * by imgst_extent.nb_slots metadata structures) appended to the file
+ * like any other content. The header extension also holds the encoding
+ * settings of the resized images (IMGST_ENCODING) and, for an imgStore
+ * preallocated by large chunks (IMGST_PREALLOC), the end of its content:
+ * beyond it, the file is reserved space, where the next content is
+ * appended (see seek_append).
+ *
  * @author Mia Primorac
  */
 
@@ -32,6 +42,26 @@
 #define MAX_IMGST_NAME  31  // max. size of a ImgStore name
 #define MAX_IMG_ID     127  // max. size of an image id
 #define MAX_MAX_FILES 100000  // will be increased later in the project (is increasted)
+#define MAX_TOTAL_FILES 10000000 // max. number of slots of a growable imgStore (all extents)
+
+/* For features in imgst_header */
+#define IMGST_GROWABLE 0x0001 // metadata table grows by chained extents when full
+#define IMGST_ENCODING 0x0002 // resized images encoded with the settings of imgst_ext.encoding
+#define IMGST_REPLOG   0x0004 // changes logged for the replicas (see replog.h)
+#define IMGST_CHECKSUM 0x0008 // each image followed by its CRC-32C (see checksum.h)
+#define IMGST_PREALLOC 0x0010 // file preallocated by chunks, data up to imgst_ext.end_of_data (see seek_append)
+
+/* bytes of the checksum following an image (IMGST_CHECKSUM) */
+#define CHECKSUM_SIZE 4
+/* bytes taken in the file by an image of size bytes */
+#define BLOB_SPAN(imgst_file, size) \
+    ((size) + ((imgst_file)->header.features & IMGST_CHECKSUM ? CHECKSUM_SIZE : 0))
+
+#define EXT_MAGIC "IMGSTEXT"
+
+/* space preallocated at a time in an imgStore file (IMGST_PREALLOC) */
+#define PREALLOC_MIN_CHUNK (1 << 20)
+#define PREALLOC_MAX_CHUNK (64 << 20)
 
 /* For is_valid in imgst_metadata */
 #define EMPTY 0
@@ -44,6 +74,20 @@
 #define NB_RES    3
 #define NB_RES_ORIG  2
 
+/* image formats (originals: all; resized images: JPEG or WebP) */
+#define IMG_FMT_JPEG 0
+#define IMG_FMT_WEBP 1
+#define IMG_FMT_PNG  2
+#define IMG_FMT_AVIF 3
+#define NB_FMT       4
+
+/* For flags in imgst_encoding */
+#define ENC_STRIP       0x01 // no metadata (EXIF, ICC profile, ...)
+#define ENC_OPTIMIZE    0x02 // optimized Huffman tables (JPEG)
+#define ENC_PROGRESSIVE 0x04 // progressive (interlaced) JPEG
+
+#define DEFAULT_QUALITY 75
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -56,8 +100,8 @@ struct imgst_header {
     uint32_t 		num_files; // nombre d'images (valides) présentes dans la base
     const uint32_t 	max_files; //nombre maximal d'images possibles dans la base
     const uint16_t 	res_resized[(NB_RES - 1) * 2]; //tableaux des résolutions maximales des images. ORDRE : « thumbnail », « small »
-    uint32_t 		unused_32;
-    uint64_t 		unused_64;
+    uint32_t 		features; // fonctionnalités optionnelles (IMGST_*) ; 0 pour le format d'origine
+    uint64_t 		live_bytes; // octets des images (toutes résolutions, sommes de contrôle comprises) encore référencés par une image valide
 
 };
 
@@ -69,18 +113,110 @@ struct img_metadata {
     uint32_t 		size[NB_RES]; //  les tailles mémoire (en octets) des images aux différentes résolutions (« thumbnail », « small » et « original »)
     uint64_t 		offset[NB_RES]; // les positions dans le fichier « base de données d'images » des images aux différentes résolutions possibles (« thumbnail », « small » et « original »)
     uint16_t 		is_valid; // si image est encore utilisée (valeur NON_EMPTY / EMPTY)
-    uint16_t 		unused_16;
+    uint16_t 		unused_16; // format de l'image d'origine (IMG_FMT_*) ; 0 (JPEG) pour le format d'origine
+
+};
+
+struct imgst_encoding {
+
+    uint8_t 		format; // format des images redimensionnées (IMG_FMT_JPEG / IMG_FMT_WEBP)
+    uint8_t 		quality; // qualité de 1 à 100 ; 0 pour DEFAULT_QUALITY
+    uint8_t 		flags; // options d'encodage (ENC_*)
+    uint8_t 		unused_8;
+
+};
+
+struct imgst_ext {
+
+    char 			magic[8]; // EXT_MAGIC (non terminé par '\0')
+    uint32_t 		nb_extents; // nombre d'extensions de la table des métadonnées
+    uint32_t 		nb_slots; // nombre total d'emplacements (table principale et extensions)
+    uint64_t 		first_extent; // position de la première extension, 0 si aucune
+    uint64_t 		last_extent; // position de la dernière extension, 0 si aucune
+    struct imgst_encoding encoding[NB_RES - 1]; // réglages d'encodage par résolution redimensionnée (IMGST_ENCODING). ORDRE : « thumbnail », « small »
+    uint64_t 		end_of_data; // fin des données (IMGST_PREALLOC) ; la suite du fichier est préallouée
+    uint8_t 		reserved[80]; // pour de futures extensions, à 0
+
+};
 
+struct imgst_extent {
+
+    uint64_t 		next; // position de l'extension suivante, 0 si dernière
+    uint32_t 		nb_slots; // nombre de métadonnées qui suivent cet en-tête
+    uint32_t 		unused_32;
+
+};
+
+/* in-memory location of a metadata extent */
+struct extent_map {
+    uint64_t offset;      // position of the extent header in the file
+    uint32_t first_slot;  // index of its first metadata in imgst_file.metadata
+    uint32_t nb_slots;
 };
 
+/* in-memory metadata, as a structure of arrays: the fields scanned by the
+ * library are packed together, without the padding of the image ids,
+ * which are kept in a string arena. It is converted to the on-disk
+ * struct img_metadata only when read from or written to the file. */
+struct metadata_table {
+    uint32_t        nb_slots;
+    uint16_t*       is_valid;   // NON_EMPTY / EMPTY
+    uint16_t*       unused_16;  // format of the original image, see SLOT_FORMAT
+    uint32_t*       id_hash;    // hash_id() of the image id
+    uint64_t*       offset;     // NB_RES per slot
+    uint32_t*       size;       // NB_RES per slot
+    uint32_t*       res_orig;   // NB_RES_ORIG per slot
+    unsigned char*  SHA;        // SHA256_DIGEST_LENGTH per slot
+    uint32_t*       img_id;     // position of the image id in names
+    char*           names;      // string arena; names[0] is the empty id of the unused slots
+    size_t          names_size; // bytes used in names
+    size_t          names_capacity;
+    size_t          names_dead; // bytes of ids no longer referenced, reclaimed when they are the majority
+    uint32_t        names_generation; // incremented when names is compacted (the ids move)
+};
+
+#define SLOT_OFFSET(table, index, res) ((table)->offset[(size_t) (index) * NB_RES + (res)])
+#define SLOT_SIZE(table, index, res) ((table)->size[(size_t) (index) * NB_RES + (res)])
+#define SLOT_RES_ORIG(table, index) (&(table)->res_orig[(size_t) (index) * NB_RES_ORIG])
+#define SLOT_SHA(table, index) (&(table)->SHA[(size_t) (index) * SHA256_DIGEST_LENGTH])
+#define SLOT_ID(table, index) (&(table)->names[(table)->img_id[index]])
+#define SLOT_FORMAT(table, index) ((table)->unused_16[index])
+
+struct imgst_wal; // see wal.h
+struct derived_cache; // see derived.h
+struct imgst_shards; // see shard.h
+struct imgst_locks; // see lock.h
+struct imgst_map; // see map.h
+struct imgst_index; // see index.h
+
 struct imgst_file {
 
     FILE* 					file;
     struct imgst_header 	header;
-    struct img_metadata* 	metadata;
+    struct metadata_table 	metadata;
+
+    uint8_t* 				metadata_loaded; // per page of metadata: 1 if read from the file; NULL if all are in memory
+    struct imgst_ext 		ext; // valid if header.features != 0
+    struct extent_map* 		extents; // ext.nb_extents extents
+    uint32_t 				nb_extra_slots; // slots provided by the extents
+    struct imgst_wal* 		wal; // journal of the in-place writes; NULL if not open for writing
+    struct derived_cache* 	cache; // images resized to arbitrary boxes; NULL if none
+    struct imgst_shards* 	shards; // NULL unless a sharded imgStore (the other fields then describe the whole)
+    struct imgst_locks* 	locks; // NULL unless in thread-safe mode
+    struct imgst_map* 		map; // NULL unless mapped read-only
+    struct imgst_replog* 	replog; // change log (IMGST_REPLOG); NULL if none or not open for writing
+    struct imgst_index* 	index; // index of the images (see index.h); NULL if none
 
 };
 
+/* total number of metadata slots: primary table and extents */
+#define NB_SLOTS(imgst_file) ((imgst_file)->header.max_files + (imgst_file)->nb_extra_slots)
+
+/* the metadata are read by pages of METADATA_PAGE slots, all of them by do_open
+ * unless loaded from the index (see index.h) */
+#define METADATA_PAGE 128
+#define NB_PAGES(nb_slots) (((nb_slots) + METADATA_PAGE - 1) / METADATA_PAGE)
+
 /**
  * @brief Prints imgStore header informations.
  *
@@ -96,7 +232,11 @@ void print_header(const struct imgst_header* header);
 void print_metadata (const struct img_metadata* metadata);
 
 /**
- * @brief Open imgStore file, read the header and all the metadata.
+ * @brief Open imgStore file and read the header. The metadata are read
+ *        from the file by pages, the first time they are accessed
+ *        through load_metadata. The journal left by a crash, if any, is
+ *        replayed first; if the file is open for writing, its in-place
+ *        writes are journaled (see wal.h).
  *
  * @param imgst_filename Path to the imgStore file
  * @param open_mode Mode for fopen(), eg.: "rb", "rb+", etc.
@@ -104,6 +244,151 @@ void print_metadata (const struct img_metadata* metadata);
  */
 int do_open (const char* imgst_filename, const char* open_mode, struct imgst_file* imgst_file);
 
+/**
+ * @brief Allocates an in-memory metadata table of nb_slots EMPTY slots.
+ *
+ * @param table The table to be initialized.
+ * @param nb_slots Number of slots.
+ * @return Some error code. 0 if no error.
+ */
+int alloc_metadata(struct metadata_table* table, uint32_t nb_slots);
+
+/**
+ * @brief Frees an in-memory metadata table.
+ *
+ * @param table The table to be freed.
+ */
+void free_metadata(struct metadata_table* table);
+
+/**
+ * @brief Access to the in-memory metadata table, making sure that the
+ *        metadata at index index is in it: its page is read from the
+ *        imgStore file if not yet in memory.
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param index Index of the metadata (primary table, then extents).
+ * @return The table, or NULL if index is out of range or in case of I/O error.
+ */
+struct metadata_table* load_metadata(struct imgst_file* imgst_file, uint32_t index);
+
+/**
+ * @brief Copies the metadata at index index in its on-disk format.
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param index Index of the metadata (primary table, then extents).
+ * @param metadata Location where to store the metadata.
+ * @return Some error code. 0 if no error.
+ */
+int get_metadata(struct imgst_file* imgst_file, uint32_t index, struct img_metadata* metadata);
+
+/**
+ * @brief Replaces the in-memory metadata at index index (the file is not
+ *        written, see write_metadata).
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param index Index of the metadata (primary table, then extents).
+ * @param metadata The new metadata, in its on-disk format.
+ * @return Some error code. 0 if no error.
+ */
+int put_metadata(struct imgst_file* imgst_file, uint32_t index, const struct img_metadata* metadata);
+
+/**
+ * @brief Rereads the header and the metadata at the given indexes, changed
+ *        in the file by another process (the writer of a read-only
+ *        imgStore). The slots not loaded yet are left to load_metadata.
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param indexes Indexes of the changed metadata.
+ * @param nb Number of indexes.
+ * @return Some error code. 0 if no error. ERR_INVALID_COMMAND if the
+ *         imgStore is sharded or its table was grown: it is to be reopened.
+ */
+int reload_metadata(struct imgst_file* imgst_file, const uint32_t* indexes, uint32_t nb);
+
+/**
+ * @brief Sets the image id of the in-memory metadata at index index.
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param index Index of the metadata (primary table, then extents).
+ * @param img_id The image id (truncated to MAX_IMG_ID characters).
+ * @return Some error code. 0 if no error.
+ */
+int set_img_id(struct imgst_file* imgst_file, uint32_t index, const char* img_id);
+
+/**
+ * @brief Hash of an image id, to compare ids without reading them.
+ *
+ * @param img_id The image id.
+ * @return The hash.
+ */
+uint32_t hash_id(const char* img_id);
+
+/**
+ * @brief Finds a valid image by its id.
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param img_id The image id.
+ * @param index Location where to store the index of the image.
+ * @return Some error code. 0 if no error (ERR_FILE_NOT_FOUND if no image has this id).
+ */
+int find_img(struct imgst_file* imgst_file, const char* img_id, uint32_t* index);
+
+/**
+ * @brief Position in the imgStore file of the metadata at index index.
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param index Index of the metadata (primary table, then extents).
+ * @return The position, or -1 if index is out of range.
+ */
+long int metadata_offset(const struct imgst_file* imgst_file, uint32_t index);
+
+/**
+ * @brief Writes the in-memory metadata at index index to the imgStore file
+ *        (in its on-disk format).
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param index Index of the metadata to be written.
+ * @return Some error code. 0 if no error.
+ */
+int write_metadata(struct imgst_file* imgst_file, uint32_t index);
+
+/**
+ * @brief Writes the in-memory header to the imgStore file (and the header
+ *        extension, holding the end of the content, if IMGST_PREALLOC).
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @return Some error code. 0 if no error.
+ */
+int write_header(struct imgst_file* imgst_file);
+
+/**
+ * @brief Positions the imgStore file where size bytes of content are to
+ *        be appended (under the writer lock): its end, or the end of its
+ *        content if IMGST_PREALLOC, the space after it being preallocated
+ *        by chunks (an eighth of the content, PREALLOC_MIN_CHUNK to
+ *        PREALLOC_MAX_CHUNK bytes) when used up, if the file system can.
+ *        Once these bytes are written, the caller sets the end of the
+ *        content to end_of_data (written to the file by write_header).
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param size Number of bytes to be appended.
+ * @param offset Set to their position in the file.
+ * @param end_of_data Set to the end of the content after them, 0 if the
+ *        imgStore is not preallocated (its content is the whole file).
+ * @return Some error code. 0 if no error.
+ */
+int seek_append(struct imgst_file* imgst_file, uint64_t size, uint64_t* offset, uint64_t* end_of_data);
+
+/**
+ * @brief Appends a new metadata extent to a growable imgStore and links
+ *        it to the previous one. The new slots are EMPTY.
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @return Some error code. 0 if no error (ERR_FULL_IMGSTORE if the
+ *         imgStore is not growable or has reached MAX_TOTAL_FILES).
+ */
+int grow_metadata(struct imgst_file* imgst_file);
+
 /**
  * @brief Do some clean-up for imgStore file handling.
  *
@@ -158,6 +443,18 @@ int do_delete(const char * img_id, struct imgst_file* imgst_file);
  */
  int resolution_atoi(const char* resolution);
 
+/**
+ * @brief Content type (MIME) of an image of an imgStore at a given
+ *        resolution: the format of the original image as inserted, or
+ *        the one of the resized images (JPEG unless IMGST_ENCODING).
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param img_id The ID of the image.
+ * @param resolution The resolution (RES_THUMB, RES_SMALL or RES_ORIG).
+ * @return The content type, e.g. "image/jpeg".
+ */
+const char* get_content_type(struct imgst_file* imgst_file, const char* img_id, int resolution);
+
 /**
  * @brief Reads the content of an image from a imgStore.
  *
@@ -170,6 +467,49 @@ int do_delete(const char * img_id, struct imgst_file* imgst_file);
  */
  int do_read(const char* img_id, const int resolution, char** image_buffer, uint32_t* image_size, struct imgst_file* imgst_file);
 
+/**
+ * @brief Where an image is stored in a imgStore (as do_read, which
+ *        creates the resized image if needed), for the callers reading
+ *        it by themselves (see aio.h): the writes through the FILE* of
+ *        the imgStore are flushed first.
+ *
+ * @param img_id The ID of the image.
+ * @param resolution The desired resolution for the image.
+ * @param imgst_file The main in-memory data structure
+ * @param fd Set to the file descriptor of the imgStore file (of its shard)
+ * @param offset Set to the position of the image in that file
+ * @param size Set to its size
+ * @return Some error code. 0 if no error.
+ */
+int locate_image(const char* img_id, const int resolution, struct imgst_file* imgst_file,
+                 int* fd, uint64_t* offset, uint32_t* size);
+
+/**
+ * @brief One image of a batch read by do_read_many.
+ */
+struct imgst_read {
+    const char* img_id; // ID of the image to be read
+    char* buffer;       // its content (to be freed), NULL if not read
+    uint32_t size;      // its size
+    int error;          // error code of its read, 0 if none
+};
+
+/**
+ * @brief Reads the content of several images from a imgStore at a same
+ *        resolution: they are all located first (resized if needed), then
+ *        read in the order of their positions in the file, for sequential
+ *        I/O. The failure to read an image does not stop the others.
+ *
+ * @param reads The images to be read (img_id set, the other fields set
+ *        by the call).
+ * @param nb_reads Their number.
+ * @param resolution The desired resolution for the images read.
+ * @param imgst_file The main in-memory data structure
+ * @return Some error code (of the whole batch, not of its images). 0 if
+ *         no error.
+ */
+int do_read_many(struct imgst_read* reads, size_t nb_reads, const int resolution, struct imgst_file* imgst_file);
+
 /**
  * @brief Insert image in the imgStore file
  *
@@ -181,6 +521,53 @@ int do_delete(const char * img_id, struct imgst_file* imgst_file);
  */
  int do_insert(const char* buffer, const size_t size, const char* img_id, struct imgst_file* imgst_file);
 
+/**
+ * @brief Space accounting of an imgStore file, as computed by do_stats.
+ */
+struct imgst_stats {
+    uint64_t file_size;     // total size of the imgStore file (but its preallocated space)
+    uint64_t table_size;    // size of the header and of the metadata table
+    uint64_t live_bytes;    // bytes of the data region still referenced by a valid image
+    uint64_t dead_bytes;    // bytes of the data region no longer referenced (deleted images, orphaned resized images)
+    double   fragmentation; // dead_bytes / size of the data region (0 if no data)
+};
+
+/**
+ * @brief Computes the number of bytes of the data region referenced by
+ *        the valid images (blobs shared by deduplication are counted once).
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param live_bytes Location where to store the number of live bytes
+ * @return Some error code. 0 if no error.
+ */
+int compute_live_bytes(struct imgst_file* imgst_file, uint64_t* live_bytes);
+
+/**
+ * @brief Computes header.live_bytes if the imgStore was written before
+ *        the space accounting. To be called before updating it.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @return Some error code. 0 if no error.
+ */
+int check_live_bytes(struct imgst_file* imgst_file);
+
+/**
+ * @brief Computes the space accounting of an imgStore: live vs. dead bytes
+ *        and the fragmentation ratio of its data region.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param stats Location where to store the result
+ * @return Some error code. 0 if no error.
+ */
+int do_stats(struct imgst_file* imgst_file, struct imgst_stats* stats);
+
+/**
+ * @brief Prints imgStore space accounting informations.
+ *
+ * @param stats The statistics to be displayed.
+ */
+void print_stats(const struct imgst_stats* stats);
+
 /**
  * @brief Removes the deleted images by moving the existing ones
  *
@@ -9,12 +9,19 @@
 
 #include "util.h" // for _unused
 #include "imgStore.h"
+#include "derived.h"
+#include "shard.h"
+#include "archive.h"
+#include "replog.h"
+#include "scrub.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
+#include <signal.h>
 #include <vips/vips.h>
 
-#define NB_COMMANDS 7
+#define NB_COMMANDS 12
 #define LENGTH_OPTIONAL_CREATE_CMD 10
 
 static const uint16_t max_res_thumb = 128;
@@ -28,6 +35,11 @@ int do_delete_cmd (int args, char* argv[]);
 int do_read_cmd (int args, char* argv[]);
 int do_insert_cmd (int args, char* argv[]);
 int do_gc_cmd(int args, char* argv[]);
+int do_stats_cmd(int args, char* argv[]);
+int do_export_cmd(int args, char* argv[]);
+int do_import_cmd(int args, char* argv[]);
+int do_follow_cmd(int args, char* argv[]);
+int do_scrub_cmd(int args, char* argv[]);
 
 typedef int (*command) (int args, char* argv[]);
 
@@ -43,7 +55,12 @@ struct command_mapping commands[NB_COMMANDS] = {
     {"delete", do_delete_cmd},
     {"read", do_read_cmd},
     {"insert", do_insert_cmd},
-    {"gc", do_gc_cmd}
+    {"gc", do_gc_cmd},
+    {"stats", do_stats_cmd},
+    {"export", do_export_cmd},
+    {"import", do_import_cmd},
+    {"follow", do_follow_cmd},
+    {"scrub", do_scrub_cmd}
 };
 
 ///args = nb d'arguments
@@ -74,6 +91,17 @@ do_list_cmd (int args, char* argv[])
     return ERR_NONE;
 }
 
+/**********************************************************************
+ * Image format of the resized images, from its name; -1 if unknown.
+ */
+static int
+format_atoi (const char* format)
+{
+    if (!strcmp("jpeg", format) || !strcmp("jpg", format)) return IMG_FMT_JPEG;
+    if (!strcmp("webp", format)) return IMG_FMT_WEBP;
+    return -1;
+}
+
 /**********************************************************************
  * Prepares and calls do_create command.
 ********************************************************************** */
@@ -87,6 +115,9 @@ do_create_cmd (int args, char* argv[])
     uint16_t thumb_res_y =  64;
     uint16_t small_res_x = 256;
     uint16_t small_res_y = 256;
+    uint32_t features    =   0;
+    uint32_t nb_shards   =   0;
+    struct imgst_encoding encoding[NB_RES - 1] = {{ .format = IMG_FMT_JPEG }, { .format = IMG_FMT_JPEG }};
 
 
     const char* imgstore_filename = argv[1];
@@ -124,6 +155,56 @@ do_create_cmd (int args, char* argv[])
                 small_res_y <= 0 || small_res_y > max_res_small){
                 return ERR_RESOLUTIONS;
             }
+        }else if(!strcmp("-growable", argv[i])){
+            features |= IMGST_GROWABLE;
+        }else if(!strcmp("-replog", argv[i])){
+            features |= IMGST_REPLOG;
+        }else if(!strcmp("-checksum", argv[i])){
+            features |= IMGST_CHECKSUM;
+        }else if(!strcmp("-prealloc", argv[i])){
+            features |= IMGST_PREALLOC;
+        }else if(!strcmp("-quality", argv[i])){
+            if(args <= i + 2){
+                return ERR_NOT_ENOUGH_ARGUMENTS;
+            }
+            for(int res = RES_THUMB; res <= RES_SMALL; ++res){
+                const uint16_t quality = atouint16(argv[i + 1 + res]);
+                if(quality == 0 || quality > 100){
+                    return ERR_INVALID_ARGUMENT;
+                }
+                encoding[res].quality = (uint8_t) quality;
+            }
+            i += 2;
+            features |= IMGST_ENCODING;
+        }else if(!strcmp("-format", argv[i])){
+            if(args <= i + 2){
+                return ERR_NOT_ENOUGH_ARGUMENTS;
+            }
+            for(int res = RES_THUMB; res <= RES_SMALL; ++res){
+                const int format = format_atoi(argv[i + 1 + res]);
+                if(format < 0){
+                    return ERR_INVALID_ARGUMENT;
+                }
+                encoding[res].format = (uint8_t) format;
+            }
+            i += 2;
+            features |= IMGST_ENCODING;
+        }else if(!strcmp("-strip", argv[i]) || !strcmp("-optimize", argv[i])
+                 || !strcmp("-progressive", argv[i])){
+            const uint8_t flag = !strcmp("-strip", argv[i]) ? ENC_STRIP :
+                                 !strcmp("-optimize", argv[i]) ? ENC_OPTIMIZE : ENC_PROGRESSIVE;
+            encoding[RES_THUMB].flags |= flag;
+            encoding[RES_SMALL].flags |= flag;
+            features |= IMGST_ENCODING;
+        }else if(!strcmp("-shards", argv[i])){
+            if(args <= i + 1){
+                return ERR_NOT_ENOUGH_ARGUMENTS;
+            }
+            nb_shards = atouint32(argv[i + 1]);
+            i += 1;
+            if(nb_shards == 0 || nb_shards > MAX_SHARDS){
+                return ERR_INVALID_ARGUMENT;
+            }
         }else{
             return ERR_INVALID_ARGUMENT;
         }
@@ -133,14 +214,17 @@ do_create_cmd (int args, char* argv[])
 
     // Local var myfile  // Initialization of the header of the imgst_file
     struct imgst_file myfile = { .header.max_files  = max_files,
+                                 .header.features   = features,
                                  .header.res_resized = {thumb_res_x, thumb_res_y, small_res_x, small_res_y}};
     myfile.file = NULL;
+    memcpy(myfile.ext.encoding, encoding, sizeof(encoding));
     
     if (imgstore_filename == NULL) return ERR_INVALID_ARGUMENT;
     if (strlen(imgstore_filename) > MAX_IMGST_NAME) return ERR_INVALID_ARGUMENT;
     
-    //Call to do_create
-    int ret = do_create(imgstore_filename, &myfile);
+    //Call to do_create (for each shard)
+    int ret = nb_shards > 0 ? shard_create(imgstore_filename, nb_shards, &myfile) :
+                              do_create(imgstore_filename, &myfile);
     if(ret == ERR_NONE) {
         print_header(&myfile.header);
     }
@@ -172,12 +256,34 @@ help (int args, char* argv[])
     fprintf(stdout, "           -small_res <X_RES> <Y_RES>: resolution for small images. \n");
     fprintf(stdout, "                                       default value is 256x256 \n");
     fprintf(stdout, "                                       maximum value is 512x512 \n");
-    fprintf(stdout, "   read   <imgstore_filename> <imgID> [original|orig|thumbnail|thumb|small]: \n");
+    fprintf(stdout, "           -growable: the metadata table grows when the imgStore is full. \n");
+    fprintf(stdout, "           -replog: log the changes, for the replicas (see follow). \n");
+    fprintf(stdout, "           -checksum: store a checksum with each image (see scrub). \n");
+    fprintf(stdout, "           -prealloc: preallocate the file by large chunks, for contiguous images. \n");
+    fprintf(stdout, "           -quality <THUMB_Q> <SMALL_Q>: encoding quality of the resized images (1 to 100). \n");
+    fprintf(stdout, "                                         default value is %d \n", DEFAULT_QUALITY);
+    fprintf(stdout, "           -format <THUMB_FMT> <SMALL_FMT>: format of the resized images (jpeg or webp). \n");
+    fprintf(stdout, "                                            default value is jpeg \n");
+    fprintf(stdout, "           -strip: no metadata (EXIF, ICC profile) in the resized images. \n");
+    fprintf(stdout, "           -optimize: optimized Huffman coding of the resized JPEG images. \n");
+    fprintf(stdout, "           -progressive: progressive resized JPEG images. \n");
+    fprintf(stdout, "           -shards <NB_SHARDS>: spread the imgStore across NB_SHARDS files. \n");
+    fprintf(stdout, "                                (<imgstore_filename>.<i>, listed in <imgstore_filename>) \n");
+    fprintf(stdout, "   read   <imgstore_filename> <imgID> [original|orig|thumbnail|thumb|small|<W>x<H>]: \n");
     fprintf(stdout, "       read an image from the imgStore and save it to a file. \n");
     fprintf(stdout, "       default resolution is \"original\". \n");
+    fprintf(stdout, "       <W>x<H>: the image fitted into a box of W x H pixels, resized on the fly. \n");
     fprintf(stdout, "   insert <imgstore_filename> <imgID> <filename>: insert a new image in the imgStore. \n");
     fprintf(stdout, "   delete <imgstore_filename> <imgID>: delete image imgID from imgStore.\n");
     fprintf(stdout, "   gc <imgstore_filename> <tmp imgstore_filename>: performs garbage collecting on imgStore. Requires a temporary filename for copying the imgStore.\n");
+    fprintf(stdout, "   stats <imgstore_filename>: displays live and dead space of imgStore, to decide when to gc.\n");
+    fprintf(stdout, "   export <imgstore_filename> [archive_filename]: writes the images of imgStore to an archive (default: standard output).\n");
+    fprintf(stdout, "   import <imgstore_filename> [archive_filename]: inserts the images of an archive (default: standard input) in imgStore.\n");
+    fprintf(stdout, "   follow <imgstore_filename> <replica_filename> [-once]: applies the changes of imgStore (created with -replog) to a replica, created if needed, until interrupted. \n");
+    fprintf(stdout, "       -once: stops at the end of the changes logged. \n");
+    fprintf(stdout, "   scrub <imgstore_filename> [-threads <NB_THREADS>]: verifies all the images of imgStore and reports the corrupted ones. \n");
+    fprintf(stdout, "       the images are verified against their checksums (created with -checksum), otherwise the originals against their SHA. \n");
+    fprintf(stdout, "       default number of threads is %d \n", SCRUB_THREADS);
     return 0;
 }
 
@@ -302,7 +408,8 @@ do_insert_cmd (int args, char* argv[])
         return ret;
     }
 
-    if(myfile.header.num_files >= myfile.header.max_files){
+    if(myfile.header.num_files >= NB_SLOTS(&myfile) && !(myfile.header.features & IMGST_GROWABLE)){
+        do_close(&myfile);
         return ERR_FULL_IMGSTORE;
     }
 
@@ -342,6 +449,8 @@ do_read_cmd (int args, char* argv[])
     }
 
     uint32_t resolution = RES_ORIG;
+    uint32_t width = 0;
+    uint32_t height = 0;
 
     char* imgstore_filename = argv[1];
     char* imgID = argv[2];
@@ -349,11 +458,23 @@ do_read_cmd (int args, char* argv[])
     if(args == 4){
         resolution = resolution_atoi(argv[3]);
         if(resolution == -1){
-            return ERR_RESOLUTIONS;
+            int ret = parse_box(argv[3], &width, &height);
+            if(ret){
+                return ret;
+            }
         }
     }
    
-    char* newname =  generate_name(imgID, resolution);
+    char* newname = NULL;
+    if(width != 0){
+        // image_id + "_<W>x<H>" + '.jpg'
+        newname = calloc(sizeof(char), strlen(imgID) + strlen(argv[3]) + strlen("_.jpg") + 1);
+        if(newname != NULL){
+            sprintf(newname, "%s_%s.jpg", imgID, argv[3]);
+        }
+    }else{
+        newname = generate_name(imgID, resolution);
+    }
 
     if(newname == NULL){
         return ERR_OUT_OF_MEMORY;
@@ -369,10 +490,15 @@ do_read_cmd (int args, char* argv[])
     uint32_t image_size;   
     char* image_buffer;
 
-    ret = do_read(imgID, resolution, &image_buffer, &image_size, &myfile);
+    if(width != 0){
+        ret = do_read_box(imgID, width, height, &image_buffer, &image_size, NULL, &myfile);
+    }else{
+        ret = do_read(imgID, resolution, &image_buffer, &image_size, &myfile);
+    }
     do_close(&myfile);
 
     if(ret){
+        free(newname);
         return ret;
     }
 
@@ -414,6 +540,256 @@ do_gc_cmd(int args, char* argv[])
     return ret;
 }
 
+/********************************************************************//**
+ * Displays the space accounting of the imgStore.
+ */
+int
+do_stats_cmd(int args, char* argv[])
+//(char* imgstore_filename)
+{
+    if(args < 2){
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+
+    const char* imgstore_filename = argv[1];
+
+    struct imgst_file myfile;
+    int ret = do_open(imgstore_filename, "rb", &myfile);
+    if(ret){
+        return ret;
+    }
+
+    struct imgst_stats stats;
+    ret = do_stats(&myfile, &stats);
+    if(ret == ERR_NONE){
+        print_header(&myfile.header);
+        print_stats(&stats);
+    }
+    do_close(&myfile);
+
+    return ret;
+}
+
+/********************************************************************//**
+ * Writes the images of the imgStore to an archive.
+ */
+int
+do_export_cmd(int args, char* argv[])
+//(char* imgstore_filename, char* archive_filename)
+{
+    if(args < 2){
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+
+    const char* imgstore_filename = argv[1];
+
+    struct imgst_file myfile;
+    int ret = do_open(imgstore_filename, "rb", &myfile);
+    if(ret){
+        return ret;
+    }
+
+    FILE* out = stdout;
+    if(args > 2 && strcmp(argv[2], "-")){
+        out = fopen(argv[2], "wb");
+    }
+
+    if(out == NULL){
+        ret = ERR_IO;
+    }else{
+        ret = do_export(&myfile, out);
+        if(out != stdout && fclose(out) != 0 && ret == ERR_NONE){
+            ret = ERR_IO;
+        }
+    }
+    do_close(&myfile);
+
+    return ret;
+}
+
+/********************************************************************//**
+ * Inserts the images of an archive in the imgStore.
+ */
+int
+do_import_cmd(int args, char* argv[])
+//(char* imgstore_filename, char* archive_filename)
+{
+    if(args < 2){
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+
+    const char* imgstore_filename = argv[1];
+
+    struct imgst_file myfile;
+    int ret = do_open(imgstore_filename, "rb+", &myfile);
+    if(ret){
+        return ret;
+    }
+
+    FILE* in = stdin;
+    if(args > 2 && strcmp(argv[2], "-")){
+        in = fopen(argv[2], "rb");
+    }
+
+    uint32_t nb_images = 0;
+    if(in == NULL){
+        ret = ERR_IO;
+    }else{
+        ret = do_import(in, &myfile, &nb_images);
+        if(in != stdin){
+            fclose(in);
+        }
+    }
+    do_close(&myfile);
+
+    fprintf(stderr, "%" PRIu32 " image(s) imported\n", nb_images);
+    return ret;
+}
+
+/********************************************************************//**
+ * Interruption of follow (Ctrl-C)
+ */
+static volatile sig_atomic_t stop_following;
+
+static void
+stop_follow(int signo)
+{
+    stop_following = 1;
+}
+
+/********************************************************************//**
+ * Creates a replica with the settings of an imgStore.
+ */
+static int
+create_replica(const struct imgst_file* imgst, const char* replica_filename)
+{
+    struct imgst_file replica = { .header.max_files  = imgst->header.max_files,
+                                  .header.features   = imgst->header.features,
+                                  .header.res_resized = { imgst->header.res_resized[RES_THUMB * 2],
+                                                          imgst->header.res_resized[(RES_THUMB * 2) + 1],
+                                                          imgst->header.res_resized[RES_SMALL * 2],
+                                                          imgst->header.res_resized[(RES_SMALL * 2) + 1]}};
+    replica.file = NULL;
+    memcpy(replica.ext.encoding, imgst->ext.encoding, sizeof(replica.ext.encoding));
+
+    const int ret = do_create(replica_filename, &replica);
+    do_close(&replica);
+    return ret;
+}
+
+/********************************************************************//**
+ * Applies the changes of the imgStore to a replica.
+ */
+int
+do_follow_cmd(int args, char* argv[])
+//(char* imgstore_filename, char* replica_filename)
+{
+    if(args < 3){
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+
+    const char* imgstore_filename = argv[1];
+    const char* replica_filename = argv[2];
+    const int once = args > 3 && !strcmp(argv[3], "-once");
+
+    if(is_shard_manifest(imgstore_filename) || is_shard_manifest(replica_filename)){
+        return ERR_INVALID_FILENAME;
+    }
+
+    struct imgst_file myfile;
+    int ret = do_open(imgstore_filename, "rb", &myfile);
+    if(ret == ERR_NONE && !(myfile.header.features & IMGST_REPLOG)){
+        ret = ERR_INVALID_COMMAND;
+    }
+
+    // a new replica, with the settings of imgStore
+    FILE* exists = ret == ERR_NONE ? fopen(replica_filename, "rb") : NULL;
+    if(exists != NULL){
+        fclose(exists);
+    }else if(ret == ERR_NONE){
+        ret = create_replica(&myfile, replica_filename);
+    }
+    do_close(&myfile);
+    if(ret){
+        return ret;
+    }
+
+    struct imgst_file replica;
+    ret = do_open(replica_filename, "rb+", &replica);
+    if(ret){
+        return ret;
+    }
+
+    signal(SIGINT, stop_follow);
+    signal(SIGTERM, stop_follow);
+
+    uint64_t applied = 0;
+    ret = replog_follow(imgstore_filename, &replica, once, &stop_following, &applied);
+    fprintf(stderr, "%" PRIu64 " change(s) applied, version %" PRIu32 "\n",
+            applied, replica.header.imgst_version);
+    do_close(&replica);
+
+    return ret;
+}
+
+/********************************************************************//**
+ * Verifies all the images of the imgStore (see scrub.h).
+ */
+int
+do_scrub_cmd(int args, char* argv[])
+//(char* imgstore_filename [-threads N])
+{
+    if(args < 2){
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+
+    const char* imgstore_filename = argv[1];
+    unsigned int nb_threads = SCRUB_THREADS;
+
+    for(int i = 2; i < args; ++i){
+        if(!strcmp("-threads", argv[i])){
+            if(args <= i + 1){
+                return ERR_NOT_ENOUGH_ARGUMENTS;
+            }
+            nb_threads = atouint32(argv[i + 1]);
+            i += 1;
+            if(nb_threads == 0 || nb_threads > MAX_SCRUB_THREADS){
+                return ERR_INVALID_ARGUMENT;
+            }
+        }else{
+            return ERR_INVALID_ARGUMENT;
+        }
+    }
+
+    struct imgst_file myfile;
+    int ret = do_open(imgstore_filename, "rb", &myfile);
+    if(ret){
+        return ret;
+    }
+
+    struct scrub_report report;
+    ret = do_scrub(&myfile, nb_threads, &report);
+    do_close(&myfile);
+    if(ret){
+        return ret;
+    }
+
+    static const char* const res_names[NB_RES] = {"thumb", "small", "orig"};
+    for(uint32_t i = 0; i < report.nb_corrupted; ++i){
+        const struct scrub_error* error = &report.corrupted[i];
+        printf("%s (%s): %s, %" PRIu32 " bytes at offset %" PRIu64 "\n", error->img_id,
+               res_names[error->resolution], error->unreadable ? "unreadable" : "corrupted",
+               error->size, error->offset);
+    }
+    printf("%" PRIu64 " blob(s) verified (%" PRIu64 " bytes), %" PRIu32 " corrupted\n",
+           report.nb_blobs, report.bytes, report.nb_corrupted);
+
+    // corrupted images: a failure, for the scripts
+    ret = report.nb_corrupted > 0 ? ERR_IO : ERR_NONE;
+    scrub_report_free(&report);
+    return ret;
+}
+
 /********************************************************************//**
  * MAIN
  */
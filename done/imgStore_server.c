@@ -8,6 +8,15 @@
 #include <vips/vips.h>
 #include "mongoose.h"
 #include "imgStore.h"
+#include "wal.h"
+#include "derived.h"
+#include "metrics.h"
+#include "trace.h"
+#include "prefork.h"
+#include "aio.h"
+#include "snapshot.h"
+#include "checksum.h"
+#include "util.h"
 
 // Handle interrupts, like Ctrl-C
 static int s_signo;
@@ -15,17 +24,59 @@ static void signal_handler(int signo) {
   s_signo = signo;
 }
 
+// SIGUSR1: dump of the trace (see trace.h), by the event loop
+static volatile sig_atomic_t s_dump_trace;
+static void dump_trace_handler(int signo) {
+  s_dump_trace = 1;
+}
+
 
 // ======================================================================
 static const char *s_listening_address = "http://localhost:8000";
 static const char* imgstore_filename;
 static struct imgst_file myfile;
+static enum wal_sync fsync_policy = WAL_SYNC_BATCH;
+static int request_error; // error code of the request being handled, for the metrics
+static uint32_t nb_workers; // pre-forked workers, 0 for a single process (see prefork.h)
+static double request_start; // of the request being handled, for the metrics
+static int request_deferred; // answered once its image is read (see start_read)
+
+// reads of images in flight (see aio.h), by tag
+struct pending_read {
+    unsigned long       conn_id;
+    char*               buffer;     // NULL if unused
+    uint32_t            size;
+    const char*         content_type;
+    double              start;
+    size_t              bytes_in;
+};
+static struct imgst_aio* aio;
+static struct pending_read pending_reads[AIO_ENTRIES];
+
+#define MAX_BATCH_READS 256 // images of a /imgStore/batch_read
+#define BATCH_BOUNDARY "imgStore-batch-read"
+
+// snapshots pinned by the requests with a snapshot=<version> (see
+// snapshot.h), released once unused for a minute; only kept
+// by a single process: a worker reopens its imgStore (see prefork.h)
+#define MAX_SNAPSHOTS 8
+#define SNAPSHOT_IDLE 60e9 // ns, as metrics_now
+struct pinned_snapshot {
+    struct imgst_snapshot*  snapshot;   // NULL if unused
+    double                  used;
+};
+static struct pinned_snapshot snapshots[MAX_SNAPSHOTS];
+
 // ======================================================================
 void mg_error_msg(struct mg_connection* nc, int error);
 void handle_list_call(struct mg_connection *nc, int ev, struct mg_http_message *hm, void *fn_data);
 void handle_read_call(struct mg_connection *nc, int ev, struct mg_http_message *hm, void *fn_data);
+void handle_batch_read_call(struct mg_connection *nc, int ev, struct mg_http_message *hm, void *fn_data);
 void handle_delete_call(struct mg_connection *nc, int ev, struct mg_http_message *hm, void *fn_data);
 void handle_insert_call(struct mg_connection *nc, int ev, struct mg_http_message *hm, void *fn_data);
+void handle_stats_call(struct mg_connection *nc, int ev, struct mg_http_message *hm, void *fn_data);
+void handle_metrics_call(struct mg_connection *nc, int ev, struct mg_http_message *hm, void *fn_data);
+void handle_trace_call(struct mg_connection *nc, int ev, struct mg_http_message *hm, void *fn_data);
 
 // ======================================================================
 /**
@@ -40,44 +91,288 @@ static void imgst_event_handler(struct mg_connection *nc,
     struct mg_http_message *hm = (struct mg_http_message *) ev_data;
 
     switch (ev) {
-    case MG_EV_HTTP_MSG:
+    case MG_EV_HTTP_MSG: {
+        const double start = metrics_now();
+        const size_t sent = nc->send.len;
+        enum route route = ROUTE_STATIC;
+        request_error = ERR_NONE;
+        request_start = start;
+        request_deferred = 0;
+
+        // a worker reopens the imgStore changed by the writer
+        if(nb_workers > 0){
+            prefork_refresh(imgstore_filename, &myfile);
+        }
+
         if(mg_http_match_uri(hm, "/imgStore/list")){
+            route = ROUTE_LIST;
             handle_list_call(nc, ev, hm, fn_data);
         }else if(mg_http_match_uri(hm, "/imgStore/read")){
+            route = ROUTE_READ;
             handle_read_call(nc, ev, hm, fn_data);
+        }else if(mg_http_match_uri(hm, "/imgStore/batch_read")){
+            route = ROUTE_BATCH_READ;
+            handle_batch_read_call(nc, ev, hm, fn_data);
         }else if(mg_http_match_uri(hm, "/imgStore/delete")){
+            route = ROUTE_DELETE;
             handle_delete_call(nc, ev, hm, fn_data);
         }else if(mg_http_match_uri(hm, "/imgStore/insert")){
+            route = ROUTE_INSERT;
             handle_insert_call(nc, ev, hm, fn_data);
+        }else if(mg_http_match_uri(hm, "/imgStore/stats")){
+            route = ROUTE_STATS;
+            handle_stats_call(nc, ev, hm, fn_data);
+        }else if(mg_http_match_uri(hm, "/imgStore/metrics")){
+            route = ROUTE_METRICS;
+            handle_metrics_call(nc, ev, hm, fn_data);
+        }else if(mg_http_match_uri(hm, "/imgStore/trace")){
+            route = ROUTE_TRACE;
+            handle_trace_call(nc, ev, hm, fn_data);
         }else{
             struct mg_http_serve_opts opts = {.root_dir = "tests/data"};
             mg_http_serve_dir(nc, ev_data, &opts);
         }
+
+        if(!request_deferred){
+            metrics_record(route, request_error, hm->message.len, nc->send.len - sent,
+                           metrics_now() - start);
+        }
+        break;
+    }
     }
 }
 
+/**
+ * @brief Snapshot of the version of a request (snapshot=<version>), or of
+ *        the current version if none: pinned by a single process, to be
+ *        closed after the request by a worker (*owned set).
+ */
+static int
+get_snapshot(struct mg_http_message *hm, struct imgst_snapshot** snapshot, int* owned)
+{
+    const double now = metrics_now();
+    *owned = nb_workers > 0;
+
+    char version[12];
+    const int len = mg_http_get_var(&hm->query, "snapshot", version, sizeof(version));
+    if(len > 0){
+        version[len] = '\0';
+    }
+
+    size_t free_slot = MAX_SNAPSHOTS;
+    for(size_t i = 0; i < MAX_SNAPSHOTS; ++i){
+        struct pinned_snapshot* pinned = &snapshots[i];
+        if(pinned->snapshot != NULL && now - pinned->used > SNAPSHOT_IDLE){
+            snapshot_close(pinned->snapshot);
+            pinned->snapshot = NULL;
+        }
+        if(pinned->snapshot == NULL){
+            if(free_slot == MAX_SNAPSHOTS){
+                free_slot = i;
+            }
+        }else if(len > 0 && snapshot_version(pinned->snapshot) == atouint32(version)){
+            pinned->used = now;
+            *snapshot = pinned->snapshot;
+            *owned = 0;
+            return ERR_NONE;
+        }
+    }
+
+    int ret = snapshot_open(&myfile, snapshot);
+    if(ret){
+        return ret;
+    }
+
+    // released meanwhile (or never taken): unless nothing changed since
+    if(len > 0 && snapshot_version(*snapshot) != atouint32(version)){
+        snapshot_close(*snapshot);
+        *snapshot = NULL;
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if(!*owned){
+        if(free_slot == MAX_SNAPSHOTS){
+            // the least recently used one
+            free_slot = 0;
+            for(size_t i = 1; i < MAX_SNAPSHOTS; ++i){
+                if(snapshots[i].used < snapshots[free_slot].used){
+                    free_slot = i;
+                }
+            }
+            snapshot_close(snapshots[free_slot].snapshot);
+        }
+        snapshots[free_slot].snapshot = *snapshot;
+        snapshots[free_slot].used = now;
+    }
+    return ERR_NONE;
+}
+
+/**
+ * @brief Lists the images, e.g. /imgStore/list; a page of them as of a
+ *        snapshot with from=<rank>&count=<number>[&snapshot=<version>]
+ *        (see snapshot_list): the next pages are asked with the version
+ *        returned by the first one.
+ */
 void 
 handle_list_call(struct mg_connection *nc,
                           int ev,
                           struct mg_http_message *hm,
                           void *fn_data)
 {
-    char* list = do_list(&myfile, JSON);
+    char from[12];
+    char count[12];
+    char version[12];
+    const int from_len = mg_http_get_var(&hm->query, "from", from, sizeof(from));
+    const int count_len = mg_http_get_var(&hm->query, "count", count, sizeof(count));
+    const int paged = from_len > 0 || count_len > 0
+                      || mg_http_get_var(&hm->query, "snapshot", version, sizeof(version)) > 0;
+
+    char* list = NULL;
+    int ret = ERR_NONE;
+
+    if(!paged){
+        list = do_list(&myfile, JSON);
+    }else{
+        struct imgst_snapshot* snapshot = NULL;
+        int owned = 0;
+        ret = get_snapshot(hm, &snapshot, &owned);
+        if(ret == ERR_NONE){
+            if(from_len > 0) from[from_len] = '\0';
+            if(count_len > 0) count[count_len] = '\0';
+            list = snapshot_list(snapshot, from_len > 0 ? atouint32(from) : 0,
+                                 count_len > 0 ? atouint32(count) : UINT32_MAX);
+            if(owned){
+                snapshot_close(snapshot);
+            }
+        }
+    }
 
-    mg_printf(
-                nc,
-                "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n%s", 
-                strlen(list), list);
-    free(list);
+    if(ret){
+        mg_error_msg(nc, ret);
+    }else if(list == NULL){
+        mg_error_msg(nc, ERR_OUT_OF_MEMORY);
+    }else{
+        mg_printf(
+                    nc,
+                    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n%s", 
+                    strlen(list), list);
+        free(list);
+    }
     nc->is_draining = 1;
 }
 
 void 
 mg_error_msg(struct mg_connection* nc, int error)
 {
+    request_error = error;
     mg_http_reply(nc, 500, "", "Error: %s", ERR_MESSAGES[error]);
 }
 
+/**
+ * @brief Reads an image, at a resolution or fitted into a box (width != 0)
+ */
+static int
+read_image(const char* img_id, int resolution, uint32_t width, uint32_t height,
+           char** image_buffer, uint32_t* image_size, int* read_resolution)
+{
+    *read_resolution = resolution;
+    if(width != 0){
+        return do_read_box(img_id, width, height, image_buffer, image_size, read_resolution, &myfile);
+    }
+    return do_read(img_id, resolution, image_buffer, image_size, &myfile);
+}
+
+/**
+ * @brief Starts reading an image with the I/O backend (see aio.h): the
+ *        request is answered by complete_reads. 0 if not started: the
+ *        image is then read at once (errors included).
+ */
+static int
+start_read(struct mg_connection *nc, struct mg_http_message *hm, const char* img_id, int resolution)
+{
+    // the checksums are verified by do_read
+    if(aio == NULL || checksum_verifying()){
+        return 0;
+    }
+
+    size_t tag = 0;
+    while(tag < AIO_ENTRIES && pending_reads[tag].buffer != NULL){
+        ++tag;
+    }
+    if(tag == AIO_ENTRIES){
+        return 0;
+    }
+
+    int fd = -1;
+    uint64_t offset = 0;
+    uint32_t size = 0;
+    if(locate_image(img_id, resolution, &myfile, &fd, &offset, &size) != ERR_NONE){
+        return 0;
+    }
+
+    struct pending_read* read = &pending_reads[tag];
+    read->buffer = malloc(size > 0 ? size : 1);
+    if(read->buffer == NULL){
+        return 0;
+    }
+    if(aio_read(aio, fd, offset, read->buffer, size, tag) != ERR_NONE){
+        free(read->buffer);
+        read->buffer = NULL;
+        return 0;
+    }
+
+    read->conn_id = nc->id;
+    read->size = size;
+    read->content_type = get_content_type(&myfile, img_id, resolution);
+    read->start = request_start;
+    read->bytes_in = hm->message.len;
+    request_deferred = 1;
+    return 1;
+}
+
+/**
+ * @brief Answers the requests whose images are read (after each round of
+ *        the event loop).
+ */
+static void
+complete_reads(struct mg_mgr* mgr)
+{
+    struct aio_completion completions[AIO_ENTRIES];
+    const size_t nb = aio_reap(aio, completions, AIO_ENTRIES);
+
+    for(size_t i = 0; i < nb; ++i){
+        struct pending_read* read = &pending_reads[completions[i].tag];
+
+        // the client may be gone meanwhile
+        struct mg_connection* nc = mgr->conns;
+        while(nc != NULL && nc->id != read->conn_id){
+            nc = nc->next;
+        }
+
+        if(nc != NULL){
+            const size_t sent = nc->send.len;
+            request_error = completions[i].result;
+
+            if(request_error){
+                mg_error_msg(nc, request_error);
+            }else{
+                mg_printf(
+                        nc,
+                        "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %" PRIu32 "\r\n\r\n",
+                        read->content_type, read->size);
+                mg_send(nc, read->buffer, read->size);
+            }
+            nc->is_draining = 1;
+
+            metrics_record(ROUTE_READ, request_error, read->bytes_in, nc->send.len - sent,
+                           metrics_now() - read->start);
+        }
+
+        free(read->buffer);
+        read->buffer = NULL;
+    }
+}
+
 void
 handle_read_call(struct mg_connection *nc,
                           int ev,
@@ -109,23 +404,58 @@ handle_read_call(struct mg_connection *nc,
         char* image_buffer;
 
         int resolution = resolution_atoi(res);
+        uint32_t width = 0;
+        uint32_t height = 0;
 
         if(resolution == -1){
+            // a box, e.g. res=800x600
+            ret = parse_box(res, &width, &height);
+        }
+
+        char version[12];
+        const int pinned = mg_http_get_var(&hm->query, "snapshot", version, sizeof(version)) > 0;
+
+        if(ret == ERR_NONE && pinned && width != 0){
+            // as of a snapshot: at a resolution of the imgStore only
             ret = ERR_RESOLUTIONS;
         }
 
         if(ret){
             mg_error_msg(nc, ret);
+        }else if(!pinned && width == 0 && start_read(nc, hm, img_id, resolution)){
+            // answered by complete_reads
+            return;
         }else{
-            ret = do_read(img_id, resolution, &image_buffer, &image_size, &myfile);
+            if(pinned){
+                struct imgst_snapshot* snapshot = NULL;
+                int owned = 0;
+                ret = get_snapshot(hm, &snapshot, &owned);
+                if(ret == ERR_NONE){
+                    ret = snapshot_read(snapshot, img_id, resolution, &image_buffer, &image_size);
+                    if(owned){
+                        snapshot_close(snapshot);
+                    }
+                }
+            }else{
+                ret = read_image(img_id, resolution, width, height, &image_buffer, &image_size, &resolution);
+            }
+
+            if(ret == ERR_INVALID_COMMAND && nb_workers > 0){
+                // a worker is read-only: the resized image is created by the writer
+                ret = prefork_forward(PREFORK_RESIZE, img_id, resolution, NULL, 0);
+                if(ret == ERR_NONE){
+                    prefork_refresh(imgstore_filename, &myfile);
+                    ret = read_image(img_id, resolution, width, height, &image_buffer, &image_size, &resolution);
+                }
+            }
 
             if(ret){
                 mg_error_msg(nc, ret);
             }else{
                 mg_printf(
                         nc,
-                        "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: %" PRIu16 "\r\n\r\n", 
-                        image_size);
+                        "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %" PRIu32 "\r\n\r\n", 
+                        get_content_type(&myfile, img_id, resolution), image_size);
 
                 mg_send(nc, image_buffer, image_size);
 
@@ -137,6 +467,132 @@ handle_read_call(struct mg_connection *nc,
     nc->is_draining = 1;            
 }
 
+/**
+ * @brief Reads several images at a same resolution, e.g.
+ *        /imgStore/batch_read?img_ids=pic1,pic2,pic3&res=thumb, answered
+ *        as multipart/mixed: one part per image, in the order of the
+ *        request, identified by its Content-ID (an error message as
+ *        text/plain for those which cannot be read).
+ */
+void
+handle_batch_read_call(struct mg_connection *nc,
+                          int ev,
+                          struct mg_http_message *hm,
+                          void *fn_data)
+{
+    int ret = 0;
+
+    char res[12];
+    int len = mg_http_get_var(&hm->query, "res", res, sizeof(res));
+    if(len <= 0){
+        ret = ERR_INVALID_ARGUMENT;
+    }else{
+        res[len] = '\0';
+    }
+
+    char* ids = calloc(hm->query.len + 1, sizeof(char));
+    struct imgst_read* reads = calloc(MAX_BATCH_READS, sizeof(struct imgst_read));
+    size_t nb_reads = 0;
+
+    if(ids == NULL || reads == NULL){
+        ret = ERR_OUT_OF_MEMORY;
+    }else if(ret == ERR_NONE){
+        len = mg_http_get_var(&hm->query, "img_ids", ids, hm->query.len + 1);
+        if(len <= 0){
+            ret = ERR_INVALID_ARGUMENT;
+        }
+    }
+
+    // the comma-separated list of the IDs
+    for(char* id = ids; ret == ERR_NONE && id != NULL; ){
+        char* comma = strchr(id, ',');
+        if(comma != NULL){
+            *comma = '\0';
+        }
+        if(strlen(id) == 0 || strlen(id) > MAX_IMG_ID){
+            ret = ERR_INVALID_IMGID;
+        }else if(nb_reads == MAX_BATCH_READS){
+            ret = ERR_INVALID_ARGUMENT;
+        }else{
+            reads[nb_reads++].img_id = id;
+        }
+        id = comma != NULL ? comma + 1 : NULL;
+    }
+
+    int resolution = -1;
+    if(ret == ERR_NONE){
+        resolution = resolution_atoi(res);
+        ret = do_read_many(reads, nb_reads, resolution, &myfile);
+    }
+
+    if(ret == ERR_NONE && nb_workers > 0){
+        // a worker is read-only: the resized images are created by the writer
+        int resized = 0;
+        for(size_t i = 0; i < nb_reads; ++i){
+            if(reads[i].error == ERR_INVALID_COMMAND
+               && prefork_forward(PREFORK_RESIZE, reads[i].img_id, resolution, NULL, 0) == ERR_NONE){
+                resized = 1;
+            }
+        }
+        if(resized){
+            prefork_refresh(imgstore_filename, &myfile);
+            for(size_t i = 0; i < nb_reads; ++i){
+                if(reads[i].error == ERR_INVALID_COMMAND){
+                    reads[i].error = do_read(reads[i].img_id, resolution, &reads[i].buffer,
+                                             &reads[i].size, &myfile);
+                }
+            }
+        }
+    }
+
+    if(ret){
+        mg_error_msg(nc, ret);
+    }else{
+        // the headers of the parts first, for the length of the response
+        char (*headers)[MAX_IMG_ID + 192] = calloc(nb_reads, sizeof(*headers));
+        if(headers == NULL){
+            mg_error_msg(nc, ERR_OUT_OF_MEMORY);
+        }else{
+            size_t length = strlen("--" BATCH_BOUNDARY "--\r\n");
+            for(size_t i = 0; i < nb_reads; ++i){
+                const struct imgst_read* read = &reads[i];
+                const char* type = read->error ? "text/plain" :
+                                   get_content_type(&myfile, read->img_id, resolution);
+                const size_t size = read->error ? strlen("Error: ") + strlen(ERR_MESSAGES[read->error]) :
+                                    read->size;
+                snprintf(headers[i], sizeof(headers[i]),
+                         "--" BATCH_BOUNDARY "\r\nContent-Type: %s\r\nContent-ID: <%s>\r\n"
+                         "Content-Length: %zu\r\n\r\n", type, read->img_id, size);
+                length += strlen(headers[i]) + size + 2;
+            }
+
+            mg_printf(nc,
+                      "HTTP/1.1 200 OK\r\nContent-Type: multipart/mixed; boundary=" BATCH_BOUNDARY
+                      "\r\nContent-Length: %zu\r\n\r\n", length);
+            for(size_t i = 0; i < nb_reads; ++i){
+                mg_send(nc, headers[i], strlen(headers[i]));
+                if(reads[i].error){
+                    mg_printf(nc, "Error: %s", ERR_MESSAGES[reads[i].error]);
+                }else{
+                    mg_send(nc, reads[i].buffer, reads[i].size);
+                }
+                mg_send(nc, "\r\n", 2);
+            }
+            mg_printf(nc, "--" BATCH_BOUNDARY "--\r\n");
+            free(headers);
+        }
+    }
+
+    if(reads != NULL){
+        for(size_t i = 0; i < nb_reads; ++i){
+            free(reads[i].buffer);
+        }
+    }
+    free(reads);
+    free(ids);
+    nc->is_draining = 1;
+}
+
 void
 handle_delete_call(struct mg_connection *nc,
                           int ev,
@@ -147,7 +603,8 @@ handle_delete_call(struct mg_connection *nc,
     int img = mg_http_get_var(&hm->query, "img_id", img_id, MAX_IMG_ID);
     img_id[img] = '\0';
 
-    int ret = do_delete(img_id, &myfile);
+    int ret = nb_workers > 0 ? prefork_forward(PREFORK_DELETE, img_id, 0, NULL, 0) :
+              do_delete(img_id, &myfile);
     if(ret){
         mg_error_msg(nc, ret);
     }else{
@@ -234,7 +691,8 @@ handle_insert_call(struct mg_connection *nc,
                     if(ret){
                         mg_error_msg(nc, ret);
                     }else{
-                        ret = do_insert(buffer, img_size, img_id, &myfile);
+                        ret = nb_workers > 0 ? prefork_forward(PREFORK_INSERT, img_id, 0, buffer, img_size) :
+                              do_insert(buffer, img_size, img_id, &myfile);
 
                         free(buffer);
                         buffer = NULL;
@@ -260,6 +718,101 @@ handle_insert_call(struct mg_connection *nc,
     nc->is_draining = 1;
 }
 
+void
+handle_stats_call(struct mg_connection *nc,
+                          int ev,
+                          struct mg_http_message *hm,
+                          void *fn_data)
+{
+    struct imgst_stats stats;
+    int ret = do_stats(&myfile, &stats);
+
+    if(ret){
+        mg_error_msg(nc, ret);
+    }else{
+        struct json_object* object = json_object_new_object();
+
+        json_object_object_add(object, "num_files", json_object_new_int64(myfile.header.num_files));
+        json_object_object_add(object, "max_files", json_object_new_int64(myfile.header.max_files));
+        json_object_object_add(object, "file_size", json_object_new_int64(stats.file_size));
+        json_object_object_add(object, "table_size", json_object_new_int64(stats.table_size));
+        json_object_object_add(object, "live_bytes", json_object_new_int64(stats.live_bytes));
+        json_object_object_add(object, "dead_bytes", json_object_new_int64(stats.dead_bytes));
+        json_object_object_add(object, "fragmentation", json_object_new_double(stats.fragmentation));
+
+        const char* json = json_object_to_json_string(object);
+
+        mg_printf(
+                    nc,
+                    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n%s",
+                    strlen(json), json);
+        json_object_put(object);
+    }
+    nc->is_draining = 1;
+}
+
+void
+handle_metrics_call(struct mg_connection *nc,
+                          int ev,
+                          struct mg_http_message *hm,
+                          void *fn_data)
+{
+    size_t size = 0;
+    char* text = metrics_to_string(&myfile, &size);
+
+    if(text == NULL){
+        mg_error_msg(nc, ERR_OUT_OF_MEMORY);
+    }else{
+        mg_printf(
+                    nc,
+                    "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+                    size);
+        mg_send(nc, text, size);
+    }
+    free(text);
+    nc->is_draining = 1;
+}
+
+void
+handle_trace_call(struct mg_connection *nc,
+                          int ev,
+                          struct mg_http_message *hm,
+                          void *fn_data)
+{
+    size_t size = 0;
+    char* json = trace_to_string(&size);
+
+    if(json == NULL){
+        mg_error_msg(nc, ERR_OUT_OF_MEMORY);
+    }else{
+        mg_printf(
+                    nc,
+                    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n",
+                    size);
+        mg_send(nc, json, size);
+    }
+    free(json);
+    nc->is_draining = 1;
+}
+
+/**
+ * @brief Writes the trace into imgStore_server-<pid>.trace.json
+ */
+static void
+dump_trace(void)
+{
+    char filename[64];
+    snprintf(filename, sizeof(filename), "imgStore_server-%ld.trace.json", (long) getpid());
+
+    FILE* out = fopen(filename, "w");
+    if (out == NULL || trace_dump(out) != ERR_NONE) {
+        fprintf(stderr, "cannot write %s\n", filename);
+    } else {
+        printf("trace written to %s\n", filename);
+    }
+    if (out != NULL) fclose(out);
+}
+
 // ======================================================================
 int main(int argc, char *argv[])
 {
@@ -277,28 +830,122 @@ int main(int argc, char *argv[])
             return 1;
         }
 
-        if (VIPS_INIT (argv[0])) //takes call name
-        vips_error_exit ("unable to start VIPS");
+        const char* program = argv[0];
 
         argc--; argv++; // skips command call name
 
         imgstore_filename = argv[0];
 
+        // options: -fsync none|batch|always (see wal.h), -trace (see trace.h),
+        // -workers N (see prefork.h), -verify (see checksum.h)
+        for (int i = 1; i < argc; ++i) {
+            if (!strcmp(argv[i], "-fsync") && i + 1 < argc) {
+                ++i;
+                if (!strcmp(argv[i], "none")) {
+                    fsync_policy = WAL_SYNC_NONE;
+                } else if (!strcmp(argv[i], "batch")) {
+                    fsync_policy = WAL_SYNC_BATCH;
+                } else if (!strcmp(argv[i], "always")) {
+                    fsync_policy = WAL_SYNC_ALWAYS;
+                } else {
+                    fprintf(stderr, "%s\n", ERR_MESSAGES[ERR_INVALID_ARGUMENT]);
+                    return ERR_INVALID_ARGUMENT;
+                }
+            } else if (!strcmp(argv[i], "-trace")) {
+                trace_enable(1);
+            } else if (!strcmp(argv[i], "-verify")) {
+                checksum_verify_reads(1);
+            } else if (!strcmp(argv[i], "-workers") && i + 1 < argc) {
+                ++i;
+                nb_workers = atouint32(argv[i]);
+                if (nb_workers == 0 || nb_workers > MAX_WORKERS) {
+                    fprintf(stderr, "%s\n", ERR_MESSAGES[ERR_INVALID_ARGUMENT]);
+                    return ERR_INVALID_ARGUMENT;
+                }
+            } else {
+                fprintf(stderr, "%s\n", ERR_MESSAGES[ERR_INVALID_ARGUMENT]);
+                return ERR_INVALID_ARGUMENT;
+            }
+        }
+
         // Initialise stuff
         signal(SIGINT, signal_handler);
         signal(SIGTERM, signal_handler);
+        signal(SIGUSR1, dump_trace_handler);
+
+        // the workers share the listening socket; forked before any thread
+        // of vips, and once the writes of a crashed writer are completed
+        int worker = -1;
+        if (nb_workers > 0) {
+            int ret = wal_recover(imgstore_filename);
+            if (ret == ERR_NONE) ret = prefork_spawn(nb_workers, &worker);
+            if (ret) {
+                fprintf(stderr, "%s\n", ERR_MESSAGES[ret]);
+                return ret;
+            }
+        }
+
+        if (VIPS_INIT (program)) //takes call name
+        vips_error_exit ("unable to start VIPS");
+
+        if (nb_workers > 0 && worker < 0) {
+            // the writer: its workers serve the requests
+            mg_mgr_free(&mgr);
+
+            int ret = do_open(imgstore_filename, "rb+", &myfile);
+            if (ret == ERR_NONE) ret = wal_set_policy(&myfile, fsync_policy);
+            if (ret == ERR_NONE) {
+                printf("Starting imgStore server on http://localhost:8000 (%" PRIu32 " workers)\n", nb_workers);
+                print_header(&myfile.header);
+                ret = prefork_serve(&myfile, &s_signo);
+                printf("Exiting imgStore server on \n");
+            }
+            do_close(&myfile);
+            vips_shutdown();
+            return ret;
+        }
 
         // Start infinite event loop
-        int ret = do_open(imgstore_filename, "rb+", &myfile);
+        int ret = nb_workers > 0 ? prefork_refresh(imgstore_filename, &myfile) :
+                  do_open(imgstore_filename, "rb+", &myfile);
+        if(ret == ERR_NONE){
+            ret = aio_init(&aio);
+        }
+        if(ret){
+            return ret;
+        }
+        ret = nb_workers > 0 ? ERR_NONE : wal_set_policy(&myfile, fsync_policy);
         if(ret){
+            do_close(&myfile);
             return ret;
         }
-        printf("Starting imgStore server on http://localhost:8000 \n");
-        print_header(&myfile.header);
+        if (nb_workers == 0) {
+            printf("Starting imgStore server on http://localhost:8000\n");
+            print_header(&myfile.header);
+        }
         
-        while (s_signo == 0) mg_mgr_poll(&mgr, 1000);
+        while (s_signo == 0) {
+            // not waiting while images are being read
+            mg_mgr_poll(&mgr, aio_pending(aio) > 0 ? 1 : 1000);
+            complete_reads(&mgr);
+            // group commit of the requests of this round
+            wal_sync(&myfile);
+            if (s_dump_trace) {
+                s_dump_trace = 0;
+                dump_trace();
+            }
+        }
         mg_mgr_free(&mgr);
-        printf("Exiting imgStore server on \n");
+        if (nb_workers == 0) {
+            printf("Exiting imgStore server on \n");
+        }
+        aio_close(aio);
+        for (size_t i = 0; i < AIO_ENTRIES; ++i) {
+            free(pending_reads[i].buffer);
+        }
+        for (size_t i = 0; i < MAX_SNAPSHOTS; ++i) {
+            snapshot_close(snapshots[i].snapshot);
+        }
         do_close(&myfile);
 
         vips_shutdown();
@@ -4,14 +4,18 @@
  *
  * Finishes to initialize the structure imgst_file and
  * writes it on the disk: it creates the file and put the data of the
- * header and of the metadatas.
+ * header and of the metadatas (and of the header extension, if any
+ * optional feature is asked for).
  */
 
 #include "imgStore.h"
 #include "error.h"
+#include "replog.h"
+#include "index.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 /**
@@ -36,6 +40,29 @@ do_create(const char* filename, struct imgst_file* imgst_file)
     imgst_file->header.num_files = 0;
     imgst_file->header.imgst_version = 0;
 
+    // written directly, without journal
+    imgst_file->wal = NULL;
+    imgst_file->cache = NULL;
+    imgst_file->shards = NULL;
+    imgst_file->locks = NULL;
+    imgst_file->map = NULL;
+    imgst_file->replog = NULL;
+    imgst_file->index = NULL;
+
+    // the index of a previous imgStore of that name is not its
+    int ret = index_remove(filename);
+    if(ret) {
+        return ret;
+    }
+
+    // a new imgStore starts a new history
+    if(imgst_file->header.features & IMGST_REPLOG) {
+        ret = replog_remove(filename);
+        if(ret) {
+            return ret;
+        }
+    }
+
     //Create a file with filename and overwrite it (if it already exists).
     if(!strncmp("/tmp/", filename, 5)){
         imgst_file->file = fopen(filename, "wb+");
@@ -48,10 +75,11 @@ do_create(const char* filename, struct imgst_file* imgst_file)
     }
 
     //Allocation for the metadatas, preallocated empty metadata array to imgStore file.
-    struct img_metadata* ptr = calloc(imgst_file->header.max_files, sizeof(struct img_metadata));
-    if(ptr == NULL) return ERR_OUT_OF_MEMORY;
-    memset(ptr,0,sizeof(struct img_metadata)* imgst_file->header.max_files );
-    imgst_file->metadata = ptr;
+    ret = alloc_metadata(&imgst_file->metadata, imgst_file->header.max_files);
+    if(ret) {
+        fclose(imgst_file->file);
+        return ret;
+    }
     
 
     //Ready to write on the file prevously created the header and the metadatas
@@ -64,14 +92,44 @@ do_create(const char* filename, struct imgst_file* imgst_file)
         return ERR_IO;
     }
     ++written;
-    //metadata:
-    size_t y;
-    y = fwrite(imgst_file->metadata, sizeof(struct img_metadata), imgst_file->header.max_files, imgst_file->file);
-    if(y != imgst_file->header.max_files) {
-        fclose(imgst_file->file);
-        return ERR_IO;
+    //metadata (all empty):
+    static const struct img_metadata empty[METADATA_PAGE];
+    for(uint32_t i = 0; i < imgst_file->header.max_files; i += METADATA_PAGE) {
+        const uint32_t nb = imgst_file->header.max_files - i < METADATA_PAGE ?
+                            imgst_file->header.max_files - i : METADATA_PAGE;
+        size_t y = fwrite(empty, sizeof(struct img_metadata), nb, imgst_file->file);
+        if(y != nb) {
+            fclose(imgst_file->file);
+            return ERR_IO;
+        }
+        written += y;
+    }
+
+    //header extension, for imgStores with optional features:
+    if(imgst_file->header.features != 0) {
+        // the encoding settings are given by the caller
+        struct imgst_encoding encoding[NB_RES - 1];
+        memcpy(encoding, imgst_file->ext.encoding, sizeof(encoding));
+        memset(&imgst_file->ext, 0, sizeof(struct imgst_ext));
+        memcpy(imgst_file->ext.magic, EXT_MAGIC, sizeof(imgst_file->ext.magic));
+        if(imgst_file->header.features & IMGST_ENCODING) {
+            memcpy(imgst_file->ext.encoding, encoding, sizeof(encoding));
+        }
+        imgst_file->ext.nb_slots = imgst_file->header.max_files;
+        // the content starts right after the extension
+        if(imgst_file->header.features & IMGST_PREALLOC) {
+            imgst_file->ext.end_of_data = sizeof(struct imgst_header)
+                                          + (uint64_t) imgst_file->header.max_files * sizeof(struct img_metadata)
+                                          + sizeof(struct imgst_ext);
+        }
+
+        size_t z = fwrite(&imgst_file->ext, sizeof(struct imgst_ext), 1, imgst_file->file);
+        if(z != 1) {
+            fclose(imgst_file->file);
+            return ERR_IO;
+        }
+        ++written;
     }
-    written += imgst_file->header.max_files;
 
     // do_close(imgst_file);
     fprintf(stdout, "%zu item(s) written \n", written);
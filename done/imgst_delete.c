@@ -5,55 +5,93 @@
 
 #include "imgStore.h"
 #include "error.h"
+#include "dedup.h"
+#include "wal.h"
+#include "shard.h"
+#include "lock.h"
+#include "replog.h"
+#include "index.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdbool.h>
 
 /********************************************************************//**
- * Delete an image from a file
+ * Delete an image from a file (do_delete, under the writer lock)
  */
-int
-do_delete(const char* img_id, struct imgst_file* imgst_file)
+static int
+delete_image(const char* img_id, struct imgst_file* imgst_file)
 {
-    if(img_id == NULL)return ERR_INVALID_ARGUMENT;
-    if (imgst_file == NULL) return ERR_INVALID_ARGUMENT;
-    if (imgst_file->metadata == NULL)return ERR_FILE_NOT_FOUND;
-
-    bool found = false;
-    struct img_metadata metadata;
-    size_t i;
-    
-    for(i = 0; i < imgst_file->header.max_files && !found; ++i ) {
-        if (imgst_file->metadata[i].is_valid == NON_EMPTY){
-            if(!strcmp(imgst_file->metadata[i].img_id, img_id)) {
-                found = true;
-                imgst_file->metadata[i].is_valid = EMPTY;
-                metadata = imgst_file->metadata[i];
-            }
-        }
-    }
-    if (!found) return ERR_FILE_NOT_FOUND;
+    if (imgst_file->metadata.is_valid == NULL)return ERR_FILE_NOT_FOUND;
+
+    int ret = check_live_bytes(imgst_file);
+    if (ret) return ret;
+
+    uint32_t index;
+    ret = find_img(imgst_file, img_id, &index);
+    if (ret) return ret;
 
     if(imgst_file->file == NULL) {
         return ERR_IO;
     }
 
-    long int offset = sizeof(struct img_metadata) * (i-1) + sizeof(struct imgst_header);
+    struct metadata_table* metadata = &imgst_file->metadata;
+    index_drop(imgst_file, index);
+    lock_slot(imgst_file, index, 1);
+    metadata->is_valid[index] = EMPTY;
+    unlock_slot(imgst_file, index);
+
+    ret = write_metadata(imgst_file, index);
+
+    // the blobs of the deleted image are dead unless shared with a duplicate
+    uint64_t dead_bytes = 0;
+    for (int res = 0; ret == ERR_NONE && res < NB_RES; ++res) {
+        const uint64_t offset = SLOT_OFFSET(metadata, index, res);
+        if (offset != 0 && !is_blob_referenced(imgst_file, offset, index)) {
+            dead_bytes += BLOB_SPAN(imgst_file, SLOT_SIZE(metadata, index, res));
+        }
+    }
+    const uint64_t live_bytes = HEADER_GET(imgst_file, live_bytes);
+    if (dead_bytes > live_bytes) dead_bytes = live_bytes;
 
-    if (fseek(imgst_file->file,offset, SEEK_SET) != 0) return ERR_IO;
+    HEADER_SUB(imgst_file, live_bytes, dead_bytes);
+    HEADER_SUB(imgst_file, num_files, 1);
+    HEADER_ADD(imgst_file, imgst_version, 1);
 
-    size_t w1 = fwrite(&metadata, sizeof(struct img_metadata), 1, imgst_file->file);
-    if (w1!= 1) return ERR_IO;
-    imgst_file->header.num_files -=1;
-    imgst_file->header.imgst_version +=1;
+    if (ret == ERR_NONE) ret = write_header(imgst_file);
+    ret = wal_commit(imgst_file, ret);
 
+    if (ret) {
+        // nothing written: the image is still there, in memory as in the file
+        HEADER_ADD(imgst_file, live_bytes, dead_bytes);
+        HEADER_ADD(imgst_file, num_files, 1);
+        HEADER_SUB(imgst_file, imgst_version, 1);
+        lock_slot(imgst_file, index, 1);
+        metadata->is_valid[index] = NON_EMPTY;
+        unlock_slot(imgst_file, index);
+        index_add(imgst_file, index);
+        return ret;
+    }
 
-    if (fseek(imgst_file->file,0, SEEK_SET)!= 0) return ERR_IO;
+    return replog_append(imgst_file, REPLOG_DELETE, RES_ORIG, img_id, NULL, 0);
+}
 
-    size_t w2 = fwrite(&imgst_file->header, sizeof(struct imgst_header), 1, imgst_file->file);
-    if (w2!= 1) return ERR_IO;
+/********************************************************************//**
+ * Delete an image from a file
+ */
+int
+do_delete(const char* img_id, struct imgst_file* imgst_file)
+{
+    if(img_id == NULL)return ERR_INVALID_ARGUMENT;
+    if (imgst_file == NULL) return ERR_INVALID_ARGUMENT;
+    if (imgst_file->shards != NULL) {
+        const int ret = do_delete(img_id, shard_of(imgst_file, img_id));
+        shard_update_header(imgst_file);
+        return ret;
+    }
 
-    return ERR_NONE;
+    lock_writer(imgst_file);
+    const int ret = delete_image(img_id, imgst_file);
+    unlock_writer(imgst_file);
+    return ret;
 }
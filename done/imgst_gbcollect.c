@@ -6,15 +6,23 @@
 #include "imgStore.h"
 #include "image_content.h"
 #include "error.h"
+#include "derived.h"
+#include "shard.h"
+#include "scan.h"
+#include "index.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define GC_BATCH (64u << 20) // bytes of original images read by a scan
 
 int 
 do_gbcollect (const char *imgst_path, const char *imgst_tmp_bkp_path)
 {
     if (imgst_path == NULL) return ERR_INVALID_ARGUMENT;
     if (imgst_tmp_bkp_path == NULL) return ERR_INVALID_ARGUMENT;
+    if (is_shard_manifest(imgst_path)) return shard_gbcollect(imgst_path, imgst_tmp_bkp_path);
 
     struct imgst_file myfile;
 
@@ -25,11 +33,13 @@ do_gbcollect (const char *imgst_path, const char *imgst_tmp_bkp_path)
     }
 
     struct imgst_file tmp_imgst = { .header.max_files  = myfile.header.max_files,
+                                    .header.features   = myfile.header.features,
                                     .header.res_resized = { myfile.header.res_resized[RES_THUMB * 2], 
                                                             myfile.header.res_resized[(RES_THUMB * 2) + 1], 
                                                             myfile.header.res_resized[RES_SMALL * 2], 
                                                             myfile.header.res_resized[(RES_SMALL * 2) + 1]}};
     tmp_imgst.file = NULL;
+    memcpy(tmp_imgst.ext.encoding, myfile.ext.encoding, sizeof(tmp_imgst.ext.encoding));
     
     ret = do_create(imgst_tmp_bkp_path, &tmp_imgst);
 
@@ -39,46 +49,86 @@ do_gbcollect (const char *imgst_path, const char *imgst_tmp_bkp_path)
         return ret;
     }
 
-    uint32_t image_size;
-    char* image_buffer;
+    // the original images are read by batches of slots, each in the order
+    // of their positions (a sweep of a part of the file), then copied in
+    // the order of their slots
+    const uint32_t nb_slots = NB_SLOTS(&myfile);
+    uint64_t* positions = calloc(nb_slots > 0 ? nb_slots : 1, sizeof(uint64_t));
+    char* batch = NULL;
+    uint64_t batch_capacity = 0;
+    if(positions == NULL) {
+        ret = ERR_OUT_OF_MEMORY;
+    }
 
-    for(size_t i = 0; i < myfile.header.max_files; ++i){
-        if(myfile.metadata[i].is_valid == NON_EMPTY){
-            ret = do_read(myfile.metadata[i].img_id, RES_ORIG, &image_buffer, &image_size, &myfile);
-            if(ret) {
-                do_close(&myfile);
-                do_close(&tmp_imgst);
-                return ret;
-            }
-            ret = do_insert(image_buffer, image_size, myfile.metadata[i].img_id, &tmp_imgst);
-            free(image_buffer);
-            image_buffer = NULL;
-            if(ret) {
-                do_close(&myfile);
-                do_close(&tmp_imgst);
-                return ret;
+    // images are inserted one after the other in the first empty slot of tmp_imgst
+    uint32_t tmp_index = 0;
+
+    for(uint32_t first = 0; ret == ERR_NONE && first < nb_slots; ){
+        // the slots of a batch: GC_BATCH bytes of originals at most (one at least),
+        // each at its position in the batch buffer
+        uint64_t batch_size = 0;
+        uint32_t end = first;
+        for(; ret == ERR_NONE && end < nb_slots; ++end){
+            struct img_metadata metadata;
+            ret = get_metadata(&myfile, end, &metadata);
+            if(ret || metadata.is_valid != NON_EMPTY) continue;
+            if(batch_size > 0 && batch_size + metadata.size[RES_ORIG] > GC_BATCH) break;
+            positions[end - first] = batch_size;
+            batch_size += metadata.size[RES_ORIG];
+        }
+
+        if(ret == ERR_NONE && batch_size > batch_capacity){
+            char* larger = realloc(batch, (size_t) batch_size);
+            if(larger == NULL) {
+                ret = ERR_OUT_OF_MEMORY;
+            } else {
+                batch = larger;
+                batch_capacity = batch_size;
             }
-            if(myfile.metadata[i].offset[RES_THUMB] != 0){
-                ret = lazily_resize(RES_THUMB, &tmp_imgst, i);
-                if(ret) {
-                    do_close(&myfile);
-                    do_close(&tmp_imgst);
-                    return ret;
-                }
+        }
+
+        struct imgst_scan* scan = NULL;
+        if(ret == ERR_NONE) {
+            ret = scan_open_slots(&myfile, RES_ORIG, first, end, &scan);
+        }
+        const struct scan_image* image = NULL;
+        while(ret == ERR_NONE && (ret = scan_next(scan, &image)) == ERR_NONE && image != NULL){
+            memcpy(batch + positions[image->index - first], image->buffer, image->size);
+        }
+        scan_close(scan);
+
+        for(uint32_t i = first; ret == ERR_NONE && i < end; ++i){
+            struct img_metadata metadata;
+            ret = get_metadata(&myfile, i, &metadata);
+            if(ret || metadata.is_valid != NON_EMPTY) continue;
+
+            ret = do_insert(batch + positions[i - first], metadata.size[RES_ORIG], metadata.img_id, &tmp_imgst);
+            if(ret == ERR_NONE && metadata.offset[RES_THUMB] != 0){
+                ret = lazily_resize(RES_THUMB, &tmp_imgst, tmp_index);
             }
-            if(myfile.metadata[i].offset[RES_SMALL] != 0){
-                ret = lazily_resize(RES_SMALL, &tmp_imgst, i);
-                if(ret) {
-                    do_close(&myfile);
-                    do_close(&tmp_imgst);
-                    return ret;
-                }
+            if(ret == ERR_NONE && metadata.offset[RES_SMALL] != 0){
+                ret = lazily_resize(RES_SMALL, &tmp_imgst, tmp_index);
             }
+            ++tmp_index;
         }
+        first = end;
+    }
+
+    free(batch);
+    free(positions);
+
+    // the version numbers the changes logged for the replicas (see replog.h)
+    if(ret == ERR_NONE && (myfile.header.features & IMGST_REPLOG)) {
+        tmp_imgst.header.imgst_version = myfile.header.imgst_version;
+        ret = write_header(&tmp_imgst);
     }
 
     do_close(&myfile);
     do_close(&tmp_imgst);
+
+    if(ret) {
+        return ret;
+    }
     
     ret = remove(imgst_path);
     if(ret){
@@ -90,5 +140,11 @@ do_gbcollect (const char *imgst_path, const char *imgst_tmp_bkp_path)
         return ERR_IO;
     }
 
-    return ERR_NONE;
+    // the images moved: the derived ones cached are those of other slots,
+    // the index that of the old file
+    ret = index_remove(imgst_path);
+    if(ret){
+        return ret;
+    }
+    return derived_remove(imgst_path);
 }
\ No newline at end of file
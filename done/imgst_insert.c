@@ -8,6 +8,13 @@
 #include "error.h"
 #include "image_content.h"
 #include "dedup.h"
+#include "wal.h"
+#include "trace.h"
+#include "shard.h"
+#include "lock.h"
+#include "replog.h"
+#include "checksum.h"
+#include "index.h"
 
 #include <vips/vips.h>
 #include <stdio.h>
@@ -16,10 +23,10 @@
 #include <openssl/sha.h>
 
 /**
- * Insert an image in the imgStore file
+ * Insert an image in the imgStore file (do_insert, without its span)
  */
-int 
-do_insert(const char* buffer, const size_t size, const char* img_id, struct imgst_file* imgst_file)
+static int
+insert_image(const char* buffer, const size_t size, const char* img_id, struct imgst_file* imgst_file)
 {
     if(buffer == NULL){
         return ERR_NONE;
@@ -42,79 +49,171 @@ do_insert(const char* buffer, const size_t size, const char* img_id, struct imgs
         return ERR_FILE_NOT_FOUND;
     }
 
-    if(imgst_file->header.num_files >= imgst_file->header.max_files)
-        return ERR_FULL_IMGSTORE;
+    int ret = check_live_bytes(imgst_file);
 
-    uint32_t index = 0;
+    if(ret){
+        return ret;
+    }
 
-    for(uint32_t i = 0; i < imgst_file->header.max_files; ++i){
-        if(imgst_file->metadata[i].is_valid == EMPTY){
-            index = i;
-            break;
+    // JPEG, PNG, WebP or AVIF
+    const int format = get_format(buffer, size);
+
+    if(format < 0){
+        return ERR_IMGLIB;
+    }
+
+    uint32_t index = NB_SLOTS(imgst_file);
+
+    TRACE_BEGIN(find_slot);
+    if(HEADER_GET(imgst_file, num_files) < NB_SLOTS(imgst_file) && INDEXED(imgst_file)){
+        index = index_free_slot(imgst_file);
+    }else if(HEADER_GET(imgst_file, num_files) < NB_SLOTS(imgst_file)){
+        for(uint32_t i = 0; i < NB_SLOTS(imgst_file); ++i){
+            const struct metadata_table* slots = load_metadata(imgst_file, i);
+            if(slots == NULL){
+                return ERR_IO;
+            }
+            if(slots->is_valid[i] == EMPTY){
+                index = i;
+                break;
+            }
+        }
+    }
+    TRACE_END(find_slot);
+
+    if(index == NB_SLOTS(imgst_file)){
+        // full: growable imgStores get a new extent, the others fail
+        lock_table(imgst_file);
+        int grown = grow_metadata(imgst_file);
+        unlock_table(imgst_file);
+        if(grown){
+            return grown;
         }
     }
+
+    // after grow_metadata: the table may have moved
+    struct metadata_table* metadata = load_metadata(imgst_file, index);
+
+    if(metadata == NULL){
+        return ERR_IO;
+    }
     
-    SHA256((const unsigned char *)buffer, size, imgst_file->metadata[index].SHA);
+    TRACE_BEGIN(sha256);
+    SHA256((const unsigned char *)buffer, size, SLOT_SHA(metadata, index));
+    TRACE_END(sha256);
+
+    // the arena of the ids may move
+    lock_table(imgst_file);
+    ret = set_img_id(imgst_file, index, img_id);
+    unlock_table(imgst_file);
 
-    strncpy(imgst_file->metadata[index].img_id, img_id, MAX_IMG_ID);
-    imgst_file->metadata[index].img_id[MAX_IMG_ID] = '\0';
+    if(ret){
+        return ret;
+    }
 
-    imgst_file->metadata[index].is_valid = NON_EMPTY;
+    SLOT_FORMAT(metadata, index) = (uint16_t) format;
 
-    imgst_file->metadata[index].size[RES_ORIG] = (uint32_t) size;
-    imgst_file->metadata[index].size[RES_THUMB] = 0;
-    imgst_file->metadata[index].size[RES_SMALL] = 0;
+    SLOT_SIZE(metadata, index, RES_ORIG) = (uint32_t) size;
+    SLOT_SIZE(metadata, index, RES_THUMB) = 0;
+    SLOT_SIZE(metadata, index, RES_SMALL) = 0;
 
-    imgst_file->metadata[index].offset[RES_THUMB] = 0;
-    imgst_file->metadata[index].offset[RES_SMALL] = 0;
+    SLOT_OFFSET(metadata, index, RES_THUMB) = 0;
+    SLOT_OFFSET(metadata, index, RES_SMALL) = 0;
 
-    int ret = do_name_and_content_dedup(imgst_file, index);
+    TRACE_BEGIN(dedup);
+    ret = do_name_and_content_dedup(imgst_file, index);
+    TRACE_END(dedup);
 
     if(ret){
+        metadata->is_valid[index] = EMPTY;
         return ret;
     }
 
-    if(imgst_file->metadata[index].offset[RES_ORIG] == 0){
-        if(fseek(imgst_file->file, 0, SEEK_END) != 0)
-            return ERR_IO;
-
-        imgst_file->metadata[index].offset[RES_ORIG] = ftell(imgst_file->file);
+    // the bytes of a new blob, live once the slot is committed
+    uint64_t blob_span = 0;
 
-        size_t write = fwrite(buffer, size, 1, imgst_file->file);
+    if(SLOT_OFFSET(metadata, index, RES_ORIG) == 0){
+        TRACE_BEGIN(write_blob);
+        uint64_t offset = 0;
+        ret = write_blob(imgst_file, buffer, size, &offset);
+        TRACE_END(write_blob);
 
-        if(write != 1){
+        if(ret){
+            metadata->is_valid[index] = EMPTY;
             return ERR_IO;
         }
+        SLOT_OFFSET(metadata, index, RES_ORIG) = offset;
+        blob_span = BLOB_SPAN(imgst_file, size);
     }
     
-    int reso = get_resolution(&imgst_file->metadata[index].res_orig[1],
-        &imgst_file->metadata[index].res_orig[0], buffer, size);
+    TRACE_BEGIN(get_resolution);
+    int reso = get_resolution(&SLOT_RES_ORIG(metadata, index)[1],
+        &SLOT_RES_ORIG(metadata, index)[0], buffer, size);
+    TRACE_END(get_resolution);
 
     if(reso != 0){
+        metadata->is_valid[index] = EMPTY;
         return reso;
     }
     
-    imgst_file->header.imgst_version += 1;
-    imgst_file->header.num_files += 1;
+    // the slot is published last, once its images can be read
+    ret = publish_writes(imgst_file);
 
-    if(fseek(imgst_file->file, 0, SEEK_SET) != 0) 
-        return ERR_IO;
+    if(ret){
+        return ret;
+    }
 
-    size_t write = fwrite(&imgst_file->header, sizeof(struct imgst_header), 1, imgst_file->file);
+    lock_slot(imgst_file, index, 1);
+    metadata->is_valid[index] = NON_EMPTY;
+    unlock_slot(imgst_file, index);
+    index_add(imgst_file, index);
 
-    if(write != 1) {
-        return ERR_IO;
+    HEADER_ADD(imgst_file, imgst_version, 1);
+    HEADER_ADD(imgst_file, num_files, 1);
+    HEADER_ADD(imgst_file, live_bytes, blob_span);
+
+    TRACE_BEGIN(commit);
+    ret = write_header(imgst_file);
+
+    if(ret == ERR_NONE) {
+        ret = write_metadata(imgst_file, index);
     }
 
-    long int offset = sizeof(struct img_metadata) * (index) + sizeof(struct imgst_header);
+    // the header and the metadata are written together, or not at all
+    ret = wal_commit(imgst_file, ret);
+    TRACE_END(commit);
 
-    if(fseek(imgst_file->file, offset, SEEK_SET) != 0) 
-        return ERR_IO;
+    if(ret){
+        // nothing written: the slot EMPTY again, as in the file, its blob dead
+        index_drop(imgst_file, index);
+        lock_slot(imgst_file, index, 1);
+        metadata->is_valid[index] = EMPTY;
+        unlock_slot(imgst_file, index);
+        HEADER_SUB(imgst_file, live_bytes, blob_span);
+        HEADER_SUB(imgst_file, num_files, 1);
+        HEADER_SUB(imgst_file, imgst_version, 1);
+        return ret;
+    }
 
-    write = fwrite(&imgst_file->metadata[index], sizeof(struct img_metadata), 1, imgst_file->file);
+    return replog_append(imgst_file, REPLOG_INSERT, RES_ORIG, img_id, buffer, (uint32_t) size);
+}
 
-    if(write != 1) {
-        return ERR_IO;
+/**
+ * Insert an image in the imgStore file
+ */
+int 
+do_insert(const char* buffer, const size_t size, const char* img_id, struct imgst_file* imgst_file)
+{
+    if(imgst_file != NULL && imgst_file->shards != NULL){
+        const int ret = do_insert(buffer, size, img_id, shard_of(imgst_file, img_id));
+        shard_update_header(imgst_file);
+        return ret;
     }
+
+    TRACE_BEGIN(do_insert);
+    lock_writer(imgst_file);
+    const int ret = insert_image(buffer, size, img_id, imgst_file);
+    unlock_writer(imgst_file);
+    TRACE_END(do_insert);
     return ret;
 }
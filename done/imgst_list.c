@@ -4,28 +4,80 @@
  */
 
 #include "imgStore.h"
+#include "shard.h"
+#include "lock.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <json-c/json.h>
 
 
+/********************************************************************//**
+ * Prints the metadata of the valid images of an imgStore (a shard)
+ */
+static void
+print_images(struct imgst_file* file)
+{
+    lock_writer(file);
+    for(uint32_t i = 0; i < NB_SLOTS(file); ++i ) {
+        const struct metadata_table* table = load_metadata(file, i);
+        if(table == NULL){
+            break;
+        }
+        if(table->is_valid[i]){
+            struct img_metadata metadata;
+            get_metadata(file, i, &metadata);
+            print_metadata(&metadata);
+        }
+    }
+    unlock_writer(file);
+}
+
+/********************************************************************//**
+ * Adds the ids of the valid images of an imgStore (a shard) to a JSON array
+ */
+static void
+add_images(struct imgst_file* file, struct json_object* array)
+{
+    lock_writer(file);
+    for(uint32_t i = 0; i < NB_SLOTS(file); ++i ) {
+        const struct metadata_table* table = load_metadata(file, i);
+        if(table == NULL){
+            break;
+        }
+        if(table->is_valid[i]){
+            struct json_object* string = json_object_new_string(SLOT_ID(table, i));
+            json_object_array_add(array, string);
+        }
+    }
+    unlock_writer(file);
+}
+
 /********************************************************************//**
  * List : print the informations about the metadata and the header
  * it prints << empty imgStore >> if the image store does not contain any images.
+ * A sharded imgStore lists the images of all its shards.
  */
 char* 
 do_list(struct imgst_file* file, enum do_list_mode mode)
 {
     if(file != NULL) {
 
+        const uint32_t nb_shards = file->shards != NULL ? file->shards->nb_shards : 1;
+
         if(mode == STDOUT){
             print_header(&file->header);
+            if (file->shards != NULL) {
+                printf("SHARDS: %" PRIu32 " imgStores, %" PRIu32 " slots\n", nb_shards, NB_SLOTS(file));
+            } else if (file->header.features & IMGST_GROWABLE) {
+                printf("GROWABLE: %" PRIu32 " slots in %" PRIu32 " extent(s)\n",
+                       NB_SLOTS(file), file->ext.nb_extents);
+            }
             if (file->header.num_files == 0 ) {
                 printf("<< empty imgStore >>\n");
             } else {
-                for(size_t i = 0; i < file->header.max_files; ++i ) {
-                    if(file->metadata[i].is_valid){
-                        print_metadata(&file->metadata[i]);
-                    }
+                for(uint32_t s = 0; s < nb_shards; ++s){
+                    print_images(file->shards != NULL ? &file->shards->files[s] : file);
                 }
             }
             return NULL;
@@ -37,14 +89,17 @@ do_list(struct imgst_file* file, enum do_list_mode mode)
 
             json_object_object_add(object, "Images", array);
 
-            for(size_t i = 0; i < file->header.max_files; ++i ) {
-                if(file->metadata[i].is_valid){
-                    struct json_object* string = json_object_new_string(file->metadata[i].img_id);
-                    json_object_array_add(array, string);
-                }
+            for(uint32_t s = 0; s < nb_shards; ++s){
+                add_images(file->shards != NULL ? &file->shards->files[s] : file, array);
             }
 
-            char* string2 = json_object_to_json_string(object);
+            // the string belongs to the object: the caller gets a copy
+            const char* json = json_object_to_json_string(object);
+            char* string2 = malloc(strlen(json) + 1);
+            if(string2 != NULL){
+                strcpy(string2, json);
+            }
+            json_object_put(object);
             return string2;
         }else{
             char* error_string = malloc(36);
@@ -4,9 +4,15 @@
  *
  */
 
+#define _DEFAULT_SOURCE // for fileno
+
 #include "imgStore.h"
 #include "error.h"
 #include "image_content.h"
+#include "trace.h"
+#include "shard.h"
+#include "lock.h"
+#include "checksum.h"
 
 #include <vips/vips.h>
 #include <stdio.h>
@@ -14,67 +20,249 @@
 #include <stdlib.h>
 
 /**
- * Reads the content of an image from a imgStore.
+ * Where an image is stored, read under the lock of its slot: in
+ * thread-safe mode, the slot may have been deleted or reused since
+ * find_img.
  */
-int 
-do_read(const char* img_id, const int resolution, char** image_buffer, uint32_t* image_size, struct imgst_file* imgst_file)
+static int
+slot_blob(struct imgst_file* imgst_file, uint32_t index, const char* img_id, int resolution,
+          uint64_t* offset, uint32_t* size)
 {
-    if(img_id == NULL)
-        return ERR_INVALID_ARGUMENT;
-    
-    if(imgst_file == NULL)
-        return ERR_INVALID_ARGUMENT;
-    
-    if(imgst_file->file == NULL){
-        return ERR_FILE_NOT_FOUND;
-    }
+    const struct metadata_table* metadata = &imgst_file->metadata;
 
-    if (imgst_file->header.num_files == 0) {
-        return ERR_NONE;
-    }
+    lock_slot(imgst_file, index, 0);
+    const int found = metadata->is_valid[index] == NON_EMPTY && !strcmp(SLOT_ID(metadata, index), img_id);
+    *offset = SLOT_OFFSET(metadata, index, resolution);
+    *size = SLOT_SIZE(metadata, index, resolution);
+    unlock_slot(imgst_file, index);
 
+    return found ? ERR_NONE : ERR_FILE_NOT_FOUND;
+}
+
+/**
+ * Where an image is stored, resized first if needed.
+ */
+static int
+find_blob(const char* img_id, const int resolution, struct imgst_file* imgst_file, uint64_t* offset, uint32_t* size)
+{
     uint32_t index = 0;
-    int ret = 0;
-
-    for(size_t i = 0; i < imgst_file->header.max_files; ++i){
-        if(imgst_file->metadata[i].is_valid == NON_EMPTY){
-            if(!strcmp(imgst_file->metadata[i].img_id, img_id)){
-                index = i;
-                break;
-            }
-        }
-        if(i == imgst_file->header.max_files - 1){
-            return ERR_FILE_NOT_FOUND;
-        }
+    TRACE_BEGIN(find_img);
+    int ret = find_img(imgst_file, img_id, &index);
+    TRACE_END(find_img);
+    if(ret){
+        return ret;
     }
 
-    if(imgst_file->metadata[index].offset[resolution] == 0){
+    ret = slot_blob(imgst_file, index, img_id, resolution, offset, size);
+    if(ret){
+        return ret;
+    }
+
+    if(*offset == 0){
         ret = lazily_resize(resolution, imgst_file, index);
         if(ret){
             return ret;
         }
+        ret = slot_blob(imgst_file, index, img_id, resolution, offset, size);
     }
+    return ret;
+}
 
-    int seek = fseek(imgst_file->file, imgst_file->metadata[index].offset[resolution], SEEK_SET);
+/**
+ * Reads the content of an image from a imgStore (do_read, without its span).
+ */
+static int
+read_image(const char* img_id, const int resolution, char** image_buffer, uint32_t* image_size, struct imgst_file* imgst_file)
+{
+    if(img_id == NULL)
+        return ERR_INVALID_ARGUMENT;
+    
+    if(imgst_file == NULL)
+        return ERR_INVALID_ARGUMENT;
+    
+    if(imgst_file->file == NULL){
+        return ERR_FILE_NOT_FOUND;
+    }
 
-    if(seek == -1) {
-        return ERR_IO;
+    // no image at all (e.g. the shard of img_id, all the others deleted)
+    if (HEADER_GET(imgst_file, num_files) == 0) {
+        return ERR_FILE_NOT_FOUND;
     }
 
-    *image_size = imgst_file->metadata[index].size[resolution];
+    uint64_t offset = 0;
+    int ret = find_blob(img_id, resolution, imgst_file, &offset, image_size);
+    if(ret){
+        return ret;
+    }
 
+    TRACE_BEGIN(read_blob);
     *image_buffer = calloc(*image_size, sizeof(char));
 
     if(*image_buffer == NULL)
         return ERR_IO;
 
-    size_t read = fread(*image_buffer, *image_size, 1, imgst_file->file);
+    ret = read_at(imgst_file, offset, *image_buffer, *image_size);
+    if(ret == ERR_NONE){
+        ret = verify_blob(imgst_file, offset, *image_buffer, *image_size);
+    }
+    TRACE_END(read_blob);
 
-    if(read != 1) {
+    if(ret) {
         free(*image_buffer);
         *image_buffer = NULL;
-        return ERR_IO;
+        return ret;
     }
 
     return ret;
 }
+
+/**
+ * Reads the content of an image from a imgStore.
+ */
+int 
+do_read(const char* img_id, const int resolution, char** image_buffer, uint32_t* image_size, struct imgst_file* imgst_file)
+{
+    if(imgst_file != NULL && imgst_file->shards != NULL){
+        return do_read(img_id, resolution, image_buffer, image_size, shard_of(imgst_file, img_id));
+    }
+
+    TRACE_BEGIN(do_read);
+    const int ret = read_image(img_id, resolution, image_buffer, image_size, imgst_file);
+    TRACE_END(do_read);
+    return ret;
+}
+
+/**
+ * Where an image is stored, for the callers reading it by themselves.
+ */
+int
+locate_image(const char* img_id, const int resolution, struct imgst_file* imgst_file,
+             int* fd, uint64_t* offset, uint32_t* size)
+{
+    if(imgst_file != NULL && imgst_file->shards != NULL){
+        return locate_image(img_id, resolution, shard_of(imgst_file, img_id), fd, offset, size);
+    }
+
+    if(img_id == NULL || imgst_file == NULL || fd == NULL || offset == NULL || size == NULL)
+        return ERR_INVALID_ARGUMENT;
+
+    if(imgst_file->file == NULL){
+        return ERR_FILE_NOT_FOUND;
+    }
+
+    int ret = find_blob(img_id, resolution, imgst_file, offset, size);
+
+    // the images appended through the FILE* (this one, if just resized)
+    // are to be visible through the file descriptor
+    if(ret == ERR_NONE && fflush(imgst_file->file) != 0){
+        ret = ERR_IO;
+    }
+    if(ret == ERR_NONE){
+        *fd = fileno(imgst_file->file);
+    }
+    return ret;
+}
+
+/**
+ * An image of a batch: its read and where it is stored.
+ */
+struct blob {
+    struct imgst_read* read;
+    struct imgst_file* file; // its shard
+    uint64_t offset;
+};
+
+/**
+ * Order of the reads of a batch: by file, then by position in the file.
+ */
+static int
+blob_cmp(const void* a, const void* b)
+{
+    const struct blob* first = a;
+    const struct blob* second = b;
+
+    if(first->file != second->file){
+        return first->file < second->file ? -1 : 1;
+    }
+    if(first->offset != second->offset){
+        return first->offset < second->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Reads the content of several images from a imgStore.
+ */
+int
+do_read_many(struct imgst_read* reads, size_t nb_reads, const int resolution, struct imgst_file* imgst_file)
+{
+    if(reads == NULL || imgst_file == NULL)
+        return ERR_INVALID_ARGUMENT;
+
+    if(resolution != RES_THUMB && resolution != RES_SMALL && resolution != RES_ORIG)
+        return ERR_RESOLUTIONS;
+
+    struct blob* blobs = calloc(nb_reads > 0 ? nb_reads : 1, sizeof(struct blob));
+    if(blobs == NULL)
+        return ERR_OUT_OF_MEMORY;
+
+    TRACE_BEGIN(do_read_many);
+
+    // first locate them all (resizing those which need it)...
+    size_t nb_blobs = 0;
+    for(size_t i = 0; i < nb_reads; ++i){
+        struct imgst_read* read = &reads[i];
+        read->buffer = NULL;
+        read->size = 0;
+
+        struct imgst_file* file = imgst_file;
+        if(read->img_id == NULL){
+            read->error = ERR_INVALID_ARGUMENT;
+            continue;
+        }
+        if(file->shards != NULL){
+            file = shard_of(imgst_file, read->img_id);
+        }
+        if(file->file == NULL){
+            read->error = ERR_FILE_NOT_FOUND;
+            continue;
+        }
+
+        uint64_t offset = 0;
+        read->error = find_blob(read->img_id, resolution, file, &offset, &read->size);
+        if(read->error == ERR_NONE){
+            blobs[nb_blobs].read = read;
+            blobs[nb_blobs].file = file;
+            blobs[nb_blobs].offset = offset;
+            ++nb_blobs;
+        }
+    }
+
+    // ...then read them along the file
+    qsort(blobs, nb_blobs, sizeof(struct blob), blob_cmp);
+
+    TRACE_BEGIN(read_blob);
+    for(size_t i = 0; i < nb_blobs; ++i){
+        struct imgst_read* read = blobs[i].read;
+
+        read->buffer = calloc(read->size > 0 ? read->size : 1, sizeof(char));
+        if(read->buffer == NULL){
+            read->error = ERR_OUT_OF_MEMORY;
+            continue;
+        }
+
+        read->error = read_at(blobs[i].file, blobs[i].offset, read->buffer, read->size);
+        if(read->error == ERR_NONE){
+            read->error = verify_blob(blobs[i].file, blobs[i].offset, read->buffer, read->size);
+        }
+        if(read->error){
+            free(read->buffer);
+            read->buffer = NULL;
+        }
+    }
+    TRACE_END(read_blob);
+
+    TRACE_END(do_read_many);
+    free(blobs);
+    return ERR_NONE;
+}
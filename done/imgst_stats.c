@@ -0,0 +1,148 @@
+/**
+ * @file imgst_stats.c
+ * @brief imgStore library: space accounting (live vs. dead bytes).
+ *
+ * The data region of an imgStore only grows: deleting an image only
+ * invalidates its metadata, so its blobs stay in the file until the next
+ * garbage collection. The number of bytes still referenced is kept in
+ * header.live_bytes so that the fragmentation can be known without
+ * scanning the file.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+#include "shard.h"
+#include "lock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct blob {
+    uint64_t offset;
+    uint32_t size;
+};
+
+static int
+blob_cmp(const void* a, const void* b)
+{
+    const struct blob* b1 = a;
+    const struct blob* b2 = b;
+    return (b1->offset > b2->offset) - (b1->offset < b2->offset);
+}
+
+/********************************************************************//**
+ * Sum of the sizes of the (distinct) blobs of the valid images.
+ */
+int
+compute_live_bytes(struct imgst_file* imgst_file, uint64_t* live_bytes)
+{
+    if(imgst_file == NULL) return ERR_INVALID_ARGUMENT;
+    if(live_bytes == NULL) return ERR_INVALID_ARGUMENT;
+
+    const size_t max_blobs = (size_t) imgst_file->header.num_files * NB_RES;
+    struct blob* blobs = calloc(max_blobs, sizeof(struct blob));
+    if(blobs == NULL && max_blobs > 0) return ERR_OUT_OF_MEMORY;
+
+    size_t nb_blobs = 0;
+    for(uint32_t i = 0; i < NB_SLOTS(imgst_file); ++i){
+        const struct metadata_table* metadata = load_metadata(imgst_file, i);
+        if(metadata == NULL){
+            free(blobs);
+            return ERR_IO;
+        }
+        if(metadata->is_valid[i] == NON_EMPTY){
+            for(int res = 0; res < NB_RES && nb_blobs < max_blobs; ++res){
+                if(SLOT_OFFSET(metadata, i, res) != 0){
+                    blobs[nb_blobs].offset = SLOT_OFFSET(metadata, i, res);
+                    blobs[nb_blobs].size = SLOT_SIZE(metadata, i, res);
+                    ++nb_blobs;
+                }
+            }
+        }
+    }
+
+    // deduplicated images share their blobs: count each offset only once
+    qsort(blobs, nb_blobs, sizeof(struct blob), blob_cmp);
+
+    uint64_t live = 0;
+    for(size_t i = 0; i < nb_blobs; ++i){
+        if(i == 0 || blobs[i].offset != blobs[i - 1].offset){
+            live += BLOB_SPAN(imgst_file, (uint64_t) blobs[i].size);
+        }
+    }
+
+    free(blobs);
+    *live_bytes = live;
+    return ERR_NONE;
+}
+
+/********************************************************************//**
+ * imgStores written before the space accounting have live_bytes == 0
+ * while holding images: compute it before its first use.
+ */
+int
+check_live_bytes(struct imgst_file* imgst_file)
+{
+    if(imgst_file == NULL) return ERR_INVALID_ARGUMENT;
+
+    if(HEADER_GET(imgst_file, live_bytes) == 0 && HEADER_GET(imgst_file, num_files) > 0){
+        uint64_t live_bytes = 0;
+        const int ret = compute_live_bytes(imgst_file, &live_bytes);
+        if(ret == ERR_NONE) HEADER_SET(imgst_file, live_bytes, live_bytes);
+        return ret;
+    }
+    return ERR_NONE;
+}
+
+/********************************************************************//**
+ * Space accounting of the imgStore (do_stats, under the writer lock).
+ */
+static int
+file_stats(struct imgst_file* imgst_file, struct imgst_stats* stats)
+{
+    if(imgst_file->file == NULL) return ERR_FILE_NOT_FOUND;
+
+    int ret = check_live_bytes(imgst_file);
+    if(ret) return ret;
+
+    if(fseek(imgst_file->file, 0, SEEK_END) != 0) return ERR_IO;
+
+    long int size = ftell(imgst_file->file);
+    if(size < 0) return ERR_IO;
+
+    // the space preallocated after the content is not dead
+    stats->file_size = (imgst_file->header.features & IMGST_PREALLOC) && imgst_file->ext.end_of_data != 0 ?
+                       imgst_file->ext.end_of_data : (uint64_t) size;
+    stats->table_size = sizeof(struct imgst_header)
+                        + (uint64_t) imgst_file->header.max_files * sizeof(struct img_metadata);
+    if(imgst_file->header.features != 0){
+        stats->table_size += sizeof(struct imgst_ext)
+                             + imgst_file->ext.nb_extents * sizeof(struct imgst_extent)
+                             + (uint64_t) imgst_file->nb_extra_slots * sizeof(struct img_metadata);
+    }
+    stats->live_bytes = HEADER_GET(imgst_file, live_bytes);
+
+    const uint64_t data_size = stats->file_size > stats->table_size ?
+                               stats->file_size - stats->table_size : 0;
+
+    stats->dead_bytes = data_size > stats->live_bytes ? data_size - stats->live_bytes : 0;
+    stats->fragmentation = data_size > 0 ? stats->dead_bytes / (double) data_size : 0.0;
+
+    return ERR_NONE;
+}
+
+/********************************************************************//**
+ * Space accounting of the imgStore.
+ */
+int
+do_stats(struct imgst_file* imgst_file, struct imgst_stats* stats)
+{
+    if(imgst_file == NULL) return ERR_INVALID_ARGUMENT;
+    if(stats == NULL) return ERR_INVALID_ARGUMENT;
+    if(imgst_file->shards != NULL) return shard_stats(imgst_file, stats);
+
+    lock_writer(imgst_file);
+    const int ret = file_stats(imgst_file, stats);
+    unlock_writer(imgst_file);
+    return ret;
+}
@@ -0,0 +1,699 @@
+/**
+ * @file index.c
+ * @brief imgStore library: index of the images, persisted next to the
+ *        imgStore.
+ */
+
+#define _DEFAULT_SOURCE // for fileno, fdatasync
+
+#include "index.h"
+#include "lock.h"
+#include "wal.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <openssl/sha.h>
+
+/* arrays of the table, in the order of the sidecar */
+#define NB_PARTS 8
+
+struct index_part {
+    void*   data;
+    size_t  entry;  // bytes per slot
+};
+
+/**********************************************************************
+ * Path of the sidecar of an imgStore
+ */
+static char*
+index_path (const char* imgst_filename, const char* suffix)
+{
+    char* path = malloc(strlen(imgst_filename) + strlen(suffix) + 1);
+    if (path == NULL) return NULL;
+
+    strcpy(path, imgst_filename);
+    strcat(path, suffix);
+    return path;
+}
+
+/**********************************************************************
+ * Keys of the hash tables
+ */
+static uint32_t
+id_key (const struct metadata_table* table, uint32_t index)
+{
+    return table->id_hash[index];
+}
+
+static uint32_t
+sha_key (const struct metadata_table* table, uint32_t index)
+{
+    uint32_t key;
+    memcpy(&key, SLOT_SHA(table, index), sizeof(key));
+    return key;
+}
+
+/**********************************************************************
+ * Size of the hash tables: at most half full
+ */
+static uint32_t
+nb_buckets_for (uint32_t nb_slots)
+{
+    uint32_t nb_buckets = 16;
+    while (nb_buckets < 2 * (uint64_t) nb_slots) nb_buckets *= 2;
+    return nb_buckets;
+}
+
+static size_t
+nb_words (uint32_t nb_slots)
+{
+    return ((size_t) nb_slots + 63) / 64;
+}
+
+/**********************************************************************
+ * Linear probing: insertion, removal by backward shift (no tombstones)
+ */
+static void
+bucket_insert (uint32_t* buckets, uint32_t mask, uint32_t key, uint32_t index)
+{
+    uint32_t bucket = key & mask;
+    while (buckets[bucket] != 0) bucket = (bucket + 1) & mask;
+    buckets[bucket] = index + 1;
+}
+
+static void
+bucket_remove (uint32_t* buckets, uint32_t mask, const struct metadata_table* table,
+               uint32_t (*key)(const struct metadata_table*, uint32_t), uint32_t index)
+{
+    uint32_t hole = key(table, index) & mask;
+    while (buckets[hole] != index + 1) {
+        if (buckets[hole] == 0) return;
+        hole = (hole + 1) & mask;
+    }
+
+    // the next entries of the run move back, unless before their home
+    for (uint32_t next = (hole + 1) & mask; buckets[next] != 0; next = (next + 1) & mask) {
+        const uint32_t home = key(table, buckets[next] - 1) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            buckets[hole] = buckets[next];
+            hole = next;
+        }
+    }
+    buckets[hole] = 0;
+}
+
+/**********************************************************************
+ * Allocation of the hash tables and of the bitmap (unchanged on error)
+ */
+static int
+index_alloc (struct imgst_index* index, uint32_t nb_slots)
+{
+    const uint32_t nb_buckets = nb_buckets_for(nb_slots);
+    uint32_t* ids = calloc(nb_buckets, sizeof(uint32_t));
+    uint32_t* shas = calloc(nb_buckets, sizeof(uint32_t));
+    uint64_t* free_slots = calloc(nb_words(nb_slots) > 0 ? nb_words(nb_slots) : 1, sizeof(uint64_t));
+    if (ids == NULL || shas == NULL || free_slots == NULL) {
+        free(ids);
+        free(shas);
+        free(free_slots);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    free(index->ids);
+    free(index->shas);
+    free(index->free_slots);
+    index->nb_slots = nb_slots;
+    index->nb_buckets = nb_buckets;
+    index->ids = ids;
+    index->shas = shas;
+    index->free_slots = free_slots;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Filling of the index from the table (all in memory)
+ */
+static void
+index_fill (const struct metadata_table* table, struct imgst_index* index)
+{
+    const uint32_t mask = index->nb_buckets - 1;
+    memset(index->ids, 0, index->nb_buckets * sizeof(uint32_t));
+    memset(index->shas, 0, index->nb_buckets * sizeof(uint32_t));
+    memset(index->free_slots, 0, nb_words(table->nb_slots) * sizeof(uint64_t));
+
+    for (uint32_t i = 0; i < table->nb_slots; ++i) {
+        if (table->is_valid[i] == NON_EMPTY) {
+            bucket_insert(index->ids, mask, id_key(table, i), i);
+            bucket_insert(index->shas, mask, sha_key(table, i), i);
+        } else {
+            index->free_slots[i / 64] |= UINT64_C(1) << (i % 64);
+        }
+    }
+}
+
+/**********************************************************************
+ * Description of the imgStore, to be matched by its sidecar
+ */
+static int
+describe (struct imgst_file* imgst_file, struct index_header* header)
+{
+    struct stat st;
+    if (fstat(fileno(imgst_file->file), &st) != 0) return ERR_IO;
+
+    memset(header, 0, sizeof(struct index_header));
+    memcpy(header->magic, INDEX_MAGIC, sizeof(header->magic));
+    header->format = INDEX_FORMAT;
+    header->imgst_version = HEADER_GET(imgst_file, imgst_version);
+    header->num_files = HEADER_GET(imgst_file, num_files);
+    header->nb_slots = NB_SLOTS(imgst_file);
+    header->live_bytes = HEADER_GET(imgst_file, live_bytes);
+    header->file_inode = (uint64_t) st.st_ino;
+    header->names_size = imgst_file->metadata.names_size;
+    header->names_dead = imgst_file->metadata.names_dead;
+    header->names_generation = imgst_file->metadata.names_generation;
+    return ERR_NONE;
+}
+
+static int
+same_imgstore (const struct index_header* first, const struct index_header* second)
+{
+    return !memcmp(first->magic, second->magic, sizeof(first->magic))
+           && first->format == second->format
+           && first->imgst_version == second->imgst_version
+           && first->num_files == second->num_files
+           && first->nb_slots == second->nb_slots
+           && first->live_bytes == second->live_bytes
+           && first->file_inode == second->file_inode;
+}
+
+/**********************************************************************
+ * Arrays of the table stored in the sidecar, is_valid last: a slot is
+ * valid once the rest of it is written
+ */
+static void
+index_parts (const struct metadata_table* table, struct index_part parts[NB_PARTS])
+{
+    parts[0] = (struct index_part) { table->unused_16, sizeof(uint16_t) };
+    parts[1] = (struct index_part) { table->id_hash, sizeof(uint32_t) };
+    parts[2] = (struct index_part) { table->offset, NB_RES * sizeof(uint64_t) };
+    parts[3] = (struct index_part) { table->size, NB_RES * sizeof(uint32_t) };
+    parts[4] = (struct index_part) { table->res_orig, NB_RES_ORIG * sizeof(uint32_t) };
+    parts[5] = (struct index_part) { table->SHA, SHA256_DIGEST_LENGTH };
+    parts[6] = (struct index_part) { table->img_id, sizeof(uint32_t) };
+    parts[7] = (struct index_part) { table->is_valid, sizeof(uint16_t) };
+}
+
+/**********************************************************************
+ * Loading of the sidecar, if it is that of the imgStore: its header is
+ * read again after the rest, unchanged if not updated meanwhile
+ */
+static int
+index_load (struct imgst_file* imgst_file, struct imgst_index* index, const char* path)
+{
+    struct index_header expected;
+    int ret = describe(imgst_file, &expected);
+    if (ret) return ret;
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return ERR_IO;
+
+    struct index_header header;
+    struct metadata_table* table = &imgst_file->metadata;
+    ret = ERR_IO;
+
+    if (fread(&header, sizeof(header), 1, file) == 1 && same_imgstore(&header, &expected)
+        && header.sequence % 2 == 0
+        && header.names_size >= 1 && header.names_size <= UINT32_MAX
+        && header.names_dead < header.names_size) {
+
+        char* names = realloc(table->names, header.names_size);
+        if (names != NULL) {
+            table->names = names;
+            table->names_capacity = header.names_size;
+            table->names_size = header.names_size;
+            table->names_dead = header.names_dead;
+            table->names_generation = header.names_generation;
+
+            struct index_part parts[NB_PARTS];
+            index_parts(table, parts);
+
+            size_t i = 0;
+            while (i < NB_PARTS && fread(parts[i].data, parts[i].entry, header.nb_slots, file) == header.nb_slots) ++i;
+
+            struct index_header again;
+            if (i == NB_PARTS && fread(names, 1, header.names_size, file) == header.names_size
+                && names[0] == '\0' && names[header.names_size - 1] == '\0'
+                && fseek(file, 0, SEEK_SET) == 0 && fread(&again, sizeof(again), 1, file) == 1
+                && !memcmp(&again, &header, sizeof(header))) {
+                ret = ERR_NONE;
+            }
+        } else {
+            ret = ERR_OUT_OF_MEMORY;
+        }
+    }
+    fclose(file);
+
+    // the ids are in the arena
+    for (uint32_t i = 0; ret == ERR_NONE && i < header.nb_slots; ++i) {
+        if (table->img_id[i] >= table->names_size) ret = ERR_IO;
+    }
+
+    if (ret == ERR_NONE) ret = index_alloc(index, header.nb_slots);
+    if (ret) return ret;
+
+    index_fill(table, index);
+    index->saved = header;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Rewriting of the sidecar: written aside, then renamed
+ */
+static int
+index_save (struct imgst_file* imgst_file, struct imgst_index* index, struct index_header* header, int durable)
+{
+    const struct metadata_table* table = &imgst_file->metadata;
+
+    struct index_part parts[NB_PARTS];
+    index_parts(table, parts);
+
+    char* tmp = index_path(index->path, ".tmp");
+    if (tmp == NULL) return ERR_OUT_OF_MEMORY;
+
+    FILE* file = fopen(tmp, "wb");
+    int ret = file == NULL ? ERR_IO : ERR_NONE;
+    if (ret == ERR_NONE && fwrite(header, sizeof(struct index_header), 1, file) != 1) ret = ERR_IO;
+    for (size_t i = 0; ret == ERR_NONE && i < NB_PARTS; ++i) {
+        if (fwrite(parts[i].data, parts[i].entry, table->nb_slots, file) != table->nb_slots) ret = ERR_IO;
+    }
+    if (ret == ERR_NONE && fwrite(table->names, 1, table->names_size, file) != table->names_size) ret = ERR_IO;
+    if (ret == ERR_NONE && fflush(file) != 0) ret = ERR_IO;
+    if (ret == ERR_NONE && durable && fdatasync(fileno(file)) != 0) ret = ERR_IO;
+    if (file != NULL && fclose(file) != 0) ret = ERR_IO;
+
+    if (ret == ERR_NONE && rename(tmp, index->path) != 0) ret = ERR_IO;
+    if (ret) unlink(tmp);
+    free(tmp);
+    return ret;
+}
+
+/**********************************************************************
+ * Update of the sidecar in place: the slots written and the new ids,
+ * between two writes of its header
+ */
+static int
+index_update (struct imgst_file* imgst_file, struct imgst_index* index, struct index_header* header, int durable)
+{
+    const struct metadata_table* table = &imgst_file->metadata;
+
+    struct index_part parts[NB_PARTS];
+    index_parts(table, parts);
+
+    const int fd = open(index->path, O_WRONLY);
+    if (fd < 0) return ERR_IO;
+
+    // marked as being updated: not loaded if left so by a crash
+    struct index_header updating = index->saved;
+    updating.sequence += 1;
+    int ret = pwrite(fd, &updating, sizeof(updating), 0) == (ssize_t) sizeof(updating) ? ERR_NONE : ERR_IO;
+
+    off_t part = (off_t) sizeof(struct index_header);
+    for (size_t i = 0; i < NB_PARTS; ++i) {
+        for (uint32_t j = 0; ret == ERR_NONE && j < index->nb_dirty; ++j) {
+            const uint32_t slot = index->dirty[j];
+            const char* entry = (const char*) parts[i].data + (size_t) slot * parts[i].entry;
+            if (pwrite(fd, entry, parts[i].entry, part + (off_t) (slot * parts[i].entry)) != (ssize_t) parts[i].entry) {
+                ret = ERR_IO;
+            }
+        }
+        part += (off_t) (table->nb_slots * parts[i].entry);
+    }
+
+    // the arena only grew
+    const size_t appended = table->names_size - index->saved.names_size;
+    if (ret == ERR_NONE && appended > 0
+        && pwrite(fd, table->names + index->saved.names_size, appended, part + (off_t) index->saved.names_size)
+           != (ssize_t) appended) {
+        ret = ERR_IO;
+    }
+
+    if (ret == ERR_NONE && durable && fdatasync(fd) != 0) ret = ERR_IO;
+
+    header->sequence = updating.sequence + 1;
+    if (ret == ERR_NONE && pwrite(fd, header, sizeof(struct index_header), 0) != (ssize_t) sizeof(struct index_header)) {
+        ret = ERR_IO;
+    }
+    if (close(fd) != 0) ret = ERR_IO;
+    return ret;
+}
+
+/**********************************************************************
+ * The sidecar up to date
+ */
+int
+index_sync (struct imgst_file* imgst_file, int durable)
+{
+    if (imgst_file == NULL || !INDEXED(imgst_file) || imgst_file->index->path == NULL) return ERR_NONE;
+
+    struct imgst_index* index = imgst_file->index;
+    const struct metadata_table* table = &imgst_file->metadata;
+    if (index->nb_slots != NB_SLOTS(imgst_file) || table->nb_slots != NB_SLOTS(imgst_file)) return ERR_IO;
+
+    struct index_header header;
+    int ret = describe(imgst_file, &header);
+    if (ret) return ret;
+    if (same_imgstore(&header, &index->saved) && index->nb_dirty == 0) return ERR_NONE;
+
+    // in place if it has the layout of the table: same slots, ids only appended (not compacted)
+    if (index->saved.format == INDEX_FORMAT && index->saved.file_inode == header.file_inode
+        && index->saved.nb_slots == header.nb_slots && index->nb_dirty <= INDEX_DIRTY
+        && header.names_generation == index->saved.names_generation
+        && header.names_size >= index->saved.names_size && header.names_dead >= index->saved.names_dead) {
+        ret = index_update(imgst_file, index, &header, durable);
+    } else {
+        header.sequence = 0;
+        ret = index_save(imgst_file, index, &header, durable);
+    }
+
+    index->nb_dirty = 0;
+    if (ret == ERR_NONE) index->saved = header;
+    // rewritten next time
+    else memset(&index->saved, 0, sizeof(index->saved));
+    return ret;
+}
+
+/**********************************************************************
+ * Building of the index from the table
+ */
+int
+index_build (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || imgst_file->file == NULL) return ERR_INVALID_ARGUMENT;
+    if (INDEXED(imgst_file)) return ERR_NONE;
+
+    for (uint32_t i = 0; i < NB_SLOTS(imgst_file); i += METADATA_PAGE) {
+        if (load_metadata(imgst_file, i) == NULL) return ERR_IO;
+    }
+
+    // not opened by do_open (a new imgStore): not written
+    if (imgst_file->index == NULL) {
+        imgst_file->index = calloc(1, sizeof(struct imgst_index));
+        if (imgst_file->index == NULL) return ERR_OUT_OF_MEMORY;
+    }
+
+    const int ret = index_alloc(imgst_file->index, NB_SLOTS(imgst_file));
+    if (ret) return ret;
+    index_fill(&imgst_file->metadata, imgst_file->index);
+
+    // written as a whole at the next index_sync
+    memset(&imgst_file->index->saved, 0, sizeof(struct index_header));
+    imgst_file->index->nb_dirty = 0;
+
+    free(imgst_file->metadata_loaded);
+    imgst_file->metadata_loaded = NULL;
+    return ERR_NONE;
+}
+
+static void
+index_free (struct imgst_index* index)
+{
+    if (index == NULL) return;
+
+    free(index->path);
+    free(index->ids);
+    free(index->shas);
+    free(index->free_slots);
+    free(index);
+}
+
+/**********************************************************************
+ * Index of an imgStore being opened
+ */
+int
+index_open (struct imgst_file* imgst_file, const char* imgst_filename, int writable)
+{
+    if (imgst_file == NULL || imgst_filename == NULL) return ERR_INVALID_ARGUMENT;
+    if (imgst_file->file == NULL || imgst_file->metadata_loaded == NULL) return ERR_INVALID_ARGUMENT;
+
+    struct imgst_index* index = calloc(1, sizeof(struct imgst_index));
+    if (index == NULL) return ERR_OUT_OF_MEMORY;
+
+    char* path = index_path(imgst_filename, INDEX_SUFFIX);
+    if (path == NULL) {
+        index_free(index);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    int ret = index_load(imgst_file, index, path);
+    if (ret == ERR_NONE) {
+        free(imgst_file->metadata_loaded);
+        imgst_file->metadata_loaded = NULL;
+    } else {
+        // the table as left by a failed load is paged in again
+        free(index->ids);
+        free(index->shas);
+        free(index->free_slots);
+        memset(index, 0, sizeof(struct imgst_index));
+
+        free_metadata(&imgst_file->metadata);
+        ret = alloc_metadata(&imgst_file->metadata, NB_SLOTS(imgst_file));
+        if (ret) {
+            free(path);
+            index_free(index);
+            return ret;
+        }
+        memset(imgst_file->metadata_loaded, 0, NB_PAGES(NB_SLOTS(imgst_file)));
+    }
+
+    // only writers write it: the readers leave the directory alone
+    if (writable) index->path = path;
+    else free(path);
+
+    imgst_file->index = index;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Saving and release of the index
+ */
+void
+index_close (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || imgst_file->index == NULL) return;
+
+    // only a cache: the next do_open pages the table in if not written
+    if (imgst_file->file != NULL) (void) index_sync(imgst_file, 0);
+
+    index_free(imgst_file->index);
+    imgst_file->index = NULL;
+}
+
+/**********************************************************************
+ * Removal of the sidecar
+ */
+int
+index_remove (const char* imgst_filename)
+{
+    if (imgst_filename == NULL) return ERR_INVALID_ARGUMENT;
+
+    char* path = index_path(imgst_filename, INDEX_SUFFIX);
+    if (path == NULL) return ERR_OUT_OF_MEMORY;
+
+    const int ret = unlink(path) == 0 || errno == ENOENT ? ERR_NONE : ERR_IO;
+    free(path);
+    return ret;
+}
+
+/**********************************************************************
+ * Lookup of an image by id: its candidates (same id hash) are found
+ * under the index lock, then checked under the locks of their slots
+ */
+int
+index_find (struct imgst_file* imgst_file, const char* img_id, uint32_t* index)
+{
+    if (imgst_file == NULL || !INDEXED(imgst_file) || img_id == NULL || index == NULL) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    const struct imgst_index* idx = imgst_file->index;
+    const struct metadata_table* table = &imgst_file->metadata;
+    const uint32_t hash = hash_id(img_id);
+    const uint32_t mask = idx->nb_buckets - 1;
+
+    uint32_t candidates[INDEX_CANDIDATES];
+    uint32_t nb_candidates = 0;
+    int overflow = 0;
+
+    lock_index(imgst_file, 0);
+    for (uint32_t bucket = hash & mask; idx->ids[bucket] != 0; bucket = (bucket + 1) & mask) {
+        const uint32_t slot = idx->ids[bucket] - 1;
+        if (table->id_hash[slot] != hash) continue;
+        if (nb_candidates == INDEX_CANDIDATES) {
+            overflow = 1;
+            break;
+        }
+        candidates[nb_candidates++] = slot;
+    }
+    unlock_index(imgst_file);
+
+    for (uint32_t i = 0; i < nb_candidates; ++i) {
+        lock_slot(imgst_file, candidates[i], 0);
+        const int found = table->is_valid[candidates[i]] == NON_EMPTY
+                          && !strcmp(SLOT_ID(table, candidates[i]), img_id);
+        unlock_slot(imgst_file, candidates[i]);
+        if (found) {
+            *index = candidates[i];
+            return ERR_NONE;
+        }
+    }
+
+    // too many ids of this hash (crafted): all the slots are checked
+    for (uint32_t i = 0; overflow && i < NB_SLOTS(imgst_file); ++i) {
+        lock_slot(imgst_file, i, 0);
+        const int found = table->is_valid[i] == NON_EMPTY && table->id_hash[i] == hash
+                          && !strcmp(SLOT_ID(table, i), img_id);
+        unlock_slot(imgst_file, i);
+        if (found) {
+            *index = i;
+            return ERR_NONE;
+        }
+    }
+    return ERR_FILE_NOT_FOUND;
+}
+
+/**********************************************************************
+ * Lookup of the last duplicate of some content (by the writer)
+ */
+int
+index_find_sha (struct imgst_file* imgst_file, const unsigned char* SHA, uint32_t except, uint32_t* index)
+{
+    const struct imgst_index* idx = imgst_file->index;
+    const struct metadata_table* table = &imgst_file->metadata;
+    const uint32_t mask = idx->nb_buckets - 1;
+    uint32_t key;
+    memcpy(&key, SHA, sizeof(key));
+
+    int ret = ERR_FILE_NOT_FOUND;
+    for (uint32_t bucket = key & mask; idx->shas[bucket] != 0; bucket = (bucket + 1) & mask) {
+        const uint32_t slot = idx->shas[bucket] - 1;
+        if (slot == except || table->is_valid[slot] != NON_EMPTY) continue;
+        if (memcmp(SLOT_SHA(table, slot), SHA, SHA256_DIGEST_LENGTH)) continue;
+        if (ret == ERR_FILE_NOT_FOUND || slot > *index) *index = slot;
+        ret = ERR_NONE;
+    }
+    return ret;
+}
+
+/**********************************************************************
+ * Blob shared with a duplicate (by the writer)
+ */
+int
+index_blob_referenced (struct imgst_file* imgst_file, uint64_t offset, uint32_t index)
+{
+    const struct imgst_index* idx = imgst_file->index;
+    const struct metadata_table* table = &imgst_file->metadata;
+    const uint32_t mask = idx->nb_buckets - 1;
+
+    for (uint32_t bucket = sha_key(table, index) & mask; idx->shas[bucket] != 0; bucket = (bucket + 1) & mask) {
+        const uint32_t slot = idx->shas[bucket] - 1;
+        if (slot == index || table->is_valid[slot] != NON_EMPTY) continue;
+        for (int res = 0; res < NB_RES; ++res) {
+            if (SLOT_OFFSET(table, slot, res) == offset) return 1;
+        }
+    }
+    return 0;
+}
+
+/**********************************************************************
+ * First empty slot (by the writer)
+ */
+uint32_t
+index_free_slot (struct imgst_file* imgst_file)
+{
+    const struct imgst_index* index = imgst_file->index;
+    const size_t words = nb_words(index->nb_slots);
+
+    for (size_t i = 0; i < words; ++i) {
+        if (index->free_slots[i] != 0) {
+            const uint32_t slot = (uint32_t) (i * 64) + (uint32_t) __builtin_ctzll(index->free_slots[i]);
+            return slot < NB_SLOTS(imgst_file) ? slot : NB_SLOTS(imgst_file);
+        }
+    }
+    return NB_SLOTS(imgst_file);
+}
+
+/**********************************************************************
+ * Changes of the valid slots
+ */
+void
+index_add (struct imgst_file* imgst_file, uint32_t index)
+{
+    if (imgst_file == NULL || !INDEXED(imgst_file)) return;
+
+    struct imgst_index* idx = imgst_file->index;
+    const struct metadata_table* table = &imgst_file->metadata;
+
+    lock_index(imgst_file, 1);
+    bucket_insert(idx->ids, idx->nb_buckets - 1, id_key(table, index), index);
+    bucket_insert(idx->shas, idx->nb_buckets - 1, sha_key(table, index), index);
+    idx->free_slots[index / 64] &= ~(UINT64_C(1) << (index % 64));
+    unlock_index(imgst_file);
+}
+
+void
+index_drop (struct imgst_file* imgst_file, uint32_t index)
+{
+    if (imgst_file == NULL || !INDEXED(imgst_file)) return;
+
+    struct imgst_index* idx = imgst_file->index;
+    const struct metadata_table* table = &imgst_file->metadata;
+
+    lock_index(imgst_file, 1);
+    bucket_remove(idx->ids, idx->nb_buckets - 1, table, id_key, index);
+    bucket_remove(idx->shas, idx->nb_buckets - 1, table, sha_key, index);
+    idx->free_slots[index / 64] |= UINT64_C(1) << (index % 64);
+    unlock_index(imgst_file);
+}
+
+/**********************************************************************
+ * Slots to be written to the sidecar (by the writer)
+ */
+void
+index_touch (struct imgst_file* imgst_file, uint32_t index)
+{
+    if (imgst_file == NULL || !INDEXED(imgst_file) || imgst_file->index->path == NULL) return;
+
+    struct imgst_index* idx = imgst_file->index;
+    if (idx->nb_dirty < INDEX_DIRTY) idx->dirty[idx->nb_dirty++] = index;
+    // too many: rewritten as a whole
+    else idx->nb_dirty = INDEX_DIRTY + 1;
+}
+
+/**********************************************************************
+ * New extent: the tables grow with the slots
+ */
+int
+index_grow (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || !INDEXED(imgst_file)) return ERR_NONE;
+
+    struct imgst_index* idx = imgst_file->index;
+    const struct metadata_table* table = &imgst_file->metadata;
+    int ret = ERR_NONE;
+
+    if (nb_buckets_for(table->nb_slots) != idx->nb_buckets) {
+        ret = index_alloc(idx, table->nb_slots);
+    } else {
+        uint64_t* free_slots = realloc(idx->free_slots, nb_words(table->nb_slots) * sizeof(uint64_t));
+        if (free_slots == NULL) ret = ERR_OUT_OF_MEMORY;
+        else idx->free_slots = free_slots;
+        if (ret == ERR_NONE) idx->nb_slots = table->nb_slots;
+    }
+    if (ret == ERR_NONE) index_fill(table, idx);
+    return ret;
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+/**
+ * @file index.h
+ * @brief imgStore library: index of the images, persisted next to the
+ *        imgStore.
+ *
+ * The metadata are read from the file by pages, when first used: an
+ * operation looking for an image (find_img), a duplicate (do_insert) or
+ * an empty slot reads the whole table sooner or later, parsing max_files
+ * on-disk metadata. Once the whole table is in memory, an index of the
+ * imgStore is built:
+ *
+ *  - a hash table of the valid images by id (for find_img);
+ *  - a hash table of the valid images by SHA (for the deduplication);
+ *  - the empty slots, as a bitmap (for do_insert).
+ *
+ * A writer keeps a copy of the table in a sidecar (<imgStore>.idx),
+ * which do_open loads with a few reads, instead of the pages, if it is
+ * still that of the imgStore: same imgst_version, num_files, live_bytes
+ * (which a resized image changes, not the version), number of slots and
+ * file. Otherwise (after a change by an older version of the library,
+ * a garbage collection...), the table is paged in as without sidecar:
+ * the index is only built once all of it was read (by find_img not
+ * finding an image, or the thread-safe mode), and the sidecar then
+ * written again by a writer.
+ *
+ * The sidecar is kept up to date at each group commit of the journal
+ * (see wal.h), once the transactions are in place: the slots written
+ * meanwhile and the new ids are written over the sidecar, its header
+ * (marked as being updated meanwhile) last. It is rewritten as a whole,
+ * atomically, when the table grows or its arena of ids is compacted.
+ * A sidecar left behind by a crash is at most that of the version of
+ * the last group commit: a replay never leaves the imgStore older.
+ *
+ * In thread-safe mode, the hash tables have their own lock (lock_index):
+ * the writer changes them, the readers look an image up in them, then
+ * check it under the lock of its slot.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdint.h>
+
+#define INDEX_SUFFIX ".idx"
+#define INDEX_MAGIC "IMGSTIDX"
+#define INDEX_FORMAT 2
+
+/* images of a same id hash looked up by find_img, a linear scan beyond */
+#define INDEX_CANDIDATES 8
+
+/* slots written between two updates of the sidecar, rewritten as a whole beyond */
+#define INDEX_DIRTY 1024
+
+/*
+ * The header of the sidecar is followed by the arrays of the table
+ * (struct metadata_table, from is_valid to img_id, of nb_slots entries
+ * each), then by its arena of ids (names_size bytes).
+ */
+struct index_header {
+
+    char 			magic[8]; // INDEX_MAGIC (non terminé par '\0')
+    uint32_t 		format; // INDEX_FORMAT
+    uint32_t 		sequence; // impair pendant une mise à jour du fichier
+    uint32_t 		imgst_version; // imgst_version de l'imgStore indexé
+    uint32_t 		num_files; // son nombre d'images valides
+    uint32_t 		nb_slots; // son nombre d'emplacements (table principale et extensions)
+    uint32_t 		names_generation; // nombre de compactages de l'arène des noms
+    uint64_t 		live_bytes; // ses octets référencés
+    uint64_t 		file_inode; // inode de son fichier
+    uint64_t 		names_size; // octets de l'arène des noms
+    uint64_t 		names_dead; // octets des noms qui n'y sont plus référencés
+
+};
+
+/* in-memory index of an imgStore */
+struct imgst_index {
+    char*           path;       // of the sidecar, NULL if not to be written (read-only)
+    struct index_header saved;  // as in the sidecar, format 0 if it is to be rewritten
+    uint32_t        nb_slots;   // slots indexed, 0 if not built (table paged in)
+    uint32_t        nb_buckets; // power of 2, at least twice the number of slots
+    uint32_t*       ids;        // slot + 1 of the valid images by id hash (linear probing), 0 if none
+    uint32_t*       shas;       // slot + 1 of the valid images by SHA (linear probing), 0 if none
+    uint64_t*       free_slots; // one bit per slot, set if EMPTY
+    uint32_t        nb_dirty;   // slots written since the sidecar, INDEX_DIRTY + 1 if too many
+    uint32_t        dirty[INDEX_DIRTY];
+};
+
+/* whether the index of an imgStore is built: its whole table in memory */
+#define INDEXED(imgst_file) ((imgst_file)->index != NULL && (imgst_file)->index->ids != NULL)
+
+/**
+ * @brief Loads the table of an imgStore from its sidecar and builds its
+ *        index, if the sidecar is that of the imgStore (called by
+ *        do_open); its table stays paged in otherwise.
+ *
+ * @param imgst_file The main in-memory data structure (header read)
+ * @param imgst_filename Path to the imgStore file
+ * @param writable Non zero if opened for writing: the sidecar is then
+ *        kept up to date.
+ * @return Some error code. 0 if no error.
+ */
+int index_open(struct imgst_file* imgst_file, const char* imgst_filename, int writable);
+
+/**
+ * @brief Builds the index of an imgStore, reading the pages of its table
+ *        not read yet (by the writer, or before the thread-safe mode).
+ *        No-op if already built.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @return Some error code. 0 if no error.
+ */
+int index_build(struct imgst_file* imgst_file);
+
+/**
+ * @brief Brings the sidecar up to date (at a group commit, under the
+ *        writer lock, the transactions in place). No-op if the imgStore
+ *        is not indexed or opened read-only.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param durable Non zero to make the slots written durable before the
+ *        header of the sidecar refers to them (fsync policy).
+ * @return Some error code. 0 if no error.
+ */
+int index_sync(struct imgst_file* imgst_file, int durable);
+
+/**
+ * @brief Brings the sidecar up to date, then frees the index (called by
+ *        do_close). A failure to write it is ignored.
+ *
+ * @param imgst_file The main in-memory data structure
+ */
+void index_close(struct imgst_file* imgst_file);
+
+/**
+ * @brief Removes the sidecar of an imgStore, if any (new or compacted
+ *        imgStore).
+ *
+ * @param imgst_filename Path to the imgStore file
+ * @return Some error code. 0 if no error.
+ */
+int index_remove(const char* imgst_filename);
+
+/**
+ * @brief Index of the valid image with a given id (see find_img).
+ *
+ * @param imgst_file The main in-memory data structure (indexed)
+ * @param img_id The ID of the image.
+ * @param index Set to the index of its slot.
+ * @return ERR_FILE_NOT_FOUND if none; some error code. 0 if no error.
+ */
+int index_find(struct imgst_file* imgst_file, const char* img_id, uint32_t* index);
+
+/**
+ * @brief Last valid image (by slot) with a given SHA, but one (by the
+ *        writer).
+ *
+ * @param imgst_file The main in-memory data structure (indexed)
+ * @param SHA The SHA-256 of the image.
+ * @param except Index of a slot to be ignored.
+ * @param index Set to the index of its slot.
+ * @return ERR_FILE_NOT_FOUND if none; 0 if found.
+ */
+int index_find_sha(struct imgst_file* imgst_file, const unsigned char* SHA, uint32_t except, uint32_t* index);
+
+/**
+ * @brief Whether a blob of an image is also one of another valid image,
+ *        one of its duplicates (see is_blob_referenced; by the writer).
+ *
+ * @param imgst_file The main in-memory data structure (indexed)
+ * @param offset Position of the blob.
+ * @param index Index of the slot of the image.
+ * @return 1 if referenced, 0 otherwise.
+ */
+int index_blob_referenced(struct imgst_file* imgst_file, uint64_t offset, uint32_t index);
+
+/**
+ * @brief First empty slot (by the writer).
+ *
+ * @param imgst_file The main in-memory data structure (indexed)
+ * @return Its index, NB_SLOTS if none.
+ */
+uint32_t index_free_slot(struct imgst_file* imgst_file);
+
+/**
+ * @brief Adds a slot just made valid to the index, or removes one about
+ *        to be made EMPTY (by the writer, its id and SHA still set).
+ *        No-op if the imgStore is not indexed.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param index Index of the slot.
+ */
+void index_add(struct imgst_file* imgst_file, uint32_t index);
+void index_drop(struct imgst_file* imgst_file, uint32_t index);
+
+/**
+ * @brief Notes a slot written to the imgStore, to be written to the
+ *        sidecar at the next index_sync (by write_metadata).
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param index Index of the slot.
+ */
+void index_touch(struct imgst_file* imgst_file, uint32_t index);
+
+/**
+ * @brief Extends the index to the slots added by grow_metadata, under
+ *        lock_index for writing. No-op if the imgStore is not indexed.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @return Some error code. 0 if no error.
+ */
+int index_grow(struct imgst_file* imgst_file);
@@ -0,0 +1,285 @@
+/**
+ * @file lock.c
+ * @brief imgStore library: thread-safe mode.
+ */
+
+#define _XOPEN_SOURCE 700 // for PTHREAD_MUTEX_RECURSIVE, pread and fileno
+
+#include "lock.h"
+#include "shard.h"
+#include "map.h"
+#include "index.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* a resized image being generated */
+struct flight {
+    uint32_t            index;
+    int                 res;
+    int                 busy;       // until generated
+    uint32_t            waiters;    // the flight is reused once they all left
+    int                 result;
+};
+
+/* locks of an imgStore in thread-safe mode */
+struct imgst_locks {
+    pthread_mutex_t     writer;     // recursive
+    pthread_mutex_t     cache;
+    pthread_rwlock_t    stripes[LOCK_STRIPES];
+    pthread_rwlock_t    index;
+    pthread_mutex_t     flights_lock;
+    pthread_cond_t      flight_done;
+    struct flight       flights[MAX_FLIGHTS];
+};
+
+#define STRIPE(index) (((index) / METADATA_PAGE) % LOCK_STRIPES)
+
+/**********************************************************************
+ * Thread-safe mode
+ */
+int
+lock_init (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL) return ERR_INVALID_ARGUMENT;
+
+    if (imgst_file->shards != NULL) {
+        for (uint32_t i = 0; i < imgst_file->shards->nb_shards; ++i) {
+            const int ret = lock_init(&imgst_file->shards->files[i]);
+            if (ret) return ret;
+        }
+        return ERR_NONE;
+    }
+    if (imgst_file->file == NULL) return ERR_INVALID_ARGUMENT;
+    if (imgst_file->locks != NULL) return ERR_NONE;
+
+    // loading a page changes the table: all of them are loaded now (with
+    // the index), and the new extents will be set in memory by grow_metadata
+    int ret = index_build(imgst_file);
+    if (ret) return ret;
+
+    struct imgst_locks* locks = calloc(1, sizeof(struct imgst_locks));
+    if (locks == NULL) return ERR_OUT_OF_MEMORY;
+
+    pthread_mutexattr_t recursive;
+    pthread_mutexattr_init(&recursive);
+    pthread_mutexattr_settype(&recursive, PTHREAD_MUTEX_RECURSIVE);
+    const int err = pthread_mutex_init(&locks->writer, &recursive);
+    pthread_mutexattr_destroy(&recursive);
+    if (err != 0) {
+        free(locks);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    pthread_mutex_init(&locks->cache, NULL);
+    pthread_mutex_init(&locks->flights_lock, NULL);
+    pthread_cond_init(&locks->flight_done, NULL);
+    for (size_t i = 0; i < LOCK_STRIPES; ++i) {
+        pthread_rwlock_init(&locks->stripes[i], NULL);
+    }
+    pthread_rwlock_init(&locks->index, NULL);
+
+    imgst_file->locks = locks;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Frees the locks
+ */
+void
+lock_close (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || imgst_file->locks == NULL) return;
+    struct imgst_locks* locks = imgst_file->locks;
+
+    pthread_mutex_destroy(&locks->writer);
+    pthread_mutex_destroy(&locks->cache);
+    pthread_mutex_destroy(&locks->flights_lock);
+    pthread_cond_destroy(&locks->flight_done);
+    for (size_t i = 0; i < LOCK_STRIPES; ++i) {
+        pthread_rwlock_destroy(&locks->stripes[i]);
+    }
+    pthread_rwlock_destroy(&locks->index);
+    free(locks);
+    imgst_file->locks = NULL;
+}
+
+/**********************************************************************
+ * Writer lock
+ */
+void
+lock_writer (struct imgst_file* imgst_file)
+{
+    if (imgst_file != NULL && imgst_file->locks != NULL) pthread_mutex_lock(&imgst_file->locks->writer);
+}
+
+void
+unlock_writer (struct imgst_file* imgst_file)
+{
+    if (imgst_file != NULL && imgst_file->locks != NULL) pthread_mutex_unlock(&imgst_file->locks->writer);
+}
+
+/**********************************************************************
+ * Lock of the stripe of a slot
+ */
+void
+lock_slot (struct imgst_file* imgst_file, uint32_t index, int write)
+{
+    if (imgst_file == NULL || imgst_file->locks == NULL) return;
+
+    pthread_rwlock_t* stripe = &imgst_file->locks->stripes[STRIPE(index)];
+    if (write) pthread_rwlock_wrlock(stripe);
+    else pthread_rwlock_rdlock(stripe);
+}
+
+void
+unlock_slot (struct imgst_file* imgst_file, uint32_t index)
+{
+    if (imgst_file == NULL || imgst_file->locks == NULL) return;
+    pthread_rwlock_unlock(&imgst_file->locks->stripes[STRIPE(index)]);
+}
+
+/**********************************************************************
+ * All the stripes, always in the same order
+ */
+void
+lock_table (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || imgst_file->locks == NULL) return;
+    for (size_t i = 0; i < LOCK_STRIPES; ++i) {
+        pthread_rwlock_wrlock(&imgst_file->locks->stripes[i]);
+    }
+}
+
+void
+unlock_table (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || imgst_file->locks == NULL) return;
+    for (size_t i = LOCK_STRIPES; i > 0; --i) {
+        pthread_rwlock_unlock(&imgst_file->locks->stripes[i - 1]);
+    }
+}
+
+/**********************************************************************
+ * Lock of the cache of derived images
+ */
+void
+lock_cache (struct imgst_file* imgst_file)
+{
+    if (imgst_file != NULL && imgst_file->locks != NULL) pthread_mutex_lock(&imgst_file->locks->cache);
+}
+
+void
+unlock_cache (struct imgst_file* imgst_file)
+{
+    if (imgst_file != NULL && imgst_file->locks != NULL) pthread_mutex_unlock(&imgst_file->locks->cache);
+}
+
+/**********************************************************************
+ * Lock of the index
+ */
+void
+lock_index (struct imgst_file* imgst_file, int write)
+{
+    if (imgst_file == NULL || imgst_file->locks == NULL) return;
+
+    if (write) pthread_rwlock_wrlock(&imgst_file->locks->index);
+    else pthread_rwlock_rdlock(&imgst_file->locks->index);
+}
+
+void
+unlock_index (struct imgst_file* imgst_file)
+{
+    if (imgst_file != NULL && imgst_file->locks != NULL) pthread_rwlock_unlock(&imgst_file->locks->index);
+}
+
+/**********************************************************************
+ * Single-flight generation of the resized images
+ */
+int
+flight_begin (struct imgst_file* imgst_file, uint32_t index, int res, int* result, struct flight** flight)
+{
+    if (flight != NULL) *flight = NULL;
+    if (imgst_file == NULL || imgst_file->locks == NULL || result == NULL || flight == NULL) return 1;
+    struct imgst_locks* locks = imgst_file->locks;
+
+    pthread_mutex_lock(&locks->flights_lock);
+    struct flight* running = NULL;
+    struct flight* unused = NULL;
+    for (size_t i = 0; i < MAX_FLIGHTS; ++i) {
+        struct flight* f = &locks->flights[i];
+        if (f->busy && f->index == index && f->res == res) running = f;
+        else if (!f->busy && f->waiters == 0 && unused == NULL) unused = f;
+    }
+
+    if (running != NULL) {
+        ++running->waiters;
+        while (running->busy) pthread_cond_wait(&locks->flight_done, &locks->flights_lock);
+        *result = running->result;
+        --running->waiters;
+        pthread_mutex_unlock(&locks->flights_lock);
+        return 0;
+    }
+
+    // all in use: generated without being shared (lazily_resize keeps a
+    // single copy all the same)
+    if (unused != NULL) {
+        unused->index = index;
+        unused->res = res;
+        unused->busy = 1;
+    }
+    *flight = unused;
+    pthread_mutex_unlock(&locks->flights_lock);
+    return 1;
+}
+
+void
+flight_end (struct imgst_file* imgst_file, struct flight* flight, int result)
+{
+    // not registered: no thread waits for it
+    if (imgst_file == NULL || imgst_file->locks == NULL || flight == NULL) return;
+    struct imgst_locks* locks = imgst_file->locks;
+
+    pthread_mutex_lock(&locks->flights_lock);
+    flight->busy = 0;
+    flight->result = result;
+    pthread_cond_broadcast(&locks->flight_done);
+    pthread_mutex_unlock(&locks->flights_lock);
+}
+
+/**********************************************************************
+ * Images written visible to pread
+ */
+int
+publish_writes (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || imgst_file->locks == NULL) return ERR_NONE;
+    return fflush(imgst_file->file) == 0 ? ERR_NONE : ERR_IO;
+}
+
+/**********************************************************************
+ * Reads at an offset of the imgStore file
+ */
+int
+read_at (struct imgst_file* imgst_file, uint64_t offset, void* buffer, size_t size)
+{
+    if (imgst_file == NULL || imgst_file->file == NULL || buffer == NULL) return ERR_INVALID_ARGUMENT;
+
+    if (imgst_file->map != NULL) return map_read(imgst_file, offset, buffer, size);
+
+    if (imgst_file->locks == NULL) {
+        if (fseek(imgst_file->file, (long int) offset, SEEK_SET) != 0) return ERR_IO;
+        return fread(buffer, size, 1, imgst_file->file) == 1 || size == 0 ? ERR_NONE : ERR_IO;
+    }
+
+    const int fd = fileno(imgst_file->file);
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t n = pread(fd, (char*) buffer + done, size - done, (off_t) (offset + done));
+        if (n <= 0) return ERR_IO;
+        done += (size_t) n;
+    }
+    return ERR_NONE;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+/**
+ * @file lock.h
+ * @brief imgStore library: thread-safe mode.
+ *
+ * By default an open imgStore is used by one thread at a time. Once
+ * lock_init has been called, its operations may be called concurrently:
+ *
+ *  - the metadata are all in memory (no more lazy paging) and are only
+ *    changed by writers (do_insert, do_delete, lazily_resize), one at a
+ *    time (writer lock, recursive; wal_sync, do_stats and do_list take
+ *    it too);
+ *  - the slots are protected by LOCK_STRIPES read-write locks, one per
+ *    METADATA_PAGE slots modulo LOCK_STRIPES: a writer takes the one of
+ *    a visible slot to change it, a reader the one of the slots it reads
+ *    (page by page for find_img), never two at a time;
+ *  - the changes of the whole table (new extent, string arena of the ids)
+ *    take all the stripes;
+ *  - the hash tables of the index (see index.h) have their own lock: a
+ *    reader looks an image up in them, releases it, then checks the slot
+ *    found under its stripe; a new extent takes it too (after all the
+ *    stripes), the table it reads moving;
+ *  - images are read with pread, without moving the FILE* of the writer,
+ *    which flushes them before publishing the metadata referring to them;
+ *  - the counters of the header are updated and read atomically
+ *    (HEADER_GET, HEADER_ADD);
+ *  - a resized image is generated without lock, then appended under the
+ *    writer lock; concurrent requests for the same one wait for a single
+ *    generation (flight_begin) instead of decoding the original again.
+ *
+ * Reads thus take no global lock: a read only waits for a writer
+ * changing a slot of the same stripe.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LOCK_STRIPES 64
+#define MAX_FLIGHTS 32
+
+/* atomic access to the counters of the header (num_files, imgst_version,
+ * live_bytes), which keep their on-disk types */
+#define HEADER_GET(imgst_file, field) __atomic_load_n(&(imgst_file)->header.field, __ATOMIC_RELAXED)
+#define HEADER_SET(imgst_file, field, value) __atomic_store_n(&(imgst_file)->header.field, (value), __ATOMIC_RELAXED)
+#define HEADER_ADD(imgst_file, field, value) __atomic_add_fetch(&(imgst_file)->header.field, (value), __ATOMIC_RELAXED)
+#define HEADER_SUB(imgst_file, field, value) __atomic_sub_fetch(&(imgst_file)->header.field, (value), __ATOMIC_RELAXED)
+
+/**
+ * @brief Turns on the thread-safe mode of an open imgStore (of each of
+ *        its shards): reads all its metadata and allocates its locks.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @return Some error code. 0 if no error.
+ */
+int lock_init(struct imgst_file* imgst_file);
+
+/**
+ * @brief Frees the locks of an imgStore (called by do_close).
+ *
+ * @param imgst_file The main in-memory data structure
+ */
+void lock_close(struct imgst_file* imgst_file);
+
+/**
+ * @brief Writer lock (recursive), for the operations changing the
+ *        imgStore. No-op if not in thread-safe mode.
+ *
+ * @param imgst_file The main in-memory data structure
+ */
+void lock_writer(struct imgst_file* imgst_file);
+void unlock_writer(struct imgst_file* imgst_file);
+
+/**
+ * @brief Lock of the stripe of a slot. No-op if not in thread-safe mode.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param index Index of the slot.
+ * @param write Non zero to change the slot, 0 to read it.
+ */
+void lock_slot(struct imgst_file* imgst_file, uint32_t index, int write);
+void unlock_slot(struct imgst_file* imgst_file, uint32_t index);
+
+/**
+ * @brief Locks all the stripes, to change the whole table (by the
+ *        writer, holding no stripe). No-op if not in thread-safe mode.
+ *
+ * @param imgst_file The main in-memory data structure
+ */
+void lock_table(struct imgst_file* imgst_file);
+void unlock_table(struct imgst_file* imgst_file);
+
+/**
+ * @brief Lock of the cache of derived images (see derived.h). No-op if
+ *        not in thread-safe mode.
+ *
+ * @param imgst_file The main in-memory data structure
+ */
+void lock_cache(struct imgst_file* imgst_file);
+void unlock_cache(struct imgst_file* imgst_file);
+
+/**
+ * @brief Lock of the index (see index.h), held without any other but
+ *        by grow_metadata (under lock_table).
+ *        No-op if not in thread-safe mode.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param write Non zero to change the index, 0 to look an image up.
+ */
+void lock_index(struct imgst_file* imgst_file, int write);
+void unlock_index(struct imgst_file* imgst_file);
+
+struct flight;
+
+/**
+ * @brief Single-flight generation of a resized image: either the caller
+ *        generates it (and then calls flight_end), or another thread
+ *        already was, and the caller waits for it. Always the former if
+ *        not in thread-safe mode.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param index Index of the slot.
+ * @param res Resolution (RES_THUMB or RES_SMALL).
+ * @param result Set to the error code of the other thread, if waited for.
+ * @param flight Set to the flight registered for the generation by the
+ *        caller, NULL if none (not in thread-safe mode, or all of them
+ *        in use: the generation is then not shared).
+ * @return 1 if the caller is to generate the image, 0 if it waited.
+ */
+int flight_begin(struct imgst_file* imgst_file, uint32_t index, int res, int* result, struct flight** flight);
+
+/**
+ * @brief End of a generation started by flight_begin: wakes up the
+ *        threads waiting for it.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param flight The flight set by flight_begin (no-op if NULL).
+ * @param result Error code of the generation, for the waiting threads.
+ */
+void flight_end(struct imgst_file* imgst_file, struct flight* flight, int result);
+
+/**
+ * @brief Makes the images written through the FILE* of the writer
+ *        visible to the readers (before publishing their metadata).
+ *        No-op if not in thread-safe mode.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @return Some error code. 0 if no error.
+ */
+int publish_writes(struct imgst_file* imgst_file);
+
+/**
+ * @brief Reads size bytes at offset in the imgStore file: from its
+ *        mapping if mapped (see map.h), with pread in thread-safe mode,
+ *        through its FILE* otherwise.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param offset Position in the imgStore file.
+ * @param buffer Where to read them.
+ * @param size Number of bytes.
+ * @return Some error code. 0 if no error.
+ */
+int read_at(struct imgst_file* imgst_file, uint64_t offset, void* buffer, size_t size);
@@ -0,0 +1,99 @@
+/**
+ * @file map.c
+ * @brief imgStore library: read-only access through mmap.
+ */
+
+#define _DEFAULT_SOURCE // for fileno
+
+#include "map.h"
+#include "shard.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**********************************************************************
+ * Maps the whole file, as large as it is now
+ */
+static int
+map_file (struct imgst_map* map, FILE* file)
+{
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) return ERR_IO;
+
+    void* data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fileno(file), 0);
+    if (data == MAP_FAILED) return ERR_IO;
+
+    map->data = data;
+    map->size = (uint64_t) st.st_size;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Read-only mapping
+ */
+int
+map_open (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL) return ERR_INVALID_ARGUMENT;
+
+    if (imgst_file->shards != NULL) {
+        for (uint32_t i = 0; i < imgst_file->shards->nb_shards; ++i) {
+            const int ret = map_open(&imgst_file->shards->files[i]);
+            if (ret) return ret;
+        }
+        return ERR_NONE;
+    }
+    if (imgst_file->file == NULL) return ERR_INVALID_ARGUMENT;
+    if (imgst_file->map != NULL) return ERR_NONE;
+
+    struct imgst_map* map = calloc(1, sizeof(struct imgst_map));
+    if (map == NULL) return ERR_OUT_OF_MEMORY;
+
+    const int ret = map_file(map, imgst_file->file);
+    if (ret) {
+        free(map);
+        return ret;
+    }
+    imgst_file->map = map;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Unmapping
+ */
+void
+map_close (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || imgst_file->map == NULL) return;
+
+    munmap((void*) imgst_file->map->data, (size_t) imgst_file->map->size);
+    free(imgst_file->map);
+    imgst_file->map = NULL;
+}
+
+/**********************************************************************
+ * Copy from the mapping
+ */
+int
+map_read (struct imgst_file* imgst_file, uint64_t offset, void* buffer, size_t size)
+{
+    if (imgst_file == NULL || imgst_file->map == NULL || buffer == NULL) return ERR_INVALID_ARGUMENT;
+    struct imgst_map* map = imgst_file->map;
+
+    // appended by the writer since mapped
+    if (offset + size > map->size) {
+        struct imgst_map grown;
+        const int ret = map_file(&grown, imgst_file->file);
+        if (ret) return ret;
+
+        munmap((void*) map->data, (size_t) map->size);
+        *map = grown;
+        if (offset + size > map->size) return ERR_IO;
+    }
+
+    memcpy(buffer, map->data + offset, size);
+    return ERR_NONE;
+}
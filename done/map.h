@@ -0,0 +1,55 @@
+#pragma once
+
+/**
+ * @file map.h
+ * @brief imgStore library: read-only access through mmap.
+ *
+ * An imgStore opened with "rb" may be mapped into memory: its images are
+ * then copied from the mapping rather than read through its FILE*. The
+ * mapping follows the file as it grows (another process, the writer,
+ * appending images to it).
+ *
+ * A mapped imgStore is read-only: lazily_resize fails on it with
+ * ERR_INVALID_COMMAND, the missing resized image is to be created by the
+ * writer. Its metadata are those read when opened: the ones the writer
+ * changed are to be reread (reload_metadata), or the imgStore reopened.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* mapping of an imgStore file */
+struct imgst_map {
+    const char*         data;
+    uint64_t            size;
+};
+
+/**
+ * @brief Maps an open imgStore (each of its shards) into memory.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @return Some error code. 0 if no error.
+ */
+int map_open(struct imgst_file* imgst_file);
+
+/**
+ * @brief Unmaps an imgStore (called by do_close).
+ *
+ * @param imgst_file The main in-memory data structure
+ */
+void map_close(struct imgst_file* imgst_file);
+
+/**
+ * @brief Copies size bytes at offset from the mapping, mapping the file
+ *        again if it grew past it.
+ *
+ * @param imgst_file The main in-memory data structure (mapped)
+ * @param offset Position in the imgStore file.
+ * @param buffer Where to copy them.
+ * @param size Number of bytes.
+ * @return Some error code. 0 if no error.
+ */
+int map_read(struct imgst_file* imgst_file, uint64_t offset, void* buffer, size_t size);
@@ -0,0 +1,157 @@
+/**
+ * @file metrics.c
+ * @brief imgStore server: per-route request metrics.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime and open_memstream
+
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stddef.h> // offsetof
+#include <time.h>
+
+/* upper bounds of the latency buckets, in seconds (the last one is +Inf) */
+static const double bucket_bounds[] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5
+};
+#define NB_BOUNDS (sizeof(bucket_bounds) / sizeof(bucket_bounds[0]))
+
+static const char* const route_names[NB_ROUTES] = {
+    "list", "read", "delete", "insert", "stats", "metrics", "trace", "batch_read", "static"
+};
+
+struct route_metrics {
+    uint64_t requests;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t errors[NB_ERR];
+    uint64_t buckets[NB_BOUNDS + 1];  // not cumulative, the last one for +Inf
+    double   latency_sum;             // seconds
+};
+
+static struct route_metrics metrics[NB_ROUTES];
+
+/**********************************************************************
+ * Current time
+ */
+double
+metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**********************************************************************
+ * Records a handled request
+ */
+void
+metrics_record(enum route route, int error, size_t bytes_in, size_t bytes_out, double latency)
+{
+    if (route < 0 || route >= NB_ROUTES) return;
+
+    struct route_metrics* m = &metrics[route];
+    m->requests += 1;
+    m->bytes_in += bytes_in;
+    m->bytes_out += bytes_out;
+    if (error > ERR_NONE && error < NB_ERR) m->errors[error] += 1;
+
+    const double seconds = latency / 1e9;
+    size_t bucket = 0;
+    while (bucket < NB_BOUNDS && seconds > bucket_bounds[bucket]) ++bucket;
+    m->buckets[bucket] += 1;
+    m->latency_sum += seconds;
+}
+
+/**********************************************************************
+ * One counter per route
+ */
+static void
+print_counter(FILE* out, const char* name, const char* help, size_t field)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (int r = 0; r < NB_ROUTES; ++r) {
+        const uint64_t value = *(const uint64_t*) ((const char*) &metrics[r] + field);
+        fprintf(out, "%s{route=\"%s\"} %" PRIu64 "\n", name, route_names[r], value);
+    }
+}
+
+/**********************************************************************
+ * Prometheus text format
+ */
+int
+metrics_print(FILE* out, const struct imgst_file* imgst_file)
+{
+    if (out == NULL) return ERR_INVALID_ARGUMENT;
+
+    print_counter(out, "imgstore_requests_total", "Requests handled.",
+                  offsetof(struct route_metrics, requests));
+    print_counter(out, "imgstore_received_bytes_total", "Bytes of the requests.",
+                  offsetof(struct route_metrics, bytes_in));
+    print_counter(out, "imgstore_sent_bytes_total", "Bytes of the responses.",
+                  offsetof(struct route_metrics, bytes_out));
+
+    fprintf(out, "# HELP imgstore_errors_total Requests that failed, by error code.\n"
+            "# TYPE imgstore_errors_total counter\n");
+    for (int r = 0; r < NB_ROUTES; ++r) {
+        for (int e = ERR_NONE + 1; e < NB_ERR; ++e) {
+            if (metrics[r].errors[e] == 0) continue;
+            fprintf(out, "imgstore_errors_total{route=\"%s\",code=\"%d\",message=\"%s\"} %" PRIu64 "\n",
+                    route_names[r], e, ERR_MESSAGES[e], metrics[r].errors[e]);
+        }
+    }
+
+    fprintf(out, "# HELP imgstore_request_duration_seconds Handling time of the requests.\n"
+            "# TYPE imgstore_request_duration_seconds histogram\n");
+    for (int r = 0; r < NB_ROUTES; ++r) {
+        uint64_t count = 0;
+        for (size_t b = 0; b < NB_BOUNDS; ++b) {
+            count += metrics[r].buckets[b];
+            fprintf(out, "imgstore_request_duration_seconds_bucket{route=\"%s\",le=\"%g\"} %" PRIu64 "\n",
+                    route_names[r], bucket_bounds[b], count);
+        }
+        count += metrics[r].buckets[NB_BOUNDS];
+        fprintf(out, "imgstore_request_duration_seconds_bucket{route=\"%s\",le=\"+Inf\"} %" PRIu64 "\n"
+                "imgstore_request_duration_seconds_sum{route=\"%s\"} %.9f\n"
+                "imgstore_request_duration_seconds_count{route=\"%s\"} %" PRIu64 "\n",
+                route_names[r], count, route_names[r], metrics[r].latency_sum,
+                route_names[r], count);
+    }
+
+    if (imgst_file != NULL) {
+        fprintf(out, "# HELP imgstore_files Images in the imgStore.\n"
+                "# TYPE imgstore_files gauge\n"
+                "imgstore_files %" PRIu32 "\n"
+                "# HELP imgstore_max_files Capacity of the imgStore.\n"
+                "# TYPE imgstore_max_files gauge\n"
+                "imgstore_max_files %" PRIu32 "\n"
+                "# HELP imgstore_live_bytes Bytes of images still referenced.\n"
+                "# TYPE imgstore_live_bytes gauge\n"
+                "imgstore_live_bytes %" PRIu64 "\n",
+                imgst_file->header.num_files, NB_SLOTS(imgst_file), imgst_file->header.live_bytes);
+    }
+
+    return ferror(out) ? ERR_IO : ERR_NONE;
+}
+
+/**********************************************************************
+ * Prometheus text format, into a string
+ */
+char*
+metrics_to_string(const struct imgst_file* imgst_file, size_t* size)
+{
+    if (size == NULL) return NULL;
+
+    char* text = NULL;
+    FILE* out = open_memstream(&text, size);
+    if (out == NULL) return NULL;
+
+    const int ret = metrics_print(out, imgst_file);
+    if (fclose(out) != 0 || ret != ERR_NONE) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
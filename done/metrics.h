@@ -0,0 +1,60 @@
+#pragma once
+
+/**
+ * @file metrics.h
+ * @brief imgStore server: per-route request metrics.
+ *
+ * Counters of requests, bytes and errors (by error code), and a histogram
+ * of the handling latencies, per route of the server. Recording is a few
+ * increments in static arrays, the server handling one request at a
+ * time; they are exported in the Prometheus text format
+ * (/imgStore/metrics).
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* routes of the server */
+enum route {ROUTE_LIST, ROUTE_READ, ROUTE_DELETE, ROUTE_INSERT, ROUTE_STATS,
+            ROUTE_METRICS, ROUTE_TRACE, ROUTE_BATCH_READ, ROUTE_STATIC, NB_ROUTES
+           };
+
+/**
+ * @brief Current time, for latencies.
+ *
+ * @return Time in nanoseconds, from an arbitrary origin.
+ */
+double metrics_now(void);
+
+/**
+ * @brief Records a handled request.
+ *
+ * @param route Route of the request.
+ * @param error Error code of its response (ERR_NONE if it succeeded).
+ * @param bytes_in Size of the request (header and body).
+ * @param bytes_out Size of the response queued by the handler.
+ * @param latency Handling time, in nanoseconds.
+ */
+void metrics_record(enum route route, int error, size_t bytes_in, size_t bytes_out, double latency);
+
+/**
+ * @brief Prints the metrics, and the occupancy of the imgStore, in the
+ *        Prometheus text format.
+ *
+ * @param out Where to print them.
+ * @param imgst_file The imgStore served (may be NULL).
+ * @return Some error code. 0 if no error.
+ */
+int metrics_print(FILE* out, const struct imgst_file* imgst_file);
+
+/**
+ * @brief Same as metrics_print, into a string.
+ *
+ * @param imgst_file The imgStore served (may be NULL).
+ * @param size Set to the length of the string.
+ * @return The string (to be freed by the caller), NULL on error.
+ */
+char* metrics_to_string(const struct imgst_file* imgst_file, size_t* size);
@@ -0,0 +1,331 @@
+/**
+ * @file prefork.c
+ * @brief imgStore server: pre-forked worker processes.
+ */
+
+#define _DEFAULT_SOURCE // for kill, usleep and MAP_ANONYMOUS
+
+#include "prefork.h"
+#include "map.h"
+#include "wal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* a change, followed by the image for PREFORK_INSERT */
+struct prefork_request {
+    uint32_t            op;
+    int32_t             resolution;
+    uint64_t            size;
+    char                img_id[MAX_IMG_ID + 1];
+};
+
+/* a change applied by the writer */
+struct prefork_change {
+    uint64_t            version;    // once applied
+    uint32_t            index;      // the slot changed, NO_SLOT if none
+    uint32_t            unused_32;
+};
+
+/* shared by the writer and the workers */
+struct prefork_shared {
+    uint64_t            version;    // odd while a change is being written
+    struct prefork_change changes[PREFORK_CHANGES]; // the last ones, by version
+};
+
+#define NO_SLOT UINT32_MAX
+#define CHANGE(version) (&shared->changes[((version) / 2) % PREFORK_CHANGES])
+
+static struct prefork_shared* shared;
+static uint32_t nb_workers;
+static pid_t workers[MAX_WORKERS];
+static int sockets[MAX_WORKERS];    // writer's ends
+static int writer_socket = -1;      // worker's end
+static uint64_t loaded_version = 1; // never even: not loaded yet
+static int opened;                  // the imgStore of the worker
+
+/**********************************************************************
+ * Whole reads and writes on a socket
+ */
+static int
+read_full (int fd, void* buf, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t n = read(fd, (char*) buf + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return ERR_IO;
+        done += (size_t) n;
+    }
+    return ERR_NONE;
+}
+
+static int
+write_full (int fd, const void* buf, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t n = write(fd, (const char*) buf + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return ERR_IO;
+        done += (size_t) n;
+    }
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Workers
+ */
+int
+prefork_spawn (uint32_t nb, int* worker)
+{
+    if (nb == 0 || nb > MAX_WORKERS || worker == NULL) return ERR_INVALID_ARGUMENT;
+
+    shared = mmap(NULL, sizeof(struct prefork_shared), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) return ERR_OUT_OF_MEMORY;
+    shared->version = 0;
+
+    for (uint32_t i = 0; i < nb; ++i) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) return ERR_IO;
+
+        const pid_t pid = fork();
+        if (pid < 0) return ERR_IO;
+
+        if (pid == 0) {
+            // a worker only keeps its end
+            for (uint32_t j = 0; j < i; ++j) close(sockets[j]);
+            close(pair[0]);
+            writer_socket = pair[1];
+            nb_workers = 0;
+            *worker = (int) i;
+            return ERR_NONE;
+        }
+
+        close(pair[1]);
+        sockets[i] = pair[0];
+        workers[i] = pid;
+        nb_workers = i + 1;
+    }
+    *worker = -1;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * A change, in the writer
+ */
+static int
+apply_request (struct imgst_file* imgst_file, int fd)
+{
+    struct prefork_request request;
+    int ret = read_full(fd, &request, sizeof(request));
+    if (ret) return ret;
+    request.img_id[MAX_IMG_ID] = '\0';
+
+    char* buffer = NULL;
+    if (request.op == PREFORK_INSERT) {
+        buffer = malloc(request.size > 0 ? request.size : 1);
+        if (buffer == NULL) {
+            // the image is skipped all the same
+            char skipped[4096];
+            for (uint64_t left = request.size; ret == ERR_NONE && left > 0; ) {
+                const size_t n = left < sizeof(skipped) ? (size_t) left : sizeof(skipped);
+                ret = read_full(fd, skipped, n);
+                left -= n;
+            }
+            int32_t result = ERR_OUT_OF_MEMORY;
+            return ret ? ret : write_full(fd, &result, sizeof(result));
+        }
+        ret = read_full(fd, buffer, request.size);
+        if (ret) {
+            free(buffer);
+            return ret;
+        }
+    }
+
+    // its slot, before it is emptied
+    uint32_t deleted = NO_SLOT;
+    if (request.op == PREFORK_DELETE && find_img(imgst_file, request.img_id, &deleted) != ERR_NONE) {
+        deleted = NO_SLOT;
+    }
+
+    // odd until written in place
+    const uint64_t version = __atomic_add_fetch(&shared->version, 1, __ATOMIC_RELEASE) + 1;
+
+    int32_t result = ERR_NONE;
+    switch (request.op) {
+    case PREFORK_INSERT:
+        result = do_insert(buffer, request.size, request.img_id, imgst_file);
+        break;
+    case PREFORK_DELETE:
+        result = do_delete(request.img_id, imgst_file);
+        break;
+    case PREFORK_RESIZE: {
+        // created by do_read, as in a single process
+        char* image = NULL;
+        uint32_t image_size = 0;
+        result = do_read(request.img_id, request.resolution, &image, &image_size, imgst_file);
+        free(image);
+        break;
+    }
+    default:
+        result = ERR_INVALID_COMMAND;
+    }
+    free(buffer);
+
+    // the slot changed, for the workers to reread it
+    uint32_t index = deleted;
+    if (request.op != PREFORK_DELETE && find_img(imgst_file, request.img_id, &index) != ERR_NONE) index = NO_SLOT;
+
+    const int sync = wal_sync(imgst_file);
+    if (fflush(imgst_file->file) != 0 && result == ERR_NONE) result = ERR_IO;
+    if (result == ERR_NONE) result = sync;
+
+    // a failed change is not described: the workers reopen the imgStore
+    struct prefork_change* change = CHANGE(version);
+    change->index = index;
+    __atomic_store_n(&change->version, result == ERR_NONE ? version : 0, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&shared->version, 1, __ATOMIC_RELEASE);
+
+    return write_full(fd, &result, sizeof(result));
+}
+
+/**********************************************************************
+ * Loop of the writer
+ */
+int
+prefork_serve (struct imgst_file* imgst_file, volatile int* stop)
+{
+    if (imgst_file == NULL || stop == NULL) return ERR_INVALID_ARGUMENT;
+
+    struct pollfd fds[MAX_WORKERS];
+    uint32_t alive = nb_workers;
+    for (uint32_t i = 0; i < nb_workers; ++i) {
+        fds[i].fd = sockets[i];
+        fds[i].events = POLLIN;
+    }
+
+    while (!*stop && alive > 0) {
+        const int ready = poll(fds, nb_workers, 1000);
+        if (ready < 0 && errno != EINTR) break;
+
+        for (uint32_t i = 0; ready > 0 && i < nb_workers; ++i) {
+            if (fds[i].fd >= 0 && fds[i].revents != 0 && apply_request(imgst_file, fds[i].fd) != ERR_NONE) {
+                // the worker is gone: its socket is not polled any more
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                --alive;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < nb_workers; ++i) {
+        kill(workers[i], SIGTERM);
+        if (fds[i].fd >= 0) close(fds[i].fd);
+    }
+    for (uint32_t i = 0; i < nb_workers; ++i) {
+        waitpid(workers[i], NULL, 0);
+    }
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * A change, forwarded by a worker
+ */
+int
+prefork_forward (enum prefork_op op, const char* img_id, int resolution,
+                 const char* buffer, size_t size)
+{
+    if (img_id == NULL || strlen(img_id) > MAX_IMG_ID) return ERR_INVALID_IMGID;
+    if (writer_socket < 0) return ERR_INVALID_COMMAND;
+
+    struct prefork_request request;
+    memset(&request, 0, sizeof(request));
+    request.op = (uint32_t) op;
+    request.resolution = resolution;
+    request.size = op == PREFORK_INSERT ? size : 0;
+    strcpy(request.img_id, img_id);
+
+    int ret = write_full(writer_socket, &request, sizeof(request));
+    if (ret == ERR_NONE && op == PREFORK_INSERT) ret = write_full(writer_socket, buffer, size);
+
+    int32_t result = ERR_IO;
+    if (ret == ERR_NONE) ret = read_full(writer_socket, &result, sizeof(result));
+    return ret ? ret : result;
+}
+
+/**********************************************************************
+ * Rereading of the slots changed since loaded_version, if all of them
+ * are still described
+ */
+static int
+reload_changes (struct imgst_file* imgst_file, uint64_t version)
+{
+    if (!opened || loaded_version % 2 == 1 || version - loaded_version > 2 * PREFORK_CHANGES) {
+        return ERR_INVALID_COMMAND;
+    }
+
+    uint32_t indexes[PREFORK_CHANGES];
+    uint32_t nb = 0;
+    for (uint64_t v = loaded_version + 2; v <= version; v += 2) {
+        const struct prefork_change* change = CHANGE(v);
+        if (__atomic_load_n(&change->version, __ATOMIC_ACQUIRE) != v) return ERR_INVALID_COMMAND;
+        if (change->index != NO_SLOT) indexes[nb++] = change->index;
+    }
+    return reload_metadata(imgst_file, indexes, nb);
+}
+
+/**********************************************************************
+ * Refreshing of the imgStore of a worker
+ */
+int
+prefork_refresh (const char* imgst_filename, struct imgst_file* imgst_file)
+{
+    if (imgst_filename == NULL || imgst_file == NULL || shared == NULL) return ERR_INVALID_ARGUMENT;
+
+    for (;;) {
+        const uint64_t version = __atomic_load_n(&shared->version, __ATOMIC_ACQUIRE);
+        if (version == loaded_version) return ERR_NONE;
+        if (version % 2 == 1) {
+            // being written: shortly done
+            usleep(100);
+            continue;
+        }
+
+        // only the changed header and slots, unless changed again meanwhile
+        if (reload_changes(imgst_file, version) == ERR_NONE) {
+            if (__atomic_load_n(&shared->version, __ATOMIC_ACQUIRE) == version) {
+                loaded_version = version;
+                return ERR_NONE;
+            }
+            // half-read, maybe: reopened
+        }
+
+        if (opened) do_close(imgst_file);
+        opened = 0;
+        loaded_version = 1;
+
+        int ret = do_open(imgst_filename, "rb", imgst_file);
+        if (ret == ERR_NONE) ret = map_open(imgst_file);
+        if (ret) {
+            do_close(imgst_file);
+            return ret;
+        }
+        opened = 1;
+
+        // changed while loaded: again
+        if (__atomic_load_n(&shared->version, __ATOMIC_ACQUIRE) == version) {
+            loaded_version = version;
+        }
+    }
+}
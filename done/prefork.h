@@ -0,0 +1,82 @@
+#pragma once
+
+/**
+ * @file prefork.h
+ * @brief imgStore server: pre-forked worker processes.
+ *
+ * With -workers N, imgStore_server forks N worker processes which all
+ * accept connections on the listening socket opened before the fork.
+ * Each worker opens the imgStore read-only and maps it (see map.h), so
+ * that reads scale with the cores without any lock.
+ *
+ * The parent process is the only writer: the workers forward it the
+ * insertions, the deletions and the creations of resized images, one
+ * request at a time over a socketpair, and wait for its answer. After
+ * each change, applied in place (wal_sync) and flushed, the writer bumps
+ * a version shared with the workers, along with the slot it changed.
+ * Before their next request, the workers reread the header and the slots
+ * changed since they last looked (prefork_refresh), and only reopen the
+ * imgStore when too many changes were missed, one failed or the table
+ * was grown. The version is odd while a change is being written, so that
+ * a worker never loads half of it.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MAX_WORKERS 64
+#define PREFORK_CHANGES 256 // changes described to the workers
+
+/* changes forwarded to the writer */
+enum prefork_op {
+    PREFORK_INSERT,
+    PREFORK_DELETE,
+    PREFORK_RESIZE
+};
+
+/**
+ * @brief Forks the workers.
+ *
+ * @param nb_workers Number of workers (at most MAX_WORKERS)
+ * @param worker Set to the index of the worker in the workers, to -1 in
+ *        the writer.
+ * @return Some error code. 0 if no error.
+ */
+int prefork_spawn(uint32_t nb_workers, int* worker);
+
+/**
+ * @brief Loop of the writer: applies the changes forwarded by the
+ *        workers until *stop, then terminates them.
+ *
+ * @param imgst_file The imgStore, open for writing
+ * @param stop Set by a signal handler
+ * @return Some error code. 0 if no error.
+ */
+int prefork_serve(struct imgst_file* imgst_file, volatile int* stop);
+
+/**
+ * @brief Forwards a change to the writer (in a worker) and waits for it.
+ *
+ * @param op The change
+ * @param img_id The image id
+ * @param resolution For PREFORK_RESIZE: the resolution to create
+ * @param buffer For PREFORK_INSERT: the image
+ * @param size For PREFORK_INSERT: its size
+ * @return The error code of the writer.
+ */
+int prefork_forward(enum prefork_op op, const char* img_id, int resolution,
+                    const char* buffer, size_t size);
+
+/**
+ * @brief Rereads the changed header and slots of the imgStore of a
+ *        worker, if it changed since it was loaded, or reopens it
+ *        read-only and mapped. Opens it the first time.
+ *
+ * @param imgst_filename Path to the imgStore
+ * @param imgst_file The imgStore of the worker
+ * @return Some error code. 0 if no error.
+ */
+int prefork_refresh(const char* imgst_filename, struct imgst_file* imgst_file);
@@ -0,0 +1,253 @@
+/**
+ * @file replog.c
+ * @brief imgStore library: change log of an imgStore, for its replicas.
+ */
+
+#define _DEFAULT_SOURCE // for nanosleep
+
+#include "replog.h"
+#include "image_content.h"
+#include "shard.h"
+#include "wal.h"
+#include "lock.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+/**********************************************************************
+ * Path of the change log of an imgStore
+ */
+static char*
+replog_path (const char* imgst_filename)
+{
+    char* path = malloc(strlen(imgst_filename) + sizeof(REPLOG_SUFFIX));
+    if (path == NULL) return NULL;
+
+    strcpy(path, imgst_filename);
+    strcat(path, REPLOG_SUFFIX);
+    return path;
+}
+
+/**********************************************************************
+ * Opening of the change log
+ */
+int
+replog_init (struct imgst_file* imgst_file, const char* imgst_filename)
+{
+    if (imgst_file == NULL || imgst_filename == NULL) return ERR_INVALID_ARGUMENT;
+    if (!(imgst_file->header.features & IMGST_REPLOG)) return ERR_NONE;
+
+    struct imgst_replog* replog = calloc(1, sizeof(struct imgst_replog));
+    if (replog == NULL) return ERR_OUT_OF_MEMORY;
+
+    replog->path = replog_path(imgst_filename);
+    replog->file = replog->path == NULL ? NULL : fopen(replog->path, "ab");
+    if (replog->file == NULL) {
+        const int ret = replog->path == NULL ? ERR_OUT_OF_MEMORY : ERR_IO;
+        free(replog->path);
+        free(replog);
+        return ret;
+    }
+
+    imgst_file->replog = replog;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Closing of the change log
+ */
+void
+replog_close (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || imgst_file->replog == NULL) return;
+
+    fclose(imgst_file->replog->file);
+    free(imgst_file->replog->path);
+    free(imgst_file->replog);
+    imgst_file->replog = NULL;
+}
+
+/**********************************************************************
+ * Removal of the change log
+ */
+int
+replog_remove (const char* imgst_filename)
+{
+    if (imgst_filename == NULL) return ERR_INVALID_ARGUMENT;
+
+    char* path = replog_path(imgst_filename);
+    if (path == NULL) return ERR_OUT_OF_MEMORY;
+
+    const int ret = unlink(path) == 0 || errno == ENOENT ? ERR_NONE : ERR_IO;
+    free(path);
+    return ret;
+}
+
+/**********************************************************************
+ * Logging of a change
+ */
+int
+replog_append (struct imgst_file* imgst_file, int op, int res, const char* img_id,
+               const void* image, uint32_t size)
+{
+    if (imgst_file == NULL || imgst_file->replog == NULL) return ERR_NONE;
+    if (img_id == NULL || (image == NULL && size > 0)) return ERR_INVALID_ARGUMENT;
+
+    struct replog_record record;
+    memset(&record, 0, sizeof(record));
+    record.magic = REPLOG_MAGIC;
+    record.version = HEADER_GET(imgst_file, imgst_version);
+    record.op = (uint16_t) op;
+    record.res = (uint16_t) res;
+    record.size = size;
+    strncpy(record.img_id, img_id, MAX_IMG_ID);
+
+    // visible to the followers at once
+    FILE* file = imgst_file->replog->file;
+    if (fwrite(&record, sizeof(record), 1, file) != 1
+        || (size > 0 && fwrite(image, size, 1, file) != 1)
+        || fflush(file) != 0) {
+        return ERR_IO;
+    }
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Applies a record to the replica, unless already applied (*applied
+ * then left to 0)
+ */
+static int
+apply_record (const struct replog_record* record, const char* image, struct imgst_file* replica,
+              int* applied)
+{
+    const uint32_t version = HEADER_GET(replica, imgst_version);
+    *applied = 0;
+
+    switch (record->op) {
+    case REPLOG_INSERT:
+        // already applied before the follower was stopped
+        if (record->version <= version) return ERR_NONE;
+        *applied = 1;
+        return do_insert(image, record->size, record->img_id, replica);
+
+    case REPLOG_DELETE:
+        if (record->version <= version) return ERR_NONE;
+        *applied = 1;
+        return do_delete(record->img_id, replica);
+
+    case REPLOG_RESIZED: {
+        // those after the change of the version of the replica may have
+        // been applied or not
+        if (record->version < version) return ERR_NONE;
+
+        uint32_t index = 0;
+        const int ret = find_img(replica, record->img_id, &index);
+        if (ret) return ret;
+
+        // already attached, e.g. before the follower was stopped
+        const struct metadata_table* table = load_metadata(replica, index);
+        if (table == NULL) return ERR_IO;
+        if (SLOT_OFFSET(table, index, record->res) != 0) return ERR_NONE;
+        *applied = 1;
+        return attach_resized(record->res, replica, index, image, record->size);
+    }
+
+    default:
+        return ERR_IO;
+    }
+}
+
+/**********************************************************************
+ * Waits for the log to grow
+ */
+static void
+wait_poll (void)
+{
+    const struct timespec delay = { .tv_sec = 0, .tv_nsec = REPLOG_POLL_MS * 1000000L };
+    nanosleep(&delay, NULL);
+}
+
+/**********************************************************************
+ * Reads the next record of the log and its image; 0 with *complete set
+ * to 0 if it is not fully written yet
+ */
+static int
+read_record (FILE* file, struct replog_record* record, char** image, int* complete)
+{
+    *complete = 0;
+    *image = NULL;
+
+    if (fread(record, sizeof(struct replog_record), 1, file) != 1) {
+        return ferror(file) ? ERR_IO : ERR_NONE;
+    }
+    if (record->magic != REPLOG_MAGIC || record->res >= NB_RES) return ERR_IO;
+    record->img_id[MAX_IMG_ID] = '\0';
+
+    *image = malloc(record->size > 0 ? record->size : 1);
+    if (*image == NULL) return ERR_OUT_OF_MEMORY;
+
+    if (record->size > 0 && fread(*image, record->size, 1, file) != 1) {
+        free(*image);
+        *image = NULL;
+        return ferror(file) ? ERR_IO : ERR_NONE;
+    }
+    *complete = 1;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Following of the change log
+ */
+int
+replog_follow (const char* imgst_filename, struct imgst_file* replica, int once,
+               volatile sig_atomic_t* stop, uint64_t* applied)
+{
+    if (imgst_filename == NULL || replica == NULL || stop == NULL) return ERR_INVALID_ARGUMENT;
+    if (replica->shards != NULL || replica->file == NULL) return ERR_INVALID_ARGUMENT;
+    if (applied != NULL) *applied = 0;
+
+    char* path = replog_path(imgst_filename);
+    if (path == NULL) return ERR_OUT_OF_MEMORY;
+
+    FILE* file = NULL;
+    int ret = ERR_NONE;
+    while (ret == ERR_NONE && !*stop) {
+        // no change logged yet
+        if (file == NULL && (file = fopen(path, "rb")) == NULL) {
+            if (errno != ENOENT) ret = ERR_IO;
+            else if (once) break;
+            else wait_poll();
+            continue;
+        }
+
+        const long int position = ftell(file);
+        struct replog_record record;
+        char* image = NULL;
+        int complete = 0;
+        ret = read_record(file, &record, &image, &complete);
+
+        if (ret == ERR_NONE && complete) {
+            int done = 0;
+            ret = apply_record(&record, image, replica, &done);
+            if (ret == ERR_NONE && done && applied != NULL) ++*applied;
+        } else if (ret == ERR_NONE) {
+            // the end of the log, or a record being written: read it again
+            clearerr(file);
+            if (position < 0 || fseek(file, position, SEEK_SET) != 0) ret = ERR_IO;
+            // the changes applied are committed while waiting
+            if (ret == ERR_NONE) ret = wal_sync(replica);
+            if (once) break;
+            wait_poll();
+        }
+        free(image);
+    }
+
+    if (file != NULL) fclose(file);
+    free(path);
+
+    const int sync = wal_sync(replica);
+    return ret ? ret : sync;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+/**
+ * @file replog.h
+ * @brief imgStore library: change log of an imgStore, for its replicas.
+ *
+ * An imgStore created with the IMGST_REPLOG feature logs each of its
+ * changes, once committed, at the end of a change log next to it
+ * (<imgStore>.log): the images inserted (their original), the images
+ * deleted and the resized images added. Each record carries the
+ * imgst_version of the imgStore after the change (unchanged by a
+ * resized image), which numbers the inserts and deletes: do_gbcollect
+ * keeps the version of such an imgStore.
+ *
+ * A replica follows the log (replog_follow): it applies the records in
+ * order, skipping the inserts and deletes up to its own version, so that
+ * a follower can be stopped and started again. A replica is an imgStore
+ * with the settings of the original one, empty when it starts to follow
+ * it from the beginning of its log.
+ *
+ * The log is only appended to (it is never emptied): it is the whole
+ * history of the imgStore since its creation.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+
+#define REPLOG_SUFFIX ".log"
+#define REPLOG_MAGIC 0x31504552 // "REP1"
+
+/* the follower checks the log for new records every REPLOG_POLL_MS */
+#define REPLOG_POLL_MS 100
+
+/* changes logged */
+#define REPLOG_INSERT  1
+#define REPLOG_DELETE  2
+#define REPLOG_RESIZED 3
+
+struct replog_record {
+
+    uint32_t 		magic; // REPLOG_MAGIC
+    uint32_t 		version; // imgst_version de l'imgStore après la modification
+    uint16_t 		op; // modification (REPLOG_INSERT / REPLOG_DELETE / REPLOG_RESIZED)
+    uint16_t 		res; // résolution de l'image qui suit (RES_ORIG pour REPLOG_INSERT)
+    uint32_t 		size; // taille de l'image qui suit, 0 si aucune
+    char 			img_id[MAX_IMG_ID + 1]; // (nom) de l'image
+
+};
+
+/* change log of an imgStore open for writing */
+struct imgst_replog {
+    char*           path;
+    FILE*           file;
+};
+
+/**
+ * @brief Opens the change log of an imgStore open for writing, if it has
+ *        the IMGST_REPLOG feature (called by do_open).
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param imgst_filename Path to the imgStore file
+ * @return Some error code. 0 if no error.
+ */
+int replog_init(struct imgst_file* imgst_file, const char* imgst_filename);
+
+/**
+ * @brief Closes the change log (called by do_close).
+ *
+ * @param imgst_file The main in-memory data structure
+ */
+void replog_close(struct imgst_file* imgst_file);
+
+/**
+ * @brief Removes the change log of an imgStore, if any (a new imgStore
+ *        starts a new history).
+ *
+ * @param imgst_filename Path to the imgStore file
+ * @return Some error code. 0 if no error.
+ */
+int replog_remove(const char* imgst_filename);
+
+/**
+ * @brief Logs a change committed (under the writer lock). No-op if the
+ *        imgStore has no change log.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param op REPLOG_INSERT, REPLOG_DELETE or REPLOG_RESIZED.
+ * @param res Resolution of the image.
+ * @param img_id The ID of the image.
+ * @param image The image (inserted or resized), NULL for a delete.
+ * @param size Its size.
+ * @return Some error code. 0 if no error.
+ */
+int replog_append(struct imgst_file* imgst_file, int op, int res, const char* img_id,
+                  const void* image, uint32_t size);
+
+/**
+ * @brief Applies the change log of an imgStore to a replica, then waits
+ *        for its new records until *stop is set.
+ *
+ * @param imgst_filename Path to the followed imgStore file
+ * @param replica The replica (opened "rb+")
+ * @param once Non zero to return once the end of the log is reached.
+ * @param stop Set (e.g. by a signal handler) to stop following.
+ * @param applied Set to the number of records applied (may be NULL).
+ * @return Some error code. 0 if no error.
+ */
+int replog_follow(const char* imgst_filename, struct imgst_file* replica, int once,
+                  volatile sig_atomic_t* stop, uint64_t* applied);
@@ -0,0 +1,237 @@
+/**
+ * @file scan.c
+ * @brief imgStore library: sequential scan of the images of an imgStore.
+ */
+
+#define _DEFAULT_SOURCE // for fileno, posix_fadvise
+
+#include "scan.h"
+#include "shard.h"
+#include "lock.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+
+struct imgst_scan {
+    int                 resolution;
+    struct scan_image*  images;     // sorted by file, then by position
+    size_t              nb_images;
+    size_t              next;
+
+    // the part of the file read ahead
+    char*               window;
+    struct imgst_file*  window_file;
+    uint64_t            window_offset;
+    size_t              window_size;
+
+    // an image larger than the window
+    char*               large;
+};
+
+/**********************************************************************
+ * Copies the metadata of the valid images of some slots of a file
+ */
+static int
+collect_images (struct imgst_scan* scan, struct imgst_file* imgst_file, uint32_t first, uint32_t end)
+{
+    if (imgst_file->file == NULL) return ERR_IO;
+
+    for (uint32_t i = first; i < end; ++i) {
+        struct img_metadata metadata;
+        lock_slot(imgst_file, i, 0);
+        const int ret = get_metadata(imgst_file, i, &metadata);
+        unlock_slot(imgst_file, i);
+        if (ret) return ret;
+
+        if (metadata.is_valid != NON_EMPTY || metadata.offset[scan->resolution] == 0) continue;
+
+        if ((scan->nb_images & (scan->nb_images - 1)) == 0) {
+            // a power of 2 (or 0): doubled
+            const size_t capacity = scan->nb_images == 0 ? 16 : scan->nb_images * 2;
+            struct scan_image* images = realloc(scan->images, capacity * sizeof(struct scan_image));
+            if (images == NULL) return ERR_OUT_OF_MEMORY;
+            scan->images = images;
+        }
+
+        struct scan_image* image = &scan->images[scan->nb_images++];
+        memset(image, 0, sizeof(struct scan_image));
+        image->metadata = metadata;
+        image->index = i;
+        image->file = imgst_file;
+        image->offset = metadata.offset[scan->resolution];
+        image->size = metadata.size[scan->resolution];
+    }
+
+    // read from start to end
+    posix_fadvise(fileno(imgst_file->file), 0, 0, POSIX_FADV_SEQUENTIAL);
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Order of a scan: by file, then by position
+ */
+static int
+image_cmp (const void* a, const void* b)
+{
+    const struct scan_image* first = a;
+    const struct scan_image* second = b;
+
+    if (first->file != second->file) return first->file < second->file ? -1 : 1;
+    if (first->offset != second->offset) return first->offset < second->offset ? -1 : 1;
+    return 0;
+}
+
+/**********************************************************************
+ * End of the opening of a scan, its images collected (or not, if ret)
+ */
+static int
+start_scan (struct imgst_scan* new, int ret, struct imgst_scan** scan)
+{
+    if (ret == ERR_NONE) {
+        new->window = malloc(SCAN_WINDOW);
+        if (new->window == NULL) ret = ERR_OUT_OF_MEMORY;
+    }
+    if (ret) {
+        scan_close(new);
+        return ret;
+    }
+
+    qsort(new->images, new->nb_images, sizeof(struct scan_image), image_cmp);
+
+    *scan = new;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Opening of a scan
+ */
+int
+scan_open (struct imgst_file* imgst_file, int resolution, struct imgst_scan** scan)
+{
+    if (imgst_file == NULL || scan == NULL) return ERR_INVALID_ARGUMENT;
+    if (resolution != RES_THUMB && resolution != RES_SMALL && resolution != RES_ORIG) return ERR_RESOLUTIONS;
+
+    struct imgst_scan* new = calloc(1, sizeof(struct imgst_scan));
+    if (new == NULL) return ERR_OUT_OF_MEMORY;
+    new->resolution = resolution;
+
+    const uint32_t nb_files = imgst_file->shards != NULL ? imgst_file->shards->nb_shards : 1;
+    struct imgst_file* files = imgst_file->shards != NULL ? imgst_file->shards->files : imgst_file;
+
+    // the images of one version (as a snapshot, see snapshot.h)
+    for (uint32_t i = 0; i < nb_files; ++i) lock_writer(&files[i]);
+
+    int ret = ERR_NONE;
+    for (uint32_t i = 0; ret == ERR_NONE && i < nb_files; ++i) {
+        ret = collect_images(new, &files[i], 0, NB_SLOTS(&files[i]));
+    }
+
+    for (uint32_t i = nb_files; i > 0; --i) unlock_writer(&files[i - 1]);
+
+    return start_scan(new, ret, scan);
+}
+
+/**********************************************************************
+ * Opening of a scan of some slots
+ */
+int
+scan_open_slots (struct imgst_file* imgst_file, int resolution, uint32_t first, uint32_t end,
+                 struct imgst_scan** scan)
+{
+    if (imgst_file == NULL || scan == NULL) return ERR_INVALID_ARGUMENT;
+    if (imgst_file->shards != NULL || first > end || end > NB_SLOTS(imgst_file)) return ERR_INVALID_ARGUMENT;
+    if (resolution != RES_THUMB && resolution != RES_SMALL && resolution != RES_ORIG) return ERR_RESOLUTIONS;
+
+    struct imgst_scan* new = calloc(1, sizeof(struct imgst_scan));
+    if (new == NULL) return ERR_OUT_OF_MEMORY;
+    new->resolution = resolution;
+
+    lock_writer(imgst_file);
+    const int ret = collect_images(new, imgst_file, first, end);
+    unlock_writer(imgst_file);
+
+    return start_scan(new, ret, scan);
+}
+
+/**********************************************************************
+ * Reads the window starting at an image: as many of the following
+ * images (of the same file) as fit in it
+ */
+static int
+read_window (struct imgst_scan* scan, size_t first)
+{
+    const struct scan_image* image = &scan->images[first];
+    const uint64_t start = image->offset;
+
+    uint64_t end = start + image->size;
+    for (size_t i = first + 1; i < scan->nb_images && scan->images[i].file == image->file; ++i) {
+        const uint64_t image_end = scan->images[i].offset + scan->images[i].size;
+        if (image_end - start > SCAN_WINDOW) break;
+        if (image_end > end) end = image_end;
+    }
+
+    scan->window_file = NULL;
+    const int ret = read_at(image->file, start, scan->window, (size_t) (end - start));
+    if (ret) return ret;
+
+    scan->window_file = image->file;
+    scan->window_offset = start;
+    scan->window_size = (size_t) (end - start);
+
+    // the next window is read by the kernel while this one is used
+    posix_fadvise(fileno(image->file->file), (off_t) end, SCAN_WINDOW, POSIX_FADV_WILLNEED);
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Next image of a scan
+ */
+int
+scan_next (struct imgst_scan* scan, const struct scan_image** image)
+{
+    if (scan == NULL || image == NULL) return ERR_INVALID_ARGUMENT;
+
+    *image = NULL;
+    if (scan->next == scan->nb_images) return ERR_NONE;
+
+    struct scan_image* next = &scan->images[scan->next];
+    const uint64_t offset = next->offset;
+    const uint32_t size = next->size;
+
+    if (size > SCAN_WINDOW) {
+        char* large = realloc(scan->large, size);
+        if (large == NULL) return ERR_OUT_OF_MEMORY;
+        scan->large = large;
+
+        const int ret = read_at(next->file, offset, scan->large, size);
+        if (ret) return ret;
+        next->buffer = scan->large;
+    } else {
+        if (next->file != scan->window_file || offset < scan->window_offset
+            || offset + size > scan->window_offset + scan->window_size) {
+            const int ret = read_window(scan, scan->next);
+            if (ret) return ret;
+        }
+        next->buffer = scan->window + (offset - scan->window_offset);
+    }
+
+    ++scan->next;
+    *image = next;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Closing of a scan
+ */
+void
+scan_close (struct imgst_scan* scan)
+{
+    if (scan == NULL) return;
+
+    free(scan->images);
+    free(scan->window);
+    free(scan->large);
+    free(scan);
+}
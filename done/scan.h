@@ -0,0 +1,84 @@
+#pragma once
+
+/**
+ * @file scan.h
+ * @brief imgStore library: sequential scan of the images of an imgStore.
+ *
+ * The slots of the metadata are in no particular order with respect to
+ * the positions of their images in the file: a pass over the whole
+ * imgStore in slot order (gc, export, verification) seeks all over it.
+ * A scan yields the valid images in ascending order of their positions
+ * instead (shard by shard), reading the file ahead by windows of
+ * SCAN_WINDOW bytes: the whole pass is a single sweep of the file.
+ *
+ * do_gbcollect scans the slots by batches (scan_open_slots): it reads
+ * the images of a batch in the order of their positions, then copies
+ * them in the order of their slots, the layout of the compacted imgStore.
+ *
+ * The images scanned are those valid when the scan is opened (their
+ * metadata are copied then, under the writer locks: those of a single
+ * version, see snapshot.h): a scan is not disturbed by the images
+ * inserted or deleted meanwhile, their blobs staying in the file until
+ * a garbage collection.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SCAN_WINDOW (4u << 20) // bytes read at a time
+
+/* an image yielded by scan_next */
+struct scan_image {
+    struct img_metadata metadata; // of its slot, when the scan was opened
+    uint32_t            index;    // index of its slot (in its shard)
+    struct imgst_file*  file;     // its imgStore (its shard if sharded)
+    uint64_t            offset;   // its position in that file, at the resolution of the scan
+    uint32_t            size;     // its size
+    const char*         buffer;   // its content, until the next scan_next
+};
+
+struct imgst_scan;
+
+/**
+ * @brief Opens a scan of the valid images of an imgStore, at a given
+ *        resolution (the images not yet resized to it are skipped).
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param resolution RES_THUMB, RES_SMALL or RES_ORIG.
+ * @param scan Set to the scan (to be closed with scan_close).
+ * @return Some error code. 0 if no error.
+ */
+int scan_open(struct imgst_file* imgst_file, int resolution, struct imgst_scan** scan);
+
+/**
+ * @brief Opens a scan of the valid images of some slots of an imgStore
+ *        which is not sharded (see scan_open).
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param resolution RES_THUMB, RES_SMALL or RES_ORIG.
+ * @param first Index of the first slot scanned.
+ * @param end Index of the slot after the last one scanned.
+ * @param scan Set to the scan (to be closed with scan_close).
+ * @return Some error code. 0 if no error.
+ */
+int scan_open_slots(struct imgst_file* imgst_file, int resolution, uint32_t first, uint32_t end,
+                    struct imgst_scan** scan);
+
+/**
+ * @brief Next image of a scan.
+ *
+ * @param scan The scan.
+ * @param image Set to the image, NULL once all of them were yielded.
+ * @return Some error code. 0 if no error.
+ */
+int scan_next(struct imgst_scan* scan, const struct scan_image** image);
+
+/**
+ * @brief Closes a scan.
+ *
+ * @param scan The scan (may be NULL).
+ */
+void scan_close(struct imgst_scan* scan);
@@ -0,0 +1,329 @@
+/**
+ * @file scrub.c
+ * @brief imgStore library: verification of all the images of an imgStore.
+ */
+
+#define _DEFAULT_SOURCE // for fileno, pread, posix_fadvise
+
+#include "scrub.h"
+#include "checksum.h"
+#include "shard.h"
+#include "lock.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <openssl/sha.h>
+
+/* outcome of the verification of a blob */
+#define BLOB_OK         0
+#define BLOB_CORRUPTED  1
+#define BLOB_UNREADABLE 2
+
+/* a blob of an image, at a resolution */
+struct scrub_blob {
+    struct imgst_file*  file;       // its imgStore (its shard if sharded)
+    uint64_t            offset;
+    uint32_t            size;
+    uint32_t            image;      // in scrub.images
+    int                 resolution;
+    int                 status;     // BLOB_*
+};
+
+struct scrub {
+    struct img_metadata*    images;
+    uint32_t                nb_images;
+    uint32_t                images_capacity;
+    struct scrub_blob*      blobs;
+    size_t                  nb_blobs;
+    size_t                  blobs_capacity;
+};
+
+/* consecutive blobs verified by a thread */
+struct scrub_range {
+    const struct scrub*     scrub;
+    struct scrub_blob*      blobs;
+    size_t                  nb_blobs;
+    uint64_t                nb_verified;    // distinct blobs
+    uint64_t                bytes;
+    int                     error;
+};
+
+/**********************************************************************
+ * Copies the valid images of a file and lists their blobs (under its
+ * writer lock)
+ */
+static int
+collect_blobs (struct scrub* scrub, struct imgst_file* imgst_file)
+{
+    if (imgst_file->file == NULL) return ERR_IO;
+
+    for (uint32_t i = 0; i < NB_SLOTS(imgst_file); ++i) {
+        struct img_metadata metadata;
+        const int ret = get_metadata(imgst_file, i, &metadata);
+        if (ret) return ret;
+        if (metadata.is_valid != NON_EMPTY) continue;
+
+        if (scrub->nb_images == scrub->images_capacity) {
+            scrub->images_capacity = scrub->images_capacity == 0 ? 16 : scrub->images_capacity * 2;
+            struct img_metadata* images = realloc(scrub->images, scrub->images_capacity * sizeof(struct img_metadata));
+            if (images == NULL) return ERR_OUT_OF_MEMORY;
+            scrub->images = images;
+        }
+        if (scrub->nb_blobs + NB_RES > scrub->blobs_capacity) {
+            scrub->blobs_capacity = scrub->blobs_capacity == 0 ? 64 : scrub->blobs_capacity * 2;
+            struct scrub_blob* blobs = realloc(scrub->blobs, scrub->blobs_capacity * sizeof(struct scrub_blob));
+            if (blobs == NULL) return ERR_OUT_OF_MEMORY;
+            scrub->blobs = blobs;
+        }
+
+        for (int res = 0; res < NB_RES; ++res) {
+            if (metadata.offset[res] == 0) continue;
+
+            struct scrub_blob* blob = &scrub->blobs[scrub->nb_blobs++];
+            blob->file = imgst_file;
+            blob->offset = metadata.offset[res];
+            blob->size = metadata.size[res];
+            blob->image = scrub->nb_images;
+            blob->resolution = res;
+            blob->status = BLOB_OK;
+        }
+        scrub->images[scrub->nb_images++] = metadata;
+    }
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Order of the blobs: by file, then by position in the file (the
+ * duplicates sharing one being then consecutive)
+ */
+static int
+blob_cmp (const void* a, const void* b)
+{
+    const struct scrub_blob* first = a;
+    const struct scrub_blob* second = b;
+
+    if (first->file != second->file) return first->file < second->file ? -1 : 1;
+    if (first->offset != second->offset) return first->offset < second->offset ? -1 : 1;
+    return (first->image > second->image) - (first->image < second->image);
+}
+
+static int
+same_blob (const struct scrub_blob* first, const struct scrub_blob* second)
+{
+    return first->file == second->file && first->offset == second->offset;
+}
+
+/**********************************************************************
+ * Reads size bytes at an offset: the bytes read, fewer at the end of
+ * the file; -1 on error
+ */
+static ssize_t
+read_fully (int fd, uint64_t offset, char* buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t n = pread(fd, buffer + done, size - done, (off_t) (offset + done));
+        if (n < 0) return -1;
+        if (n == 0) break;
+        done += (size_t) n;
+    }
+    return (ssize_t) done;
+}
+
+/**********************************************************************
+ * Verification of a blob read (with its checksum, if any)
+ */
+static int
+verify (const struct scrub* scrub, const struct scrub_blob* blob, const char* buffer)
+{
+    if (blob->file->header.features & IMGST_CHECKSUM) {
+        uint32_t crc;
+        memcpy(&crc, buffer + blob->size, CHECKSUM_SIZE);
+        return crc == crc32c(buffer, blob->size) ? BLOB_OK : BLOB_CORRUPTED;
+    }
+
+    if (blob->resolution == RES_ORIG) {
+        unsigned char sha[SHA256_DIGEST_LENGTH];
+        SHA256((const unsigned char*) buffer, blob->size, sha);
+        return memcmp(sha, scrub->images[blob->image].SHA, SHA256_DIGEST_LENGTH) ? BLOB_CORRUPTED : BLOB_OK;
+    }
+    return BLOB_OK;
+}
+
+/**********************************************************************
+ * Verification of a range of blobs (by a thread)
+ */
+static void*
+scrub_range (void* arg)
+{
+    struct scrub_range* range = arg;
+    char* buffer = NULL;
+    size_t capacity = 0;
+
+    for (size_t i = 0; i < range->nb_blobs; ++i) {
+        struct scrub_blob* blob = &range->blobs[i];
+
+        // a blob shared by duplicates is read once
+        if (i > 0 && same_blob(blob, &range->blobs[i - 1])) {
+            blob->status = range->blobs[i - 1].status;
+            continue;
+        }
+
+        const size_t span = BLOB_SPAN(blob->file, (size_t) blob->size);
+        if (span > capacity) {
+            char* ptr = realloc(buffer, span);
+            if (ptr == NULL) {
+                range->error = ERR_OUT_OF_MEMORY;
+                break;
+            }
+            buffer = ptr;
+            capacity = span;
+        }
+
+        const ssize_t n = read_fully(fileno(blob->file->file), blob->offset, buffer, span);
+        if (n < 0) {
+            range->error = ERR_IO;
+            break;
+        }
+        blob->status = (size_t) n < span ? BLOB_UNREADABLE : verify(range->scrub, blob, buffer);
+
+        ++range->nb_verified;
+        range->bytes += blob->size;
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/**********************************************************************
+ * Report of the corrupted blobs
+ */
+static int
+make_report (const struct scrub* scrub, struct scrub_report* report)
+{
+    for (size_t i = 0; i < scrub->nb_blobs; ++i) {
+        if (scrub->blobs[i].status != BLOB_OK) ++report->nb_corrupted;
+    }
+    if (report->nb_corrupted == 0) return ERR_NONE;
+
+    report->corrupted = calloc(report->nb_corrupted, sizeof(struct scrub_error));
+    if (report->corrupted == NULL) return ERR_OUT_OF_MEMORY;
+
+    struct scrub_error* error = report->corrupted;
+    for (size_t i = 0; i < scrub->nb_blobs; ++i) {
+        const struct scrub_blob* blob = &scrub->blobs[i];
+        if (blob->status == BLOB_OK) continue;
+
+        strncpy(error->img_id, scrub->images[blob->image].img_id, MAX_IMG_ID);
+        error->resolution = blob->resolution;
+        error->offset = blob->offset;
+        error->size = blob->size;
+        error->unreadable = blob->status == BLOB_UNREADABLE;
+        ++error;
+    }
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Verifies the blobs, split into ranges of about the same size
+ */
+static int
+verify_blobs (struct scrub* scrub, unsigned int nb_threads, struct scrub_report* report)
+{
+    struct scrub_range ranges[MAX_SCRUB_THREADS];
+    pthread_t threads[MAX_SCRUB_THREADS];
+    int started[MAX_SCRUB_THREADS];
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < scrub->nb_blobs; ++i) total += scrub->blobs[i].size;
+
+    size_t first = 0;
+    uint64_t bytes = 0;
+    for (unsigned int t = 0; t < nb_threads; ++t) {
+        // up to its share of the bytes, without separating the duplicates
+        const uint64_t end_bytes = total / nb_threads * (t + 1);
+        size_t last = first;
+        while (last < scrub->nb_blobs
+               && (t + 1 == nb_threads || bytes < end_bytes
+                   || (last > first && same_blob(&scrub->blobs[last], &scrub->blobs[last - 1])))) {
+            bytes += scrub->blobs[last].size;
+            ++last;
+        }
+
+        ranges[t] = (struct scrub_range) { .scrub = scrub, .blobs = scrub->blobs + first,
+                                           .nb_blobs = last - first };
+        first = last;
+
+        // run by the caller if no thread can be started
+        started[t] = pthread_create(&threads[t], NULL, scrub_range, &ranges[t]) == 0;
+        if (!started[t]) scrub_range(&ranges[t]);
+    }
+
+    int ret = ERR_NONE;
+    for (unsigned int t = 0; t < nb_threads; ++t) {
+        if (started[t]) pthread_join(threads[t], NULL);
+        if (ret == ERR_NONE) ret = ranges[t].error;
+        report->nb_blobs += ranges[t].nb_verified;
+        report->bytes += ranges[t].bytes;
+    }
+    return ret;
+}
+
+/**********************************************************************
+ * Scrub of an imgStore
+ */
+int
+do_scrub (struct imgst_file* imgst_file, unsigned int nb_threads, struct scrub_report* report)
+{
+    if (imgst_file == NULL || report == NULL) return ERR_INVALID_ARGUMENT;
+    if (nb_threads == 0 || nb_threads > MAX_SCRUB_THREADS) return ERR_INVALID_ARGUMENT;
+    memset(report, 0, sizeof(struct scrub_report));
+
+    const uint32_t nb_files = imgst_file->shards != NULL ? imgst_file->shards->nb_shards : 1;
+    struct imgst_file* files = imgst_file->shards != NULL ? imgst_file->shards->files : imgst_file;
+    struct scrub scrub;
+    memset(&scrub, 0, sizeof(scrub));
+
+    // the images of one version (see snapshot.h)
+    for (uint32_t i = 0; i < nb_files; ++i) lock_writer(&files[i]);
+
+    int ret = ERR_NONE;
+    for (uint32_t i = 0; ret == ERR_NONE && i < nb_files; ++i) {
+        ret = collect_blobs(&scrub, &files[i]);
+        // read with pread: the blobs appended through the FILE* first
+        if (ret == ERR_NONE && fflush(files[i].file) != 0) ret = ERR_IO;
+    }
+
+    for (uint32_t i = nb_files; i > 0; --i) unlock_writer(&files[i - 1]);
+
+    if (ret == ERR_NONE) {
+        qsort(scrub.blobs, scrub.nb_blobs, sizeof(struct scrub_blob), blob_cmp);
+        for (uint32_t i = 0; i < nb_files; ++i) {
+            posix_fadvise(fileno(files[i].file), 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+        ret = verify_blobs(&scrub, nb_threads, report);
+    }
+    if (ret == ERR_NONE) ret = make_report(&scrub, report);
+
+    free(scrub.images);
+    free(scrub.blobs);
+    if (ret) scrub_report_free(report);
+    return ret;
+}
+
+/**********************************************************************
+ * Freeing of a report
+ */
+void
+scrub_report_free (struct scrub_report* report)
+{
+    if (report == NULL) return;
+
+    free(report->corrupted);
+    report->corrupted = NULL;
+    report->nb_corrupted = 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+/**
+ * @file scrub.h
+ * @brief imgStore library: verification of all the images of an imgStore.
+ *
+ * A scrub reads every blob of the valid images (each blob once, however
+ * many duplicates share it) and verifies it:
+ *
+ *  - against its CRC-32C if the imgStore has the IMGST_CHECKSUM feature
+ *    (see checksum.h), whatever its resolution;
+ *  - otherwise, an original against its SHA-256, a resized image only
+ *    as readable.
+ *
+ * The blobs are read in ascending order of their positions, split into
+ * as many ranges of consecutive blobs (of about the same size) as
+ * threads, each read sequentially by one of them with pread: the whole
+ * imgStore is verified in a few sweeps of the file, in parallel.
+ *
+ * The images are those valid when the scrub starts (see snapshot.h):
+ * the imgStore may be changed meanwhile, their blobs staying in the file
+ * until a garbage collection.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdint.h>
+
+#define SCRUB_THREADS 4
+#define MAX_SCRUB_THREADS 64
+
+/* an image whose blob at a resolution failed its verification */
+struct scrub_error {
+    char            img_id[MAX_IMG_ID + 1];
+    int             resolution;
+    uint64_t        offset;     // of the blob, in the file of its shard
+    uint32_t        size;
+    int             unreadable; // 1 if it could not be read (beyond the end of the file)
+};
+
+/* outcome of a scrub */
+struct scrub_report {
+    uint64_t            nb_blobs;       // distinct blobs verified
+    uint64_t            bytes;          // their size
+    uint32_t            nb_corrupted;   // images (at a resolution) corrupted
+    struct scrub_error* corrupted;      // by position of their blobs, NULL if none
+};
+
+/**
+ * @brief Verifies all the images of an imgStore.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param nb_threads Number of threads reading the blobs (1 to MAX_SCRUB_THREADS).
+ * @param report Set to its outcome (to be freed with scrub_report_free),
+ *        the images found corrupted included: that is not an error.
+ * @return Some error code. 0 if no error.
+ */
+int do_scrub(struct imgst_file* imgst_file, unsigned int nb_threads, struct scrub_report* report);
+
+/**
+ * @brief Frees the content of a report of do_scrub.
+ *
+ * @param report The report.
+ */
+void scrub_report_free(struct scrub_report* report);
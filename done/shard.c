@@ -0,0 +1,292 @@
+/**
+ * @file shard.c
+ * @brief imgStore library: one logical imgStore spread across several
+ *        imgStore files (shards).
+ */
+
+#include "shard.h"
+#include "lock.h"
+
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+/**********************************************************************
+ * Whether a file starts with SHARD_MAGIC
+ */
+int
+is_shard_manifest (const char* filename)
+{
+    if (filename == NULL) return 0;
+
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) return 0;
+
+    char magic[sizeof(SHARD_MAGIC)] = {0};
+    const size_t read = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+
+    return read == sizeof(magic) && !strncmp(magic, SHARD_MAGIC, strlen(SHARD_MAGIC))
+           && magic[strlen(SHARD_MAGIC)] == '\n';
+}
+
+/**********************************************************************
+ * Path of a shard: relative to the directory of the manifest
+ */
+static char*
+shard_path (const char* manifest, const char* path)
+{
+    const char* slash = strrchr(manifest, '/');
+    const size_t dir_len = path[0] == '/' || slash == NULL ? 0 : (size_t) (slash - manifest) + 1;
+
+    char* full = malloc(dir_len + strlen(path) + 1);
+    if (full == NULL) return NULL;
+
+    memcpy(full, manifest, dir_len);
+    strcpy(full + dir_len, path);
+    return full;
+}
+
+/**********************************************************************
+ * Frees the shards (closing those open)
+ */
+static void
+free_shards (struct imgst_shards* shards)
+{
+    if (shards == NULL) return;
+
+    for (uint32_t i = 0; i < shards->nb_shards; ++i) {
+        if (shards->files != NULL) do_close(&shards->files[i]);
+        if (shards->paths != NULL) free(shards->paths[i]);
+    }
+    free(shards->files);
+    free(shards->paths);
+    free(shards);
+}
+
+/**********************************************************************
+ * Reads the paths of the shards from the manifest
+ */
+static int
+read_manifest (const char* manifest, struct imgst_shards* shards)
+{
+    FILE* file = fopen(manifest, "r");
+    if (file == NULL) return ERR_IO;
+
+    shards->paths = calloc(MAX_SHARDS, sizeof(char*));
+    if (shards->paths == NULL) {
+        fclose(file);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    int ret = ERR_NONE;
+    char line[FILENAME_MAX + 2];
+    int first = 1;
+    while (ret == ERR_NONE && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (first) {
+            first = 0;
+            if (strcmp(line, SHARD_MAGIC)) ret = ERR_INVALID_FILENAME;
+        } else if (line[0] != '\0') {
+            if (shards->nb_shards == MAX_SHARDS) {
+                ret = ERR_INVALID_ARGUMENT;
+            } else {
+                shards->paths[shards->nb_shards] = shard_path(manifest, line);
+                if (shards->paths[shards->nb_shards] == NULL) ret = ERR_OUT_OF_MEMORY;
+                else ++shards->nb_shards;
+            }
+        }
+    }
+    if (ferror(file)) ret = ERR_IO;
+    fclose(file);
+
+    if (ret == ERR_NONE && shards->nb_shards == 0) ret = ERR_INVALID_FILENAME;
+    return ret;
+}
+
+/**********************************************************************
+ * Header of the logical imgStore
+ */
+void
+shard_update_header (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || imgst_file->shards == NULL) return;
+    const struct imgst_shards* shards = imgst_file->shards;
+
+    uint32_t num_files = 0;
+    uint32_t version = 0;
+    uint64_t live_bytes = 0;
+    uint64_t nb_slots = 0;
+    for (uint32_t i = 0; i < shards->nb_shards; ++i) {
+        num_files += HEADER_GET(&shards->files[i], num_files);
+        version += HEADER_GET(&shards->files[i], imgst_version);
+        live_bytes += HEADER_GET(&shards->files[i], live_bytes);
+        nb_slots += NB_SLOTS(&shards->files[i]);
+    }
+
+    HEADER_SET(imgst_file, num_files, num_files);
+    HEADER_SET(imgst_file, imgst_version, version);
+    HEADER_SET(imgst_file, live_bytes, live_bytes);
+    imgst_file->nb_extra_slots = (uint32_t) (nb_slots - imgst_file->header.max_files);
+}
+
+/**********************************************************************
+ * Opening of the shards
+ */
+int
+shard_open (const char* manifest, const char* open_mode, struct imgst_file* imgst_file)
+{
+    if (manifest == NULL || open_mode == NULL || imgst_file == NULL) return ERR_INVALID_ARGUMENT;
+
+    struct imgst_shards* shards = calloc(1, sizeof(struct imgst_shards));
+    if (shards == NULL) return ERR_OUT_OF_MEMORY;
+
+    int ret = read_manifest(manifest, shards);
+    if (ret == ERR_NONE) {
+        shards->files = calloc(shards->nb_shards, sizeof(struct imgst_file));
+        if (shards->files == NULL) ret = ERR_OUT_OF_MEMORY;
+    }
+    for (uint32_t i = 0; ret == ERR_NONE && i < shards->nb_shards; ++i) {
+        // a shard is an ordinary imgStore
+        ret = is_shard_manifest(shards->paths[i]) ? ERR_INVALID_FILENAME :
+              do_open(shards->paths[i], open_mode, &shards->files[i]);
+    }
+    if (ret) {
+        free_shards(shards);
+        return ret;
+    }
+
+    // the header (as fread by do_open) and the settings of the first shard;
+    // the logical imgStore has no table, file, journal or cache of its own
+    memset(&imgst_file->metadata, 0, sizeof(struct metadata_table));
+    imgst_file->metadata_loaded = NULL;
+    imgst_file->extents = NULL;
+    imgst_file->wal = NULL;
+    imgst_file->cache = NULL;
+    imgst_file->locks = NULL;
+    imgst_file->map = NULL;
+    imgst_file->replog = NULL;
+    imgst_file->index = NULL;
+    memcpy(&imgst_file->header, &shards->files[0].header, sizeof(struct imgst_header));
+    memcpy(&imgst_file->ext, &shards->files[0].ext, sizeof(struct imgst_ext));
+    imgst_file->file = NULL;
+    imgst_file->shards = shards;
+    shard_update_header(imgst_file);
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Closing of the shards
+ */
+void
+shard_close (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || imgst_file->shards == NULL) return;
+
+    free_shards(imgst_file->shards);
+    imgst_file->shards = NULL;
+    imgst_file->nb_extra_slots = 0;
+}
+
+/**********************************************************************
+ * Creation of the shards and of their manifest
+ */
+int
+shard_create (const char* manifest, uint32_t nb_shards, struct imgst_file* imgst_file)
+{
+    if (manifest == NULL || imgst_file == NULL) return ERR_INVALID_ARGUMENT;
+    if (nb_shards == 0 || nb_shards > MAX_SHARDS) return ERR_INVALID_ARGUMENT;
+
+    FILE* file = fopen(manifest, "w");
+    if (file == NULL) return ERR_IO;
+    fprintf(file, "%s\n", SHARD_MAGIC);
+
+    // named after the manifest, next to it
+    const char* slash = strrchr(manifest, '/');
+    const char* name = slash == NULL ? manifest : slash + 1;
+
+    int ret = ERR_NONE;
+    for (uint32_t i = 0; ret == ERR_NONE && i < nb_shards; ++i) {
+        char* path = malloc(strlen(manifest) + 12);
+        if (path == NULL) {
+            ret = ERR_OUT_OF_MEMORY;
+            break;
+        }
+        sprintf(path, "%s.%" PRIu32, manifest, i);
+
+        struct imgst_file shard;
+        memcpy(&shard, imgst_file, sizeof(struct imgst_file));
+        ret = do_create(path, &shard);
+        do_close(&shard);
+        free(path);
+
+        if (ret == ERR_NONE && fprintf(file, "%s.%" PRIu32 "\n", name, i) < 0) ret = ERR_IO;
+    }
+    if (fclose(file) != 0 && ret == ERR_NONE) ret = ERR_IO;
+    if (ret) return ret;
+
+    return shard_open(manifest, "rb", imgst_file);
+}
+
+/**********************************************************************
+ * Shard of an image
+ */
+struct imgst_file*
+shard_of (struct imgst_file* imgst_file, const char* img_id)
+{
+    const struct imgst_shards* shards = imgst_file->shards;
+    if (img_id == NULL) return &shards->files[0];
+    return &shards->files[hash_id(img_id) % shards->nb_shards];
+}
+
+/**********************************************************************
+ * Space accounting, summed over the shards
+ */
+int
+shard_stats (struct imgst_file* imgst_file, struct imgst_stats* stats)
+{
+    if (imgst_file == NULL || imgst_file->shards == NULL || stats == NULL) return ERR_INVALID_ARGUMENT;
+    const struct imgst_shards* shards = imgst_file->shards;
+
+    memset(stats, 0, sizeof(struct imgst_stats));
+    for (uint32_t i = 0; i < shards->nb_shards; ++i) {
+        struct imgst_stats shard;
+        const int ret = do_stats(&shards->files[i], &shard);
+        if (ret) return ret;
+
+        stats->file_size += shard.file_size;
+        stats->table_size += shard.table_size;
+        stats->live_bytes += shard.live_bytes;
+        stats->dead_bytes += shard.dead_bytes;
+    }
+    shard_update_header(imgst_file);
+
+    const uint64_t data_size = stats->file_size - stats->table_size;
+    stats->fragmentation = data_size > 0 ? stats->dead_bytes / (double) data_size : 0.0;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Garbage collection of each shard
+ */
+int
+shard_gbcollect (const char* manifest, const char* imgst_tmp_bkp_path)
+{
+    if (manifest == NULL || imgst_tmp_bkp_path == NULL) return ERR_INVALID_ARGUMENT;
+
+    struct imgst_shards* shards = calloc(1, sizeof(struct imgst_shards));
+    if (shards == NULL) return ERR_OUT_OF_MEMORY;
+
+    int ret = read_manifest(manifest, shards);
+    char* tmp = malloc(strlen(imgst_tmp_bkp_path) + 12);
+    if (tmp == NULL && ret == ERR_NONE) ret = ERR_OUT_OF_MEMORY;
+
+    for (uint32_t i = 0; ret == ERR_NONE && i < shards->nb_shards; ++i) {
+        sprintf(tmp, "%s.%" PRIu32, imgst_tmp_bkp_path, i);
+        ret = do_gbcollect(shards->paths[i], tmp);
+    }
+
+    free(tmp);
+    free_shards(shards);
+    return ret;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+/**
+ * @file shard.h
+ * @brief imgStore library: one logical imgStore spread across several
+ *        imgStore files (shards).
+ *
+ * A sharded imgStore is a text manifest listing its shards, one path per
+ * line after SHARD_MAGIC; a relative path is relative to the directory
+ * of the manifest, so that shards can be moved to other disks by editing
+ * it. An image lives in the shard hash_id(img_id) % nb_shards.
+ *
+ * do_open recognizes a manifest and opens all its shards: do_read,
+ * do_read_box, do_insert, do_delete, do_list, do_stats, do_gbcollect and
+ * do_close then work on the logical imgStore. Each shard is an ordinary
+ * imgStore, journaled and locked on its own. The header of the logical
+ * imgStore is the one of its first shard with the counters (num_files,
+ * live_bytes, imgst_version) summed over all of them; NB_SLOTS is the
+ * total number of slots.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define SHARD_MAGIC "imgStore shards"
+#define MAX_SHARDS 256
+
+/* shards of an open imgStore */
+struct imgst_shards {
+    uint32_t            nb_shards;
+    struct imgst_file*  files;
+    char**              paths;
+};
+
+/**
+ * @brief Whether a file is the manifest of a sharded imgStore.
+ *
+ * @param filename Path to the file
+ * @return 1 if it is, 0 otherwise.
+ */
+int is_shard_manifest(const char* filename);
+
+/**
+ * @brief Creates a sharded imgStore: nb_shards imgStores <manifest>.<i>,
+ *        all with the header of imgst_file, and their manifest.
+ *
+ * @param manifest Path to the manifest
+ * @param nb_shards Number of shards (at most MAX_SHARDS)
+ * @param imgst_file In memory structure with the header of the shards;
+ *        set as for do_open on success.
+ * @return Some error code. 0 if no error.
+ */
+int shard_create(const char* manifest, uint32_t nb_shards, struct imgst_file* imgst_file);
+
+/**
+ * @brief Opens all the shards listed in a manifest (see do_open).
+ *
+ * @param manifest Path to the manifest
+ * @param open_mode Mode for fopen(), eg.: "rb", "rb+", etc.
+ * @param imgst_file The logical imgStore.
+ * @return Some error code. 0 if no error.
+ */
+int shard_open(const char* manifest, const char* open_mode, struct imgst_file* imgst_file);
+
+/**
+ * @brief Closes all the shards of an imgStore.
+ *
+ * @param imgst_file The logical imgStore.
+ */
+void shard_close(struct imgst_file* imgst_file);
+
+/**
+ * @brief Shard of an image.
+ *
+ * @param imgst_file The logical imgStore.
+ * @param img_id The image id.
+ * @return The shard holding (or to hold) the image.
+ */
+struct imgst_file* shard_of(struct imgst_file* imgst_file, const char* img_id);
+
+/**
+ * @brief Updates the header of the logical imgStore after a write to one
+ *        of its shards.
+ *
+ * @param imgst_file The logical imgStore.
+ */
+void shard_update_header(struct imgst_file* imgst_file);
+
+/**
+ * @brief Space accounting of a sharded imgStore: the sum of its shards.
+ *
+ * @param imgst_file The logical imgStore.
+ * @param stats Location where to store the result
+ * @return Some error code. 0 if no error.
+ */
+int shard_stats(struct imgst_file* imgst_file, struct imgst_stats* stats);
+
+/**
+ * @brief Garbage collection of each shard, through <tmp path>.<i>.
+ *
+ * @param manifest Path to the manifest
+ * @param imgst_tmp_bkp_path Prefix of the temporary imgStores
+ * @return Some error code. 0 if no error.
+ */
+int shard_gbcollect(const char* manifest, const char* imgst_tmp_bkp_path);
@@ -0,0 +1,244 @@
+/**
+ * @file snapshot.c
+ * @brief imgStore library: read views of an imgStore pinned at a version.
+ */
+
+#include "snapshot.h"
+#include "image_content.h"
+#include "shard.h"
+#include "lock.h"
+#include "checksum.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <json-c/json.h>
+
+/* an image of a snapshot */
+struct snapshot_image {
+    struct img_metadata metadata;
+    uint32_t            index;  // of its slot
+    struct imgst_file*  file;   // its imgStore (its shard if sharded)
+};
+
+struct imgst_snapshot {
+    uint32_t                version;
+    struct snapshot_image*  images; // sorted by id
+    uint32_t                nb_images;
+};
+
+/**********************************************************************
+ * Copies the metadata of the valid images of a file (under its writer
+ * lock)
+ */
+static int
+copy_images (struct imgst_snapshot* snapshot, struct imgst_file* imgst_file, uint32_t* capacity)
+{
+    if (imgst_file->file == NULL) return ERR_IO;
+
+    for (uint32_t i = 0; i < NB_SLOTS(imgst_file); ++i) {
+        struct img_metadata metadata;
+        const int ret = get_metadata(imgst_file, i, &metadata);
+        if (ret) return ret;
+        if (metadata.is_valid != NON_EMPTY) continue;
+
+        if (snapshot->nb_images == *capacity) {
+            *capacity = *capacity == 0 ? 16 : *capacity * 2;
+            struct snapshot_image* images = realloc(snapshot->images, *capacity * sizeof(struct snapshot_image));
+            if (images == NULL) return ERR_OUT_OF_MEMORY;
+            snapshot->images = images;
+        }
+
+        struct snapshot_image* image = &snapshot->images[snapshot->nb_images++];
+        image->metadata = metadata;
+        image->index = i;
+        image->file = imgst_file;
+    }
+    snapshot->version += HEADER_GET(imgst_file, imgst_version);
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Order of the images: by id
+ */
+static int
+image_cmp (const void* a, const void* b)
+{
+    return strcmp(((const struct snapshot_image*) a)->metadata.img_id,
+                  ((const struct snapshot_image*) b)->metadata.img_id);
+}
+
+/**********************************************************************
+ * Snapshot of an imgStore
+ */
+int
+snapshot_open (struct imgst_file* imgst_file, struct imgst_snapshot** snapshot)
+{
+    if (imgst_file == NULL || snapshot == NULL) return ERR_INVALID_ARGUMENT;
+
+    struct imgst_snapshot* new = calloc(1, sizeof(struct imgst_snapshot));
+    if (new == NULL) return ERR_OUT_OF_MEMORY;
+
+    const uint32_t nb_files = imgst_file->shards != NULL ? imgst_file->shards->nb_shards : 1;
+    struct imgst_file* files = imgst_file->shards != NULL ? imgst_file->shards->files : imgst_file;
+
+    // the same version of all the shards: none of them changes meanwhile
+    for (uint32_t i = 0; i < nb_files; ++i) lock_writer(&files[i]);
+
+    uint32_t capacity = 0;
+    int ret = ERR_NONE;
+    for (uint32_t i = 0; ret == ERR_NONE && i < nb_files; ++i) {
+        ret = copy_images(new, &files[i], &capacity);
+    }
+
+    for (uint32_t i = nb_files; i > 0; --i) unlock_writer(&files[i - 1]);
+
+    if (ret) {
+        snapshot_close(new);
+        return ret;
+    }
+
+    qsort(new->images, new->nb_images, sizeof(struct snapshot_image), image_cmp);
+    *snapshot = new;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Freeing of a snapshot
+ */
+void
+snapshot_close (struct imgst_snapshot* snapshot)
+{
+    if (snapshot == NULL) return;
+
+    free(snapshot->images);
+    free(snapshot);
+}
+
+/**********************************************************************
+ * Version and size of a snapshot
+ */
+uint32_t
+snapshot_version (const struct imgst_snapshot* snapshot)
+{
+    return snapshot != NULL ? snapshot->version : 0;
+}
+
+uint32_t
+snapshot_count (const struct imgst_snapshot* snapshot)
+{
+    return snapshot != NULL ? snapshot->nb_images : 0;
+}
+
+/**********************************************************************
+ * Where the resized image of an image of a snapshot is now: created if
+ * its slot still holds the same image; 0 otherwise
+ */
+static int
+live_resized (const struct snapshot_image* image, int resolution, uint64_t* offset, uint32_t* size)
+{
+    struct imgst_file* file = image->file;
+    const struct metadata_table* metadata = &file->metadata;
+    const uint64_t original = image->metadata.offset[RES_ORIG];
+    *offset = 0;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        lock_slot(file, image->index, 0);
+        const int same = metadata->is_valid[image->index] == NON_EMPTY
+                         && SLOT_OFFSET(metadata, image->index, RES_ORIG) == original
+                         && !strcmp(SLOT_ID(metadata, image->index), image->metadata.img_id);
+        if (same) {
+            *offset = SLOT_OFFSET(metadata, image->index, resolution);
+            *size = SLOT_SIZE(metadata, image->index, resolution);
+        }
+        unlock_slot(file, image->index);
+
+        if (!same || *offset != 0) return ERR_NONE;
+
+        // a read-only (mapped) imgStore cannot create it, and the slot
+        // may have been deleted meanwhile
+        const int ret = lazily_resize(resolution, file, image->index);
+        if (ret) return ret == ERR_INVALID_COMMAND || ret == ERR_FILE_NOT_FOUND ? ERR_NONE : ret;
+    }
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Read of an image as of a snapshot
+ */
+int
+snapshot_read (struct imgst_snapshot* snapshot, const char* img_id, int resolution,
+               char** image_buffer, uint32_t* image_size)
+{
+    if (snapshot == NULL || img_id == NULL || image_buffer == NULL || image_size == NULL) {
+        return ERR_INVALID_ARGUMENT;
+    }
+    if (resolution != RES_THUMB && resolution != RES_SMALL && resolution != RES_ORIG) return ERR_RESOLUTIONS;
+
+    struct snapshot_image key;
+    strncpy(key.metadata.img_id, img_id, MAX_IMG_ID);
+    key.metadata.img_id[MAX_IMG_ID] = '\0';
+    const struct snapshot_image* image = bsearch(&key, snapshot->images, snapshot->nb_images,
+                                                 sizeof(struct snapshot_image), image_cmp);
+    if (image == NULL) return ERR_FILE_NOT_FOUND;
+
+    uint64_t offset = image->metadata.offset[resolution];
+    uint32_t size = image->metadata.size[resolution];
+
+    if (offset == 0) {
+        int ret = live_resized(image, resolution, &offset, &size);
+        if (ret) return ret;
+
+        if (offset == 0) {
+            // the slot changed since: the image is resized for this read only
+            void* buffer = NULL;
+            size_t len = 0;
+            ret = generate_resized(resolution, image->file, image->metadata.offset[RES_ORIG],
+                                   image->metadata.size[RES_ORIG], image->metadata.unused_16,
+                                   &buffer, &len);
+            if (ret) return ret;
+
+            *image_buffer = buffer;
+            *image_size = (uint32_t) len;
+            return ERR_NONE;
+        }
+    }
+
+    *image_buffer = calloc(size > 0 ? size : 1, sizeof(char));
+    if (*image_buffer == NULL) return ERR_OUT_OF_MEMORY;
+
+    int ret = read_at(image->file, offset, *image_buffer, size);
+    if (ret == ERR_NONE) ret = verify_blob(image->file, offset, *image_buffer, size);
+    if (ret) {
+        free(*image_buffer);
+        *image_buffer = NULL;
+        return ret;
+    }
+    *image_size = size;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Page of the images of a snapshot
+ */
+char*
+snapshot_list (const struct imgst_snapshot* snapshot, uint32_t from, uint32_t count)
+{
+    if (snapshot == NULL) return NULL;
+
+    struct json_object* object = json_object_new_object();
+    struct json_object* array = json_object_new_array();
+    json_object_object_add(object, "Images", array);
+
+    for (uint32_t i = from; i < snapshot->nb_images && i - from < count; ++i) {
+        json_object_array_add(array, json_object_new_string(snapshot->images[i].metadata.img_id));
+    }
+    json_object_object_add(object, "snapshot", json_object_new_int64(snapshot->version));
+    json_object_object_add(object, "total", json_object_new_int64(snapshot->nb_images));
+
+    // the string belongs to the object: the caller gets a copy
+    const char* json = json_object_to_json_string(object);
+    char* list = malloc(strlen(json) + 1);
+    if (list != NULL) strcpy(list, json);
+    json_object_put(object);
+    return list;
+}
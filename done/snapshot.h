@@ -0,0 +1,79 @@
+#pragma once
+
+/**
+ * @file snapshot.h
+ * @brief imgStore library: read views of an imgStore pinned at a version.
+ *
+ * A snapshot is a copy of the metadata of the valid images of an
+ * imgStore as of one imgst_version, taken under its writer lock (of all
+ * its shards at once): the writers only wait for the copy. The images
+ * are then read as they were at that version, while inserts and deletes
+ * go on: their blobs stay in the file until a garbage collection, which
+ * works on another file (an open snapshot keeps reading the old one
+ * only if its imgStore is not reopened meanwhile).
+ *
+ * A resized image not yet created at that version is created (in the
+ * imgStore) if its slot still holds the same image, generated for the
+ * read only otherwise.
+ *
+ * The images of a snapshot are ordered by id, for a stable pagination.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdint.h>
+
+struct imgst_snapshot;
+
+/**
+ * @brief Takes a snapshot of an imgStore at its current version.
+ *
+ * @param imgst_file The main in-memory data structure
+ * @param snapshot Set to the snapshot (to be closed with snapshot_close,
+ *        before the imgStore).
+ * @return Some error code. 0 if no error.
+ */
+int snapshot_open(struct imgst_file* imgst_file, struct imgst_snapshot** snapshot);
+
+/**
+ * @brief Frees a snapshot.
+ *
+ * @param snapshot The snapshot (may be NULL).
+ */
+void snapshot_close(struct imgst_snapshot* snapshot);
+
+/**
+ * @brief Version of the imgStore pinned by a snapshot (for a sharded
+ *        imgStore, the sum of the versions of its shards).
+ */
+uint32_t snapshot_version(const struct imgst_snapshot* snapshot);
+
+/**
+ * @brief Number of images of a snapshot.
+ */
+uint32_t snapshot_count(const struct imgst_snapshot* snapshot);
+
+/**
+ * @brief Reads the content of an image as of a snapshot (as do_read).
+ *
+ * @param snapshot The snapshot.
+ * @param img_id The ID of the image to be read.
+ * @param resolution The desired resolution for the image read.
+ * @param image_buffer Location of the location of the image content
+ * @param image_size Location of the image size variable
+ * @return Some error code. 0 if no error.
+ */
+int snapshot_read(struct imgst_snapshot* snapshot, const char* img_id, int resolution,
+                  char** image_buffer, uint32_t* image_size);
+
+/**
+ * @brief Lists a page of the images of a snapshot, in JSON:
+ *        {"Images": [ids], "snapshot": version, "total": count}.
+ *
+ * @param snapshot The snapshot.
+ * @param from Rank of the first image of the page.
+ * @param count Maximal number of images of the page.
+ * @return The JSON string (to be freed), NULL if out of memory.
+ */
+char* snapshot_list(const struct imgst_snapshot* snapshot, uint32_t from, uint32_t count);
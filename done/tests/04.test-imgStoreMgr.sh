@@ -60,7 +60,7 @@ THUMBNAIL: 64 x 64      SMALL: 256 x 256
 IMAGE ID: pic1
 SHA: 66ac648b32a8268ed0b350b184cfa04c00c6236af3a2aa4411c01518f6061af8
 VALID: 1
-UNUSED: 0
+FORMAT: jpeg
 OFFSET ORIG. : 2224             SIZE ORIG. : 72876
 OFFSET THUMB.: 0                SIZE THUMB.: 0
 OFFSET SMALL : 0                SIZE SMALL : 0
@@ -69,7 +69,7 @@ ORIGINAL: 1200 x 800
 IMAGE ID: pic2
 SHA: 1183f8ef10dcb4d87a1857bd16f9b5f8728a8d1ea6c9c7eb37ddfa1da01bff52
 VALID: 1
-UNUSED: 0
+FORMAT: jpeg
 OFFSET ORIG. : 75100            SIZE ORIG. : 369911
 OFFSET THUMB.: 0                SIZE THUMB.: 0
 OFFSET SMALL : 0                SIZE SMALL : 0
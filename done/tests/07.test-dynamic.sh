@@ -19,7 +19,7 @@ THUMBNAIL: 64 x 64      SMALL: 256 x 256
 pict1="IMAGE ID: pic1
 SHA: 66ac648b32a8268ed0b350b184cfa04c00c6236af3a2aa4411c01518f6061af8
 VALID: 1
-UNUSED: 0
+FORMAT: jpeg
 OFFSET ORIG. : 21664             SIZE ORIG. : 72876
 OFFSET THUMB.: 0                SIZE THUMB.: 0
 OFFSET SMALL : 0                SIZE SMALL : 0
@@ -102,7 +102,7 @@ $pict1
 IMAGE ID: pic2
 SHA: 95962b09e0fc9716ee4c2a1cf173f9147758235360d7ac0a73dfa378858b8a10
 VALID: 1
-UNUSED: 0
+FORMAT: jpeg
 OFFSET ORIG. : 94540            SIZE ORIG. : 98119
 OFFSET THUMB.: 0                SIZE THUMB.: 0
 OFFSET SMALL : 0                SIZE SMALL : 0
@@ -144,7 +144,7 @@ image_txt() {
     echo "IMAGE ID: $1
 SHA: $2
 VALID: 1
-UNUSED: 0
+FORMAT: jpeg
 OFFSET ORIG. : $4		SIZE ORIG. : $3
 OFFSET THUMB.: 0		SIZE THUMB.: 0
 OFFSET SMALL : 0		SIZE SMALL : 0
@@ -58,6 +58,9 @@ libmongoose="${PWD}/libmongoose"
 # server PID
 job_pid=
 
+# server options (e.g. -workers)
+server_opts=
+
 # error messages
 nea='Not enough arguments'
 ires='Invalid resolution(s)'
@@ -171,7 +174,7 @@ image_txt() {
     echo "IMAGE ID: $1
 SHA: $2
 VALID: 1
-UNUSED: 0
+FORMAT: jpeg
 OFFSET ORIG. : $4		SIZE ORIG. : $3
 OFFSET THUMB.: 0		SIZE THUMB.: 0
 OFFSET SMALL : 0		SIZE SMALL : 0
@@ -183,7 +186,7 @@ ORIGINAL: $res
 launch_server_core()
 {
     opid=$($pidof "$exec") && error "another $(basename "$exec") is already running (PID=$opid)!"
-    $stdbuf -oL "$exec" "$db" 1> "${LOG}.log" 2> "${LOG}-err.log" &
+    $stdbuf -oL "$exec" "$db" $server_opts 1> "${LOG}.log" 2> "${LOG}-err.log" &
     job_pid=$!
     sleep 1 #wait a bit
     echo "$(pwd)/${LOG}.log"     >> "$TMP_FILES"
@@ -242,7 +245,7 @@ relaunch_with()
     stop_server
     safecp "$1"
     launch_server
-    check "$2" '' "$(tail -n +2 "${LOG}.log")" "${LOG}-err.log"
+    check "$2" '' "$(grep -v ' mongoose\.c:' "${LOG}.log")" "${LOG}-err.log"
 }
 
 # ----------------------------------------------------------------------
@@ -343,6 +346,54 @@ test_read () {
     echo -e "==> ${green}PASS${end}"
 }
 
+# ----------------------------------------------------------------------
+# params: ids (comma separated), then for each of them its reference file,
+# or '' if not found
+test_batch_read () {
+    local ids="$1"; shift
+    printf "${magenta}Test %1d${end} (batch read $ids):\n" $((++test))
+    local boundary=imgStore-batch-read
+
+    # the parts in the order of the ids, then the closing boundary
+    local expected="$(new_tmp_file)"
+    local id
+    for id in ${ids//,/ }; do
+        if [ -z "$1" ]; then
+            local msg="Error: $fnf"
+            printf -- "--%s\r\nContent-Type: text/plain\r\nContent-ID: <%s>\r\nContent-Length: %d\r\n\r\n%s\r\n" \
+                   $boundary "$id" ${#msg} "$msg"
+        else
+            local reffile="tests/data/$1"
+            [ -f "$reffile" ] || quit "Cannot launch test, reference file $reffile not present"
+            printf -- "--%s\r\nContent-Type: image/jpeg\r\nContent-ID: <%s>\r\nContent-Length: %d\r\n\r\n" \
+                   $boundary "$id" $($stat -c%s "$reffile")
+            cat "$reffile"
+            printf "\r\n"
+        fi
+        shift
+    done > "$expected"
+    printf -- "--%s--\r\n" $boundary >> "$expected"
+
+    printf "\ta. reading      : "
+    local headers="$(new_tmp_file)"
+    local file="$(new_tmp_file)"
+    check_curl '' '' -D "$headers" -o "$file" "${baseURL}/imgStore/batch_read?res=orig&img_ids=$ids" || return 1
+
+    printf "\tb. content type : "
+    check "multipart/mixed; boundary=$boundary" '' \
+          "$(grep -i '^Content-Type:' "$headers" | tr -d '\r' | cut -d' ' -f2-)" /dev/null || return 1
+
+    printf "\tc. check content: "
+    if cmp -s "$file" "$expected"; then
+        echo -e "${green}PASS${end}"
+    else
+        echo -e "${red}FAIL${end}: the parts are not what I was expecting"
+        return 1
+    fi
+
+    echo -e "==> ${green}PASS${end}"
+}
+
 # ----------------------------------------------------------------------
 do_insert () {
     local insfile="tests/data/$2"
@@ -425,6 +476,12 @@ test_url 'imgStore/read?res=small' "Error: $iarg" || ok=0
 # no resolution
 test_url 'imgStore/read?img_id=pic1' "Error: $iarg" || ok=0
 
+# no ids
+test_url 'imgStore/batch_read?res=orig' "Error: $iarg" || ok=0
+
+# wrong resolution
+test_url 'imgStore/batch_read?res=foo&img_ids=pic1' "Error: $ires" || ok=0
+
 ## --------------------------------------------------
 ## delete error cases
 
@@ -464,6 +521,11 @@ test_url imgStore/list '{ "Images": [ "pic1", "pic2" ] }' || ok=0
 test_read 'first img' pic1 orig papillon.jpg    || ok=0
 test_read '2nd img'   pic2 orig coquelicots.jpg || ok=0
 
+# several at once, in the order asked, the missing ones as errors
+test_batch_read pic1,pic2 papillon.jpg coquelicots.jpg || ok=0
+test_batch_read pic2,pic42,pic1 coquelicots.jpg '' papillon.jpg || ok=0
+test_batch_read pic42 '' || ok=0
+
 # read with resized creation
 size_before=$original_size
 size_after=$(($size_before + 12126))
@@ -503,6 +565,47 @@ pic1 papillon.jpg "{ \"Images\": [ \"pic1\", $output_txt ] }" || ok=0
 
 ## --------------------------------------------------
 
+# ======================================================================
+# ---- 3. prefork workers
+printf "\n${yellow}III. Prefork workers:${end}\n"
+
+# the changes are made by the writer, the reads served by the workers
+server_opts='-workers 2'
+relaunch_with test02.imgst_dynamic "Starting imgStore server on http://localhost:8000 (2 workers)
+$(header 2 2)" || ok=0
+
+## --------------------------------------------------
+## insert, then read back by the workers (from the grown file)
+
+size_before=$original_size
+size_after=$(($size_before + 369911))
+test_insert 'through the writer' pic3 foret.jpg \
+'{ "Images": [ "pic1", "pic2", "pic3" ] }' $size_before $size_after || ok=0
+for i in 1 2 3 4; do
+    test_read "by the workers, #$i" pic3 orig foret.jpg || ok=0
+done
+
+## --------------------------------------------------
+## delete, then no longer served by the workers
+
+test_delete pic1 '{ "Images": [ "pic2", "pic3" ] }' || ok=0
+for i in 1 2 3 4; do
+    test_url 'imgStore/read?res=orig&img_id=pic1' "Error: $fnf" || ok=0
+done
+
+# the freed slot reused, its content no longer shared
+size_before=$size_after
+size_after=$(($size_before + 72876))
+test_insert 'in the freed slot' pic4 papillon.jpg \
+'{ "Images": [ "pic4", "pic2", "pic3" ] }' $size_before $size_after || ok=0
+for i in 1 2 3 4; do
+    test_read "by the workers, #$i" pic4 orig papillon.jpg || ok=0
+done
+test_batch_read pic4,pic1,pic3 papillon.jpg '' foret.jpg || ok=0
+server_opts=
+
+## --------------------------------------------------
+
 # ======================================================================
 stop_server
 
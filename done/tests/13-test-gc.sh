@@ -157,7 +157,7 @@ image_txt() {
     echo "IMAGE ID: $1
 SHA: $2
 VALID: 1
-UNUSED: 0
+FORMAT: jpeg
 OFFSET ORIG. : $4		SIZE ORIG. : $3
 OFFSET THUMB.: ${6:-0}		SIZE THUMB.: ${5:-0}
 OFFSET SMALL : ${8:-0}		SIZE SMALL : ${7:-0}
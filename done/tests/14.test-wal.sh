@@ -0,0 +1,202 @@
+#!/bin/bash
+
+## Black-box testing of the write-ahead log -- replay after a crash
+
+# ======================================================================
+# options
+
+with_colors=0
+while [ $# -ge 1 ]; do
+    case "$1" in
+        -c|--color|--colors) with_colors=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+if [ "x$with_colors" = 'x1' ]; then
+    esc="\033["
+    red="${esc}31m"
+    green="${esc}32m"
+    yellow="${esc}33m"
+    blue="${esc}34m"
+    magenta="${esc}35m"
+    cyan="${esc}36m"
+    bold="${esc}1m"
+    end="${esc}0m"
+else
+    red=
+    green=
+    yellow=
+    blue=
+    magenta=
+    cyan=
+    bold=
+    end=
+fi
+
+# ======================================================================
+printf "${bold}${blue}"
+source $(dirname ${BASH_SOURCE[0]})/test_env.sh
+printf "${end}"
+
+test=0
+ok=1
+
+# Logfiles root name
+LOG=server-$$
+# webserver exec
+exec="${PWD}/imgStore_server"
+# base URL
+baseURL=http://localhost:8000
+# server PID
+job_pid=
+
+# header and metadata table of test02.imgst_dynamic (written in place)
+table_size=21664
+
+db="$(new_tmp_file)"
+before="$(new_tmp_file)"
+journal="$(new_tmp_file)"
+crashed="$(new_tmp_file)"
+
+# ======================================================================
+# tool functions
+# ----------------------------------------------------------------------
+quit() {
+    stop_server
+    error "$*"
+}
+
+# ----------------------------------------------------------------------
+check() {
+    EXPECTED_OUTPUT="$1"; shift
+    ACTUAL_OUTPUT="$1"  ; shift
+
+    if ! diff -w <(echo "$ACTUAL_OUTPUT") <(echo -e "$EXPECTED_OUTPUT"); then
+        echo -e "${red}FAIL${end}"
+        echo -e "${yellow}Expected:${end}\n$EXPECTED_OUTPUT"
+        echo -e "${cyan}Actual:${end}\n$ACTUAL_OUTPUT"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+launch_server()
+{
+    $stdbuf -oL "$exec" "$db" 1> "${LOG}.log" 2> "${LOG}-err.log" &
+    job_pid=$!
+    sleep 1 #wait a bit
+    echo "$(pwd)/${LOG}.log"     >> "$TMP_FILES"
+    echo "$(pwd)/${LOG}-err.log" >> "$TMP_FILES"
+    ps -p$job_pid >/dev/null 2>&1 || error "cannot lauch \"$(basename "$exec")\" (with image store \"$db\")"
+}
+
+# --------------------------------------------------
+stop_server()
+{
+    if [ "x$job_pid" != 'x' ]; then
+        ps -p$job_pid >/dev/null 2>&1 && kill -TERM $job_pid
+        sleep 1 # wait a bit
+        job_pid=
+    fi
+    return 0
+}
+
+# ----------------------------------------------------------------------
+do_insert () {
+    local insfile="tests/data/$2"
+    local size=$($stat -c%s "$insfile")
+    curl -sS --data-binary @"$insfile" "${baseURL}/imgStore/insert?offset=0&name=$1" >/dev/null \
+    && curl -sS -d '' "${baseURL}/imgStore/insert?offset=${size}&name=$1" >/dev/null \
+    || quit "cannot insert $1"
+}
+
+# ----------------------------------------------------------------------
+# the ids listed by imgStoreMgr, on one line
+ids() {
+    imgStoreMgr list "$1" | awk '/^IMAGE ID:/ { printf "%s ", $3 }'
+}
+
+# ----------------------------------------------------------------------
+# the imgStore as left by a crash before its metadata were written in
+# place: its images appended, its table as before, and the journal,
+# damaged by the command $1 if given
+crash() {
+    cp "$db" "$crashed"
+    dd if="$before" of="$crashed" bs=$table_size count=1 conv=notrunc status=none
+    cp "$journal" "$crashed.wal"
+    [ $# -ge 1 ] && eval "$1"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# inverts the byte at offset $1 of the journal
+flip() {
+    local byte=$(od -An -tu1 -j "$1" -N1 "$crashed.wal")
+    printf "$(printf '\\%03o' $((255 - byte)))" \
+    | dd of="$crashed.wal" bs=1 seek="$1" count=1 conv=notrunc status=none
+}
+
+# ----------------------------------------------------------------------
+# $1: info message
+# $2: expected ids
+# $3: command damaging the journal, or empty to leave it whole
+replay_test () {
+    local info="$1"; shift
+    local expected="$1"; shift
+    printf "${magenta}Test %1d${end} (replay of $info):\n" $((++test))
+
+    crash "$@"
+    printf '\ta. list: '
+    check "$expected" "$(ids "$crashed")" || return 1
+
+    printf '\tb. journal removed: '
+    if [ -e "$crashed.wal" ]; then
+        echo -e "${red}FAIL${end}: $crashed.wal still there"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+
+    # the replayed imgStore is the one of the writer
+    if [ $# -eq 0 ]; then
+        printf '\tc. same as written: '
+        check "$(imgStoreMgr list "$db")" "$(imgStoreMgr list "$crashed")" || return 1
+    fi
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ======================================================================
+checkX "command line ImgStore tool" imgStoreMgr
+checkX webserver "$exec"
+
+cp tests/data/test02.imgst_dynamic "$db" || error "Cannot copy test02.imgst_dynamic to \"$db\""
+cp "$db" "$before"
+
+# two transactions, logged while the writer runs
+launch_server
+do_insert pic3 foret.jpg
+do_insert pic4 papillon.jpg
+[ -s "$db.wal" ] || quit "no journal next to \"$db\""
+cp "$db.wal" "$journal"
+stop_server
+
+size=$($stat -c%s "$journal")
+
+replay_test 'whole journal' 'pic1 pic2 pic3 pic4' || ok=0
+replay_test 'torn second transaction' 'pic1 pic2 pic3' "truncate -s $(($size - 1)) \"\$crashed.wal\"" || ok=0
+replay_test 'torn first transaction' 'pic1 pic2' 'truncate -s 10 "$crashed.wal"' || ok=0
+replay_test 'corrupted second transaction' 'pic1 pic2 pic3' "flip $(($size - 1))" || ok=0
+
+# ======================================================================
+if [ "x$ok" = 'x1' ]; then
+    echo -e "$0 ${bold}${green}SUCCESS${end}"
+    exit 0
+else
+   echo -e "$0 ${bold}${red}FAILED${end} at some point"
+   exit 1
+fi
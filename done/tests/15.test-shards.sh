@@ -0,0 +1,164 @@
+#!/bin/bash
+
+## Black-box testing of imgStoreMgr -- sharded imgStore
+
+# ======================================================================
+# options
+
+with_colors=0
+while [ $# -ge 1 ]; do
+    case "$1" in
+        -c|--color|--colors) with_colors=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+if [ "x$with_colors" = 'x1' ]; then
+    esc="\033["
+    red="${esc}31m"
+    green="${esc}32m"
+    yellow="${esc}33m"
+    blue="${esc}34m"
+    magenta="${esc}35m"
+    cyan="${esc}36m"
+    bold="${esc}1m"
+    end="${esc}0m"
+else
+    red=
+    green=
+    yellow=
+    blue=
+    magenta=
+    cyan=
+    bold=
+    end=
+fi
+
+# ======================================================================
+printf "${bold}${blue}"
+source $(dirname ${BASH_SOURCE[0]})/test_env.sh
+printf "${end}"
+
+test=0
+ok=1
+
+# error messages
+exiid='Existing image ID'
+fnf='File not found'
+
+db="$(new_tmp_file)"
+
+# ======================================================================
+# tool functions
+# ----------------------------------------------------------------------
+check() {
+    EXPECTED_OUTPUT="$1"; shift
+    ACTUAL_OUTPUT="$1"  ; shift
+
+    if ! diff -w <(echo "$ACTUAL_OUTPUT") <(echo -e "$EXPECTED_OUTPUT"); then
+        echo -e "${red}FAIL${end}"
+        echo -e "${yellow}Expected:${end}\n$EXPECTED_OUTPUT"
+        echo -e "${cyan}Actual:${end}\n$ACTUAL_OUTPUT"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# the ids listed by imgStoreMgr, sorted, on one line
+ids() {
+    imgStoreMgr list "$1" | awk '/^IMAGE ID:/ { print $3 }' | sort | xargs
+}
+
+# ----------------------------------------------------------------------
+# the number of images in the header listed by imgStoreMgr
+count() {
+    imgStoreMgr list "$1" | awk '/^IMAGE COUNT:/ { print $3 }'
+}
+
+# ----------------------------------------------------------------------
+# first line of the error of an imgStoreMgr command, empty if none
+error_of() {
+    imgStoreMgr "$@" 2>&1 >/dev/null | head -n 1
+}
+
+# ----------------------------------------------------------------------
+# $1: info message
+# $2: expected ids in the imgStore
+# $3: expected number of images
+# others: ids and files of the expected images, read back as originals
+content_test () {
+    local info="$1"; shift
+    local expected="$1"; shift
+    local nb="$1"; shift
+    printf "${magenta}Test %1d${end} ($info):\n" $((++test))
+
+    printf '\ta. list: '
+    check "$expected" "$(ids "$db")" || return 1
+
+    # each image in exactly one shard
+    printf '\tb. shards: '
+    local all="$( (ids "$db.0"; ids "$db.1") | xargs -n 1 | sort | xargs)"
+    local counts=$(( $(count "$db.0") + $(count "$db.1") ))
+    check "$expected $nb $nb" "$all $counts $(count "$db")" || return 1
+
+    printf '\tc. read: '
+    while [ $# -ge 2 ]; do
+        local err="$(error_of read "$db" "$1")"
+        if [ -n "$err" ] || ! cmp -s "${1}_orig.jpg" "tests/data/$2"; then
+            rm -f "${1}_orig.jpg"
+            echo -e "${red}FAIL${end}: $1 not read back as $2 $err"
+            return 1
+        fi
+        rm -f "${1}_orig.jpg"
+        shift 2
+    done
+    echo -e "${green}PASS${end}"
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# $1: info message
+# $2: expected error, empty if none
+# others: command to be tested and all its arguments
+error_test () {
+    local info="$1"; shift
+    local expected="$1"; shift
+    printf "${magenta}Test %1d${end} ($info): " $((++test))
+    check "$expected" "$(error_of "$@")"
+}
+
+# ======================================================================
+checkX "command line ImgStore tool" imgStoreMgr
+
+rm -f "$db"
+imgStoreMgr create "$db" -shards 2 >/dev/null || error "Cannot create a sharded imgStore \"$db\""
+[ -f "$db.0" ] && [ -f "$db.1" ] || error "no shards next to \"$db\""
+
+error_test 'insert pic1' '' insert "$db" pic1 tests/data/papillon.jpg || ok=0
+error_test 'insert pic2' '' insert "$db" pic2 tests/data/foret.jpg || ok=0
+error_test 'insert pic3' '' insert "$db" pic3 tests/data/coquelicots.jpg || ok=0
+
+content_test 'sharded insert' 'pic1 pic2 pic3' 3 \
+pic1 papillon.jpg pic2 foret.jpg pic3 coquelicots.jpg || ok=0
+
+error_test 'existing id' "ERROR: $exiid" insert "$db" pic2 tests/data/papillon.jpg || ok=0
+error_test 'delete pic2' '' delete "$db" pic2 || ok=0
+
+content_test 'sharded delete' 'pic1 pic3' 2 \
+pic1 papillon.jpg pic3 coquelicots.jpg || ok=0
+
+error_test 'read deleted pic2' "ERROR: $fnf" read "$db" pic2 || ok=0
+
+# ======================================================================
+if [ "x$ok" = 'x1' ]; then
+    echo -e "$0 ${bold}${green}SUCCESS${end}"
+    exit 0
+else
+   echo -e "$0 ${bold}${red}FAILED${end} at some point"
+   exit 1
+fi
@@ -0,0 +1,155 @@
+#!/bin/bash
+
+## Black-box testing of imgStoreMgr -- export and import
+
+# ======================================================================
+# options
+
+with_colors=0
+while [ $# -ge 1 ]; do
+    case "$1" in
+        -c|--color|--colors) with_colors=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+if [ "x$with_colors" = 'x1' ]; then
+    esc="\033["
+    red="${esc}31m"
+    green="${esc}32m"
+    yellow="${esc}33m"
+    blue="${esc}34m"
+    magenta="${esc}35m"
+    cyan="${esc}36m"
+    bold="${esc}1m"
+    end="${esc}0m"
+else
+    red=
+    green=
+    yellow=
+    blue=
+    magenta=
+    cyan=
+    bold=
+    end=
+fi
+
+# ======================================================================
+printf "${bold}${blue}"
+source $(dirname ${BASH_SOURCE[0]})/test_env.sh
+printf "${end}"
+
+test=0
+ok=1
+
+# error messages
+exiid='Existing image ID'
+
+db="$(new_tmp_file)"
+archive="$(new_tmp_file)"
+copy="$(new_tmp_file)"
+
+# ======================================================================
+# tool functions
+# ----------------------------------------------------------------------
+check() {
+    EXPECTED_OUTPUT="$1"; shift
+    ACTUAL_OUTPUT="$1"  ; shift
+
+    if ! diff -w <(echo "$ACTUAL_OUTPUT") <(echo -e "$EXPECTED_OUTPUT"); then
+        echo -e "${red}FAIL${end}"
+        echo -e "${yellow}Expected:${end}\n$EXPECTED_OUTPUT"
+        echo -e "${cyan}Actual:${end}\n$ACTUAL_OUTPUT"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# the images of an imgStore, whatever their offsets: id, SHA and sizes
+images() {
+    imgStoreMgr list "$1" | awk '/^IMAGE ID:/ { id = $3 } /^SHA:/ { sha = $2 }
+        /^OFFSET ORIG/ { orig = $NF } /^OFFSET THUMB/ { thumb = $NF }
+        /^OFFSET SMALL/ { print id, sha, orig, thumb, $NF }' | sort
+}
+
+# ----------------------------------------------------------------------
+# error reported by an imgStoreMgr command, empty if none
+error_of() {
+    imgStoreMgr "$@" 2>&1 >/dev/null | grep '^ERROR' | head -n 1 || true
+}
+
+# ----------------------------------------------------------------------
+# new empty imgStore
+fresh() {
+    rm -f "$1" "$1".*
+    imgStoreMgr create "$1" >/dev/null || error "Cannot create \"$1\""
+}
+
+# ----------------------------------------------------------------------
+# $1: info message
+# $2: expected output of the import
+# others: the import command and its arguments (or a pipe, as a string)
+import_test () {
+    local info="$1"; shift
+    local expected="$1"; shift
+    printf "${magenta}Test %1d${end} ($info):\n" $((++test))
+
+    printf '\ta. import: '
+    check "$expected" "$(eval "$@" 2>&1)" || return 1
+
+    printf '\tb. same images: '
+    check "$(images "$db")" "$(images "$copy")" || return 1
+
+    printf '\tc. same content: '
+    for id in pic1 pic2 pic3; do
+        for res in orig thumb; do
+            imgStoreMgr read "$db" $id $res >/dev/null && mv ${id}_${res}.jpg "$archive.$id"
+            imgStoreMgr read "$copy" $id $res >/dev/null
+            if ! cmp -s ${id}_${res}.jpg "$archive.$id"; then
+                rm -f ${id}_${res}.jpg
+                echo -e "${red}FAIL${end}: $id ($res) not the same"
+                return 1
+            fi
+            rm -f ${id}_${res}.jpg
+        done
+    done
+    echo -e "${green}PASS${end}"
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ======================================================================
+checkX "command line ImgStore tool" imgStoreMgr
+
+# some derived images to be exported as well
+cp tests/data/test02.imgst_dynamic "$db" || error "Cannot copy test02.imgst_dynamic to \"$db\""
+imgStoreMgr insert "$db" pic3 tests/data/foret.jpg >/dev/null || error "Cannot insert pic3"
+imgStoreMgr read "$db" pic1 thumb >/dev/null && rm -f pic1_thumb.jpg || error "Cannot read pic1"
+imgStoreMgr read "$db" pic3 small >/dev/null && rm -f pic3_small.jpg || error "Cannot read pic3"
+
+printf "${magenta}Test %1d${end} (export): " $((++test))
+check '' "$(error_of export "$db" "$archive")" || ok=0
+
+fresh "$copy"
+import_test 'import from a file' '3 image(s) imported' \
+imgStoreMgr import "$copy" "$archive" || ok=0
+
+printf "${magenta}Test %1d${end} (import again): " $((++test))
+check "ERROR: $exiid" "$(error_of import "$copy" "$archive")" || ok=0
+
+fresh "$copy"
+import_test 'export | import' '3 image(s) imported' \
+"imgStoreMgr export '$db' | imgStoreMgr import '$copy'" || ok=0
+
+# ======================================================================
+if [ "x$ok" = 'x1' ]; then
+    echo -e "$0 ${bold}${green}SUCCESS${end}"
+    exit 0
+else
+   echo -e "$0 ${bold}${red}FAILED${end} at some point"
+   exit 1
+fi
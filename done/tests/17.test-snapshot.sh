@@ -0,0 +1,170 @@
+#!/bin/bash
+
+## Black-box testing of imgStore webserver -- reads as of a snapshot
+
+# ======================================================================
+# options
+
+with_colors=0
+while [ $# -ge 1 ]; do
+    case "$1" in
+        -c|--color|--colors) with_colors=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+if [ "x$with_colors" = 'x1' ]; then
+    esc="\033["
+    red="${esc}31m"
+    green="${esc}32m"
+    yellow="${esc}33m"
+    blue="${esc}34m"
+    magenta="${esc}35m"
+    cyan="${esc}36m"
+    bold="${esc}1m"
+    end="${esc}0m"
+else
+    red=
+    green=
+    yellow=
+    blue=
+    magenta=
+    cyan=
+    bold=
+    end=
+fi
+
+# ======================================================================
+printf "${bold}${blue}"
+source $(dirname ${BASH_SOURCE[0]})/test_env.sh
+printf "${end}"
+
+test=0
+ok=1
+
+# Logfiles root name
+LOG=server-$$
+# webserver exec
+exec="${PWD}/imgStore_server"
+# base URL
+baseURL=http://localhost:8000
+# server PID
+job_pid=
+
+# error messages
+fnf='File not found'
+
+db="$(new_tmp_file)"
+image="$(new_tmp_file)"
+
+# ======================================================================
+# tool functions
+# ----------------------------------------------------------------------
+quit() {
+    stop_server
+    error "$*"
+}
+
+# ----------------------------------------------------------------------
+check() {
+    EXPECTED_OUTPUT="$1"; shift
+    ACTUAL_OUTPUT="$1"  ; shift
+
+    if ! diff -w <(echo "$ACTUAL_OUTPUT") <(echo -e "$EXPECTED_OUTPUT"); then
+        echo -e "${red}FAIL${end}"
+        echo -e "${yellow}Expected:${end}\n$EXPECTED_OUTPUT"
+        echo -e "${cyan}Actual:${end}\n$ACTUAL_OUTPUT"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+launch_server()
+{
+    $stdbuf -oL "$exec" "$db" 1> "${LOG}.log" 2> "${LOG}-err.log" &
+    job_pid=$!
+    sleep 1 #wait a bit
+    echo "$(pwd)/${LOG}.log"     >> "$TMP_FILES"
+    echo "$(pwd)/${LOG}-err.log" >> "$TMP_FILES"
+    ps -p$job_pid >/dev/null 2>&1 || error "cannot lauch \"$(basename "$exec")\" (with image store \"$db\")"
+}
+
+# --------------------------------------------------
+stop_server()
+{
+    if [ "x$job_pid" != 'x' ]; then
+        ps -p$job_pid >/dev/null 2>&1 && kill -TERM $job_pid
+        sleep 1 # wait a bit
+        job_pid=
+    fi
+    return 0
+}
+
+# ----------------------------------------------------------------------
+do_insert () {
+    local insfile="tests/data/$2"
+    local size=$($stat -c%s "$insfile")
+    curl -sS --data-binary @"$insfile" "${baseURL}/imgStore/insert?offset=0&name=$1" >/dev/null \
+    && curl -sS -d '' "${baseURL}/imgStore/insert?offset=${size}&name=$1" >/dev/null \
+    || quit "cannot insert $1"
+}
+
+# ----------------------------------------------------------------------
+# $1: info message
+# $2: expected answer
+# $3: URL, after ${baseURL}/imgStore/
+url_test () {
+    printf "${magenta}Test %1d${end} ($1): " $((++test))
+    check "$2" "$(curl -sS "${baseURL}/imgStore/$3" 2>&1)"
+}
+
+# ----------------------------------------------------------------------
+# $1: info message
+# $2: expected content (a file of tests/data)
+# $3: URL, after ${baseURL}/imgStore/
+image_test () {
+    printf "${magenta}Test %1d${end} ($1): " $((++test))
+    curl -sS "${baseURL}/imgStore/$3" -o "$image" || { echo -e "${red}FAIL${end}"; return 1; }
+    if ! cmp -s "$image" "tests/data/$2"; then
+        echo -e "${red}FAIL${end}: not the content of $2"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+}
+
+# ======================================================================
+checkX webserver "$exec"
+
+cp tests/data/test02.imgst_dynamic "$db" || error "Cannot copy test02.imgst_dynamic to \"$db\""
+launch_server
+
+# the first page pins version 2
+url_test 'first page' '{"Images": ["pic1"], "snapshot": 2, "total": 2}' \
+'list?from=0&count=1' || ok=0
+
+do_insert pic3 foret.jpg
+curl -sS "${baseURL}/imgStore/delete?img_id=pic1" >/dev/null || quit "cannot delete pic1"
+
+url_test 'current list' '{"Images": ["pic2", "pic3"]}' 'list' || ok=0
+url_test 'next page, as of the snapshot' '{"Images": ["pic2"], "snapshot": 2, "total": 2}' \
+'list?from=1&count=1&snapshot=2' || ok=0
+image_test 'deleted image, as of the snapshot' papillon.jpg \
+'read?res=orig&img_id=pic1&snapshot=2' || ok=0
+url_test 'inserted image, as of the snapshot' "Error: $fnf" \
+'read?res=orig&img_id=pic3&snapshot=2' || ok=0
+url_test 'deleted image, now' "Error: $fnf" 'read?res=orig&img_id=pic1' || ok=0
+image_test 'inserted image, now' foret.jpg 'read?res=orig&img_id=pic3' || ok=0
+
+# ======================================================================
+stop_server
+
+if [ "x$ok" = 'x1' ]; then
+    echo -e "$0 ${bold}${green}SUCCESS${end}"
+    exit 0
+else
+   echo -e "$0 ${bold}${red}FAILED${end} at some point"
+   exit 1
+fi
@@ -0,0 +1,141 @@
+#!/bin/bash
+
+## Black-box testing of imgStoreMgr -- scrub
+
+# ======================================================================
+# options
+
+with_colors=0
+while [ $# -ge 1 ]; do
+    case "$1" in
+        -c|--color|--colors) with_colors=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+if [ "x$with_colors" = 'x1' ]; then
+    esc="\033["
+    red="${esc}31m"
+    green="${esc}32m"
+    yellow="${esc}33m"
+    blue="${esc}34m"
+    magenta="${esc}35m"
+    cyan="${esc}36m"
+    bold="${esc}1m"
+    end="${esc}0m"
+else
+    red=
+    green=
+    yellow=
+    blue=
+    magenta=
+    cyan=
+    bold=
+    end=
+fi
+
+# ======================================================================
+printf "${bold}${blue}"
+source $(dirname ${BASH_SOURCE[0]})/test_env.sh
+printf "${end}"
+
+test=0
+ok=1
+
+# error messages
+ioerr='I/O Error'
+
+db="$(new_tmp_file)"
+
+# ======================================================================
+# tool functions
+# ----------------------------------------------------------------------
+check() {
+    EXPECTED_OUTPUT="$1"; shift
+    ACTUAL_OUTPUT="$1"  ; shift
+
+    if ! diff -w <(echo "$ACTUAL_OUTPUT") <(echo -e "$EXPECTED_OUTPUT"); then
+        echo -e "${red}FAIL${end}"
+        echo -e "${yellow}Expected:${end}\n$EXPECTED_OUTPUT"
+        echo -e "${cyan}Actual:${end}\n$ACTUAL_OUTPUT"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# report of a scrub (without the help printed on error)
+scrub() {
+    imgStoreMgr scrub "$@" 2>/dev/null | $sed '/^imgStoreMgr \[COMMAND\]/,$d' || true
+}
+
+# ----------------------------------------------------------------------
+# error reported by an imgStoreMgr command, empty if none
+error_of() {
+    imgStoreMgr "$@" 2>&1 >/dev/null | grep '^ERROR' | head -n 1 || true
+}
+
+# ----------------------------------------------------------------------
+# offset of the original of an image
+offset_of() {
+    imgStoreMgr list "$db" | awk -v id="$1" '/^IMAGE ID:/ { found = $3 == id }
+        /^OFFSET ORIG/ && found { print $4 }'
+}
+
+# ----------------------------------------------------------------------
+# flips the bits of the byte at $1 of the imgStore
+flip() {
+    local byte=$(od -An -tu1 -j "$1" -N 1 "$db")
+    printf "\\x$(printf %02x $((255 - $byte)))" | dd of="$db" bs=1 seek="$1" conv=notrunc status=none
+}
+
+# ----------------------------------------------------------------------
+# $1: info message
+# others: options of create
+scrub_test () {
+    local info="$1"; shift
+    printf "${magenta}Test %1d${end} (scrub $info):\n" $((++test))
+
+    rm -f "$db" "$db".*
+    imgStoreMgr create "$db" "$@" >/dev/null || error "Cannot create \"$db\""
+    imgStoreMgr insert "$db" pic1 tests/data/papillon.jpg >/dev/null || error "Cannot insert pic1"
+    imgStoreMgr insert "$db" pic2 tests/data/foret.jpg >/dev/null || error "Cannot insert pic2"
+
+    printf '\ta. intact: '
+    check '2 blob(s) verified (442787 bytes), 0 corrupted' "$(scrub "$db")" || return 1
+
+    local offset=$(offset_of pic2)
+    flip $(($offset + 1000))
+
+    printf '\tb. flipped byte: '
+    check "pic2 (orig): corrupted, 369911 bytes at offset $offset
+2 blob(s) verified (442787 bytes), 1 corrupted" "$(scrub "$db" -threads 1)" || return 1
+
+    printf '\tc. reported as an error: '
+    check "ERROR: $ioerr" "$(error_of scrub "$db")" || return 1
+
+    # restored: nothing left to report
+    flip $(($offset + 1000))
+    printf '\td. flipped back: '
+    check '2 blob(s) verified (442787 bytes), 0 corrupted' "$(scrub "$db" -threads 2)" || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ======================================================================
+checkX "command line ImgStore tool" imgStoreMgr
+
+scrub_test 'against the checksums' -checksum || ok=0
+scrub_test 'against the SHA' || ok=0
+
+# ======================================================================
+if [ "x$ok" = 'x1' ]; then
+    echo -e "$0 ${bold}${green}SUCCESS${end}"
+    exit 0
+else
+   echo -e "$0 ${bold}${red}FAILED${end} at some point"
+   exit 1
+fi
@@ -0,0 +1,256 @@
+#!/bin/bash
+
+## Black-box testing of imgStoreMgr -- index sidecar
+
+# ======================================================================
+# options
+
+with_colors=0
+while [ $# -ge 1 ]; do
+    case "$1" in
+        -c|--color|--colors) with_colors=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+if [ "x$with_colors" = 'x1' ]; then
+    esc="\033["
+    red="${esc}31m"
+    green="${esc}32m"
+    yellow="${esc}33m"
+    blue="${esc}34m"
+    magenta="${esc}35m"
+    cyan="${esc}36m"
+    bold="${esc}1m"
+    end="${esc}0m"
+else
+    red=
+    green=
+    yellow=
+    blue=
+    magenta=
+    cyan=
+    bold=
+    end=
+fi
+
+# ======================================================================
+printf "${bold}${blue}"
+source $(dirname ${BASH_SOURCE[0]})/test_env.sh
+printf "${end}"
+
+test=0
+ok=1
+
+# error messages
+exiid='Existing image ID'
+fnf='File not found'
+
+db="$(new_tmp_file)"
+saved="$(new_tmp_file)"
+
+# ======================================================================
+# tool functions
+# ----------------------------------------------------------------------
+check() {
+    EXPECTED_OUTPUT="$1"; shift
+    ACTUAL_OUTPUT="$1"  ; shift
+
+    if ! diff -w <(echo "$ACTUAL_OUTPUT") <(echo -e "$EXPECTED_OUTPUT"); then
+        echo -e "${red}FAIL${end}"
+        echo -e "${yellow}Expected:${end}\n$EXPECTED_OUTPUT"
+        echo -e "${cyan}Actual:${end}\n$ACTUAL_OUTPUT"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# error reported by an imgStoreMgr command, empty if none
+error_of() {
+    imgStoreMgr "$@" 2>&1 >/dev/null | grep '^ERROR' | head -n 1 || true
+}
+
+# ----------------------------------------------------------------------
+# new imgStore with pic1, pic2 and pic3
+populate() {
+    rm -f "$db" "$db".*
+    imgStoreMgr create "$db" >/dev/null || error "Cannot create \"$db\""
+    imgStoreMgr insert "$db" pic1 tests/data/papillon.jpg >/dev/null || error "Cannot insert pic1"
+    imgStoreMgr insert "$db" pic2 tests/data/foret.jpg >/dev/null || error "Cannot insert pic2"
+    imgStoreMgr insert "$db" pic3 tests/data/coquelicots.jpg >/dev/null || error "Cannot insert pic3"
+}
+
+# ----------------------------------------------------------------------
+# the ids listed by imgStoreMgr, sorted, on one line
+ids() {
+    imgStoreMgr list "$db" | awk '/^IMAGE ID:/ { print $3 }' | sort | xargs
+}
+
+# ----------------------------------------------------------------------
+# $1: image id, $2: the file of tests/data it is to be read as, or
+# nothing if it is not to be found
+lookup() {
+    if [ $# -eq 1 ]; then
+        [ "$(error_of read "$db" "$1")" = "ERROR: $fnf" ]
+        return
+    fi
+    local found=0
+    [ -z "$(error_of read "$db" "$1")" ] && cmp -s "${1}_orig.jpg" "tests/data/$2" && found=1
+    rm -f "${1}_orig.jpg"
+    [ $found -eq 1 ]
+}
+
+# ----------------------------------------------------------------------
+# $1: info message
+# $2: expected ids
+# others: lookups, separated by ','
+lookup_test () {
+    local info="$1"; shift
+    local expected="$1"; shift
+    printf "\t$info: "
+
+    [ "$(ids)" = "$expected" ] || { check "$expected" "$(ids)"; return 1; }
+    while [ $# -ge 1 ]; do
+        local args=()
+        while [ $# -ge 1 ] && [ "$1" != ',' ]; do
+            args+=("$1")
+            shift
+        done
+        [ $# -ge 1 ] && shift
+        if ! lookup "${args[@]}"; then
+            echo -e "${red}FAIL${end}: lookup of ${args[*]}"
+            return 1
+        fi
+    done
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# $1: info message
+# $2: how to spoil the sidecar (a command)
+spoilt_test () {
+    local info="$1"; shift
+    printf "${magenta}Test %1d${end} ($info sidecar):\n" $((++test))
+
+    populate
+    eval "$1"
+
+    lookup_test 'a. lookups' 'pic1 pic2 pic3' pic1 papillon.jpg , pic2 foret.jpg , pic4 || return 1
+
+    printf '\tb. duplicate id: '
+    check "ERROR: $exiid" "$(error_of insert "$db" pic3 tests/data/papillon.jpg)" || return 1
+
+    printf '\tc. delete pic2: '
+    check '' "$(error_of delete "$db" pic2)" || return 1
+    lookup_test 'd. lookups' 'pic1 pic3' pic2 , pic3 coquelicots.jpg || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# a sidecar kept up to date by the writes
+valid_test () {
+    printf "${magenta}Test %1d${end} (valid sidecar):\n" $((++test))
+
+    populate
+    printf '\ta. written: '
+    [ -s "$db.idx" ] || { echo -e "${red}FAIL${end}: no sidecar next to $db"; return 1; }
+    echo -e "${green}PASS${end}"
+    lookup_test 'b. lookups' 'pic1 pic2 pic3' pic1 papillon.jpg , pic2 foret.jpg , pic4 || return 1
+
+    cp "$db.idx" "$saved"
+    local inode=$($stat -c%i "$db.idx")
+    printf '\tc. delete pic2: '
+    check '' "$(error_of delete "$db" pic2)" || return 1
+
+    printf '\td. updated in place: '
+    if cmp -s "$db.idx" "$saved" || [ "$($stat -c%i "$db.idx")" != "$inode" ]; then
+        echo -e "${red}FAIL${end}"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    lookup_test 'e. lookups' 'pic1 pic3' pic2 , pic3 coquelicots.jpg , pic1 papillon.jpg || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# the sidecar of before the deletion of valid_test
+stale_test () {
+    printf "${magenta}Test %1d${end} (stale sidecar):\n" $((++test))
+
+    cp "$saved" "$db.idx"
+    lookup_test 'a. lookups' 'pic1 pic3' pic2 , pic3 coquelicots.jpg || return 1
+
+    printf '\tb. insert pic2 again: '
+    check '' "$(error_of insert "$db" pic2 tests/data/foret.jpg)" || return 1
+    lookup_test 'c. lookups' 'pic1 pic2 pic3' pic2 foret.jpg , pic3 coquelicots.jpg || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# a slot reused once the ids are compacted: the sidecar is rewritten
+compaction_test () {
+    printf "${magenta}Test %1d${end} (compacted ids):\n" $((++test))
+
+    rm -f "$db" "$db".*
+    imgStoreMgr create "$db" >/dev/null || error "Cannot create \"$db\""
+    printf '\ta. insert pic1, delete pic1, insert pic2: '
+    check '' "$(error_of insert "$db" pic1 tests/data/papillon.jpg)$(error_of delete "$db" pic1)$(error_of insert "$db" pic2 tests/data/foret.jpg)" || return 1
+    lookup_test 'b. lookups' 'pic2' pic2 foret.jpg , pic1 || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# the same listing with and without the sidecar, after a mix of writes
+mutations_test () {
+    printf "${magenta}Test %1d${end} (listing after mutations):\n" $((++test))
+
+    populate
+    printf '\ta. mutations: '
+    check '' "$(error_of delete "$db" pic2)$(error_of insert "$db" pic4 tests/data/foret.jpg)$(error_of read "$db" pic3 small)$(error_of delete "$db" pic1)$(error_of insert "$db" pic1 tests/data/coquelicots.jpg)$(error_of insert "$db" pic5 tests/data/papillon.jpg)$(error_of delete "$db" pic4)" || return 1
+    rm -f pic3_small.jpg
+
+    local listed="$(imgStoreMgr list "$db")"
+    printf '\tb. without the sidecar: '
+    rm -f "$db.idx"
+    check "$listed" "$(imgStoreMgr list "$db")" || return 1
+    lookup_test 'c. lookups' 'pic1 pic3 pic5' pic1 coquelicots.jpg , pic5 papillon.jpg , pic2 , pic4 || return 1
+
+    printf '\td. with the rebuilt sidecar: '
+    [ -s "$db.idx" ] || { echo -e "${red}FAIL${end}: no sidecar next to $db"; return 1; }
+    check "$listed" "$(imgStoreMgr list "$db")" || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ======================================================================
+checkX "command line ImgStore tool" imgStoreMgr
+
+valid_test && stale_test || ok=0
+
+spoilt_test 'truncated' 'truncate -s $(($($stat -c%s "$db.idx") / 2)) "$db.idx"' || ok=0
+spoilt_test 'random' 'head -c 4096 /dev/urandom > "$db.idx"' || ok=0
+spoilt_test 'missing' 'rm -f "$db.idx"' || ok=0
+compaction_test || ok=0
+mutations_test || ok=0
+
+# ======================================================================
+if [ "x$ok" = 'x1' ]; then
+    echo -e "$0 ${bold}${green}SUCCESS${end}"
+    exit 0
+else
+   echo -e "$0 ${bold}${red}FAILED${end} at some point"
+   exit 1
+fi
@@ -0,0 +1,156 @@
+#!/bin/bash
+
+## Black-box testing of imgStoreMgr -- preallocated imgStore
+
+# ======================================================================
+# options
+
+with_colors=0
+while [ $# -ge 1 ]; do
+    case "$1" in
+        -c|--color|--colors) with_colors=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+if [ "x$with_colors" = 'x1' ]; then
+    esc="\033["
+    red="${esc}31m"
+    green="${esc}32m"
+    yellow="${esc}33m"
+    blue="${esc}34m"
+    magenta="${esc}35m"
+    cyan="${esc}36m"
+    bold="${esc}1m"
+    end="${esc}0m"
+else
+    red=
+    green=
+    yellow=
+    blue=
+    magenta=
+    cyan=
+    bold=
+    end=
+fi
+
+# ======================================================================
+printf "${bold}${blue}"
+source $(dirname ${BASH_SOURCE[0]})/test_env.sh
+printf "${end}"
+
+test=0
+ok=1
+
+db="$(new_tmp_file)"
+dbbkup="$(new_tmp_file)"
+
+# header and metadata of an imgStore of 10 images, with its extension
+table_size=2352
+
+# ======================================================================
+# tool functions
+# ----------------------------------------------------------------------
+check() {
+    EXPECTED_OUTPUT="$1"; shift
+    ACTUAL_OUTPUT="$1"  ; shift
+
+    if ! diff -w <(echo "$ACTUAL_OUTPUT") <(echo -e "$EXPECTED_OUTPUT"); then
+        echo -e "${red}FAIL${end}"
+        echo -e "${yellow}Expected:${end}\n$EXPECTED_OUTPUT"
+        echo -e "${cyan}Actual:${end}\n$ACTUAL_OUTPUT"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# error reported by an imgStoreMgr command, empty if none
+error_of() {
+    imgStoreMgr "$@" 2>&1 >/dev/null | grep '^ERROR' | head -n 1 || true
+}
+
+# ----------------------------------------------------------------------
+# offset of the original of each image, sorted by id
+offsets() {
+    imgStoreMgr list "$db" | awk '/^IMAGE ID:/ { id = $3 } /^OFFSET ORIG/ { print id, $4 }' | sort
+}
+
+# ----------------------------------------------------------------------
+# end of the content, as reported by stats
+end_of_data() {
+    imgStoreMgr stats "$db" | awk '/^FILE SIZE:/ { print $3 }'
+}
+
+# ----------------------------------------------------------------------
+# $1: info message
+# $2: expected offsets
+# $3: expected end of the content
+# others: command to be tested and all its arguments
+prealloc_test () {
+    local info="$1"; shift
+    local expected="$1"; shift
+    local eod="$1"; shift
+    printf "${magenta}Test %1d${end} ($info):\n" $((++test))
+
+    printf "\ta. $1: "
+    check '' "$(error_of "$@")" || return 1
+
+    printf '\tb. offsets: '
+    check "$expected" "$(offsets)" || return 1
+
+    printf '\tc. end of the content: '
+    check "$eod" "$(end_of_data)" || return 1
+
+    # the rest of the file is preallocated
+    printf '\td. file size: '
+    if [ $($stat -c%s "$db") -le $eod ]; then
+        echo -e "${red}FAIL${end}: $db not preallocated past its content"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ======================================================================
+checkX "command line ImgStore tool" imgStoreMgr
+
+rm -f "$db"
+imgStoreMgr create "$db" -prealloc >/dev/null || error "Cannot create \"$db\""
+
+size1=72876
+size2=369911
+size3=98119
+
+# images one after the other, not at the end of the file
+eod=$(($table_size + $size1))
+prealloc_test 'insert pic1' "pic1 $table_size" $eod \
+insert "$db" pic1 tests/data/papillon.jpg || ok=0
+
+prealloc_test 'insert pic2' "pic1 $table_size
+pic2 $eod" $(($eod + $size2)) \
+insert "$db" pic2 tests/data/foret.jpg || ok=0
+
+imgStoreMgr delete "$db" pic1 >/dev/null || error "Cannot delete pic1"
+
+# the end of the content of the new file, right after pic2
+eod=$(($table_size + $size2))
+prealloc_test 'gc' "pic2 $table_size" $eod \
+gc "$db" "$dbbkup" || ok=0
+
+prealloc_test 'insert pic3 after gc' "pic2 $table_size
+pic3 $eod" $(($eod + $size3)) \
+insert "$db" pic3 tests/data/coquelicots.jpg || ok=0
+
+# ======================================================================
+if [ "x$ok" = 'x1' ]; then
+    echo -e "$0 ${bold}${green}SUCCESS${end}"
+    exit 0
+else
+   echo -e "$0 ${bold}${red}FAILED${end} at some point"
+   exit 1
+fi
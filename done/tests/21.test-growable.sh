@@ -0,0 +1,190 @@
+#!/bin/bash
+
+## Black-box testing of imgStoreMgr -- growable imgStores
+
+# ======================================================================
+# options
+
+with_colors=0
+while [ $# -ge 1 ]; do
+    case "$1" in
+        -c|--color|--colors) with_colors=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+if [ "x$with_colors" = 'x1' ]; then
+    esc="\033["
+    red="${esc}31m"
+    green="${esc}32m"
+    yellow="${esc}33m"
+    blue="${esc}34m"
+    magenta="${esc}35m"
+    cyan="${esc}36m"
+    bold="${esc}1m"
+    end="${esc}0m"
+else
+    red=
+    green=
+    yellow=
+    blue=
+    magenta=
+    cyan=
+    bold=
+    end=
+fi
+
+# ======================================================================
+printf "${bold}${blue}"
+source $(dirname ${BASH_SOURCE[0]})/test_env.sh
+printf "${end}"
+
+test=0
+ok=1
+
+# error messages
+full='Full imgStore'
+
+db="$(new_tmp_file)"
+tmp="$(new_tmp_file)"
+
+# images inserted, in turn
+files=(papillon.jpg foret.jpg coquelicots.jpg)
+
+# ======================================================================
+# tool functions
+# ----------------------------------------------------------------------
+check() {
+    EXPECTED_OUTPUT="$1"; shift
+    ACTUAL_OUTPUT="$1"  ; shift
+
+    if ! diff -w <(echo "$ACTUAL_OUTPUT") <(echo -e "$EXPECTED_OUTPUT"); then
+        echo -e "${red}FAIL${end}"
+        echo -e "${yellow}Expected:${end}\n$EXPECTED_OUTPUT"
+        echo -e "${cyan}Actual:${end}\n$ACTUAL_OUTPUT"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# error reported by an imgStoreMgr command, empty if none
+error_of() {
+    imgStoreMgr "$@" 2>&1 >/dev/null | grep '^ERROR' | head -n 1 || true
+}
+
+# ----------------------------------------------------------------------
+# the ids listed by imgStoreMgr, sorted, on one line
+ids() {
+    imgStoreMgr list "$db" | awk '/^IMAGE ID:/ { print $3 }' | sort -V | xargs
+}
+
+# ----------------------------------------------------------------------
+# inserts pic$1 to pic$2; the errors, if any
+insert_range() {
+    local i
+    for i in $(seq "$1" "$2"); do
+        error_of insert "$db" pic$i "tests/data/${files[$(( (i - 1) % 3 ))]}"
+    done
+}
+
+# ----------------------------------------------------------------------
+# $@: ids to be read back as inserted by insert_range
+read_test() {
+    local id
+    for id in "$@"; do
+        local i=${id#pic}
+        if [ -n "$(error_of read "$db" $id)" ] \
+           || ! cmp -s ${id}_orig.jpg "tests/data/${files[$(( (i - 1) % 3 ))]}"; then
+            rm -f ${id}_orig.jpg
+            echo -e "${red}FAIL${end}: read of $id"
+            return 1
+        fi
+        rm -f ${id}_orig.jpg
+    done
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# a store of 2 slots grown to hold 7 images
+grow_test () {
+    printf "${magenta}Test %1d${end} (growable imgStore):\n" $((++test))
+
+    rm -f "$db" "$db".*
+    imgStoreMgr create "$db" -max_files 2 -growable >/dev/null || error "Cannot create \"$db\""
+    printf '\ta. insert past max_files: '
+    check '' "$(insert_range 1 7)" || return 1
+
+    printf '\tb. list after reopening: '
+    check 'pic1 pic2 pic3 pic4 pic5 pic6 pic7' "$(ids)" || return 1
+
+    printf '\tc. read: '
+    read_test pic1 pic2 pic4 pic7 || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# gc of grow_test: the tmp store, of 2 slots, grows as it is filled
+gc_test () {
+    printf "${magenta}Test %1d${end} (gc of a grown imgStore):\n" $((++test))
+
+    printf '\ta. delete pic2 and pic5: '
+    check '' "$(error_of delete "$db" pic2)$(error_of delete "$db" pic5)" || return 1
+
+    printf '\tb. gc: '
+    check '' "$(error_of gc "$db" "$tmp")" || return 1
+
+    printf '\tc. list: '
+    check 'pic1 pic3 pic4 pic6 pic7' "$(ids)" || return 1
+
+    printf '\td. read: '
+    read_test pic1 pic3 pic4 pic6 pic7 || return 1
+
+    printf '\te. insert after gc: '
+    check '' "$(insert_range 8 9)" || return 1
+    printf '\tf. list: '
+    check 'pic1 pic3 pic4 pic6 pic7 pic8 pic9' "$(ids)" || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# a store of 2 slots, not growable
+full_test () {
+    printf "${magenta}Test %1d${end} (imgStore not growable):\n" $((++test))
+
+    rm -f "$db" "$db".*
+    imgStoreMgr create "$db" -max_files 2 >/dev/null || error "Cannot create \"$db\""
+    printf '\ta. insert up to max_files: '
+    check '' "$(insert_range 1 2)" || return 1
+
+    printf '\tb. insert past max_files: '
+    check "ERROR: $full" "$(insert_range 3 3)" || return 1
+
+    printf '\tc. list: '
+    check 'pic1 pic2' "$(ids)" || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ======================================================================
+checkX "command line ImgStore tool" imgStoreMgr
+
+grow_test && gc_test || ok=0
+full_test || ok=0
+
+# ======================================================================
+if [ "x$ok" = 'x1' ]; then
+    echo -e "$0 ${bold}${green}SUCCESS${end}"
+    exit 0
+else
+   echo -e "$0 ${bold}${red}FAILED${end} at some point"
+   exit 1
+fi
@@ -0,0 +1,183 @@
+#!/bin/bash
+
+## Black-box testing of imgStoreMgr -- replicas (follow)
+
+# ======================================================================
+# options
+
+with_colors=0
+while [ $# -ge 1 ]; do
+    case "$1" in
+        -c|--color|--colors) with_colors=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+if [ "x$with_colors" = 'x1' ]; then
+    esc="\033["
+    red="${esc}31m"
+    green="${esc}32m"
+    yellow="${esc}33m"
+    blue="${esc}34m"
+    magenta="${esc}35m"
+    cyan="${esc}36m"
+    bold="${esc}1m"
+    end="${esc}0m"
+else
+    red=
+    green=
+    yellow=
+    blue=
+    magenta=
+    cyan=
+    bold=
+    end=
+fi
+
+# ======================================================================
+printf "${bold}${blue}"
+source $(dirname ${BASH_SOURCE[0]})/test_env.sh
+printf "${end}"
+
+test=0
+ok=1
+
+# error messages
+fnf='File not found'
+
+db="$(new_tmp_file)"
+replica="$(new_tmp_file)"
+
+# ======================================================================
+# tool functions
+# ----------------------------------------------------------------------
+check() {
+    EXPECTED_OUTPUT="$1"; shift
+    ACTUAL_OUTPUT="$1"  ; shift
+
+    if ! diff -w <(echo "$ACTUAL_OUTPUT") <(echo -e "$EXPECTED_OUTPUT"); then
+        echo -e "${red}FAIL${end}"
+        echo -e "${yellow}Expected:${end}\n$EXPECTED_OUTPUT"
+        echo -e "${cyan}Actual:${end}\n$ACTUAL_OUTPUT"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# error reported by an imgStoreMgr command, empty if none
+error_of() {
+    imgStoreMgr "$@" 2>&1 >/dev/null | grep '^ERROR' | head -n 1 || true
+}
+
+# ----------------------------------------------------------------------
+# the ids listed by imgStoreMgr, sorted, on one line
+ids() {
+    imgStoreMgr list "$1" | awk '/^IMAGE ID:/ { print $3 }' | sort | xargs
+}
+
+# ----------------------------------------------------------------------
+# the report of follow -once
+follow_once() {
+    imgStoreMgr follow "$db" "$replica" -once 2>&1 >/dev/null | grep 'change(s) applied' || true
+}
+
+# ----------------------------------------------------------------------
+# $1: image id, $2: resolution; the image read from the replica, compared
+# to the one read from the imgStore
+same_image() {
+    local ret=0
+    [ -z "$(error_of read "$db" $1 $2)" ] && mv ${1}_$2.jpg ${1}_$2-db.jpg || ret=1
+    [ $ret -eq 0 ] && [ -z "$(error_of read "$replica" $1 $2)" ] && cmp -s ${1}_$2.jpg ${1}_$2-db.jpg || ret=1
+    rm -f ${1}_$2.jpg ${1}_$2-db.jpg
+    return $ret
+}
+
+# ----------------------------------------------------------------------
+# $1: info message
+# $2: expected report of follow -once
+# $3: expected ids in the replica
+follow_test () {
+    printf "\t$1: "
+    check "$2" "$(follow_once)" || return 1
+    printf "\t$1, ids: "
+    check "$3" "$(ids "$replica")"
+}
+
+# ----------------------------------------------------------------------
+# a new replica of three images
+converge_test () {
+    printf "${magenta}Test %1d${end} (new replica):\n" $((++test))
+
+    rm -f "$db" "$db".* "$replica" "$replica".*
+    imgStoreMgr create "$db" -replog >/dev/null || error "Cannot create \"$db\""
+    imgStoreMgr insert "$db" pic1 tests/data/papillon.jpg >/dev/null || error "Cannot insert pic1"
+    imgStoreMgr insert "$db" pic2 tests/data/foret.jpg >/dev/null || error "Cannot insert pic2"
+    imgStoreMgr insert "$db" pic3 tests/data/coquelicots.jpg >/dev/null || error "Cannot insert pic3"
+
+    follow_test 'a. follow' '3 change(s) applied, version 3' 'pic1 pic2 pic3' || return 1
+    printf '\tb. same images: '
+    for id in pic1 pic2 pic3; do
+        same_image $id orig || { echo -e "${red}FAIL${end}: $id"; return 1; }
+    done
+    echo -e "${green}PASS${end}"
+
+    follow_test 'c. follow again' '0 change(s) applied, version 3' 'pic1 pic2 pic3' || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# the replica of converge_test, after a delete
+delete_test () {
+    printf "${magenta}Test %1d${end} (delete):\n" $((++test))
+
+    imgStoreMgr delete "$db" pic2 >/dev/null || error "Cannot delete pic2"
+    follow_test 'a. follow' '1 change(s) applied, version 4' 'pic1 pic3' || return 1
+    printf '\tb. read pic2: '
+    check "ERROR: $fnf" "$(error_of read "$replica" pic2)" || return 1
+    follow_test 'c. follow again' '0 change(s) applied, version 4' 'pic1 pic3' || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# the replica of delete_test, after a resized image is created
+resized_test () {
+    printf "${magenta}Test %1d${end} (resized image):\n" $((++test))
+
+    printf '\ta. read pic1 small: '
+    check '' "$(error_of read "$db" pic1 small)" || return 1
+    rm -f pic1_small.jpg
+
+    follow_test 'b. follow' '1 change(s) applied, version 4' 'pic1 pic3' || return 1
+
+    # attached as it is in the imgStore: not resized by the replica
+    local size=$($stat -c%s "$replica")
+    printf '\tc. same small image: '
+    same_image pic1 small || { echo -e "${red}FAIL${end}"; return 1; }
+    check "$size" "$($stat -c%s "$replica")" || return 1
+
+    follow_test 'd. follow again' '0 change(s) applied, version 4' 'pic1 pic3' || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ======================================================================
+checkX "command line ImgStore tool" imgStoreMgr
+
+converge_test && delete_test && resized_test || ok=0
+
+# ======================================================================
+if [ "x$ok" = 'x1' ]; then
+    echo -e "$0 ${bold}${green}SUCCESS${end}"
+    exit 0
+else
+   echo -e "$0 ${bold}${red}FAILED${end} at some point"
+   exit 1
+fi
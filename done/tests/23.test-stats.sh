@@ -0,0 +1,189 @@
+#!/bin/bash
+
+## Black-box testing of imgStoreMgr -- space accounting (stats)
+
+# ======================================================================
+# options
+
+with_colors=0
+while [ $# -ge 1 ]; do
+    case "$1" in
+        -c|--color|--colors) with_colors=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+if [ "x$with_colors" = 'x1' ]; then
+    esc="\033["
+    red="${esc}31m"
+    green="${esc}32m"
+    yellow="${esc}33m"
+    blue="${esc}34m"
+    magenta="${esc}35m"
+    cyan="${esc}36m"
+    bold="${esc}1m"
+    end="${esc}0m"
+else
+    red=
+    green=
+    yellow=
+    blue=
+    magenta=
+    cyan=
+    bold=
+    end=
+fi
+
+# ======================================================================
+printf "${bold}${blue}"
+source $(dirname ${BASH_SOURCE[0]})/test_env.sh
+printf "${end}"
+
+test=0
+ok=1
+
+db="$(new_tmp_file)"
+tmp="$(new_tmp_file)"
+
+# sizes of the images of tests/data
+papillon=72876
+coquelicots=98119
+# header and metadata table of test02.imgst_dynamic
+table_size=21664
+
+# ======================================================================
+# tool functions
+# ----------------------------------------------------------------------
+check() {
+    EXPECTED_OUTPUT="$1"; shift
+    ACTUAL_OUTPUT="$1"  ; shift
+
+    if ! diff -w <(echo "$ACTUAL_OUTPUT") <(echo -e "$EXPECTED_OUTPUT"); then
+        echo -e "${red}FAIL${end}"
+        echo -e "${yellow}Expected:${end}\n$EXPECTED_OUTPUT"
+        echo -e "${cyan}Actual:${end}\n$ACTUAL_OUTPUT"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# error reported by an imgStoreMgr command, empty if none
+error_of() {
+    imgStoreMgr "$@" 2>&1 >/dev/null | grep '^ERROR' | head -n 1 || true
+}
+
+# ----------------------------------------------------------------------
+# the space accounting printed by stats
+stats() {
+    imgStoreMgr stats "$db" | sed -n '/^FILE SIZE:/,/^FRAGMENTATION:/p'
+}
+
+# ----------------------------------------------------------------------
+# the expected space accounting
+# $1: file size (or end of the data), $2: table size, $3: live bytes
+expected_stats() {
+    local data=$(($1 - $2))
+    local dead=$((data - $3))
+    local fragmentation=0.00
+    [ $data -gt 0 ] && fragmentation=$(awk "BEGIN { printf \"%.2f\", 100 * $dead / $data }")
+    echo "FILE SIZE: $1"
+    echo "METADATA SIZE: $2"
+    echo "LIVE BYTES: $3 DEAD BYTES: $dead"
+    echo "FRAGMENTATION: $fragmentation %"
+}
+
+# ----------------------------------------------------------------------
+# $1: info message, $2: the command, without the imgStore
+step() {
+    local info="$1"; shift
+    printf "\t$info: "
+    check '' "$(error_of "$1" "$db" "${@:2}")"
+}
+
+# ----------------------------------------------------------------------
+# $1: info message, others: as expected_stats
+stats_step() {
+    local info="$1"; shift
+    printf "\t$info: "
+    check "$(expected_stats "$@")" "$(stats)"
+}
+
+# ----------------------------------------------------------------------
+# an imgStore without live_bytes in its header: computed once
+legacy_test () {
+    printf "${magenta}Test %1d${end} (imgStore without live bytes):\n" $((++test))
+
+    cp tests/data/test02.imgst_dynamic "$db" || error "Cannot copy test02.imgst_dynamic to \"$db\""
+    rm -f "$db".*
+    local size=$($stat -c%s "$db")
+
+    stats_step 'a. stats' $size $table_size $((papillon + coquelicots)) || return 1
+    step 'b. delete pic1' delete pic1 || return 1
+    stats_step 'c. stats' $size $table_size $coquelicots || return 1
+
+    step 'd. gc' gc "$tmp" || return 1
+    stats_step 'e. stats' $((table_size + coquelicots)) $table_size $coquelicots || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# $1: info message, others: options of create
+# fragmentation of the images deleted, none after gc
+fragmentation_test () {
+    local info="$1"; shift
+    printf "${magenta}Test %1d${end} ($info):\n" $((++test))
+
+    rm -f "$db" "$db".*
+    imgStoreMgr create "$db" "$@" >/dev/null || error "Cannot create \"$db\""
+    local table=$(imgStoreMgr stats "$db" | awk '/^METADATA SIZE:/ { print $3 }')
+    local eod=$table
+
+    stats_step 'a. stats' $eod $table 0 || return 1
+
+    step 'b. insert pic1' insert pic1 tests/data/papillon.jpg || return 1
+    step 'c. insert pic2' insert pic2 tests/data/coquelicots.jpg || return 1
+    eod=$((eod + papillon + coquelicots))
+    stats_step 'd. stats' $eod $table $((papillon + coquelicots)) || return 1
+    if [ "${1:-}" = '-prealloc' ]; then
+        printf '\td. preallocated past the data: '
+        [ $($stat -c%s "$db") -gt $eod ] || { echo -e "${red}FAIL${end}"; return 1; }
+        echo -e "${green}PASS${end}"
+    fi
+
+    step 'e. delete pic2' delete pic2 || return 1
+    stats_step 'f. stats' $eod $table $papillon || return 1
+
+    step 'g. gc' gc "$tmp" || return 1
+    stats_step 'h. stats' $((table + papillon)) $table $papillon || return 1
+
+    step 'i. delete pic1' delete pic1 || return 1
+    stats_step 'j. stats' $((table + papillon)) $table 0 || return 1
+
+    step 'k. gc' gc "$tmp" || return 1
+    stats_step 'l. stats' $table $table 0 || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ======================================================================
+checkX "command line ImgStore tool" imgStoreMgr
+
+legacy_test || ok=0
+fragmentation_test 'imgStore' || ok=0
+# FILE SIZE is the end of the data, not of the preallocated file
+fragmentation_test 'preallocated imgStore' -prealloc || ok=0
+
+# ======================================================================
+if [ "x$ok" = 'x1' ]; then
+    echo -e "$0 ${bold}${green}SUCCESS${end}"
+    exit 0
+else
+   echo -e "$0 ${bold}${red}FAILED${end} at some point"
+   exit 1
+fi
@@ -0,0 +1,225 @@
+#!/bin/bash
+
+## Black-box testing of imgStoreMgr -- images fitted into a box, and their cache
+
+# ======================================================================
+# options
+
+with_colors=0
+while [ $# -ge 1 ]; do
+    case "$1" in
+        -c|--color|--colors) with_colors=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+if [ "x$with_colors" = 'x1' ]; then
+    esc="\033["
+    red="${esc}31m"
+    green="${esc}32m"
+    yellow="${esc}33m"
+    blue="${esc}34m"
+    magenta="${esc}35m"
+    cyan="${esc}36m"
+    bold="${esc}1m"
+    end="${esc}0m"
+else
+    red=
+    green=
+    yellow=
+    blue=
+    magenta=
+    cyan=
+    bold=
+    end=
+fi
+
+# ======================================================================
+printf "${bold}${blue}"
+source $(dirname ${BASH_SOURCE[0]})/test_env.sh
+printf "${end}"
+
+test=0
+ok=1
+
+# error messages
+imglib='Image manipulation library error'
+
+db="$(new_tmp_file)"
+tmp="$(new_tmp_file)"
+saved="$(new_tmp_file)"
+
+# header and table of the cache, before its data (see derived.h)
+cache_table=$((32 + 4096 * 32))
+# sets of 4 entries of the cache
+nb_sets=1024
+
+# ======================================================================
+# tool functions
+# ----------------------------------------------------------------------
+check() {
+    EXPECTED_OUTPUT="$1"; shift
+    ACTUAL_OUTPUT="$1"  ; shift
+
+    if ! diff -w <(echo "$ACTUAL_OUTPUT") <(echo -e "$EXPECTED_OUTPUT"); then
+        echo -e "${red}FAIL${end}"
+        echo -e "${yellow}Expected:${end}\n$EXPECTED_OUTPUT"
+        echo -e "${cyan}Actual:${end}\n$ACTUAL_OUTPUT"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# error reported by an imgStoreMgr command, empty if none
+error_of() {
+    imgStoreMgr "$@" 2>&1 >/dev/null | grep '^ERROR' | head -n 1 || true
+}
+
+# ----------------------------------------------------------------------
+# new imgStore with pic1 (1200 x 800)
+populate() {
+    rm -f "$db" "$db".*
+    imgStoreMgr create "$db" >/dev/null || error "Cannot create \"$db\""
+    imgStoreMgr insert "$db" pic1 tests/data/papillon.jpg >/dev/null || error "Cannot insert pic1"
+}
+
+# ----------------------------------------------------------------------
+# set of the cache of slot $1 in box $2x$3 (as cache_set of derived.c)
+cache_set() {
+    local hash=$(( ($1 * 2654435761) & 0xFFFFFFFF ))
+    hash=$(( hash ^ (((($2 << 16) | $3) * 2246822519) & 0xFFFFFFFF) ))
+    hash=$(( hash ^ (hash >> 15) ))
+    echo $(( hash % nb_sets ))
+}
+
+# ----------------------------------------------------------------------
+# $1 more boxes of slot 0 in the same set of the cache as 100x80
+same_set_boxes() {
+    local set=$(cache_set 0 100 80)
+    local found=0
+    local w h
+    for h in $(seq 80 799); do
+        for w in $(seq 101 1199); do
+            if [ $(cache_set 0 $w $h) -eq $set ]; then
+                echo ${w}x$h
+                [ $((++found)) -eq $1 ] && return 0
+            fi
+        done
+    done
+}
+
+# ----------------------------------------------------------------------
+# $1: box; reads pic1 fitted into it, saved as pic1_$1-$2.jpg
+read_box() {
+    local err="$(error_of read "$db" pic1 $1)"
+    [ -z "$err" ] && mv pic1_$1.jpg pic1_$1-$2.jpg
+    echo "$err"
+}
+
+# ----------------------------------------------------------------------
+# derived image, then read again from the cache
+cached_test () {
+    printf "${magenta}Test %1d${end} (derived image):\n" $((++test))
+
+    populate
+    printf '\ta. read pic1 100x80: '
+    check '' "$(read_box 100x80 first)" || return 1
+    local size=$($stat -c%s pic1_100x80-first.jpg)
+
+    printf '\tb. cached: '
+    check $((cache_table + size)) "$($stat -c%s "$db.cache")" || return 1
+
+    printf '\tc. read again: '
+    check '' "$(read_box 100x80 again)" || return 1
+    printf '\td. same image: '
+    cmp -s pic1_100x80-first.jpg pic1_100x80-again.jpg || { echo -e "${red}FAIL${end}"; return 1; }
+    echo -e "${green}PASS${end}"
+    printf '\te. not cached again: '
+    check $((cache_table + size)) "$($stat -c%s "$db.cache")" || return 1
+
+    rm -f pic1_100x80-again.jpg
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# the image of cached_test evicted by 4 newer ones of its set
+evicted_test () {
+    printf "${magenta}Test %1d${end} (eviction):\n" $((++test))
+
+    local boxes=$(same_set_boxes 4)
+    local box
+    printf '\ta. read pic1 in %s: ' "$(echo $boxes)"
+    for box in $boxes; do
+        local err="$(read_box $box first)"
+        [ -z "$err" ] || { check '' "$err"; return 1; }
+    done
+    echo -e "${green}PASS${end}"
+
+    # the original image spoilt: only cached images can be read
+    local offset=$(imgStoreMgr list "$db" | awk '/^OFFSET ORIG/ { print $4 }')
+    dd if=/dev/zero of="$db" bs=1 seek=$offset count=1024 conv=notrunc status=none
+
+    printf '\tb. read them from the cache: '
+    for box in $boxes; do
+        local err="$(read_box $box again)"
+        if [ -n "$err" ] || ! cmp -s pic1_$box-first.jpg pic1_$box-again.jpg; then
+            echo -e "${red}FAIL${end}: $box $err"
+            return 1
+        fi
+        rm -f pic1_$box-first.jpg pic1_$box-again.jpg
+    done
+    echo -e "${green}PASS${end}"
+
+    printf '\tc. read pic1 100x80, evicted: '
+    check "ERROR: $imglib" "$(read_box 100x80 again)" || return 1
+
+    rm -f pic1_100x80-first.jpg
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# the cache removed by gc, which moves the images
+gc_test () {
+    printf "${magenta}Test %1d${end} (gc):\n" $((++test))
+
+    populate
+    printf '\ta. read pic1 100x80: '
+    check '' "$(read_box 100x80 first)" || return 1
+    [ -s "$db.cache" ] || { echo -e "${red}FAIL${end}: no cache next to $db"; return 1; }
+
+    printf '\tb. gc: '
+    check '' "$(error_of gc "$db" "$tmp")" || return 1
+    printf '\tc. cache removed: '
+    [ ! -e "$db.cache" ] || { echo -e "${red}FAIL${end}: $db.cache still there"; return 1; }
+    echo -e "${green}PASS${end}"
+
+    printf '\td. read pic1 100x80: '
+    check '' "$(read_box 100x80 again)" || return 1
+    local size=$($stat -c%s pic1_100x80-again.jpg)
+    printf '\te. cached alone: '
+    check $((cache_table + size)) "$($stat -c%s "$db.cache")" || return 1
+
+    rm -f pic1_100x80-first.jpg pic1_100x80-again.jpg
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ======================================================================
+checkX "command line ImgStore tool" imgStoreMgr
+
+cached_test && evicted_test || ok=0
+gc_test || ok=0
+
+# ======================================================================
+if [ "x$ok" = 'x1' ]; then
+    echo -e "$0 ${bold}${green}SUCCESS${end}"
+    exit 0
+else
+   echo -e "$0 ${bold}${red}FAILED${end} at some point"
+   exit 1
+fi
@@ -0,0 +1,223 @@
+#!/bin/bash
+
+## Black-box testing of imgStore webserver -- formats of the original images
+
+# ======================================================================
+# options
+
+with_colors=0
+while [ $# -ge 1 ]; do
+    case "$1" in
+        -c|--color|--colors) with_colors=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+if [ "x$with_colors" = 'x1' ]; then
+    esc="\033["
+    red="${esc}31m"
+    green="${esc}32m"
+    yellow="${esc}33m"
+    blue="${esc}34m"
+    magenta="${esc}35m"
+    cyan="${esc}36m"
+    bold="${esc}1m"
+    end="${esc}0m"
+else
+    red=
+    green=
+    yellow=
+    blue=
+    magenta=
+    cyan=
+    bold=
+    end=
+fi
+
+# ======================================================================
+printf "${bold}${blue}"
+source $(dirname ${BASH_SOURCE[0]})/test_env.sh
+printf "${end}"
+
+test=0
+ok=1
+
+# Logfiles root name
+LOG=server-$$
+# webserver exec
+exec="${PWD}/imgStore_server"
+# base URL
+baseURL=http://localhost:8000
+# server PID
+job_pid=
+
+# error messages
+imglib='Image manipulation library error'
+
+db="$(new_tmp_file)"
+image="$(new_tmp_file)"
+
+# ======================================================================
+# tool functions
+# ----------------------------------------------------------------------
+quit() {
+    stop_server
+    error "$*"
+}
+
+# ----------------------------------------------------------------------
+check() {
+    EXPECTED_OUTPUT="$1"; shift
+    ACTUAL_OUTPUT="$1"  ; shift
+
+    if ! diff -w <(echo "$ACTUAL_OUTPUT") <(echo -e "$EXPECTED_OUTPUT"); then
+        echo -e "${red}FAIL${end}"
+        echo -e "${yellow}Expected:${end}\n$EXPECTED_OUTPUT"
+        echo -e "${cyan}Actual:${end}\n$ACTUAL_OUTPUT"
+        return 1
+    fi
+    echo -e "${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# error reported by an imgStoreMgr command, empty if none
+error_of() {
+    imgStoreMgr "$@" 2>&1 >/dev/null | grep '^ERROR' | head -n 1 || true
+}
+
+# ----------------------------------------------------------------------
+launch_server()
+{
+    $stdbuf -oL "$exec" "$db" 1> "${LOG}.log" 2> "${LOG}-err.log" &
+    job_pid=$!
+    sleep 1 #wait a bit
+    echo "$(pwd)/${LOG}.log"     >> "$TMP_FILES"
+    echo "$(pwd)/${LOG}-err.log" >> "$TMP_FILES"
+    ps -p$job_pid >/dev/null 2>&1 || error "cannot lauch \"$(basename "$exec")\" (with image store \"$db\")"
+}
+
+# --------------------------------------------------
+stop_server()
+{
+    if [ "x$job_pid" != 'x' ]; then
+        ps -p$job_pid >/dev/null 2>&1 && kill -TERM $job_pid
+        sleep 1 # wait a bit
+        job_pid=
+    fi
+    return 0
+}
+
+# ----------------------------------------------------------------------
+do_insert () {
+    local insfile="tests/data/$2"
+    local size=$($stat -c%s "$insfile")
+    curl -sS --data-binary @"$insfile" "${baseURL}/imgStore/insert?offset=0&name=$1" >/dev/null \
+    && curl -sS -d '' "${baseURL}/imgStore/insert?offset=${size}&name=$1" >/dev/null \
+    || quit "cannot insert $1"
+}
+
+# ----------------------------------------------------------------------
+# the format and resolution listed for image $1
+format_of() {
+    imgStoreMgr list "$db" \
+    | awk -v id="$1" '/^IMAGE ID:/ { found = ($3 == id) } found && /^(FORMAT|ORIGINAL):/' \
+    | xargs
+}
+
+# ----------------------------------------------------------------------
+# the first bytes of a file, in hexadecimal
+magic() {
+    od -An -tx1 -N4 "$1" | xargs
+}
+
+# ----------------------------------------------------------------------
+# $1: img_id, $2: res; the content type of the image served
+content_type() {
+    curl -sS -o "$image" -D - "${baseURL}/imgStore/read?res=$2&img_id=$1" \
+    | tr -d '\r' | awk -F': ' 'tolower($1) == "content-type" { print $2 }'
+}
+
+# ----------------------------------------------------------------------
+# a PNG image inserted by imgStoreMgr: sniffed, kept as it is
+manager_test () {
+    printf "${magenta}Test %1d${end} (PNG image, imgStoreMgr):\n" $((++test))
+
+    rm -f "$db" "$db".*
+    imgStoreMgr create "$db" >/dev/null || error "Cannot create \"$db\""
+    printf '\ta. insert: '
+    check '' "$(error_of insert "$db" png tests/data/degrade.png)$(error_of insert "$db" jpeg tests/data/papillon.jpg)" || return 1
+
+    printf '\tb. list: '
+    check 'FORMAT: png ORIGINAL: 320 x 200' "$(format_of png)" || return 1
+    printf '\tc. list: '
+    check 'FORMAT: jpeg ORIGINAL: 1200 x 800' "$(format_of jpeg)" || return 1
+
+    printf '\td. read orig: '
+    check '' "$(error_of read "$db" png orig)" || return 1
+    printf '\te. same image: '
+    cmp -s png_orig.jpg tests/data/degrade.png || { echo -e "${red}FAIL${end}"; rm -f png_orig.jpg; return 1; }
+    echo -e "${green}PASS${end}"
+    rm -f png_orig.jpg
+
+    # resized as the resized images of the imgStore
+    printf '\tf. read thumb: '
+    check '' "$(error_of read "$db" png thumb)" || return 1
+    printf '\tg. encoded as JPEG: '
+    check 'ff d8 ff' "$(magic png_thumb.jpg | cut -d' ' -f1-3)" || { rm -f png_thumb.jpg; return 1; }
+    rm -f png_thumb.jpg
+
+    printf '\th. insert a text: '
+    check "ERROR: $imglib" "$(error_of insert "$db" text tests/data/index.html)" || return 1
+    printf '\ti. not listed: '
+    check '' "$(format_of text)" || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ----------------------------------------------------------------------
+# the images of manager_test, and one inserted through the webserver
+server_test () {
+    printf "${magenta}Test %1d${end} (content types, webserver):\n" $((++test))
+
+    launch_server
+    do_insert png2 degrade.png
+
+    printf '\ta. png orig: '
+    check 'image/png' "$(content_type png orig)" || return 1
+    printf '\tb. same image: '
+    cmp -s "$image" tests/data/degrade.png || { echo -e "${red}FAIL${end}"; return 1; }
+    echo -e "${green}PASS${end}"
+
+    printf '\tc. png thumb: '
+    check 'image/jpeg' "$(content_type png thumb)" || return 1
+    printf '\td. jpeg orig: '
+    check 'image/jpeg' "$(content_type jpeg orig)" || return 1
+    printf '\te. png inserted by the webserver: '
+    check 'image/png' "$(content_type png2 orig)" || return 1
+
+    stop_server
+    printf '\tf. list: '
+    check 'FORMAT: png ORIGINAL: 320 x 200' "$(format_of png2)" || return 1
+
+    echo -e "==> ${green}PASS${end}"
+    return 0
+}
+
+# ======================================================================
+checkX "command line ImgStore tool" imgStoreMgr
+checkX webserver "$exec"
+
+manager_test && server_test || ok=0
+stop_server
+
+# ======================================================================
+if [ "x$ok" = 'x1' ]; then
+    echo -e "$0 ${bold}${green}SUCCESS${end}"
+    exit 0
+else
+   echo -e "$0 ${bold}${red}FAILED${end} at some point"
+   exit 1
+fi
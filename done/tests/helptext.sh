@@ -13,15 +13,37 @@ helptxt_next="  create <imgstore_filename> [options]: create a new imgStore.
                                   maximum value is 128x128
           -small_res <X_RES> <Y_RES>: resolution for small images.
                                   default value is 256x256
-                                  maximum value is 512x512"
+                                  maximum value is 512x512
+          -growable: the metadata table grows when the imgStore is full.
+          -replog: log the changes, for the replicas (see follow).
+          -checksum: store a checksum with each image (see scrub).
+          -prealloc: preallocate the file by large chunks, for contiguous images.
+          -quality <THUMB_Q> <SMALL_Q>: encoding quality of the resized images (1 to 100).
+                                  default value is 75
+          -format <THUMB_FMT> <SMALL_FMT>: format of the resized images (jpeg or webp).
+                                  default value is jpeg
+          -strip: no metadata (EXIF, ICC profile) in the resized images.
+          -optimize: optimized Huffman coding of the resized JPEG images.
+          -progressive: progressive resized JPEG images.
+          -shards <NB_SHARDS>: spread the imgStore across NB_SHARDS files.
+                               (<imgstore_filename>.<i>, listed in <imgstore_filename>)"
 helptxt_next="$helptxt_next
-  read   <imgstore_filename> <imgID> [original|orig|thumbnail|thumb|small]:
+  read   <imgstore_filename> <imgID> [original|orig|thumbnail|thumb|small|<W>x<H>]:
       read an image from the imgStore and save it to a file.
       default resolution is \"original\".
+      <W>x<H>: the image fitted into a box of W x H pixels, resized on the fly.
   insert <imgstore_filename> <imgID> <filename>: insert a new image in the imgStore."
 helptxt_next="$helptxt_next
   delete <imgstore_filename> <imgID>: delete image imgID from imgStore."
 helptxt_next="$helptxt_next
-  gc <imgstore_filename> <tmp imgstore_filename>: performs garbage collecting on imgStore. Requires a temporary filename for copying the imgStore."
+  gc <imgstore_filename> <tmp imgstore_filename>: performs garbage collecting on imgStore. Requires a temporary filename for copying the imgStore.
+  stats <imgstore_filename>: displays live and dead space of imgStore, to decide when to gc.
+  export <imgstore_filename> [archive_filename]: writes the images of imgStore to an archive (default: standard output).
+  import <imgstore_filename> [archive_filename]: inserts the images of an archive (default: standard input) in imgStore.
+  follow <imgstore_filename> <replica_filename> [-once]: applies the changes of imgStore (created with -replog) to a replica, created if needed, until interrupted.
+      -once: stops at the end of the changes logged.
+  scrub <imgstore_filename> [-threads <NB_THREADS>]: verifies all the images of imgStore and reports the corrupted ones.
+      the images are verified against their checksums (created with -checksum), otherwise the originals against their SHA.
+      default number of threads is 4"
 helptxt="$helptxt
 $helptxt_next"
@@ -15,6 +15,8 @@
 // ======================================================================
 #define SIZE_imgst_header   64
 #define SIZE_img_metadata  216
+#define SIZE_imgst_ext     128
+#define SIZE_imgst_extent   16
 
 #define SIZE_imgst_file   2232
 
@@ -60,6 +62,8 @@ int main(int argc, char** argv)
     test_size(imgst_header);
     test_size(img_metadata);
     test_size(imgst_file  );
+    test_size(imgst_ext   );
+    test_size(imgst_extent);
   
     test_member(imgst_header, imgst_name    );
     test_member(imgst_header, imgst_version );
@@ -84,7 +84,7 @@ new_tmp_file() {
 clean_tmp_files() {
     while read f
     do
-	rm -f "$f"
+	rm -f "$f" "$f".*
     done < "$TMP_FILES"
 
     rm "$TMP_FILES"
@@ -29,13 +29,20 @@
       .header.max_files   = MAX_FILES, \
       .header.res_resized = { 64, 64, 256, 256} \
     }; \
-    ck_assert_ptr_nonnull((X).metadata = calloc(X.header.max_files, sizeof(struct img_metadata)))
+    ck_assert_err_none(alloc_metadata(&(X).metadata, X.header.max_files))
 
 // ------------------------------------------------------------
 static void release_imgst(struct imgst_file* imgst)
 {
-  free(imgst->metadata);
-  imgst->metadata = NULL;
+  free_metadata(&imgst->metadata);
+}
+
+// ------------------------------------------------------------
+static struct img_metadata metadata_at(struct imgst_file* imgst, uint32_t index)
+{
+    struct img_metadata metadata;
+    ck_assert_err_none(get_metadata(imgst, index, &metadata));
+    return metadata;
 }
   
 // ------------------------------------------------------------
@@ -49,13 +56,16 @@ static void insert(struct imgst_file* imgst, uint32_t index
 {
     ck_assert_int_lt(index, imgst->header.max_files);
 
-    strncpy(imgst->metadata[index].img_id, id , MAX_IMGST_NAME);
-    strncpy((char*) imgst->metadata[index].SHA   , sha, SHA256_DIGEST_LENGTH); // not null-terminated
-    imgst->metadata[index].res_orig[0] = res_X;
-    imgst->metadata[index].res_orig[1] = res_Y;
-    memcpy(imgst->metadata[index].size  , sizes  , NB_RES * sizeof(*sizes  ));
-    memcpy(imgst->metadata[index].offset, offsets, NB_RES * sizeof(*offsets));
-    imgst->metadata[index].is_valid = NON_EMPTY;
+    struct img_metadata metadata;
+    memset(&metadata, 0, sizeof(metadata));
+    strncpy(metadata.img_id, id , MAX_IMGST_NAME);
+    strncpy((char*) metadata.SHA   , sha, SHA256_DIGEST_LENGTH); // not null-terminated
+    metadata.res_orig[0] = res_X;
+    metadata.res_orig[1] = res_Y;
+    memcpy(metadata.size  , sizes  , NB_RES * sizeof(*sizes  ));
+    memcpy(metadata.offset, offsets, NB_RES * sizeof(*offsets));
+    metadata.is_valid = NON_EMPTY;
+    ck_assert_err_none(put_metadata(imgst, index, &metadata));
 }
 
 // ======================================================================
@@ -99,12 +109,12 @@ END_TEST
 
 // ======================================================================
 #define dedup_check(X) \
-    ck_assert_msg(imgst.metadata[index3].X == imgst.metadata[index2].X || \
-                  imgst.metadata[index3].X == imgst.metadata[index4].X, \
+    ck_assert_msg(metadata_at(&imgst, index3).X == metadata_at(&imgst, index2).X || \
+                  metadata_at(&imgst, index3).X == metadata_at(&imgst, index4).X, \
                   "did not dedup " #X " (or didn't take the first image as reference)")
 // ------------------------------------------------------------
 #define check_unchanged_field(I, F, RES, REF) \
-    ck_assert_msg(imgst.metadata[I].F[RES] == REF[RES], \
+    ck_assert_msg(metadata_at(&imgst, I).F[RES] == REF[RES], \
                   "dedup did change some metadata (" #F "[" #RES "])")
 // ------------------------------------------------------------
 #define check_unchanged(I, S, O) \
@@ -135,7 +145,7 @@ START_TEST(same_content)
            "monid1", sha,
            1024, 768, // res
            sizes, offsets2);
-    imgst.metadata[index1].is_valid  = EMPTY; // this one is not a valid copy
+    imgst.metadata.is_valid[index1]  = EMPTY; // this one is not a valid copy
 
     // that one IS a valid copy, could be the reference
     const uint32_t index2 = 3;
@@ -213,7 +223,7 @@ START_TEST(different_content)
     ck_assert_err_none(do_name_and_content_dedup(&imgst, index2));
 
     // dedup set offset[RES_ORIG] to 0
-    ck_assert_msg(imgst.metadata[index2].offset[RES_ORIG] == 0, 
+    ck_assert_msg(metadata_at(&imgst, index2).offset[RES_ORIG] == 0, 
                   " dedup did not set offset[RES_ORIG] to 0");
 
     // dedup didn't change other metadata
@@ -0,0 +1,320 @@
+/**
+ * @file unit-test-metadata.c
+ * @brief Unit tests for the in-memory metadata table (ids, lookups)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+#include <inttypes.h>
+
+#include "tests.h"
+#include "imgStore.h"
+
+#define MAX_FILES 9
+#define PICTDB_TEST_FILE "tmp-unit-test-metadata.imgst"
+
+// ======================================================================
+// tool macro
+#define init_imgst(X) \
+    struct imgst_file X = { \
+      .header.max_files   = MAX_FILES, \
+      .header.res_resized = { 64, 64, 256, 256} \
+    }; \
+    ck_assert_err_none(alloc_metadata(&(X).metadata, X.header.max_files))
+
+// ------------------------------------------------------------
+static void release_imgst(struct imgst_file* imgst)
+{
+    free_metadata(&imgst->metadata);
+}
+
+// ------------------------------------------------------------
+static void remove_test_file(void)
+{
+    remove(PICTDB_TEST_FILE);
+    remove(PICTDB_TEST_FILE ".idx");
+}
+
+// ------------------------------------------------------------
+static struct img_metadata make_metadata(const char* id, uint32_t seed)
+{
+    struct img_metadata metadata;
+    memset(&metadata, 0, sizeof(metadata));
+    strncpy(metadata.img_id, id, MAX_IMG_ID);
+    for (size_t i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+        metadata.SHA[i] = (unsigned char) (seed * 31 + i);
+    }
+    metadata.res_orig[0] = 1024 + seed;
+    metadata.res_orig[1] = 768 + seed;
+    for (int res = 0; res < NB_RES; ++res) {
+        metadata.size[res] = 1000 * (seed + 1) + (uint32_t) res;
+        metadata.offset[res] = ((uint64_t) 1 << 33) + 100000 * seed + (uint64_t) res;
+    }
+    metadata.is_valid = NON_EMPTY;
+    metadata.unused_16 = IMG_FMT_PNG;
+    return metadata;
+}
+
+// ------------------------------------------------------------
+// the bytes of the arena used by the ids of the slots
+static size_t names_used(const struct metadata_table* table)
+{
+    size_t used = 1; // the empty id
+    for (uint32_t i = 0; i < table->nb_slots; ++i) {
+        if (table->img_id[i] != 0) used += strlen(SLOT_ID(table, i)) + 1;
+    }
+    return used;
+}
+
+// ======================================================================
+START_TEST(id_reuse)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    init_imgst(imgst);
+    struct metadata_table* table = &imgst.metadata;
+
+    ck_assert_err_none(set_img_id(&imgst, 0, "pic1"));
+    ck_assert_err_none(set_img_id(&imgst, 1, "pic2"));
+    ck_assert_str_eq(SLOT_ID(table, 0), "pic1");
+    ck_assert_str_eq(SLOT_ID(table, 1), "pic2");
+    ck_assert_uint_eq(table->id_hash[0], hash_id("pic1"));
+    ck_assert_uint_eq(table->names_dead, 0);
+
+    // the slot reused: its former id is dead
+    ck_assert_err_none(set_img_id(&imgst, 0, "other pic"));
+    ck_assert_str_eq(SLOT_ID(table, 0), "other pic");
+    ck_assert_str_eq(SLOT_ID(table, 1), "pic2");
+    ck_assert_uint_eq(table->id_hash[0], hash_id("other pic"));
+    ck_assert_uint_eq(table->names_dead, strlen("pic1") + 1);
+
+    // an unused slot has the empty id
+    ck_assert_err_none(set_img_id(&imgst, 1, ""));
+    ck_assert_uint_eq(table->img_id[1], 0);
+    ck_assert_str_eq(SLOT_ID(table, 1), "");
+    ck_assert_uint_eq(table->names_dead, strlen("pic1") + strlen("pic2") + 2);
+
+    // truncated to MAX_IMG_ID characters
+    char long_id[MAX_IMG_ID + 10];
+    memset(long_id, 'x', sizeof(long_id) - 1);
+    long_id[sizeof(long_id) - 1] = '\0';
+    ck_assert_err_none(set_img_id(&imgst, 2, long_id));
+    ck_assert_uint_eq(strlen(SLOT_ID(table, 2)), MAX_IMG_ID);
+
+    release_imgst(&imgst);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+// ======================================================================
+START_TEST(id_compaction)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    init_imgst(imgst);
+    struct metadata_table* table = &imgst.metadata;
+
+    char id[32];
+    for (uint32_t i = 0; i < MAX_FILES; ++i) {
+        snprintf(id, sizeof(id), "image %" PRIu32, i);
+        ck_assert_err_none(set_img_id(&imgst, i, id));
+    }
+    ck_assert_uint_eq(table->names_size, names_used(table));
+
+    // slot 0 renamed until its dead ids are the majority of the arena
+    const uint32_t generation = table->names_generation;
+    unsigned int renames = 0;
+    while (table->names_generation == generation) {
+        ck_assert_uint_lt(++renames, 1000);
+        snprintf(id, sizeof(id), "renamed %u", renames);
+        ck_assert_err_none(set_img_id(&imgst, 0, id));
+        ck_assert_uint_le(table->names_dead, table->names_size / 2);
+    }
+    ck_assert_uint_gt(renames, 1);
+    ck_assert_uint_eq(table->names_generation, generation + 1);
+
+    // compacted: no dead id left, every id unchanged
+    ck_assert_uint_eq(table->names_dead, 0);
+    ck_assert_uint_eq(table->names_size, names_used(table));
+    ck_assert_str_eq(SLOT_ID(table, 0), id);
+    for (uint32_t i = 1; i < MAX_FILES; ++i) {
+        snprintf(id, sizeof(id), "image %" PRIu32, i);
+        ck_assert_str_eq(SLOT_ID(table, i), id);
+        ck_assert_uint_eq(table->id_hash[i], hash_id(id));
+    }
+
+    release_imgst(&imgst);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+// ======================================================================
+START_TEST(metadata_roundtrip)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    init_imgst(imgst);
+
+    for (uint32_t i = 0; i < MAX_FILES; i += 2) {
+        char id[32];
+        snprintf(id, sizeof(id), "pic%" PRIu32, i);
+        const struct img_metadata metadata = make_metadata(id, i);
+        ck_assert_err_none(put_metadata(&imgst, i, &metadata));
+    }
+
+    for (uint32_t i = 0; i < MAX_FILES; ++i) {
+        struct img_metadata expected;
+        memset(&expected, 0, sizeof(expected));
+        if (i % 2 == 0) {
+            char id[32];
+            snprintf(id, sizeof(id), "pic%" PRIu32, i);
+            expected = make_metadata(id, i);
+        }
+
+        struct img_metadata metadata;
+        ck_assert_err_none(get_metadata(&imgst, i, &metadata));
+        ck_assert_str_eq(metadata.img_id, expected.img_id);
+        ck_assert_msg(!memcmp(&metadata, &expected, sizeof(metadata)),
+                      "metadata %" PRIu32 " changed by put_metadata/get_metadata", i);
+    }
+
+    // replaced: the new id, the new fields
+    const struct img_metadata replaced = make_metadata("replaced", 42);
+    ck_assert_err_none(put_metadata(&imgst, 4, &replaced));
+    struct img_metadata metadata;
+    ck_assert_err_none(get_metadata(&imgst, 4, &metadata));
+    ck_assert_msg(!memcmp(&metadata, &replaced, sizeof(metadata)), "metadata 4 not replaced");
+
+    release_imgst(&imgst);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+// ======================================================================
+START_TEST(find_after_delete)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    struct imgst_file imgst = {
+        .header.max_files   = MAX_FILES,
+        .header.res_resized = { 64, 64, 256, 256}
+    };
+    ck_assert_err_none(do_create(PICTDB_TEST_FILE, &imgst));
+    do_close(&imgst);
+
+    // three images (without content) written in the table
+    ck_assert_err_none(do_open(PICTDB_TEST_FILE, "rb+", &imgst));
+    const char* const ids[] = { "pic1", "pic2", "pic3" };
+    for (uint32_t i = 0; i < 3; ++i) {
+        struct img_metadata metadata = make_metadata(ids[i], i);
+        memset(metadata.offset, 0, sizeof(metadata.offset));
+        ck_assert_err_none(put_metadata(&imgst, 2 * i, &metadata));
+        ck_assert_err_none(write_metadata(&imgst, 2 * i));
+    }
+    imgst.header.num_files = 3;
+    ck_assert_err_none(write_header(&imgst));
+
+    uint32_t index = MAX_FILES;
+    ck_assert_err_none(find_img(&imgst, "pic2", &index));
+    ck_assert_uint_eq(index, 2);
+
+    ck_assert_err_none(do_delete("pic2", &imgst));
+    ck_assert_int_eq(find_img(&imgst, "pic2", &index), ERR_FILE_NOT_FOUND);
+    // again, once the lookups are indexed
+    ck_assert_int_eq(find_img(&imgst, "pic2", &index), ERR_FILE_NOT_FOUND);
+    ck_assert_err_none(find_img(&imgst, "pic3", &index));
+    ck_assert_uint_eq(index, 4);
+    ck_assert_int_eq(do_delete("pic2", &imgst), ERR_FILE_NOT_FOUND);
+
+    // the slot reused by another id
+    struct img_metadata metadata = make_metadata("pic4", 4);
+    memset(metadata.offset, 0, sizeof(metadata.offset));
+    ck_assert_err_none(put_metadata(&imgst, 2, &metadata));
+    ck_assert_err_none(write_metadata(&imgst, 2));
+    imgst.header.num_files = 3;
+    ck_assert_err_none(write_header(&imgst));
+    do_close(&imgst);
+
+    // reopened
+    ck_assert_err_none(do_open(PICTDB_TEST_FILE, "rb", &imgst));
+    ck_assert_int_eq(find_img(&imgst, "pic2", &index), ERR_FILE_NOT_FOUND);
+    ck_assert_err_none(find_img(&imgst, "pic4", &index));
+    ck_assert_uint_eq(index, 2);
+    ck_assert_err_none(find_img(&imgst, "pic1", &index));
+    ck_assert_uint_eq(index, 0);
+    do_close(&imgst);
+
+    remove_test_file();
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+// ======================================================================
+START_TEST(error_cases)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    init_imgst(imgst);
+    struct img_metadata metadata;
+    uint32_t index;
+
+    ck_assert_invalid_arg(set_img_id(NULL, 0, "pic1"));
+    ck_assert_invalid_arg(set_img_id(&imgst, 0, NULL));
+    ck_assert_invalid_arg(set_img_id(&imgst, MAX_FILES, "pic1"));
+    ck_assert_invalid_arg(get_metadata(&imgst, MAX_FILES, &metadata));
+    ck_assert_invalid_arg(get_metadata(&imgst, 0, NULL));
+    ck_assert_invalid_arg(put_metadata(&imgst, MAX_FILES, &metadata));
+    ck_assert_invalid_arg(put_metadata(&imgst, 0, NULL));
+    ck_assert_invalid_arg(find_img(NULL, "pic1", &index));
+    ck_assert_invalid_arg(find_img(&imgst, NULL, &index));
+    ck_assert_invalid_arg(find_img(&imgst, "pic1", NULL));
+
+    release_imgst(&imgst);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+// ======================================================================
+Suite* metadata_test_suite()
+{
+    Suite* s = suite_create("Tests of the metadata table");
+
+    Add_Case(s, tc1, "metadata tests");
+    tcase_add_test(tc1, id_reuse);
+    tcase_add_test(tc1, id_compaction);
+    tcase_add_test(tc1, metadata_roundtrip);
+    tcase_add_test(tc1, find_after_delete);
+    tcase_add_test(tc1, error_cases);
+
+    return s;
+}
+
+TEST_SUITE(metadata_test_suite)
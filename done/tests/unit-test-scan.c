@@ -0,0 +1,271 @@
+/**
+ * @file unit-test-scan.c
+ * @brief Unit tests for the sequential scan of the images (see scan.h)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+#include <inttypes.h>
+
+#include "tests.h"
+#include "imgStore.h"
+#include "scan.h"
+
+#define PICTDB_TEST_FILE "tmp-unit-test-scan.imgst"
+
+#define NB_SLOTS_TEST 16                   // slots of the imgStore
+#define NB_BLOBS 12                        // contents appended to it
+#define BLOB_SIZE (900u << 10)             // their size: several windows in all
+#define LARGE_BLOB 5                       // the one larger than a window
+#define LARGE_SIZE (SCAN_WINDOW + (1u << 20))
+
+// ======================================================================
+// the imgStore scanned: the slot of each blob, in the order of their
+// positions, is not in the order of the slots; the blobs 3 and 8 are
+// shared by a second slot (dedup), in another batch of slots (see
+// batches_in_position_order)
+static const uint32_t blob_slot[NB_BLOBS] = { 9, 2, 14, 6, 0, 11, 4, 15, 7, 1, 12, 5 };
+static const uint32_t shared_blob[] = { 3, 8 };
+static const uint32_t shared_slot[] = { 10, 3 };
+// slots 8 and 13 left empty
+
+// the blob of each slot, -1 if empty
+static int slot_blob[NB_SLOTS_TEST];
+
+// ------------------------------------------------------------
+static void remove_test_file(void)
+{
+    remove(PICTDB_TEST_FILE);
+    remove(PICTDB_TEST_FILE ".idx");
+    remove(PICTDB_TEST_FILE ".wal");
+}
+
+// ------------------------------------------------------------
+static uint32_t blob_size(int blob)
+{
+    return blob == LARGE_BLOB ? LARGE_SIZE : BLOB_SIZE;
+}
+
+// ------------------------------------------------------------
+// content of a blob: different at each position and from blob to blob
+static char blob_byte(int blob, uint32_t i)
+{
+    return (char) (((i * 2654435761u) >> 13) ^ (uint32_t) (blob * 97));
+}
+
+// ------------------------------------------------------------
+static void fill_slot(struct imgst_file* imgst, uint32_t index, int blob, uint64_t offset)
+{
+    struct img_metadata metadata;
+    memset(&metadata, 0, sizeof(metadata));
+    snprintf(metadata.img_id, sizeof(metadata.img_id), "slot%" PRIu32, index);
+    metadata.offset[RES_ORIG] = offset;
+    metadata.size[RES_ORIG] = blob_size(blob);
+    metadata.is_valid = NON_EMPTY;
+    ck_assert_err_none(put_metadata(imgst, index, &metadata));
+    ck_assert_err_none(write_metadata(imgst, index));
+    slot_blob[index] = blob;
+}
+
+// ------------------------------------------------------------
+// the imgStore described above, opened
+static void create_imgst(struct imgst_file* imgst)
+{
+    remove_test_file();
+    struct imgst_file created = {
+        .header.max_files   = NB_SLOTS_TEST,
+        .header.res_resized = { 64, 64, 256, 256}
+    };
+    ck_assert_err_none(do_create(PICTDB_TEST_FILE, &created));
+    do_close(&created);
+
+    ck_assert_err_none(do_open(PICTDB_TEST_FILE, "rb+", imgst));
+    for (uint32_t i = 0; i < NB_SLOTS_TEST; ++i) slot_blob[i] = -1;
+
+    char* buffer = malloc(LARGE_SIZE);
+    ck_assert_ptr_nonnull(buffer);
+    for (int blob = 0; blob < NB_BLOBS; ++blob) {
+        const uint32_t size = blob_size(blob);
+        for (uint32_t i = 0; i < size; ++i) buffer[i] = blob_byte(blob, i);
+
+        uint64_t offset = 0;
+        uint64_t end_of_data = 0;
+        ck_assert_err_none(seek_append(imgst, size, &offset, &end_of_data));
+        ck_assert_uint_eq(fwrite(buffer, size, 1, imgst->file), 1);
+
+        fill_slot(imgst, blob_slot[blob], blob, offset);
+        for (size_t s = 0; s < sizeof(shared_blob) / sizeof(shared_blob[0]); ++s) {
+            if (shared_blob[s] == (uint32_t) blob) fill_slot(imgst, shared_slot[s], blob, offset);
+        }
+    }
+    free(buffer);
+    ck_assert_int_eq(fflush(imgst->file), 0);
+}
+
+// ------------------------------------------------------------
+// scans the slots first to end: each valid one yielded once, in
+// ascending order of positions, with the content of its blob
+static void check_scan(struct imgst_file* imgst, uint32_t first, uint32_t end, int seen[])
+{
+    struct imgst_scan* scan = NULL;
+    if (first == 0 && end == NB_SLOTS_TEST) {
+        ck_assert_err_none(scan_open(imgst, RES_ORIG, &scan));
+    } else {
+        ck_assert_err_none(scan_open_slots(imgst, RES_ORIG, first, end, &scan));
+    }
+
+    uint64_t previous = 0;
+    const struct scan_image* image = NULL;
+    while (1) {
+        ck_assert_err_none(scan_next(scan, &image));
+        if (image == NULL) break;
+
+        ck_assert_uint_ge(image->index, first);
+        ck_assert_uint_lt(image->index, end);
+        ck_assert_msg(seen[image->index] == 0, "slot %" PRIu32 " yielded twice", image->index);
+        seen[image->index] = 1;
+
+        ck_assert_uint_ge(image->offset, previous);
+        previous = image->offset;
+
+        const int blob = slot_blob[image->index];
+        ck_assert_int_ge(blob, 0);
+        ck_assert_ptr_eq(image->file, imgst);
+        ck_assert_uint_eq(image->offset, image->metadata.offset[RES_ORIG]);
+        ck_assert_uint_eq(image->size, blob_size(blob));
+        for (uint32_t i = 0; i < image->size; ++i) {
+            if (image->buffer[i] != blob_byte(blob, i)) {
+                ck_abort_msg("slot %" PRIu32 ": wrong content at byte %" PRIu32, image->index, i);
+            }
+        }
+    }
+    scan_close(scan);
+}
+
+// ------------------------------------------------------------
+static void check_all_seen(const int seen[])
+{
+    for (uint32_t i = 0; i < NB_SLOTS_TEST; ++i) {
+        ck_assert_msg(seen[i] == (slot_blob[i] >= 0), "slot %" PRIu32 " %s", i,
+                      seen[i] ? "yielded while empty" : "not yielded");
+    }
+}
+
+// ======================================================================
+START_TEST(whole_scan_in_position_order)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    struct imgst_file imgst;
+    create_imgst(&imgst);
+
+    int seen[NB_SLOTS_TEST] = { 0 };
+    check_scan(&imgst, 0, NB_SLOTS_TEST, seen);
+    check_all_seen(seen);
+
+    do_close(&imgst);
+
+    // as read from the file
+    ck_assert_err_none(do_open(PICTDB_TEST_FILE, "rb", &imgst));
+    memset(seen, 0, sizeof(seen));
+    check_scan(&imgst, 0, NB_SLOTS_TEST, seen);
+    check_all_seen(seen);
+    do_close(&imgst);
+
+    remove_test_file();
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+// ======================================================================
+START_TEST(batches_in_position_order)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    struct imgst_file imgst;
+    create_imgst(&imgst);
+
+    // as by do_gbcollect: each shared blob yielded in both batches
+    const uint32_t bounds[] = { 0, 5, 8, 13, NB_SLOTS_TEST };
+    int seen[NB_SLOTS_TEST] = { 0 };
+    for (size_t b = 0; b + 1 < sizeof(bounds) / sizeof(bounds[0]); ++b) {
+        check_scan(&imgst, bounds[b], bounds[b + 1], seen);
+    }
+    check_all_seen(seen);
+
+    // empty batches
+    check_scan(&imgst, 8, 9, seen);
+    check_scan(&imgst, 4, 4, seen);
+
+    do_close(&imgst);
+    remove_test_file();
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+// ======================================================================
+START_TEST(skipped_and_error_cases)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    struct imgst_file imgst;
+    create_imgst(&imgst);
+
+    // no image resized yet
+    struct imgst_scan* scan = NULL;
+    const struct scan_image* image = NULL;
+    ck_assert_err_none(scan_open(&imgst, RES_THUMB, &scan));
+    ck_assert_err_none(scan_next(scan, &image));
+    ck_assert_ptr_null(image);
+    ck_assert_err_none(scan_next(scan, &image));
+    ck_assert_ptr_null(image);
+    scan_close(scan);
+
+    ck_assert_invalid_arg(scan_open(NULL, RES_ORIG, &scan));
+    ck_assert_invalid_arg(scan_open(&imgst, RES_ORIG, NULL));
+    ck_assert_int_eq(scan_open(&imgst, NB_RES, &scan), ERR_RESOLUTIONS);
+    ck_assert_invalid_arg(scan_open_slots(&imgst, RES_ORIG, 5, 4, &scan));
+    ck_assert_invalid_arg(scan_open_slots(&imgst, RES_ORIG, 0, NB_SLOTS_TEST + 1, &scan));
+    ck_assert_int_eq(scan_open_slots(&imgst, -1, 0, NB_SLOTS_TEST, &scan), ERR_RESOLUTIONS);
+    ck_assert_invalid_arg(scan_next(NULL, &image));
+    scan_close(NULL);
+
+    do_close(&imgst);
+    remove_test_file();
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+// ======================================================================
+Suite* scan_test_suite()
+{
+    Suite* s = suite_create("Tests of the sequential scan");
+
+    Add_Case(s, tc1, "scan tests");
+    tcase_set_timeout(tc1, 60);
+    tcase_add_test(tc1, whole_scan_in_position_order);
+    tcase_add_test(tc1, batches_in_position_order);
+    tcase_add_test(tc1, skipped_and_error_cases);
+
+    return s;
+}
+
+TEST_SUITE(scan_test_suite)
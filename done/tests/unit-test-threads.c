@@ -0,0 +1,217 @@
+/**
+ * @file unit-test-threads.c
+ * @brief Unit tests for the thread-safe mode (see lock.h)
+ */
+
+#define _POSIX_C_SOURCE 200809L // for pthread_barrier_t
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <check.h>
+#include <inttypes.h>
+
+#include "tests.h"
+#include "imgStore.h"
+#include "image_content.h"
+#include "lock.h"
+#include "wal.h"
+
+#define PICTDB_TEST_FILE "tmp-unit-test-threads.imgst"
+#define IMAGE_FILE "tests/data/papillon.jpg"
+
+#define NB_WRITERS 4    // threads inserting, then reading back, images
+#define NB_INSERTS 8    // by each of them
+#define NB_RESIZERS 4   // threads resizing the same image
+#define NB_RESIZES 16   // by each of them
+
+// ======================================================================
+// shared by the threads
+static struct imgst_file imgst;
+static pthread_barrier_t start;
+static char* image;
+static size_t image_size;
+static uint32_t base_index;
+
+// ------------------------------------------------------------
+static void remove_test_file(void)
+{
+    remove(PICTDB_TEST_FILE);
+    remove(PICTDB_TEST_FILE ".idx");
+    remove(PICTDB_TEST_FILE ".wal");
+}
+
+// ------------------------------------------------------------
+static char* read_file(const char* filename, size_t* size)
+{
+    FILE* file = fopen(filename, "rb");
+    ck_assert_ptr_nonnull(file);
+    ck_assert_int_eq(fseek(file, 0, SEEK_END), 0);
+    const long int length = ftell(file);
+    ck_assert_int_gt(length, 0);
+    rewind(file);
+
+    char* buffer = malloc((size_t) length);
+    ck_assert_ptr_nonnull(buffer);
+    ck_assert_uint_eq(fread(buffer, (size_t) length, 1, file), 1);
+    fclose(file);
+    *size = (size_t) length;
+    return buffer;
+}
+
+// ------------------------------------------------------------
+static uint64_t file_size(void)
+{
+    struct stat st;
+    ck_assert_int_eq(stat(PICTDB_TEST_FILE, &st), 0);
+    return (uint64_t) st.st_size;
+}
+
+// ------------------------------------------------------------
+// inserts its images, then reads them back; the number of failures
+static void* writer(void* arg)
+{
+    const int id = *(const int*) arg;
+    intptr_t failures = 0;
+    pthread_barrier_wait(&start);
+
+    char img_id[32];
+    for (int i = 0; i < NB_INSERTS; ++i) {
+        snprintf(img_id, sizeof(img_id), "writer%d-%d", id, i);
+        if (do_insert(image, image_size, img_id, &imgst) != ERR_NONE) ++failures;
+    }
+
+    for (int i = 0; i < NB_INSERTS; ++i) {
+        snprintf(img_id, sizeof(img_id), "writer%d-%d", id, i);
+        char* buffer = NULL;
+        uint32_t size = 0;
+        if (do_read(img_id, RES_ORIG, &buffer, &size, &imgst) != ERR_NONE
+            || size != image_size || memcmp(buffer, image, size) != 0) {
+            ++failures;
+        }
+        free(buffer);
+    }
+    return (void*) failures;
+}
+
+// ------------------------------------------------------------
+// resizes the base image, again and again; the number of failures
+static void* resizer(void* arg)
+{
+    (void) arg;
+    intptr_t failures = 0;
+    pthread_barrier_wait(&start);
+
+    for (int i = 0; i < NB_RESIZES; ++i) {
+        if (lazily_resize(RES_SMALL, &imgst, base_index) != ERR_NONE) ++failures;
+    }
+    return (void*) failures;
+}
+
+// ======================================================================
+START_TEST(concurrent_inserts_and_resizes)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    image = read_file(IMAGE_FILE, &image_size);
+
+    struct imgst_file created = {
+        .header.max_files   = 1 + NB_WRITERS * NB_INSERTS,
+        .header.res_resized = { 64, 64, 256, 256}
+    };
+    ck_assert_err_none(do_create(PICTDB_TEST_FILE, &created));
+    do_close(&created);
+
+    ck_assert_err_none(do_open(PICTDB_TEST_FILE, "rb+", &imgst));
+    ck_assert_err_none(do_insert(image, image_size, "base", &imgst));
+    ck_assert_err_none(find_img(&imgst, "base", &base_index));
+    ck_assert_err_none(lock_init(&imgst));
+
+    // the images inserted share the content of base (dedup): only the
+    // small image of base is to be appended
+    ck_assert_err_none(wal_sync(&imgst));
+    const uint64_t size_before = file_size();
+
+    ck_assert_int_eq(pthread_barrier_init(&start, NULL, NB_WRITERS + NB_RESIZERS), 0);
+    pthread_t threads[NB_WRITERS + NB_RESIZERS];
+    int ids[NB_WRITERS];
+    for (int t = 0; t < NB_WRITERS; ++t) {
+        ids[t] = t;
+        ck_assert_int_eq(pthread_create(&threads[t], NULL, writer, &ids[t]), 0);
+    }
+    for (int t = NB_WRITERS; t < NB_WRITERS + NB_RESIZERS; ++t) {
+        ck_assert_int_eq(pthread_create(&threads[t], NULL, resizer, NULL), 0);
+    }
+
+    intptr_t failures = 0;
+    for (int t = 0; t < NB_WRITERS + NB_RESIZERS; ++t) {
+        void* result = NULL;
+        ck_assert_int_eq(pthread_join(threads[t], &result), 0);
+        failures += (intptr_t) result;
+    }
+    pthread_barrier_destroy(&start);
+    ck_assert_int_eq(failures, 0);
+
+    // num_files as the valid slots
+    const uint32_t expected = 1 + NB_WRITERS * NB_INSERTS;
+    ck_assert_uint_eq(HEADER_GET(&imgst, num_files), expected);
+    uint32_t valid = 0;
+    for (uint32_t i = 0; i < NB_SLOTS(&imgst); ++i) {
+        if (imgst.metadata.is_valid[i] == NON_EMPTY) ++valid;
+    }
+    ck_assert_uint_eq(valid, expected);
+
+    // a single small image, appended once
+    const uint64_t small_offset = SLOT_OFFSET(&imgst.metadata, base_index, RES_SMALL);
+    const uint32_t small_size = SLOT_SIZE(&imgst.metadata, base_index, RES_SMALL);
+    ck_assert_uint_ne(small_offset, 0);
+    ck_assert_uint_ne(small_size, 0);
+    ck_assert_uint_eq(small_offset, size_before);
+    do_close(&imgst);
+    ck_assert_uint_eq(file_size(), size_before + BLOB_SPAN(&imgst, small_size));
+
+    // as written in the file
+    ck_assert_err_none(do_open(PICTDB_TEST_FILE, "rb", &imgst));
+    ck_assert_uint_eq(imgst.header.num_files, expected);
+    struct img_metadata base;
+    ck_assert_err_none(get_metadata(&imgst, base_index, &base));
+    ck_assert_uint_eq(base.offset[RES_SMALL], small_offset);
+    valid = 0;
+    for (uint32_t i = 0; i < NB_SLOTS(&imgst); ++i) {
+        struct img_metadata metadata;
+        ck_assert_err_none(get_metadata(&imgst, i, &metadata));
+        if (metadata.is_valid == NON_EMPTY) {
+            ++valid;
+            ck_assert_uint_eq(metadata.offset[RES_ORIG], base.offset[RES_ORIG]);
+        }
+    }
+    ck_assert_uint_eq(valid, expected);
+    do_close(&imgst);
+
+    free(image);
+    remove_test_file();
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+// ======================================================================
+Suite* threads_test_suite()
+{
+    Suite* s = suite_create("Tests of the thread-safe mode");
+
+    Add_Case(s, tc1, "threads tests");
+    tcase_set_timeout(tc1, 60);
+    tcase_add_test(tc1, concurrent_inserts_and_resizes);
+
+    return s;
+}
+
+TEST_SUITE(threads_test_suite)
@@ -5,12 +5,26 @@
  * @author Mia Primorac
  */
 
+#define _DEFAULT_SOURCE // for fileno, posix_fallocate
+
 #include "imgStore.h"
+#include "wal.h"
+#include "derived.h"
+#include "shard.h"
+#include "lock.h"
+#include "map.h"
+#include "replog.h"
+#include "index.h"
 
 #include <stdint.h> // for uint8_t
 #include <stdio.h> // for sprintf
 #include <openssl/sha.h> // for SHA256_DIGEST_LENGTH
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h> // for offsetof
+#include <fcntl.h> // for posix_fallocate
+#include <errno.h>
+#include <sys/stat.h>
 
 /********************************************************************//**
  * Human-readable SHA
@@ -54,6 +68,26 @@ print_header(const struct imgst_header* header)
 }
 
 
+/**********************************************************************
+ * Name of an image format
+ */
+static const char*
+format_name (int format)
+{
+    switch (format) {
+    case IMG_FMT_JPEG:
+        return "jpeg";
+    case IMG_FMT_WEBP:
+        return "webp";
+    case IMG_FMT_PNG:
+        return "png";
+    case IMG_FMT_AVIF:
+        return "avif";
+    default:
+        return "unknown";
+    }
+}
+
 /********************************************************************//**
  * Metadata display.
  */
@@ -69,8 +103,8 @@ print_metadata (const struct img_metadata* metadata)
            sha_printable);
     printf("VALID: %" PRIu16 " \n",
            metadata->is_valid);
-    printf("UNUSED: %" PRIu16 " \n",
-           metadata->unused_16);
+    printf("FORMAT: %s \n",
+           format_name(metadata->unused_16));
     printf("OFFSET ORIG. : %" PRIu64 " \t\t",
            metadata->offset[RES_ORIG]);
     printf("SIZE ORIG. : %" PRIu32 "\n",
@@ -88,9 +122,77 @@ print_metadata (const struct img_metadata* metadata)
     printf("*****************************************\n");
 }
 
+/********************************************************************//**
+ * Space accounting display.
+ */
+void
+print_stats(const struct imgst_stats* stats)
+{
+    printf("FILE SIZE: %" PRIu64 " \n",
+           stats->file_size);
+    printf("METADATA SIZE: %" PRIu64 " \n",
+           stats->table_size);
+    printf("LIVE BYTES: %" PRIu64 " \t\t",
+           stats->live_bytes);
+    printf("DEAD BYTES: %" PRIu64 " \n",
+           stats->dead_bytes);
+    printf("FRAGMENTATION: %.2f %%\n",
+           100.0 * stats->fragmentation);
+}
+
+/**********************************************************************
+ * Position of the header extension: right after the primary table
+ */
+static long int
+ext_offset (const struct imgst_file* imgst_file)
+{
+    return (long int) sizeof(struct imgst_header)
+           + (long int) imgst_file->header.max_files * sizeof(struct img_metadata);
+}
+
+/**********************************************************************
+ * Reads the header extension and the headers of the chained metadata
+ * extents (their metadata are loaded on demand, as the primary ones)
+ */
+static int
+read_extents (struct imgst_file* imgst_file)
+{
+    if (fseek(imgst_file->file, ext_offset(imgst_file), SEEK_SET) != 0) return ERR_IO;
+    if (fread(&imgst_file->ext, sizeof(struct imgst_ext), 1, imgst_file->file) != 1) return ERR_IO;
+    if (memcmp(imgst_file->ext.magic, EXT_MAGIC, sizeof(imgst_file->ext.magic))) return ERR_IO;
+
+    if (imgst_file->ext.nb_extents == 0) return ERR_NONE;
+    if (imgst_file->ext.nb_slots > MAX_TOTAL_FILES) return ERR_MAX_FILES;
+
+    imgst_file->extents = calloc(imgst_file->ext.nb_extents, sizeof(struct extent_map));
+    if (imgst_file->extents == NULL) return ERR_OUT_OF_MEMORY;
+
+    uint64_t offset = imgst_file->ext.first_extent;
+    uint32_t first_slot = imgst_file->header.max_files;
+
+    for (uint32_t i = 0; i < imgst_file->ext.nb_extents; ++i) {
+        struct imgst_extent extent;
+
+        if (offset == 0) return ERR_IO;
+        if (fseek(imgst_file->file, (long int) offset, SEEK_SET) != 0) return ERR_IO;
+        if (fread(&extent, sizeof(struct imgst_extent), 1, imgst_file->file) != 1) return ERR_IO;
+        if (first_slot + extent.nb_slots > imgst_file->ext.nb_slots) return ERR_IO;
+
+        imgst_file->extents[i].offset = offset;
+        imgst_file->extents[i].first_slot = first_slot;
+        imgst_file->extents[i].nb_slots = extent.nb_slots;
+
+        first_slot += extent.nb_slots;
+        imgst_file->nb_extra_slots += extent.nb_slots;
+        offset = extent.next;
+    }
+
+    return ERR_NONE;
+}
+
 /**********************************************************************
  * Open a file which contain an imgst_file
- * Read the header and the metadatas
+ * Read the header and the metadatas, with their index
  */
 int
 do_open (const char* imgst_filename, const char* open_mode, struct imgst_file* imgst_file)
@@ -100,6 +202,26 @@ do_open (const char* imgst_filename, const char* open_mode, struct imgst_file* i
     if (open_mode == NULL) return ERR_INVALID_ARGUMENT;
     if (imgst_file == NULL) return ERR_INVALID_ARGUMENT;
 
+    memset(&imgst_file->metadata, 0, sizeof(struct metadata_table));
+    imgst_file->metadata_loaded = NULL;
+    imgst_file->extents = NULL;
+    imgst_file->nb_extra_slots = 0;
+    imgst_file->wal = NULL;
+    imgst_file->cache = NULL;
+    imgst_file->shards = NULL;
+    imgst_file->locks = NULL;
+    imgst_file->map = NULL;
+    imgst_file->replog = NULL;
+    imgst_file->index = NULL;
+    memset(&imgst_file->ext, 0, sizeof(struct imgst_ext));
+
+    if (is_shard_manifest(imgst_filename)) {
+        return shard_open(imgst_filename, open_mode, imgst_file);
+    }
+
+    // the writes of a crashed writer are completed first
+    int ret = wal_recover(imgst_filename);
+    if (ret) return ret;
 
     // open the file
     FILE * fileptr = fopen(imgst_filename, open_mode);
@@ -111,31 +233,461 @@ do_open (const char* imgst_filename, const char* open_mode, struct imgst_file* i
     // Put the content of the file(the header part in imgst_file)
     size_t r1 = fread(&imgst_file->header, sizeof(struct imgst_header),1, imgst_file->file);
     if (r1 != 1) return ERR_IO;
-    
 
-    // Allocation for the metadata
-    struct img_metadata* ptr = NULL;
-    ptr = calloc(imgst_file->header.max_files, sizeof(struct img_metadata));
+    if (imgst_file->header.features != 0) {
+        int ret = read_extents(imgst_file);
+        if (ret) return ret;
+    }
+
+    // Allocation for the metadata: as it is large, calloc gets it directly
+    // from the system and untouched pages of it do not use any memory
+    ret = alloc_metadata(&imgst_file->metadata, NB_SLOTS(imgst_file));
+    if (ret) return ret;
+
+    imgst_file->metadata_loaded = calloc(NB_PAGES(NB_SLOTS(imgst_file)), sizeof(uint8_t));
+    if (imgst_file->metadata_loaded == NULL) return ERR_OUT_OF_MEMORY;
+
+    const int writable = strchr(open_mode, '+') != NULL || strchr(open_mode, 'w') != NULL
+                         || strchr(open_mode, 'a') != NULL;
+
+    // the whole table from the sidecar if still valid, paged in otherwise (see index.h)
+    ret = index_open(imgst_file, imgst_filename, writable);
+    if (ret) return ret;
+
+    ret = derived_init(imgst_file, imgst_filename);
+    if (ret) return ret;
+
+    if (writable) {
+        ret = wal_init(imgst_file, imgst_filename, WAL_SYNC_BATCH);
+        if (ret == ERR_NONE) ret = replog_init(imgst_file, imgst_filename);
+        return ret;
+    }
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Conversions between the in-memory table and the on-disk format
+ */
+static void
+unpack_metadata (struct metadata_table* table, uint32_t index, const struct img_metadata* metadata)
+{
+    table->is_valid[index] = metadata->is_valid;
+    table->unused_16[index] = metadata->unused_16;
+    memcpy(&SLOT_OFFSET(table, index, 0), metadata->offset, sizeof(metadata->offset));
+    memcpy(&SLOT_SIZE(table, index, 0), metadata->size, sizeof(metadata->size));
+    memcpy(SLOT_RES_ORIG(table, index), metadata->res_orig, sizeof(metadata->res_orig));
+    memcpy(SLOT_SHA(table, index), metadata->SHA, sizeof(metadata->SHA));
+}
+
+static void
+pack_metadata (const struct metadata_table* table, uint32_t index, struct img_metadata* metadata)
+{
+    memset(metadata, 0, sizeof(struct img_metadata));
+    strncpy(metadata->img_id, SLOT_ID(table, index), MAX_IMG_ID);
+    metadata->is_valid = table->is_valid[index];
+    metadata->unused_16 = table->unused_16[index];
+    memcpy(metadata->offset, &SLOT_OFFSET(table, index, 0), sizeof(metadata->offset));
+    memcpy(metadata->size, &SLOT_SIZE(table, index, 0), sizeof(metadata->size));
+    memcpy(metadata->res_orig, SLOT_RES_ORIG(table, index), sizeof(metadata->res_orig));
+    memcpy(metadata->SHA, SLOT_SHA(table, index), sizeof(metadata->SHA));
+}
+
+/**********************************************************************
+ * Sets nb slots from index to EMPTY (and without id)
+ */
+static void
+clear_slots (struct metadata_table* table, uint32_t index, uint32_t nb)
+{
+    memset(&table->is_valid[index], 0, nb * sizeof(uint16_t));
+    memset(&table->unused_16[index], 0, nb * sizeof(uint16_t));
+    memset(&table->id_hash[index], 0, nb * sizeof(uint32_t));
+    memset(&SLOT_OFFSET(table, index, 0), 0, (size_t) nb * NB_RES * sizeof(uint64_t));
+    memset(&SLOT_SIZE(table, index, 0), 0, (size_t) nb * NB_RES * sizeof(uint32_t));
+    memset(SLOT_RES_ORIG(table, index), 0, (size_t) nb * NB_RES_ORIG * sizeof(uint32_t));
+    memset(SLOT_SHA(table, index), 0, (size_t) nb * SHA256_DIGEST_LENGTH);
+    memset(&table->img_id[index], 0, nb * sizeof(uint32_t));
+}
+
+/**********************************************************************
+ * Allocation of the in-memory table
+ */
+int
+alloc_metadata (struct metadata_table* table, uint32_t nb_slots)
+{
+    if (table == NULL) return ERR_INVALID_ARGUMENT;
+
+    memset(table, 0, sizeof(struct metadata_table));
+    table->is_valid = calloc(nb_slots, sizeof(uint16_t));
+    table->unused_16 = calloc(nb_slots, sizeof(uint16_t));
+    table->id_hash = calloc(nb_slots, sizeof(uint32_t));
+    table->offset = calloc((size_t) nb_slots * NB_RES, sizeof(uint64_t));
+    table->size = calloc((size_t) nb_slots * NB_RES, sizeof(uint32_t));
+    table->res_orig = calloc((size_t) nb_slots * NB_RES_ORIG, sizeof(uint32_t));
+    table->SHA = calloc(nb_slots, SHA256_DIGEST_LENGTH);
+    table->img_id = calloc(nb_slots, sizeof(uint32_t));
+    table->names_capacity = MAX_IMG_ID + 1;
+    table->names = calloc(table->names_capacity, sizeof(char));
+    table->names_size = 1; // the empty id
+
+    if ((nb_slots > 0 && (table->is_valid == NULL || table->unused_16 == NULL || table->id_hash == NULL
+                          || table->offset == NULL || table->size == NULL || table->res_orig == NULL
+                          || table->SHA == NULL || table->img_id == NULL))
+        || table->names == NULL) {
+        free_metadata(table);
+        return ERR_OUT_OF_MEMORY;
+    }
+    table->nb_slots = nb_slots;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Release of the in-memory table
+ */
+void
+free_metadata (struct metadata_table* table)
+{
+    if (table == NULL) return;
+
+    free(table->is_valid);
+    free(table->unused_16);
+    free(table->id_hash);
+    free(table->offset);
+    free(table->size);
+    free(table->res_orig);
+    free(table->SHA);
+    free(table->img_id);
+    free(table->names);
+    memset(table, 0, sizeof(struct metadata_table));
+}
+
+/**********************************************************************
+ * Reallocation of one array of the table; the new elements are not set
+ */
+static int
+resize_array (void** array, size_t element_size, uint32_t nb_slots)
+{
+    void* ptr = realloc(*array, (size_t) nb_slots * element_size);
     if (ptr == NULL) return ERR_OUT_OF_MEMORY;
-    imgst_file->metadata = ptr;
+    *array = ptr;
+    return ERR_NONE;
+}
 
-    // Put the content of the file(the hmetadataeader part in imgst_file)
-    size_t r2 = fread(imgst_file->metadata, sizeof(struct img_metadata), imgst_file->header.max_files,imgst_file->file);
-    if (r2 != imgst_file->header.max_files) return ERR_IO;
+static int
+resize_metadata (struct metadata_table* table, uint32_t nb_slots)
+{
+    if (resize_array((void**) &table->is_valid, sizeof(uint16_t), nb_slots)
+        || resize_array((void**) &table->unused_16, sizeof(uint16_t), nb_slots)
+        || resize_array((void**) &table->id_hash, sizeof(uint32_t), nb_slots)
+        || resize_array((void**) &table->offset, NB_RES * sizeof(uint64_t), nb_slots)
+        || resize_array((void**) &table->size, NB_RES * sizeof(uint32_t), nb_slots)
+        || resize_array((void**) &table->res_orig, NB_RES_ORIG * sizeof(uint32_t), nb_slots)
+        || resize_array((void**) &table->SHA, SHA256_DIGEST_LENGTH, nb_slots)
+        || resize_array((void**) &table->img_id, sizeof(uint32_t), nb_slots)) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    // slots without id until set: the arena may be compacted before they are
+    if (nb_slots > table->nb_slots) {
+        memset(&table->img_id[table->nb_slots], 0, (nb_slots - table->nb_slots) * sizeof(uint32_t));
+    }
+    table->nb_slots = nb_slots;
+    return ERR_NONE;
+}
 
+/**********************************************************************
+ * Hash of an image id (FNV-1a)
+ */
+uint32_t
+hash_id (const char* img_id)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; img_id[i] != '\0' && i < MAX_IMG_ID; ++i) {
+        hash = (hash ^ (unsigned char) img_id[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**********************************************************************
+ * Rewrites the string arena without the ids no longer referenced
+ */
+static int
+compact_names (struct metadata_table* table)
+{
+    char* names = malloc(table->names_size - table->names_dead);
+    if (names == NULL) return ERR_OUT_OF_MEMORY;
+
+    names[0] = '\0';
+    size_t size = 1;
+    for (uint32_t i = 0; i < table->nb_slots; ++i) {
+        if (table->img_id[i] != 0) {
+            const size_t length = strlen(&table->names[table->img_id[i]]) + 1;
+            memcpy(&names[size], &table->names[table->img_id[i]], length);
+            table->img_id[i] = (uint32_t) size;
+            size += length;
+        }
+    }
+
+    free(table->names);
+    table->names = names;
+    table->names_size = size;
+    table->names_capacity = size;
+    table->names_dead = 0;
+    ++table->names_generation;
     return ERR_NONE;
 }
 
+/**********************************************************************
+ * Image id of a slot, appended to the string arena
+ */
+int
+set_img_id (struct imgst_file* imgst_file, uint32_t index, const char* img_id)
+{
+    if (imgst_file == NULL || img_id == NULL) return ERR_INVALID_ARGUMENT;
+
+    struct metadata_table* table = &imgst_file->metadata;
+    if (index >= table->nb_slots) return ERR_INVALID_ARGUMENT;
+
+    if (table->img_id[index] != 0) {
+        table->names_dead += strlen(SLOT_ID(table, index)) + 1;
+        table->img_id[index] = 0;
+    }
+    table->id_hash[index] = hash_id(img_id);
+
+    const char* end = memchr(img_id, '\0', MAX_IMG_ID);
+    const size_t length = end != NULL ? (size_t) (end - img_id) : MAX_IMG_ID;
+    if (length == 0) return ERR_NONE;
+
+    if (table->names_dead > table->names_size / 2) {
+        int ret = compact_names(table);
+        if (ret) return ret;
+    }
+
+    if (table->names_size + length + 1 > table->names_capacity) {
+        size_t capacity = 2 * table->names_capacity;
+        if (capacity < table->names_size + length + 1) capacity = table->names_size + length + 1;
+        if (capacity > UINT32_MAX) return ERR_OUT_OF_MEMORY;
+
+        char* names = realloc(table->names, capacity);
+        if (names == NULL) return ERR_OUT_OF_MEMORY;
+        table->names = names;
+        table->names_capacity = capacity;
+    }
+
+    memcpy(&table->names[table->names_size], img_id, length);
+    table->names[table->names_size + length] = '\0';
+    table->img_id[index] = (uint32_t) table->names_size;
+    table->names_size += length + 1;
+
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Reads one page of metadata from the file. A page may span the primary
+ * table and the extents, which are read separately.
+ */
+static int
+load_page (struct imgst_file* imgst_file, uint32_t page)
+{
+    struct img_metadata buffer[METADATA_PAGE];
+    uint32_t index = page * METADATA_PAGE;
+    uint32_t end = index + METADATA_PAGE < NB_SLOTS(imgst_file) ?
+                   index + METADATA_PAGE : NB_SLOTS(imgst_file);
+
+    while (index < end) {
+        // end of the table (primary or extent) holding index
+        uint32_t run_end = imgst_file->header.max_files;
+        for (uint32_t i = 0; index >= run_end && i < imgst_file->ext.nb_extents; ++i) {
+            run_end = imgst_file->extents[i].first_slot + imgst_file->extents[i].nb_slots;
+        }
+        if (run_end > end) run_end = end;
+        if (run_end <= index) return ERR_IO;
+
+        long int offset = metadata_offset(imgst_file, index);
+        if (offset < 0) return ERR_IO;
+        if (fseek(imgst_file->file, offset, SEEK_SET) != 0) return ERR_IO;
+
+        size_t r = fread(buffer, sizeof(struct img_metadata), run_end - index, imgst_file->file);
+        if (r != run_end - index) return ERR_IO;
+
+        for (uint32_t i = 0; i < r; ++i) {
+            unpack_metadata(&imgst_file->metadata, index + i, &buffer[i]);
+            // only the ids of the valid images are kept in memory
+            int ret = set_img_id(imgst_file, index + i,
+                                 buffer[i].is_valid == NON_EMPTY ? buffer[i].img_id : "");
+            if (ret) return ret;
+        }
+
+        index = run_end;
+    }
+
+    imgst_file->metadata_loaded[page] = 1;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Access to the in-memory table, reading the page of index if needed
+ */
+struct metadata_table*
+load_metadata (struct imgst_file* imgst_file, uint32_t index)
+{
+    if (imgst_file == NULL || imgst_file->metadata.is_valid == NULL) return NULL;
+    if (index >= NB_SLOTS(imgst_file)) return NULL;
+
+    if (imgst_file->metadata_loaded != NULL && !imgst_file->metadata_loaded[index / METADATA_PAGE]) {
+        if (load_page(imgst_file, index / METADATA_PAGE) != ERR_NONE) return NULL;
+    }
+    return &imgst_file->metadata;
+}
+
+/**********************************************************************
+ * Copy of one metadata, in its on-disk format
+ */
+int
+get_metadata (struct imgst_file* imgst_file, uint32_t index, struct img_metadata* metadata)
+{
+    if (metadata == NULL) return ERR_INVALID_ARGUMENT;
+
+    const struct metadata_table* table = load_metadata(imgst_file, index);
+    if (table == NULL) return imgst_file == NULL || index >= NB_SLOTS(imgst_file) ? ERR_INVALID_ARGUMENT : ERR_IO;
+
+    pack_metadata(table, index, metadata);
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Replacement of one metadata, given in its on-disk format
+ */
+int
+put_metadata (struct imgst_file* imgst_file, uint32_t index, const struct img_metadata* metadata)
+{
+    if (metadata == NULL) return ERR_INVALID_ARGUMENT;
+
+    struct metadata_table* table = load_metadata(imgst_file, index);
+    if (table == NULL) return imgst_file == NULL || index >= NB_SLOTS(imgst_file) ? ERR_INVALID_ARGUMENT : ERR_IO;
+
+    unpack_metadata(table, index, metadata);
+    return set_img_id(imgst_file, index, metadata->img_id);
+}
+
+/**********************************************************************
+ * Rereads the header and the given slots, changed by another process
+ */
+int
+reload_metadata (struct imgst_file* imgst_file, const uint32_t* indexes, uint32_t nb)
+{
+    if (imgst_file == NULL || imgst_file->file == NULL || (indexes == NULL && nb > 0)) return ERR_INVALID_ARGUMENT;
+    if (imgst_file->shards != NULL) return ERR_INVALID_COMMAND;
+
+    struct imgst_header header;
+    int ret = read_at(imgst_file, 0, &header, sizeof(struct imgst_header));
+    if (ret) return ret;
+
+    struct imgst_ext ext = imgst_file->ext;
+    if (header.features != 0) {
+        ret = read_at(imgst_file, (uint64_t) ext_offset(imgst_file), &ext, sizeof(struct imgst_ext));
+        if (ret) return ret;
+    }
+
+    // a table grown meanwhile: the extents are to be read again
+    if (header.max_files != imgst_file->header.max_files || header.features != imgst_file->header.features
+        || ext.nb_extents != imgst_file->ext.nb_extents || ext.nb_slots != imgst_file->ext.nb_slots) {
+        return ERR_INVALID_COMMAND;
+    }
+    memcpy(&imgst_file->header, &header, sizeof(struct imgst_header));
+    imgst_file->ext = ext;
+
+    for (uint32_t i = 0; i < nb; ++i) {
+        const uint32_t index = indexes[i];
+        if (index >= NB_SLOTS(imgst_file)) continue;
+        // not loaded yet: read as it is now when needed
+        if (imgst_file->metadata_loaded != NULL && !imgst_file->metadata_loaded[index / METADATA_PAGE]) continue;
+
+        struct img_metadata metadata;
+        ret = read_at(imgst_file, (uint64_t) metadata_offset(imgst_file, index), &metadata, sizeof(struct img_metadata));
+        if (ret) return ret;
+
+        struct metadata_table* table = &imgst_file->metadata;
+        if (table->is_valid[index] == NON_EMPTY) index_drop(imgst_file, index);
+        unpack_metadata(table, index, &metadata);
+        ret = set_img_id(imgst_file, index, metadata.is_valid == NON_EMPTY ? metadata.img_id : "");
+        if (ret) return ret;
+        if (table->is_valid[index] == NON_EMPTY) index_add(imgst_file, index);
+    }
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Index of the valid image with a given id
+ */
+int
+find_img (struct imgst_file* imgst_file, const char* img_id, uint32_t* index)
+{
+    if (imgst_file == NULL || img_id == NULL || index == NULL) return ERR_INVALID_ARGUMENT;
+
+    if (INDEXED(imgst_file)) return index_find(imgst_file, img_id, index);
+
+    const uint32_t hash = hash_id(img_id);
+    int ret = ERR_FILE_NOT_FOUND;
+
+    // the metadata pages are read only until the image is found; each
+    // one under the lock of its stripe (see lock.h)
+    for (uint32_t page = 0; ret == ERR_FILE_NOT_FOUND; ++page) {
+        const uint32_t first = page * METADATA_PAGE;
+        lock_slot(imgst_file, first, 0);
+
+        const uint32_t end = NB_SLOTS(imgst_file) - first < METADATA_PAGE ?
+                             NB_SLOTS(imgst_file) : first + METADATA_PAGE;
+        if (first >= NB_SLOTS(imgst_file)) {
+            unlock_slot(imgst_file, first);
+            break;
+        }
+
+        const struct metadata_table* table = load_metadata(imgst_file, first);
+        if (table == NULL) ret = ERR_IO;
+
+        for (uint32_t i = first; ret == ERR_FILE_NOT_FOUND && i < end; ++i) {
+            if (table->is_valid[i] == NON_EMPTY && table->id_hash[i] == hash
+                && !strcmp(SLOT_ID(table, i), img_id)) {
+                *index = i;
+                ret = ERR_NONE;
+            }
+        }
+        unlock_slot(imgst_file, first);
+    }
+
+    // all the pages read: the next lookups use the index (or the pages
+    // again, if it cannot be built)
+    if (ret == ERR_FILE_NOT_FOUND && imgst_file->locks == NULL) {
+        (void) index_build(imgst_file);
+    }
+    return ret;
+}
+
 /**********************************************************************
  * Close a file
  */
 void
 do_close (struct imgst_file* imgst_file)
 {
-    if (imgst_file->metadata != NULL) {
-       free(imgst_file->metadata);
-       imgst_file->metadata = NULL;
+    shard_close(imgst_file);
+    wal_close(imgst_file);
+    replog_close(imgst_file);
+    derived_close(imgst_file);
+    index_close(imgst_file);
+    lock_close(imgst_file);
+    map_close(imgst_file);
+
+    free_metadata(&imgst_file->metadata);
+
+    if (imgst_file->metadata_loaded != NULL) {
+       free(imgst_file->metadata_loaded);
+       imgst_file->metadata_loaded = NULL;
+    }
+
+    if (imgst_file->extents != NULL) {
+       free(imgst_file->extents);
+       imgst_file->extents = NULL;
     }
+    imgst_file->nb_extra_slots = 0;
     
     if(imgst_file->file != NULL) {
        fclose(imgst_file->file);
@@ -144,6 +696,196 @@ do_close (struct imgst_file* imgst_file)
     }
 }
 
+/**********************************************************************
+ * Position of a metadata in the file
+ */
+long int
+metadata_offset (const struct imgst_file* imgst_file, uint32_t index)
+{
+    if (index < imgst_file->header.max_files) {
+        return (long int) sizeof(struct imgst_header) + (long int) index * sizeof(struct img_metadata);
+    }
+
+    for (uint32_t i = 0; i < imgst_file->ext.nb_extents; ++i) {
+        const struct extent_map* extent = &imgst_file->extents[i];
+        if (index >= extent->first_slot && index < extent->first_slot + extent->nb_slots) {
+            return (long int) (extent->offset + sizeof(struct imgst_extent))
+                   + (long int) (index - extent->first_slot) * sizeof(struct img_metadata);
+        }
+    }
+    return -1;
+}
+
+/**********************************************************************
+ * Write one metadata to the file
+ */
+int
+write_metadata (struct imgst_file* imgst_file, uint32_t index)
+{
+    long int offset = metadata_offset(imgst_file, index);
+    if (offset < 0) return ERR_INVALID_ARGUMENT;
+
+    struct img_metadata metadata;
+    int ret = get_metadata(imgst_file, index, &metadata);
+    if (ret) return ret;
+
+    ret = wal_write(imgst_file, offset, &metadata, sizeof(struct img_metadata));
+    if (ret == ERR_NONE) index_touch(imgst_file, index);
+    return ret;
+}
+
+/**********************************************************************
+ * Write the header to the file
+ */
+int
+write_header (struct imgst_file* imgst_file)
+{
+    int ret = wal_write(imgst_file, 0, &imgst_file->header, sizeof(struct imgst_header));
+
+    // with the end of the content appended meanwhile
+    if (ret == ERR_NONE && (imgst_file->header.features & IMGST_PREALLOC)) {
+        ret = wal_write(imgst_file, ext_offset(imgst_file), &imgst_file->ext, sizeof(struct imgst_ext));
+    }
+    return ret;
+}
+
+/**********************************************************************
+ * Position of new content: the end of the file, or of the content of a
+ * preallocated one
+ */
+int
+seek_append (struct imgst_file* imgst_file, uint64_t size, uint64_t* offset, uint64_t* end_of_data)
+{
+    if (imgst_file == NULL || imgst_file->file == NULL || offset == NULL || end_of_data == NULL) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if (!(imgst_file->header.features & IMGST_PREALLOC) || imgst_file->ext.end_of_data == 0) {
+        if (fseek(imgst_file->file, 0, SEEK_END) != 0) return ERR_IO;
+        const long int position = ftell(imgst_file->file);
+        if (position < 0) return ERR_IO;
+        *offset = (uint64_t) position;
+        *end_of_data = 0;
+        return ERR_NONE;
+    }
+
+    const uint64_t end = imgst_file->ext.end_of_data;
+    struct stat st;
+    if (fstat(fileno(imgst_file->file), &st) != 0) return ERR_IO;
+
+    if (end + size > (uint64_t) st.st_size) {
+        uint64_t chunk = end / 8;
+        if (chunk < PREALLOC_MIN_CHUNK) chunk = PREALLOC_MIN_CHUNK;
+        if (chunk > PREALLOC_MAX_CHUNK) chunk = PREALLOC_MAX_CHUNK;
+        if (chunk < size) chunk = size;
+        const int err = posix_fallocate(fileno(imgst_file->file), (off_t) end, (off_t) chunk);
+        // a file system which cannot preallocate: the content just extends the file
+        if (err != 0 && err != EINVAL && err != EOPNOTSUPP) return ERR_IO;
+    }
+
+    if (fseek(imgst_file->file, (long int) end, SEEK_SET) != 0) return ERR_IO;
+    *offset = end;
+    *end_of_data = end + size;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Append a metadata extent (growable imgStores)
+ */
+int
+grow_metadata (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL) return ERR_INVALID_ARGUMENT;
+    if (imgst_file->file == NULL) return ERR_IO;
+    if (!(imgst_file->header.features & IMGST_GROWABLE)) return ERR_FULL_IMGSTORE;
+
+    // each extent doubles the capacity, within the limits of one table
+    const uint32_t nb_slots = NB_SLOTS(imgst_file);
+    uint32_t extent_slots = nb_slots < MAX_MAX_FILES ? nb_slots : MAX_MAX_FILES;
+    if (nb_slots >= MAX_TOTAL_FILES) return ERR_FULL_IMGSTORE;
+    if (nb_slots + extent_slots > MAX_TOTAL_FILES) extent_slots = MAX_TOTAL_FILES - nb_slots;
+
+    // the last page may be shared by the old and the new slots
+    if (nb_slots > 0 && load_metadata(imgst_file, nb_slots - 1) == NULL) return ERR_IO;
+
+    // the arrays move: not looked up meanwhile (index_find)
+    lock_index(imgst_file, 1);
+    int ret = resize_metadata(&imgst_file->metadata, nb_slots + extent_slots);
+
+    if (ret == ERR_NONE && imgst_file->metadata_loaded != NULL) {
+        const uint32_t nb_pages = NB_PAGES(nb_slots + extent_slots);
+        uint8_t* loaded = realloc(imgst_file->metadata_loaded, nb_pages);
+        if (loaded == NULL) {
+            ret = ERR_OUT_OF_MEMORY;
+        } else {
+            imgst_file->metadata_loaded = loaded;
+            // new pages are read back (as EMPTY slots) from the file when needed
+            memset(&loaded[NB_PAGES(nb_slots)], 0, nb_pages - NB_PAGES(nb_slots));
+        }
+    }
+
+    if (ret == ERR_NONE) {
+        // only the new slots of the last old page, if any, are set in memory
+        uint32_t in_memory = nb_slots % METADATA_PAGE == 0 ? 0 : METADATA_PAGE - nb_slots % METADATA_PAGE;
+        if (imgst_file->metadata_loaded == NULL || in_memory > extent_slots) in_memory = extent_slots;
+        clear_slots(&imgst_file->metadata, nb_slots, in_memory);
+
+        ret = index_grow(imgst_file);
+    }
+    unlock_index(imgst_file);
+    if (ret) return ret;
+
+    struct extent_map* extents = realloc(imgst_file->extents,
+                                         (imgst_file->ext.nb_extents + 1) * sizeof(struct extent_map));
+    if (extents == NULL) return ERR_OUT_OF_MEMORY;
+    imgst_file->extents = extents;
+
+    // the new extent is appended like any content...
+    uint64_t offset = 0;
+    uint64_t end_of_data = 0;
+    ret = seek_append(imgst_file, sizeof(struct imgst_extent) + (uint64_t) extent_slots * sizeof(struct img_metadata),
+                      &offset, &end_of_data);
+    if (ret) return ret;
+
+    struct imgst_extent extent = { .next = 0, .nb_slots = extent_slots };
+    if (fwrite(&extent, sizeof(struct imgst_extent), 1, imgst_file->file) != 1) return ERR_IO;
+
+    static const struct img_metadata empty[METADATA_PAGE];
+    for (uint32_t written = 0; written < extent_slots; written += METADATA_PAGE) {
+        const uint32_t nb = extent_slots - written < METADATA_PAGE ? extent_slots - written : METADATA_PAGE;
+        if (fwrite(empty, sizeof(struct img_metadata), nb, imgst_file->file) != nb) return ERR_IO;
+    }
+
+    // ...then linked to the previous one: a crash before leaves only dead space
+    long int link = imgst_file->ext.nb_extents == 0 ?
+                    ext_offset(imgst_file) + (long int) offsetof(struct imgst_ext, first_extent) :
+                    (long int) (imgst_file->ext.last_extent + offsetof(struct imgst_extent, next));
+    uint64_t next = (uint64_t) offset;
+    struct imgst_ext ext = imgst_file->ext;
+    if (ext.nb_extents == 0) ext.first_extent = next;
+    ext.last_extent = next;
+    ext.nb_extents += 1;
+    ext.nb_slots = nb_slots + extent_slots;
+    if (end_of_data != 0) ext.end_of_data = end_of_data;
+
+    ret = wal_write(imgst_file, link, &next, sizeof(uint64_t));
+    if (ret == ERR_NONE) {
+        ret = wal_write(imgst_file, ext_offset(imgst_file), &ext, sizeof(struct imgst_ext));
+    }
+
+    // a transaction of its own: the extent stays, whatever becomes of the insertion
+    ret = wal_commit(imgst_file, ret);
+    if (ret) return ret;
+    imgst_file->ext = ext;
+
+    imgst_file->extents[imgst_file->ext.nb_extents - 1].offset = next;
+    imgst_file->extents[imgst_file->ext.nb_extents - 1].first_slot = nb_slots;
+    imgst_file->extents[imgst_file->ext.nb_extents - 1].nb_slots = extent_slots;
+    imgst_file->nb_extra_slots += extent_slots;
+
+    return ERR_NONE;
+}
+
 /**
  * Transforms resolution string to its int value.
  */
@@ -161,3 +903,50 @@ resolution_atoi(const char* resolution)
     }
     return -1;
 }
+
+/**********************************************************************
+ * Content type of an image format
+ */
+static const char*
+format_content_type (int format)
+{
+    switch (format) {
+    case IMG_FMT_WEBP:
+        return "image/webp";
+    case IMG_FMT_PNG:
+        return "image/png";
+    case IMG_FMT_AVIF:
+        return "image/avif";
+    default:
+        return "image/jpeg";
+    }
+}
+
+/**********************************************************************
+ * Content type of an image at a resolution
+ */
+const char*
+get_content_type (struct imgst_file* imgst_file, const char* img_id, int resolution)
+{
+    if (imgst_file == NULL) return format_content_type(IMG_FMT_JPEG);
+    if (imgst_file->shards != NULL) {
+        return get_content_type(shard_of(imgst_file, img_id), img_id, resolution);
+    }
+
+    if (resolution == RES_ORIG) {
+        uint32_t index = 0;
+        if (img_id == NULL || find_img(imgst_file, img_id, &index) != ERR_NONE) {
+            return format_content_type(IMG_FMT_JPEG);
+        }
+        lock_slot(imgst_file, index, 0);
+        const int format = SLOT_FORMAT(&imgst_file->metadata, index);
+        unlock_slot(imgst_file, index);
+        return format_content_type(format);
+    }
+
+    if ((imgst_file->header.features & IMGST_ENCODING)
+        && (resolution == RES_THUMB || resolution == RES_SMALL)) {
+        return format_content_type(imgst_file->ext.encoding[resolution].format);
+    }
+    return format_content_type(IMG_FMT_JPEG);
+}
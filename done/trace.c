@@ -0,0 +1,154 @@
+/**
+ * @file trace.c
+ * @brief Lightweight tracing of the hot paths of the imgStore library.
+ *
+ * Each thread records into its own ring, created at its first span and
+ * pushed (lock-free) on a global list, so that recording never takes a
+ * lock. A dump running while another thread records may catch one of
+ * its spans half-written: spans are a diagnostic, not an account.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime, getpid and open_memstream
+
+#include "trace.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+struct trace_event {
+    const char* name;
+    uint64_t    start;      // ns
+    uint64_t    duration;   // ns
+};
+
+struct trace_ring {
+    struct trace_ring*  next;
+    uint32_t            tid;
+    atomic_uint_fast64_t count;     // events recorded so far
+    struct trace_event  events[TRACE_RING_SIZE];
+};
+
+static atomic_int enabled;
+static _Atomic(struct trace_ring*) rings;
+static atomic_uint next_tid = 1;
+static _Thread_local struct trace_ring* ring;
+
+/**********************************************************************
+ * Current time in nanoseconds
+ */
+static uint64_t
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/**********************************************************************
+ * Ring of the calling thread, created at its first span
+ */
+static struct trace_ring*
+thread_ring(void)
+{
+    if (ring != NULL) return ring;
+
+    struct trace_ring* r = calloc(1, sizeof(struct trace_ring));
+    if (r == NULL) return NULL;
+    r->tid = atomic_fetch_add(&next_tid, 1);
+
+    r->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &r->next, r)) {}
+
+    ring = r;
+    return ring;
+}
+
+/**********************************************************************
+ * Tracing on or off
+ */
+void
+trace_enable(int on)
+{
+    atomic_store(&enabled, on != 0);
+}
+
+/**********************************************************************
+ * Start of a span
+ */
+uint64_t
+trace_begin(void)
+{
+    return atomic_load_explicit(&enabled, memory_order_relaxed) ? now() : 0;
+}
+
+/**********************************************************************
+ * End of a span
+ */
+void
+trace_end(const char* name, uint64_t start)
+{
+    if (start == 0) return;
+
+    struct trace_ring* r = thread_ring();
+    if (r == NULL) return;
+
+    const uint64_t count = atomic_load_explicit(&r->count, memory_order_relaxed);
+    struct trace_event* event = &r->events[count % TRACE_RING_SIZE];
+    event->name = name;
+    event->start = start;
+    event->duration = now() - start;
+    atomic_store_explicit(&r->count, count + 1, memory_order_release);
+}
+
+/**********************************************************************
+ * Chrome trace JSON ("complete" events, times in microseconds)
+ */
+int
+trace_dump(FILE* out)
+{
+    if (out == NULL) return ERR_INVALID_ARGUMENT;
+
+    const long pid = (long) getpid();
+    int first = 1;
+
+    fprintf(out, "{\"traceEvents\":[");
+    for (struct trace_ring* r = atomic_load(&rings); r != NULL; r = r->next) {
+        const uint64_t count = atomic_load_explicit(&r->count, memory_order_acquire);
+        const uint64_t oldest = count > TRACE_RING_SIZE ? count - TRACE_RING_SIZE : 0;
+
+        for (uint64_t i = oldest; i < count; ++i) {
+            const struct trace_event* event = &r->events[i % TRACE_RING_SIZE];
+            fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":%ld,\"tid\":%" PRIu32 "}",
+                    first ? "" : ",", event->name, event->start / 1e3, event->duration / 1e3,
+                    pid, r->tid);
+            first = 0;
+        }
+    }
+    fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    return ferror(out) ? ERR_IO : ERR_NONE;
+}
+
+/**********************************************************************
+ * Chrome trace JSON, into a string
+ */
+char*
+trace_to_string(size_t* size)
+{
+    if (size == NULL) return NULL;
+
+    char* text = NULL;
+    FILE* out = open_memstream(&text, size);
+    if (out == NULL) return NULL;
+
+    const int ret = trace_dump(out);
+    if (fclose(out) != 0 || ret != ERR_NONE) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+/**
+ * @file trace.h
+ * @brief Lightweight tracing of the hot paths of the imgStore library.
+ *
+ * A span is a named interval of time (do_read, lazily_resize, one call
+ * to vips_resize, ...), recorded when it ends into a ring buffer of the
+ * calling thread: the last TRACE_RING_SIZE spans of each thread are kept.
+ * They can be dumped in the Chrome trace format (chrome://tracing,
+ * Perfetto), nested spans showing where the time of the enclosing one
+ * went.
+ *
+ * Tracing is off by default: a span then costs a test. A span left by an
+ * early return (an error) is simply not recorded.
+ */
+
+#include "error.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define TRACE_RING_SIZE 4096
+
+/**
+ * @brief Starts a span, e.g. TRACE_BEGIN(vips_resize);
+ */
+#define TRACE_BEGIN(span) const uint64_t trace_##span = trace_begin()
+
+/**
+ * @brief Ends a span started by TRACE_BEGIN and records it.
+ */
+#define TRACE_END(span) trace_end(#span, trace_##span)
+
+/**
+ * @brief Turns tracing on or off (for all threads).
+ *
+ * @param on Non zero to record spans.
+ */
+void trace_enable(int on);
+
+/**
+ * @brief Start of a span (see TRACE_BEGIN).
+ *
+ * @return Current time in nanoseconds, 0 if tracing is off.
+ */
+uint64_t trace_begin(void);
+
+/**
+ * @brief End of a span (see TRACE_END): records it in the ring buffer of
+ *        the calling thread.
+ *
+ * @param name Name of the span (a string literal: it is not copied).
+ * @param start What trace_begin returned.
+ */
+void trace_end(const char* name, uint64_t start);
+
+/**
+ * @brief Prints the spans recorded by all threads, as Chrome trace JSON.
+ *
+ * @param out Where to print them.
+ * @return Some error code. 0 if no error.
+ */
+int trace_dump(FILE* out);
+
+/**
+ * @brief Same as trace_dump, into a string.
+ *
+ * @param size Set to the length of the string.
+ * @return The string (to be freed by the caller), NULL on error.
+ */
+char* trace_to_string(size_t* size);
@@ -0,0 +1,432 @@
+/**
+ * @file wal.c
+ * @brief imgStore library: write-ahead log of the in-place writes.
+ *
+ * A transaction is logged as a struct wal_tx followed by its writes
+ * (struct wal_write and data). It is complete if its checksum matches:
+ * the replay stops at the first incomplete one, the end of a journal
+ * being torn by a crash.
+ */
+
+#define _DEFAULT_SOURCE // for fileno, fsync, fdatasync, ftruncate and flock
+
+#include "wal.h"
+#include "trace.h"
+#include "shard.h"
+#include "lock.h"
+#include "checksum.h"
+#include "index.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+/* bigger transactions are taken for garbage */
+#define WAL_MAX_TX (16 << 20)
+
+/**********************************************************************
+ * Path of the journal of an imgStore
+ */
+static char*
+wal_path (const char* imgst_filename)
+{
+    char* path = malloc(strlen(imgst_filename) + sizeof(WAL_SUFFIX));
+    if (path == NULL) return NULL;
+
+    strcpy(path, imgst_filename);
+    strcat(path, WAL_SUFFIX);
+    return path;
+}
+
+/**********************************************************************
+ * Appends len bytes to a growing buffer
+ */
+static int
+append (char** buffer, size_t* size, size_t* capacity, const void* data, size_t len)
+{
+    if (*size + len > *capacity) {
+        size_t new_capacity = *capacity == 0 ? 4096 : 2 * *capacity;
+        while (new_capacity < *size + len) new_capacity *= 2;
+
+        char* ptr = realloc(*buffer, new_capacity);
+        if (ptr == NULL) return ERR_OUT_OF_MEMORY;
+        *buffer = ptr;
+        *capacity = new_capacity;
+    }
+    memcpy(*buffer + *size, data, len);
+    *size += len;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Flushes a file down to the disk
+ */
+static int
+sync_file (FILE* file)
+{
+    if (fflush(file) != 0) return ERR_IO;
+    if (fsync(fileno(file)) != 0) return ERR_IO;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Writes in place a sequence of logged writes
+ */
+static int
+apply (FILE* file, const char* writes, size_t size)
+{
+    size_t pos = 0;
+    while (pos < size) {
+        struct wal_write write;
+        if (size - pos < sizeof(struct wal_write)) return ERR_IO;
+        memcpy(&write, writes + pos, sizeof(struct wal_write));
+        pos += sizeof(struct wal_write);
+        if (size - pos < write.size) return ERR_IO;
+
+        if (fseek(file, (long int) write.offset, SEEK_SET) != 0) return ERR_IO;
+        if (fwrite(writes + pos, write.size, 1, file) != 1) return ERR_IO;
+        pos += write.size;
+    }
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Replay of the journal left by a crash
+ */
+int
+wal_recover (const char* imgst_filename)
+{
+    if (imgst_filename == NULL) return ERR_INVALID_ARGUMENT;
+
+    char* path = wal_path(imgst_filename);
+    if (path == NULL) return ERR_OUT_OF_MEMORY;
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        free(path);
+        return errno == ENOENT ? ERR_NONE : ERR_IO;
+    }
+
+    // locked: the journal of a running writer, not of a crash
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        free(path);
+        return ERR_NONE;
+    }
+
+    FILE* wal = fdopen(fd, "rb");
+    FILE* store = fopen(imgst_filename, "rb+");
+    if (wal == NULL || store == NULL) {
+        if (wal != NULL) fclose(wal); else close(fd);
+        if (store != NULL) fclose(store);
+        free(path);
+        return ERR_IO;
+    }
+
+    int ret = ERR_NONE;
+    uint64_t seq = 0;
+    struct wal_tx tx;
+
+    while (ret == ERR_NONE && fread(&tx, sizeof(struct wal_tx), 1, wal) == 1) {
+        if (tx.magic != WAL_MAGIC || tx.size > WAL_MAX_TX) break;
+        if (seq != 0 && tx.seq != seq + 1) break;
+
+        char* writes = malloc(tx.size);
+        if (writes == NULL) {
+            ret = ERR_OUT_OF_MEMORY;
+        } else if (fread(writes, 1, tx.size, wal) == tx.size
+                   && crc32c(writes, tx.size) == tx.checksum) {
+            ret = apply(store, writes, tx.size);
+            seq = tx.seq;
+        } else {
+            free(writes);
+            break;
+        }
+        free(writes);
+    }
+
+    if (ret == ERR_NONE) ret = sync_file(store);
+    fclose(store);
+
+    // the journal is only removed once it is in place
+    if (ret == ERR_NONE && unlink(path) != 0) ret = ERR_IO;
+    fclose(wal);
+    free(path);
+    return ret;
+}
+
+/**********************************************************************
+ * Journal of an imgStore open for writing
+ */
+int
+wal_init (struct imgst_file* imgst_file, const char* imgst_filename, enum wal_sync policy)
+{
+    if (imgst_file == NULL || imgst_filename == NULL) return ERR_INVALID_ARGUMENT;
+
+    struct imgst_wal* wal = calloc(1, sizeof(struct imgst_wal));
+    if (wal == NULL) return ERR_OUT_OF_MEMORY;
+
+    wal->path = wal_path(imgst_filename);
+    if (wal->path == NULL) {
+        free(wal);
+        return ERR_OUT_OF_MEMORY;
+    }
+    wal->policy = policy;
+
+    imgst_file->wal = wal;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Creation of the journal, locked while the imgStore is open
+ */
+static int
+open_journal (struct imgst_wal* wal)
+{
+    int fd = open(wal->path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return ERR_IO;
+
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || ftruncate(fd, 0) != 0) {
+        close(fd);
+        return ERR_IO;
+    }
+
+    wal->file = fdopen(fd, "wb");
+    if (wal->file == NULL) {
+        close(fd);
+        return ERR_IO;
+    }
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Empties the journal, once all its transactions are in place
+ */
+static int
+checkpoint (struct imgst_file* imgst_file)
+{
+    struct imgst_wal* wal = imgst_file->wal;
+
+    int ret = wal->policy == WAL_SYNC_NONE ?
+              (fflush(imgst_file->file) == 0 ? ERR_NONE : ERR_IO) :
+              sync_file(imgst_file->file);
+    if (ret) return ret;
+
+    if (fflush(wal->file) != 0) return ERR_IO;
+    if (ftruncate(fileno(wal->file), 0) != 0) return ERR_IO;
+    rewind(wal->file);
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Change of fsync policy
+ */
+int
+wal_set_policy (struct imgst_file* imgst_file, enum wal_sync policy)
+{
+    if (imgst_file != NULL && imgst_file->shards != NULL) {
+        int ret = ERR_NONE;
+        for (uint32_t i = 0; ret == ERR_NONE && i < imgst_file->shards->nb_shards; ++i) {
+            ret = wal_set_policy(&imgst_file->shards->files[i], policy);
+        }
+        return ret;
+    }
+    if (imgst_file == NULL || imgst_file->wal == NULL) return ERR_INVALID_ARGUMENT;
+
+    lock_writer(imgst_file);
+    int ret = wal_sync(imgst_file);
+    imgst_file->wal->policy = policy;
+    unlock_writer(imgst_file);
+    return ret;
+}
+
+/**********************************************************************
+ * One in-place write
+ */
+int
+wal_write (struct imgst_file* imgst_file, long int offset, const void* data, size_t size)
+{
+    if (imgst_file == NULL || imgst_file->file == NULL || offset < 0) return ERR_INVALID_ARGUMENT;
+
+    struct imgst_wal* wal = imgst_file->wal;
+    if (wal == NULL) {
+        if (fseek(imgst_file->file, offset, SEEK_SET) != 0) return ERR_IO;
+        if (fwrite(data, size, 1, imgst_file->file) != 1) return ERR_IO;
+        return ERR_NONE;
+    }
+
+    struct wal_write write = { .offset = (uint64_t) offset, .size = (uint32_t) size };
+    int ret = append(&wal->tx, &wal->tx_size, &wal->tx_capacity, &write, sizeof(struct wal_write));
+    if (ret) return ret;
+
+    ret = append(&wal->tx, &wal->tx_size, &wal->tx_capacity, data, size);
+    if (ret) return ret;
+
+    wal->tx_writes += 1;
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * End of a transaction
+ */
+int
+wal_commit (struct imgst_file* imgst_file, int ret)
+{
+    if (imgst_file == NULL || imgst_file->wal == NULL) return ret;
+
+    struct imgst_wal* wal = imgst_file->wal;
+
+    // a failed operation: none of its writes, not even the first ones
+    if (ret != ERR_NONE || wal->tx_size == 0) {
+        wal->tx_size = 0;
+        wal->tx_writes = 0;
+        return ret;
+    }
+
+    // logged with its group, once the images it refers to are written
+    struct wal_tx tx = { .magic = WAL_MAGIC, .size = (uint32_t) wal->tx_size,
+                         .seq = wal->seq + 1, .nb_writes = wal->tx_writes,
+                         .checksum = crc32c(wal->tx, wal->tx_size) };
+    const size_t group_size = wal->group_size;
+    int err = append(&wal->group, &wal->group_size, &wal->group_capacity, &tx, sizeof(struct wal_tx));
+    if (err == ERR_NONE) {
+        err = append(&wal->group, &wal->group_size, &wal->group_capacity, wal->tx, wal->tx_size);
+    }
+
+    if (err) {
+        // not logged: written in place all the same, as without journal
+        wal->group_size = group_size;
+        apply(imgst_file->file, wal->tx, wal->tx_size);
+    } else {
+        wal->seq = tx.seq;
+    }
+    wal->tx_size = 0;
+    wal->tx_writes = 0;
+
+    if (err == ERR_NONE && (wal->policy != WAL_SYNC_BATCH || wal->group_size >= WAL_GROUP_SIZE)) {
+        err = wal_sync(imgst_file);
+    }
+    return err;
+}
+
+/**********************************************************************
+ * Writes in place the transactions of a group
+ */
+static int
+apply_group (FILE* file, const char* group, size_t size)
+{
+    size_t pos = 0;
+    while (pos < size) {
+        struct wal_tx tx;
+        if (size - pos < sizeof(struct wal_tx)) return ERR_IO;
+        memcpy(&tx, group + pos, sizeof(struct wal_tx));
+        pos += sizeof(struct wal_tx);
+        if (size - pos < tx.size) return ERR_IO;
+
+        const int ret = apply(file, group + pos, tx.size);
+        if (ret) return ret;
+        pos += tx.size;
+    }
+    return ERR_NONE;
+}
+
+/**********************************************************************
+ * Group commit (wal_sync, under the writer lock)
+ */
+static int
+sync_group (struct imgst_file* imgst_file)
+{
+    struct imgst_wal* wal = imgst_file->wal;
+    if (wal->group_size == 0) return ERR_NONE;
+
+    // the images must be written (on disk, unless WAL_SYNC_NONE) before
+    // the metadata referring to them are logged
+    TRACE_BEGIN(wal_fsync);
+    int ret = fflush(imgst_file->file) == 0 ? ERR_NONE : ERR_IO;
+    if (ret == ERR_NONE && wal->policy != WAL_SYNC_NONE && fdatasync(fileno(imgst_file->file)) != 0) {
+        ret = ERR_IO;
+    }
+
+    int logged = ERR_NONE;
+    if (ret == ERR_NONE) {
+        logged = wal->file == NULL ? open_journal(wal) : ERR_NONE;
+        if (logged == ERR_NONE && fwrite(wal->group, wal->group_size, 1, wal->file) != 1) logged = ERR_IO;
+        if (logged == ERR_NONE) {
+            logged = wal->policy == WAL_SYNC_NONE ?
+                     (fflush(wal->file) == 0 ? ERR_NONE : ERR_IO) :
+                     sync_file(wal->file);
+        }
+    }
+    TRACE_END(wal_fsync);
+    if (ret) return ret;
+
+    // not logged: written in place all the same, as without journal
+    TRACE_BEGIN(wal_apply);
+    ret = apply_group(imgst_file->file, wal->group, wal->group_size);
+    TRACE_END(wal_apply);
+    wal->group_size = 0;
+    if (ret == ERR_NONE) ret = logged;
+    if (ret || wal->file == NULL) return ret;
+
+    // only a cache: rewritten as a whole at the next group commit if it fails
+    (void) index_sync(imgst_file, wal->policy != WAL_SYNC_NONE);
+
+    long int size = ftell(wal->file);
+    if (size < 0 || size > WAL_CHECKPOINT_SIZE) {
+        ret = checkpoint(imgst_file);
+    }
+    return ret;
+}
+
+/**********************************************************************
+ * Group commit
+ */
+int
+wal_sync (struct imgst_file* imgst_file)
+{
+    if (imgst_file != NULL && imgst_file->shards != NULL) {
+        int ret = ERR_NONE;
+        for (uint32_t i = 0; i < imgst_file->shards->nb_shards; ++i) {
+            const int shard = wal_sync(&imgst_file->shards->files[i]);
+            if (ret == ERR_NONE) ret = shard;
+        }
+        return ret;
+    }
+    if (imgst_file == NULL || imgst_file->wal == NULL) return ERR_NONE;
+
+    lock_writer(imgst_file);
+    const int ret = sync_group(imgst_file);
+    unlock_writer(imgst_file);
+    return ret;
+}
+
+/**********************************************************************
+ * Removal of the journal, when closing the imgStore
+ */
+int
+wal_close (struct imgst_file* imgst_file)
+{
+    if (imgst_file == NULL || imgst_file->wal == NULL) return ERR_NONE;
+
+    struct imgst_wal* wal = imgst_file->wal;
+
+    int ret = wal_commit(imgst_file, ERR_NONE);
+    if (ret == ERR_NONE) ret = wal_sync(imgst_file);
+
+    if (wal->file != NULL) {
+        if (ret == ERR_NONE) ret = checkpoint(imgst_file);
+        // kept for the replay if anything went wrong
+        if (ret == ERR_NONE) unlink(wal->path);
+        fclose(wal->file);
+    }
+
+    free(wal->path);
+    free(wal->tx);
+    free(wal->group);
+    free(wal);
+    imgst_file->wal = NULL;
+    return ret;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+/**
+ * @file wal.h
+ * @brief Write-ahead log of the in-place writes of an imgStore.
+ *
+ * Images are appended to the imgStore file, but the header and the
+ * metadata are overwritten in place: a crash between two of these writes
+ * would leave num_files inconsistent with the metadata table. When the
+ * imgStore is opened for writing, the in-place writes of each operation
+ * (do_insert, do_delete, lazily_resize) are first logged, as one
+ * transaction, in a journal next to it (<imgStore>.wal), and only then
+ * written in place. do_open replays the complete transactions of a
+ * journal left by a crash.
+ *
+ * Transactions are committed by groups (one fsync of the journal for all
+ * of them), according to the fsync policy of the imgStore. A group is
+ * only logged once the images its metadata refer to are written to the
+ * imgStore file (flushed, and on disk unless WAL_SYNC_NONE): a replay
+ * never installs metadata of images lost by the crash. The transaction
+ * of a failed operation is discarded, none of its writes done.
+ */
+
+#include "imgStore.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define WAL_SUFFIX ".wal"
+#define WAL_MAGIC 0x31585457 // "WTX1"
+
+/* a group commit is forced when its transactions reach WAL_GROUP_SIZE bytes */
+#define WAL_GROUP_SIZE (1 << 20)
+/* the journal is emptied (checkpoint) when it exceeds WAL_CHECKPOINT_SIZE bytes */
+#define WAL_CHECKPOINT_SIZE (8 << 20)
+
+/**
+ * @brief fsync policies of the journal.
+ *
+ * WAL_SYNC_NONE: no fsync, transactions are only atomic (within what the
+ * system writes back); WAL_SYNC_BATCH: one fsync per group of
+ * transactions, closed by wal_sync (e.g. once per event loop) or
+ * do_close; WAL_SYNC_ALWAYS: one fsync per transaction.
+ */
+enum wal_sync {WAL_SYNC_NONE, WAL_SYNC_BATCH, WAL_SYNC_ALWAYS};
+
+/* header of a transaction in the journal, followed by its writes */
+struct wal_tx {
+    uint32_t magic;     // WAL_MAGIC
+    uint32_t size;      // bytes of writes that follow
+    uint64_t seq;       // transaction number
+    uint32_t nb_writes;
+    uint32_t checksum;  // of the writes
+};
+
+/* one in-place write, followed by its size bytes of data */
+struct wal_write {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t unused_32;
+};
+
+/* journal of an imgStore open for writing */
+struct imgst_wal {
+    char*           path;
+    FILE*           file;       // opened at the first group commit
+    enum wal_sync   policy;
+    uint64_t        seq;
+
+    char*           tx;         // writes of the current transaction
+    size_t          tx_size;
+    size_t          tx_capacity;
+    uint32_t        tx_writes;
+
+    char*           group;      // transactions committed (struct wal_tx and writes), not yet logged nor in place
+    size_t          group_size;
+    size_t          group_capacity;
+};
+
+/**
+ * @brief Replays the journal of an imgStore, if any (and not in use by a
+ *        running writer), then removes it.
+ *
+ * @param imgst_filename Path to the imgStore file
+ * @return Some error code. 0 if no error.
+ */
+int wal_recover(const char* imgst_filename);
+
+/**
+ * @brief Sets up the journal of an imgStore opened for writing.
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param imgst_filename Path to the imgStore file
+ * @param policy fsync policy.
+ * @return Some error code. 0 if no error.
+ */
+int wal_init(struct imgst_file* imgst_file, const char* imgst_filename, enum wal_sync policy);
+
+/**
+ * @brief Changes the fsync policy of the journal (after a group commit).
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param policy fsync policy.
+ * @return Some error code. 0 if no error.
+ */
+int wal_set_policy(struct imgst_file* imgst_file, enum wal_sync policy);
+
+/**
+ * @brief Writes size bytes at offset in the imgStore file: logged in the
+ *        current transaction if the imgStore has a journal, written
+ *        directly otherwise.
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param offset Position in the imgStore file.
+ * @param data Bytes to be written.
+ * @param size Number of bytes.
+ * @return Some error code. 0 if no error.
+ */
+int wal_write(struct imgst_file* imgst_file, long int offset, const void* data, size_t size);
+
+/**
+ * @brief Ends the current transaction: its writes are logged in the
+ *        journal and written in place, at once or with its group
+ *        depending on the fsync policy; they are discarded if the
+ *        operation failed.
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @param ret Result of the operation, returned if not ERR_NONE.
+ * @return ret, or some error code of the commit. 0 if no error.
+ */
+int wal_commit(struct imgst_file* imgst_file, int ret);
+
+/**
+ * @brief Group commit: logs the committed transactions once their
+ *        images are written (one fdatasync of the imgStore for them,
+ *        then one fsync of the journal) and writes them in place.
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @return Some error code. 0 if no error.
+ */
+int wal_sync(struct imgst_file* imgst_file);
+
+/**
+ * @brief Group commit, checkpoint and removal of the journal.
+ *
+ * @param imgst_file Structure for header, metadata and file pointer.
+ * @return Some error code. 0 if no error.
+ */
+int wal_close(struct imgst_file* imgst_file);